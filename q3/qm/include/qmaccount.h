@@ -39,6 +39,7 @@ class AccountManagerHandler;
 class AccountManagerEvent;
 
 class Message;
+class MessageChangeFeed;
 class MessageHolder;
 class MessageHolderHandler;
 class MessageOperationCallback;
@@ -122,7 +123,8 @@ public:
 		SUPPORT_EXTERNALLINK			= 0x10,
 		SUPPORT_DELETEDMESSAGE			= 0x20,
 		SUPPORT_JUNKFILTER				= 0x40,
-		SUPPORT_SALVAGE					= 0x80
+		SUPPORT_SALVAGE					= 0x80,
+		SUPPORT_PARALLELSYNC			= 0x100
 	};
 
 public:
@@ -215,12 +217,19 @@ public:
 	
 	void setOffline(bool bOffline);
 	bool compact(MessageOperationCallback* pCallback);
+	bool compactPartially(const MessageHolderList& l);
+	bool startCompaction();
+	void stopCompaction();
+	bool isCompacting() const;
+	unsigned int getCompactionProgress() const;
+	unsigned int getFragmentation() const;
 	bool salvage(NormalFolder* pFolder,
 				 MessageOperationCallback* pCallback);
 	bool check(AccountCheckCallback* pCallback);
 	bool save(bool bForce) const;
 	bool saveMessages(bool bForce) const;
 	bool flushMessageStore() const;
+	bool freeUnusedMessageStore();
 	bool importMessage(NormalFolder* pFolder,
 					   const CHAR* pszMessage,
 					   size_t nLen,
@@ -265,6 +274,24 @@ public:
 	bool isIndexPrepared(const MessageHolder* pmh) const;
 	void prepareIndex(MessageHolderList& l);
 	
+	/**
+	 * Read indices which are not cached and cache them. This can be called
+	 * without locking this account. Keys and the generation should be
+	 * taken together while this account is locked.
+	 *
+	 * @param l [in] Keys and lengths of indices.
+	 * @param nGeneration [in] Generation got by getIndexGeneration.
+	 */
+	void prepareIndex(const MessageIndexKeyList& l,
+					  unsigned int nGeneration);
+	unsigned int getIndexGeneration() const;
+	
+	/**
+	 * Get the feed of changes of messages in this account, from which
+	 * indexers can catch up without scanning all the messages.
+	 */
+	MessageChangeFeed* getChangeFeed() const;
+	
 	void addAccountHandler(AccountHandler* pHandler);
 	void removeAccountHandler(AccountHandler* pHandler);
 	
@@ -329,6 +356,7 @@ public:
 // These methods are intended to be called from ProtocolDriver class
 public:
 	unsigned int generateFolderId() const;
+	void fireRemoteFolderChanged(NormalFolder* pFolder);
 
 // These methods are intended to be called from SyncManager class
 public:
@@ -668,6 +696,14 @@ public:
 	virtual void messageCopied(NormalFolder* pFolderFrom,
 							   NormalFolder* pFolderTo,
 							   unsigned int nCopyFlags) = 0;
+	
+	/**
+	 * Called when the server notifies that the folder has been changed.
+	 * This can be called from any thread.
+	 *
+	 * @param pFolder [in] Folder.
+	 */
+	virtual void remoteFolderChanged(NormalFolder* pFolder) = 0;
 };
 
 
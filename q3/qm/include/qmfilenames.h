@@ -30,18 +30,22 @@ struct FileNames
 	static const WCHAR* BOX_EXT;
 	static const WCHAR* CA_PEM;
 	static const WCHAR* CERT;
+	static const WCHAR* CHANGES;
 	static const WCHAR* CHECK;
+	static const WCHAR* CHECKPOINT_EXT;
 	static const WCHAR* COLORS_XML;
 	static const WCHAR* COMPACT;
 	static const WCHAR* FILTERS_XML;
 	static const WCHAR* FOLDER_BMP;
 	static const WCHAR* FOLDERS_XML;
 	static const WCHAR* FONTS_XML;
+	static const WCHAR* FULLTEXT;
 	static const WCHAR* GOROUND_XML;
 	static const WCHAR* HEADER_XML;
 	static const WCHAR* HEADEREDIT_XML;
 	static const WCHAR* INDEX;
 	static const WCHAR* INDEX_EXT;
+	static const WCHAR* JOURNAL_EXT;
 	static const WCHAR* KEY;
 	static const WCHAR* KEYMAP_XML;
 	static const WCHAR* LIST_BMP;
@@ -50,15 +54,19 @@ struct FileNames
 	static const WCHAR* MENUS_XML;
 	static const WCHAR* MSG;
 	static const WCHAR* NOTIFY_BMP;
+	static const WCHAR* PART;
 	static const WCHAR* PASSWORDS_XML;
 	static const WCHAR* PEM_EXT;
 	static const WCHAR* QMAIL_XML;
+	static const WCHAR* REF_EXT;
 	static const WCHAR* RESOURCES_XML;
 	static const WCHAR* RULES_XML;
+	static const WCHAR* SEGMENT_EXT;
 	static const WCHAR* SIGNATURES_XML;
 	static const WCHAR* SYNCFILTERS_XML;
 	static const WCHAR* TABS_XML;
 	static const WCHAR* TEXTS_XML;
+	static const WCHAR* THREAD_EXT;
 	static const WCHAR* TOOLBAR_BMP;
 	static const WCHAR* TOOLBARS_XML;
 	static const WCHAR* VIEW_XML;
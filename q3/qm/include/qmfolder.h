@@ -34,6 +34,7 @@ class ActionInvoker;
 class Document;
 class Message;
 class MessageHolder;
+class MessageOperationCallback;
 class MessagePtr;
 
 
@@ -181,6 +182,8 @@ public:
 public:
 	unsigned int getValidity() const;
 	bool setValidity(unsigned int nValidity);
+	unsigned __int64 getHighestModSeq() const;
+	void setHighestModSeq(unsigned __int64 nHighestModSeq);
 	unsigned int getDownloadCount() const;
 	unsigned int getDeletedCount() const;
 	unsigned int getLastSyncTime() const;
@@ -190,6 +193,7 @@ public:
 	bool updateMessageInfos(const MessageInfoList& listMessageInfo,
 							bool bUpdateFlagsAndLabel,
 							bool* pbClear);
+	bool updateMessageFlags(const MessageInfoList& listMessageInfo);
 	void setHook(FolderHook* pHook);
 
 public:
@@ -261,7 +265,8 @@ public:
 				ActionInvoker* pActionInvoker,
 				HWND hwnd,
 				qs::Profile* pProfile,
-				unsigned int nSecurityMode);
+				unsigned int nSecurityMode,
+				MessageOperationCallback* pCallback);
 
 public:
 	virtual Type getType() const;
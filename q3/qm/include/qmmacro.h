@@ -10,6 +10,7 @@
 
 #include <qm.h>
 #include <qmmessageholder.h>
+#include <qmmessageindex.h>
 
 #include <qs.h>
 #include <qsmime.h>
@@ -29,6 +30,7 @@ class Macro;
 class MacroParser;
 class MacroVariableHolder;
 class MacroContext;
+class MacroFieldPlan;
 class MacroValue;
 	class MacroValueBoolean;
 	class MacroValueString;
@@ -41,6 +43,7 @@ class MacroValue;
 	class MacroValueMessageList;
 class MacroValuePtr;
 class MacroFactory;
+struct MacroValuePool;
 
 class Account;
 class ActionInvoker;
@@ -50,6 +53,7 @@ class MacroExpr;
 class MacroExprPtr;
 class MacroGlobalContext;
 class MacroFunctionHolder;
+class MacroProgram;
 class Message;
 
 
@@ -188,6 +192,7 @@ public:
 	Message* getMessage() const;
 	Message* getMessage(MessageType type,
 						const WCHAR* pwszField) const;
+	qs::wstring_ptr getIndex(MessageIndexName name) const;
 	void clearMessage();
 	Account* getAccount() const;
 	SubAccount* getSubAccount() const;
@@ -237,6 +242,55 @@ private:
 };
 
 
+/****************************************************************************
+ *
+ * MacroFieldPlan
+ *
+ * Parts of a message which a macro refers. A macro whose message type is
+ * MESSAGETYPE_NONE is evaluated only with the index of a message. When
+ * isAllFields returns false, the header is referred only through the fields
+ * returned by getFields. isIndex tells which values of the index are referred.
+ *
+ */
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+class QMEXPORTCLASS MacroFieldPlan
+{
+public:
+	typedef std::vector<qs::WSTRING> FieldList;
+
+public:
+	MacroFieldPlan();
+	~MacroFieldPlan();
+
+public:
+	MacroContext::MessageType getMessageType() const;
+	bool isAllFields() const;
+	const FieldList& getFields() const;
+	bool isField(const WCHAR* pwszName) const;
+	bool isIndex(MessageIndexName name) const;
+
+public:
+	void addMessageType(MacroContext::MessageType type);
+	void addField(const WCHAR* pwszName);
+	void addIndex(MessageIndexName name);
+
+private:
+	MacroFieldPlan(const MacroFieldPlan&);
+	MacroFieldPlan& operator=(const MacroFieldPlan&);
+
+private:
+	MacroContext::MessageType type_;
+	bool bAllFields_;
+	FieldList listField_;
+	unsigned int nIndex_;
+};
+
+#pragma warning(pop)
+
+
 /****************************************************************************
  *
  * Macro
@@ -256,6 +310,7 @@ public:
 	MacroValuePtr value(MacroContext* pContext) const;
 	qs::wstring_ptr getString() const;
 	MacroContext::MessageType getMessageTypeHint() const;
+	const MacroFieldPlan& getFieldPlan() const;
 
 public:
 	const MacroExpr* getExpr() const;
@@ -266,6 +321,8 @@ private:
 
 private:
 	MacroExpr* pExpr_;
+	MacroProgram* pProgram_;
+	MacroFieldPlan plan_;
 };
 
 #pragma warning(pop)
@@ -368,6 +425,11 @@ public:
 	virtual MacroValuePtr clone();
 	virtual void release();
 
+// These methods are intended to be called from MacroValueFactory
+public:
+	MacroValuePool* getPool() const;
+	void setPool(MacroValuePool* pPool);
+
 protected:
 	void initRef();
 
@@ -378,6 +440,7 @@ private:
 private:
 	Type type_;
 	unsigned int nRef_;
+	MacroValuePool* pPool_;
 };
 
 
@@ -419,6 +482,11 @@ private:
 
 class MacroValueString : public MacroValue
 {
+public:
+	enum {
+		INLINE_SIZE	= 32
+	};
+
 public:
 	MacroValueString();
 	virtual ~MacroValueString();
@@ -426,6 +494,8 @@ public:
 public:
 	void init(qs::wstring_ptr wstr);
 	void init(qs::wxstring_ptr wxstr);
+	void init(const WCHAR* pwsz,
+			  size_t nLen);
 	void term();
 
 public:
@@ -443,6 +513,8 @@ private:
 private:
 	qs::wstring_ptr wstr_;
 	qs::wxstring_ptr wxstr_;
+	WCHAR wszInline_[INLINE_SIZE];
+	bool bInline_;
 };
 
 
@@ -728,6 +800,15 @@ private:
 
 class QMEXPORTCLASS MacroValueFactory
 {
+public:
+	struct Stats
+	{
+		unsigned int nAllocation_;
+		unsigned int nStringAllocation_;
+		unsigned int nRemoteRelease_;
+		unsigned int nDrain_;
+	};
+
 private:
 	MacroValueFactory();
 
@@ -769,6 +850,14 @@ public:
 	void deleteMessageList(MacroValueMessageList* pmvml);
 	
 	void deleteValue(MacroValue* pmv);
+	
+	/**
+	 * Get counts accumulated by the pools of all threads. They are logged
+	 * when rules are applied and when a macro is searched.
+	 *
+	 * @param pStats [out] Counts.
+	 */
+	void getStats(Stats* pStats) const;
 
 public:
 	static MacroValueFactory& getFactory();
@@ -782,6 +871,8 @@ private:
 
 private:
 	static MacroValueFactory factory__;
+	
+	friend struct MacroValueFactoryImpl;
 };
 
 }
@@ -9,6 +9,7 @@
 #define __QMMESSAGEHOLDER_H__
 
 #include <qm.h>
+#include <qmmessageindex.h>
 
 #include <qs.h>
 #include <qsstring.h>
@@ -132,6 +133,7 @@ public:
 							unsigned int nSecurityMode,
 							Message* pMessage) = 0;
 	virtual MessageHolder* getMessageHolder() = 0;
+	virtual qs::wstring_ptr getIndex(MessageIndexName name) const;
 };
 
 
@@ -197,6 +199,7 @@ public:
 							unsigned int nSecurityMode,
 							Message* pMessage);
 	virtual MessageHolder* getMessageHolder();
+	virtual qs::wstring_ptr getIndex(MessageIndexName name) const;
 	
 public:
 	bool isFlag(Flag flag) const;
@@ -205,11 +208,15 @@ public:
 	unsigned int getMessageIdHash() const;
 	qs::wstring_ptr getReference() const;
 	unsigned int getReferenceHash() const;
+	qs::wstring_ptr getReferences() const;
 	qs::wstring_ptr getLabel() const;
 	const MessageIndexKey& getMessageIndexKey() const;
 	const MessageBoxKey& getMessageBoxKey() const;
 	MessageDate getDate() const;
 
+public:
+	static unsigned int hashMessageId(const WCHAR* pwszMessageId);
+
 // These methods are intended to be called from Folder class
 public:
 	void getInit(Init* pInit) const;
@@ -159,6 +159,13 @@ inline qm::MessageHolder* qm::MessageHolder::getMessageHolder()
 	return this;
 }
 
+inline qs::wstring_ptr qm::MessageHolder::getIndex(MessageIndexName name) const
+{
+	qs::Lock<Account> lock(*getAccount());
+	return getAccount()->getIndex(messageIndexKey_.nKey_,
+		messageIndexKey_.nLength_, name);
+}
+
 inline bool qm::MessageHolder::isFlag(Flag flag) const
 {
 	qs::Lock<Account> lock(*getAccount());
@@ -186,6 +193,13 @@ inline qs::wstring_ptr qm::MessageHolder::getReference() const
 		messageIndexKey_.nLength_, NAME_REFERENCE);
 }
 
+inline qs::wstring_ptr qm::MessageHolder::getReferences() const
+{
+	qs::Lock<Account> lock(*getAccount());
+	return getAccount()->getIndex(messageIndexKey_.nKey_,
+		messageIndexKey_.nLength_, NAME_REFERENCES);
+}
+
 inline qs::wstring_ptr qm::MessageHolder::getLabel() const
 {
 	qs::Lock<Account> lock(*getAccount());
@@ -10,6 +10,8 @@
 
 #include <qm.h>
 
+#include <vector>
+
 
 namespace qm {
 
@@ -20,10 +22,13 @@ enum MessageIndexName {
 	NAME_MESSAGEID,
 	NAME_REFERENCE,
 	NAME_LABEL,
+	NAME_REFERENCES,
 	
 	NAME_MAX
 };
 
+typedef std::vector<std::pair<unsigned int, unsigned int> > MessageIndexKeyList;
+
 }
 
 #endif // __QMMESSAGEINDEX_H__
@@ -46,7 +46,8 @@ public:
 	typedef std::vector<RuleSet*> RuleSetList;
 
 public:
-	explicit RuleManager(const WCHAR* pwszPath);
+	RuleManager(const WCHAR* pwszPath,
+				unsigned int nThreadCount);
 	~RuleManager();
 
 public:
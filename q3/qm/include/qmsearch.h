@@ -14,11 +14,13 @@
 
 #include <qm.h>
 #include <qmmessageholder.h>
+#include <qmmessageoperation.h>
 
 
 namespace qm {
 
 class SearchDriver;
+class SearchCallback;
 class SearchUI;
 class SearchPropertyData;
 class SearchPropertyPage;
@@ -49,6 +51,32 @@ public:
 };
 
 
+/****************************************************************************
+ *
+ * SearchCallback
+ *
+ * Callback of a search. A driver which supports it reports its progress and
+ * messages found so far while searching, and stops when it's canceled.
+ *
+ */
+
+class QMEXPORTCLASS SearchCallback : public MessageOperationCallback
+{
+public:
+	virtual ~SearchCallback();
+
+public:
+	/**
+	 * Called when messages are found. They are also returned as a result
+	 * of the search. This is called by the thread which searches while
+	 * the account is locked.
+	 *
+	 * @param l [in] Messages found.
+	 */
+	virtual void found(const MessageHolderList& l) = 0;
+};
+
+
 /****************************************************************************
  *
  * SearchUI
@@ -244,7 +272,8 @@ public:
 	SearchContext(const WCHAR* pwszCondition,
 				  const WCHAR* pwszTargetFolder,
 				  bool bRecursive,
-				  unsigned int nSecurityMode);
+				  unsigned int nSecurityMode,
+				  SearchCallback* pCallback);
 	~SearchContext();
 
 public:
@@ -252,6 +281,7 @@ public:
 	const WCHAR* getTargetFolder() const;
 	bool isRecursive() const;
 	unsigned int getSecurityMode() const;
+	SearchCallback* getCallback() const;
 	void getTargetFolders(Account* pAccount,
 						  FolderList* pList) const;
 
@@ -264,6 +294,7 @@ private:
 	qs::wstring_ptr wstrTargetFolder_;
 	bool bRecursive_;
 	unsigned int nSecurityMode_;
+	SearchCallback* pCallback_;
 };
 
 #pragma warning(pop)
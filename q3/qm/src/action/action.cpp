@@ -5277,8 +5277,10 @@ void qm::MessageSearchAction::invoke(const ActionEvent& event)
 			pFolderModel_->setCurrent(0, pSearch, false);
 		
 		if (pFolder == pSearch || !pSearch->isFlag(Folder::FLAG_ACTIVESYNC)) {
+			ProgressDialogMessageOperationCallback callback(
+				hwnd_, IDS_PROGRESS_SEARCH, IDS_PROGRESS_SEARCH);
 			if (!pSearch->search(pDocument_, pActionInvoker_, hwnd_,
-				pProfile_, pSecurityModel_->getSecurityMode())) {
+				pProfile_, pSecurityModel_->getSecurityMode(), &callback)) {
 				ActionUtil::error(hwnd_, IDS_ERROR_SEARCH);
 				return;
 			}
@@ -7340,10 +7342,14 @@ void qm::ViewRefreshAction::invoke(const ActionEvent& event)
 		}
 		break;
 	case Folder::TYPE_QUERY:
-		if (!static_cast<QueryFolder*>(pFolder)->search(pDocument_, pActionInvoker_,
-			hwnd_, pProfile_, pSecurityModel_->getSecurityMode())) {
-			ActionUtil::error(hwnd_, IDS_ERROR_REFRESH);
-			return;
+		{
+			ProgressDialogMessageOperationCallback callback(
+				hwnd_, IDS_PROGRESS_SEARCH, IDS_PROGRESS_SEARCH);
+			if (!static_cast<QueryFolder*>(pFolder)->search(pDocument_, pActionInvoker_,
+				hwnd_, pProfile_, pSecurityModel_->getSecurityMode(), &callback)) {
+				ActionUtil::error(hwnd_, IDS_ERROR_REFRESH);
+				return;
+			}
 		}
 		break;
 	default:
@@ -542,9 +542,8 @@ void qm::MacroExpr::release()
 	delete this;
 }
 
-MacroContext::MessageType qm::MacroExpr::getMessageTypeHint() const
+void qm::MacroExpr::getFieldPlan(MacroFieldPlan* pPlan) const
 {
-	return MacroContext::MESSAGETYPE_NONE;
 }
 
 MacroValuePtr qm::MacroExpr::error(const MacroContext& context,
@@ -611,9 +610,9 @@ wstring_ptr qm::MacroField::getString() const
 	return allocWString(wstrName_.get());
 }
 
-MacroContext::MessageType qm::MacroField::getMessageTypeHint() const
+void qm::MacroField::getFieldPlan(MacroFieldPlan* pPlan) const
 {
-	return MacroContext::MESSAGETYPE_HEADER;
+	pPlan->addField(wstrName_.get());
 }
 
 void qm::MacroField::visit(MacroExprVisitor* pVisitor) const
@@ -712,6 +711,27 @@ wstring_ptr qm::MacroFieldCache::getString() const
 	return concat(L"%", pwszNames[type_]);
 }
 
+void qm::MacroFieldCache::getFieldPlan(MacroFieldPlan* pPlan) const
+{
+	switch (type_) {
+	case TYPE_FROM:
+		pPlan->addIndex(NAME_FROM);
+		break;
+	case TYPE_TO:
+		pPlan->addIndex(NAME_TO);
+		break;
+	case TYPE_FROMTO:
+		pPlan->addIndex(NAME_FROM);
+		pPlan->addIndex(NAME_TO);
+		break;
+	case TYPE_SUBJECT:
+		pPlan->addIndex(NAME_SUBJECT);
+		break;
+	default:
+		break;
+	}
+}
+
 void qm::MacroFieldCache::visit(MacroExprVisitor* pVisitor) const
 {
 	pVisitor->visitFieldCache(*this);
@@ -1079,6 +1099,174 @@ qm::MacroExprVisitor::~MacroExprVisitor()
 }
 
 
+/****************************************************************************
+ *
+ * ReadOnlyMacroExprVisitor
+ *
+ */
+
+qm::ReadOnlyMacroExprVisitor::ReadOnlyMacroExprVisitor() :
+	bReadOnly_(true),
+	pwszLiteral_(0)
+{
+}
+
+qm::ReadOnlyMacroExprVisitor::~ReadOnlyMacroExprVisitor()
+{
+}
+
+bool qm::ReadOnlyMacroExprVisitor::isReadOnly() const
+{
+	return bReadOnly_;
+}
+
+void qm::ReadOnlyMacroExprVisitor::visitField(const MacroField& field)
+{
+}
+
+void qm::ReadOnlyMacroExprVisitor::visitFieldCache(const MacroFieldCache& fieldCache)
+{
+}
+
+void qm::ReadOnlyMacroExprVisitor::visitLiteral(const MacroLiteral& literal)
+{
+	pwszLiteral_ = literal.getValue();
+}
+
+void qm::ReadOnlyMacroExprVisitor::visitNumber(const MacroNumber& number)
+{
+}
+
+void qm::ReadOnlyMacroExprVisitor::visitBoolean(const MacroBoolean& boolean)
+{
+}
+
+void qm::ReadOnlyMacroExprVisitor::visitRegex(const MacroRegex& regex)
+{
+}
+
+void qm::ReadOnlyMacroExprVisitor::visitVariable(const MacroVariable& variable)
+{
+}
+
+void qm::ReadOnlyMacroExprVisitor::visitConstant(const MacroConstant& constant)
+{
+}
+
+void qm::ReadOnlyMacroExprVisitor::visitFunction(const MacroFunction& function)
+{
+	// Functions which only read the message and its folder, with the maximum
+	// number of arguments with which they don't modify anything. They don't
+	// lock the account when they read a snapshot
+	const struct {
+		const WCHAR* pwszName_;
+		size_t nMaxArgSize_;
+	} functions[] = {
+		{ L"Account",			-1	},
+		{ L"Add",				-1	},
+		{ L"Address",			-1	},
+		{ L"And",				-1	},
+		{ L"Attachment",		-1	},
+		{ L"BeginWith",			-1	},
+		{ L"Body",				-1	},
+		{ L"Concat",			-1	},
+		{ L"Contain",			-1	},
+		{ L"Date",				-1	},
+		{ L"Decode",			-1	},
+		{ L"Defun",				-1	},
+		{ L"Deleted",			0	},
+		{ L"Download",			0	},
+		{ L"DownloadText",		0	},
+		{ L"Draft",				0	},
+		{ L"Equal",				-1	},
+		{ L"Exist",				-1	},
+		{ L"False",				-1	},
+		{ L"Field",				-1	},
+		{ L"FieldParameter",	-1	},
+		{ L"Find",				-1	},
+		{ L"Flag",				1	},
+		{ L"Folder",			-1	},
+		{ L"Forwarded",			0	},
+		{ L"Greater",			-1	},
+		{ L"Header",			-1	},
+		{ L"Id",				-1	},
+		{ L"If",				-1	},
+		{ L"Label",				0	},
+		{ L"Length",			-1	},
+		{ L"Less",				-1	},
+		{ L"Marked",			0	},
+		{ L"MessageId",			-1	},
+		{ L"Multipart",			0	},
+		{ L"Name",				-1	},
+		{ L"Not",				-1	},
+		{ L"Or",				-1	},
+		{ L"Partial",			0	},
+		{ L"Passed",			-1	},
+		{ L"Progn",				-1	},
+		{ L"References",		-1	},
+		{ L"RegexFind",			-1	},
+		{ L"RegexMatch",		-1	},
+		{ L"Replied",			0	},
+		{ L"Seen",				0	},
+		{ L"Sent",				0	},
+		{ L"Set",				2	},
+		{ L"Size",				-1	},
+		{ L"Subject",			-1	},
+		{ L"Substring",			-1	},
+		{ L"SubstringAfter",	-1	},
+		{ L"SubstringBefore",	-1	},
+		{ L"Subtract",			-1	},
+		{ L"True",				-1	},
+		{ L"User1",				0	},
+		{ L"User2",				0	},
+		{ L"User3",				0	},
+		{ L"User4",				0	},
+		{ L"Variable",			1	}
+	};
+	
+	const WCHAR* pwszName = function.getFunctionName();
+	size_t nArgSize = function.getArgSize();
+	bool bReadOnly = isDefined(pwszName);
+	for (int n = 0; n < countof(functions) && !bReadOnly; ++n)
+		bReadOnly = _wcsicmp(functions[n].pwszName_, pwszName) == 0 &&
+			nArgSize <= functions[n].nMaxArgSize_;
+	if (!bReadOnly) {
+		bReadOnly_ = false;
+		return;
+	}
+	
+	if (_wcsicmp(pwszName, L"Defun") == 0) {
+		// A function can be called only when its name is known here
+		pwszLiteral_ = 0;
+		if (nArgSize != 0)
+			function.getArg(0)->visit(this);
+		if (!pwszLiteral_) {
+			bReadOnly_ = false;
+			return;
+		}
+		listFunction_.push_back(pwszLiteral_);
+	}
+	
+	for (size_t n = 0; n < nArgSize && bReadOnly_; ++n)
+		function.getArg(n)->visit(this);
+}
+
+bool qm::ReadOnlyMacroExprVisitor::isReadOnly(const MacroExpr* pExpr)
+{
+	assert(pExpr);
+	
+	ReadOnlyMacroExprVisitor visitor;
+	pExpr->visit(&visitor);
+	return visitor.isReadOnly();
+}
+
+bool qm::ReadOnlyMacroExprVisitor::isDefined(const WCHAR* pwszName) const
+{
+	return std::find_if(listFunction_.begin(), listFunction_.end(),
+		boost::bind(string_equal_i<WCHAR>(), _1, pwszName)) != listFunction_.end();
+}
+
+
 /****************************************************************************
  *
  * MacroExprPtr
@@ -1327,6 +1515,737 @@ const MacroConstantFactory& qm::MacroConstantFactory::getFactory()
 }
 
 
+/****************************************************************************
+ *
+ * MacroProgram
+ *
+ */
+
+qm::MacroProgram::MacroProgram()
+{
+}
+
+qm::MacroProgram::~MacroProgram()
+{
+	std::for_each(listString_.begin(), listString_.end(), &freeWString);
+	std::for_each(listFind_.begin(), listFind_.end(),
+		boost::checked_deleter<BMFindString<WSTRING> >());
+}
+
+MacroValuePtr qm::MacroProgram::run(MacroContext* pContext) const
+{
+	assert(pContext);
+	
+	Registers regs;
+	
+	size_t n = 0;
+	while (n < listInstruction_.size()) {
+		const Instruction& inst = listInstruction_[n++];
+		switch (inst.op_) {
+		case OP_BOOLEAN:
+			regs.setBoolean(inst.nReg_, inst.nValue_ != 0);
+			break;
+		case OP_NUMBER:
+			regs.setNumber(inst.nReg_, inst.nValue_);
+			break;
+		case OP_STRING:
+			regs.setString(inst.nReg_, listString_[inst.nValue_]);
+			break;
+		case OP_EVAL:
+			{
+				MacroValuePtr pValue(inst.pExpr_->value(pContext));
+				if (!pValue.get())
+					return MacroValuePtr();
+				regs.set(inst.nReg_, pValue);
+			}
+			break;
+		case OP_TEST:
+			regs.setBoolean(inst.nReg_, boolean(regs[inst.nReg_]));
+			break;
+		case OP_NOT:
+			regs.setBoolean(inst.nReg_, !boolean(regs[inst.nReg_]));
+			break;
+		case OP_JUMP:
+			n = inst.nValue_;
+			break;
+		case OP_JUMPIFTRUE:
+			if (boolean(regs[inst.nReg_]))
+				n = inst.nValue_;
+			break;
+		case OP_JUMPIFFALSE:
+			if (!boolean(regs[inst.nReg_]))
+				n = inst.nValue_;
+			break;
+		case OP_EQUAL:
+		case OP_CONTAIN:
+			{
+				unsigned int nFlags = inst.nValue_;
+				if ((nFlags & FLAG_CASEREGISTER) && boolean(regs[inst.nReg_]))
+					nFlags |= FLAG_CASE;
+				
+				bool bResult = false;
+				if (inst.op_ == OP_EQUAL) {
+					bResult = equal(regs[inst.nReg2_], regs[inst.nReg3_], (nFlags & FLAG_CASE) != 0);
+				}
+				else {
+					WCHAR wszLhs[32];
+					MacroValue::String wstrLhs(string(regs[inst.nReg2_], wszLhs, countof(wszLhs)));
+					if (inst.nReg3_ == -1) {
+						bResult = listFind_[inst.nIndex_]->find(wstrLhs.get()) != 0;
+					}
+					else {
+						WCHAR wszRhs[32];
+						MacroValue::String wstrRhs(string(regs[inst.nReg3_], wszRhs, countof(wszRhs)));
+						bResult = contain(wstrLhs.get(), wstrRhs.get(), nFlags);
+					}
+				}
+				regs.setBoolean(inst.nReg_, bResult);
+			}
+			break;
+		default:
+			assert(false);
+			break;
+		}
+	}
+	
+	return regs.get(0);
+}
+
+std::auto_ptr<MacroProgram> qm::MacroProgram::compile(const MacroExpr& expr)
+{
+	std::auto_ptr<MacroProgram> pProgram(new MacroProgram());
+	Compiler compiler(pProgram.get());
+	compiler.compile(expr, 0);
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::MacroProgram");
+	
+	// It's no use running a program which only evaluates the expression
+	const InstructionList& l = pProgram->listInstruction_;
+	if (l.size() == 1 && l.front().op_ == OP_EVAL) {
+		if (log.isDebugEnabled()) {
+			wstring_ptr wstrMacro(expr.getString());
+			log.debugf(L"Not compiled: %s", wstrMacro.get());
+		}
+		return std::auto_ptr<MacroProgram>(0);
+	}
+	
+	if (log.isDebugEnabled()) {
+		wstring_ptr wstrMacro(expr.getString());
+		log.debugf(L"Compiled: %s", wstrMacro.get());
+		
+		const WCHAR* pwszOps[] = {
+			L"BOOLEAN",
+			L"NUMBER",
+			L"STRING",
+			L"EVAL",
+			L"TEST",
+			L"NOT",
+			L"JUMP",
+			L"JUMPIFTRUE",
+			L"JUMPIFFALSE",
+			L"EQUAL",
+			L"CONTAIN"
+		};
+		for (InstructionList::size_type n = 0; n < l.size(); ++n) {
+			const Instruction& inst = l[n];
+			assert(inst.op_ < countof(pwszOps));
+			wstring_ptr wstrExpr;
+			if (inst.pExpr_)
+				wstrExpr = inst.pExpr_->getString();
+			log.debugf(L"%4u: %-11s r%u r%u r%u %u %u %s",
+				static_cast<unsigned int>(n), pwszOps[inst.op_],
+				inst.nReg_, inst.nReg2_, inst.nReg3_, inst.nValue_,
+				inst.nIndex_, wstrExpr.get() ? wstrExpr.get() : L"");
+		}
+	}
+	
+	return pProgram;
+}
+
+bool qm::MacroProgram::boolean(const Register& reg)
+{
+	if (reg.pValue_)
+		return reg.pValue_->boolean();
+	
+	switch (reg.type_) {
+	case MacroValue::TYPE_BOOLEAN:
+		return reg.b_;
+	case MacroValue::TYPE_NUMBER:
+		return reg.n_ != 0;
+	case MacroValue::TYPE_STRING:
+		return *reg.pwsz_ != L'\0';
+	default:
+		assert(false);
+		return false;
+	}
+}
+
+unsigned int qm::MacroProgram::number(const Register& reg)
+{
+	if (reg.pValue_)
+		return reg.pValue_->number();
+	
+	switch (reg.type_) {
+	case MacroValue::TYPE_BOOLEAN:
+		return reg.b_ ? 1 : 0;
+	case MacroValue::TYPE_NUMBER:
+		return reg.n_;
+	case MacroValue::TYPE_STRING:
+		if (MacroParser::isNumber(reg.pwsz_)) {
+			WCHAR* pEnd = 0;
+			return wcstol(reg.pwsz_, &pEnd, 10);
+		}
+		return 0;
+	default:
+		assert(false);
+		return 0;
+	}
+}
+
+MacroValue::String qm::MacroProgram::string(const Register& reg,
+											WCHAR* pwszBuf,
+											size_t nBufLen)
+{
+	if (reg.pValue_)
+		return reg.pValue_->string();
+	
+	switch (reg.type_) {
+	case MacroValue::TYPE_BOOLEAN:
+		return MacroValue::String(reg.b_ ? L"true" : L"false");
+	case MacroValue::TYPE_NUMBER:
+		_snwprintf(pwszBuf, nBufLen, L"%lu", reg.n_);
+		return MacroValue::String(pwszBuf);
+	case MacroValue::TYPE_STRING:
+		return MacroValue::String(reg.pwsz_);
+	default:
+		assert(false);
+		return MacroValue::String(L"");
+	}
+}
+
+bool qm::MacroProgram::equal(const Register& lhs,
+							 const Register& rhs,
+							 bool bCase)
+{
+	if (lhs.type_ == MacroValue::TYPE_BOOLEAN &&
+		rhs.type_ == MacroValue::TYPE_BOOLEAN) {
+		return boolean(lhs) == boolean(rhs);
+	}
+	else if (lhs.type_ == MacroValue::TYPE_NUMBER &&
+		rhs.type_ == MacroValue::TYPE_NUMBER) {
+		return number(lhs) == number(rhs);
+	}
+	else {
+		WCHAR wszLhs[32];
+		MacroValue::String wstrLhs(string(lhs, wszLhs, countof(wszLhs)));
+		WCHAR wszRhs[32];
+		MacroValue::String wstrRhs(string(rhs, wszRhs, countof(wszRhs)));
+		if (bCase)
+			return wcscmp(wstrLhs.get(), wstrRhs.get()) == 0;
+		else
+			return _wcsicmp(wstrLhs.get(), wstrRhs.get()) == 0;
+	}
+}
+
+bool qm::MacroProgram::contain(const WCHAR* pwszLhs,
+							   const WCHAR* pwszRhs,
+							   unsigned int nFlags)
+{
+	size_t nLhsLen = wcslen(pwszLhs);
+	size_t nRhsLen = wcslen(pwszRhs);
+	
+	if (nRhsLen == 0) {
+		return true;
+	}
+	else if (nLhsLen < nRhsLen) {
+		return false;
+	}
+	else if (nFlags & FLAG_BEGINWITH) {
+		return _wcsnicmp(pwszLhs, pwszRhs, nRhsLen) == 0;
+	}
+	else {
+		BMFindString<WSTRING> bmfs(pwszRhs, nRhsLen,
+			nFlags & FLAG_CASE ? 0 : BMFindString<WSTRING>::FLAG_IGNORECASE);
+		return bmfs.find(pwszLhs) != 0;
+	}
+}
+
+
+/****************************************************************************
+ *
+ * MacroProgram::Registers
+ *
+ */
+
+qm::MacroProgram::Registers::Registers()
+{
+	for (unsigned int n = 0; n < MAX_REGISTER; ++n) {
+		Register& reg = r_[n];
+		reg.type_ = MacroValue::TYPE_BOOLEAN;
+		reg.b_ = false;
+		reg.n_ = 0;
+		reg.pwsz_ = 0;
+		reg.pValue_ = 0;
+	}
+}
+
+qm::MacroProgram::Registers::~Registers()
+{
+	for (unsigned int n = 0; n < MAX_REGISTER; ++n)
+		clear(n);
+}
+
+MacroProgram::Register& qm::MacroProgram::Registers::operator[](unsigned int n)
+{
+	assert(n < MAX_REGISTER);
+	return r_[n];
+}
+
+void qm::MacroProgram::Registers::set(unsigned int n,
+									  MacroValuePtr pValue)
+{
+	assert(pValue.get());
+	
+	clear(n);
+	r_[n].type_ = pValue->getType();
+	r_[n].pValue_ = pValue.release();
+}
+
+void qm::MacroProgram::Registers::setBoolean(unsigned int n,
+											 bool b)
+{
+	clear(n);
+	r_[n].type_ = MacroValue::TYPE_BOOLEAN;
+	r_[n].b_ = b;
+}
+
+void qm::MacroProgram::Registers::setNumber(unsigned int n,
+											unsigned int nValue)
+{
+	clear(n);
+	r_[n].type_ = MacroValue::TYPE_NUMBER;
+	r_[n].n_ = nValue;
+}
+
+void qm::MacroProgram::Registers::setString(unsigned int n,
+											const WCHAR* pwsz)
+{
+	clear(n);
+	r_[n].type_ = MacroValue::TYPE_STRING;
+	r_[n].pwsz_ = pwsz;
+}
+
+MacroValuePtr qm::MacroProgram::Registers::get(unsigned int n)
+{
+	Register& reg = r_[n];
+	if (reg.pValue_) {
+		MacroValuePtr pValue(reg.pValue_);
+		reg.pValue_ = 0;
+		return pValue;
+	}
+	
+	MacroValueFactory& factory = MacroValueFactory::getFactory();
+	switch (reg.type_) {
+	case MacroValue::TYPE_BOOLEAN:
+		return factory.newBoolean(reg.b_);
+	case MacroValue::TYPE_NUMBER:
+		return factory.newNumber(reg.n_);
+	case MacroValue::TYPE_STRING:
+		return factory.newString(reg.pwsz_);
+	default:
+		assert(false);
+		return MacroValuePtr();
+	}
+}
+
+void qm::MacroProgram::Registers::clear(unsigned int n)
+{
+	assert(n < MAX_REGISTER);
+	
+	Register& reg = r_[n];
+	if (reg.pValue_) {
+		reg.pValue_->release();
+		reg.pValue_ = 0;
+	}
+}
+
+
+/****************************************************************************
+ *
+ * MacroProgram::Compiler
+ *
+ */
+
+qm::MacroProgram::Compiler::Compiler(MacroProgram* pProgram) :
+	pProgram_(pProgram),
+	pExpr_(0),
+	nReg_(0)
+{
+}
+
+qm::MacroProgram::Compiler::~Compiler()
+{
+}
+
+void qm::MacroProgram::Compiler::compile(const MacroExpr& expr,
+										 unsigned int nReg)
+{
+	const MacroExpr* pExpr = pExpr_;
+	unsigned int nRegPrev = nReg_;
+	
+	pExpr_ = &expr;
+	nReg_ = nReg;
+	expr.visit(this);
+	
+	pExpr_ = pExpr;
+	nReg_ = nRegPrev;
+}
+
+void qm::MacroProgram::Compiler::visitField(const MacroField& field)
+{
+	emitEval(field);
+}
+
+void qm::MacroProgram::Compiler::visitFieldCache(const MacroFieldCache& fieldCache)
+{
+	emitEval(fieldCache);
+}
+
+void qm::MacroProgram::Compiler::visitLiteral(const MacroLiteral& literal)
+{
+	wstring_ptr wstrValue(allocWString(literal.getValue()));
+	pProgram_->listString_.push_back(wstrValue.get());
+	wstrValue.release();
+	emit(OP_STRING, nReg_, 0, 0, static_cast<unsigned int>(pProgram_->listString_.size() - 1));
+}
+
+void qm::MacroProgram::Compiler::visitNumber(const MacroNumber& number)
+{
+	emit(OP_NUMBER, nReg_, 0, 0, number.getValue());
+}
+
+void qm::MacroProgram::Compiler::visitBoolean(const MacroBoolean& boolean)
+{
+	emit(OP_BOOLEAN, nReg_, 0, 0, boolean.getValue());
+}
+
+void qm::MacroProgram::Compiler::visitRegex(const MacroRegex& regex)
+{
+	emitEval(regex);
+}
+
+void qm::MacroProgram::Compiler::visitVariable(const MacroVariable& variable)
+{
+	emitEval(variable);
+}
+
+void qm::MacroProgram::Compiler::visitConstant(const MacroConstant& constant)
+{
+	emitEval(constant);
+}
+
+void qm::MacroProgram::Compiler::visitFunction(const MacroFunction& function)
+{
+	const WCHAR* pwszName = function.getFunctionName();
+	if (wcscmp(pwszName, L"And") == 0)
+		compileLogical(function, true);
+	else if (wcscmp(pwszName, L"Or") == 0)
+		compileLogical(function, false);
+	else if (wcscmp(pwszName, L"Not") == 0)
+		compileNot(function);
+	else if (wcscmp(pwszName, L"If") == 0)
+		compileIf(function);
+	else if (wcscmp(pwszName, L"Equal") == 0)
+		compileCompare(function, OP_EQUAL, 0);
+	else if (wcscmp(pwszName, L"Contain") == 0)
+		compileCompare(function, OP_CONTAIN, 0);
+	else if (wcscmp(pwszName, L"BeginWith") == 0)
+		compileCompare(function, OP_CONTAIN, FLAG_BEGINWITH);
+	else
+		emitEval(function);
+}
+
+bool qm::MacroProgram::Compiler::compileConstant(const MacroExpr& expr,
+												 unsigned int nReg,
+												 Instruction* pConstant)
+{
+	assert(pConstant);
+	
+	InstructionList& l = pProgram_->listInstruction_;
+	size_t nSize = l.size();
+	compile(expr, nReg);
+	if (l.size() != nSize + 1)
+		return false;
+	
+	switch (l.back().op_) {
+	case OP_BOOLEAN:
+	case OP_NUMBER:
+	case OP_STRING:
+		break;
+	default:
+		return false;
+	}
+	
+	*pConstant = l.back();
+	l.pop_back();
+	
+	return true;
+}
+
+void qm::MacroProgram::Compiler::compileLogical(const MacroFunction& function,
+												bool bAnd)
+{
+	size_t nSize = function.getArgSize();
+	if (nSize == 0) {
+		emitEval(function);
+		return;
+	}
+	
+	typedef std::vector<size_t> JumpList;
+	JumpList listJump;
+	
+	bool bDetermined = false;
+	for (size_t n = 0; n < nSize && !bDetermined; ++n) {
+		Instruction constant;
+		if (compileConstant(*function.getArg(n), nReg_, &constant)) {
+			Register reg;
+			getConstant(constant, &reg);
+			if (MacroProgram::boolean(reg) != bAnd) {
+				emit(OP_BOOLEAN, nReg_, 0, 0, !bAnd);
+				bDetermined = true;
+			}
+		}
+		else {
+			emit(OP_TEST, nReg_, 0, 0, 0);
+			listJump.push_back(emit(bAnd ? OP_JUMPIFFALSE : OP_JUMPIFTRUE, nReg_, 0, 0, 0));
+		}
+	}
+	if (!bDetermined) {
+		if (listJump.empty()) {
+			emit(OP_BOOLEAN, nReg_, 0, 0, bAnd);
+		}
+		else {
+			// The last jump is to the next instruction
+			pProgram_->listInstruction_.pop_back();
+			listJump.pop_back();
+		}
+	}
+	
+	for (JumpList::const_iterator it = listJump.begin(); it != listJump.end(); ++it)
+		patch(*it);
+}
+
+void qm::MacroProgram::Compiler::compileNot(const MacroFunction& function)
+{
+	if (function.getArgSize() != 1) {
+		emitEval(function);
+		return;
+	}
+	
+	Instruction constant;
+	if (compileConstant(*function.getArg(0), nReg_, &constant)) {
+		Register reg;
+		getConstant(constant, &reg);
+		emit(OP_BOOLEAN, nReg_, 0, 0, !MacroProgram::boolean(reg));
+	}
+	else {
+		emit(OP_NOT, nReg_, 0, 0, 0);
+	}
+}
+
+void qm::MacroProgram::Compiler::compileIf(const MacroFunction& function)
+{
+	size_t nSize = function.getArgSize();
+	if (nSize < 3 || nSize % 2 == 0) {
+		emitEval(function);
+		return;
+	}
+	
+	typedef std::vector<size_t> JumpList;
+	JumpList listJump;
+	
+	size_t n = 0;
+	while (n < nSize - 1) {
+		Instruction constant;
+		if (compileConstant(*function.getArg(n), nReg_, &constant)) {
+			Register reg;
+			getConstant(constant, &reg);
+			if (MacroProgram::boolean(reg))
+				break;
+		}
+		else {
+			size_t nNext = emit(OP_JUMPIFFALSE, nReg_, 0, 0, 0);
+			compile(*function.getArg(n + 1), nReg_);
+			listJump.push_back(emit(OP_JUMP, nReg_, 0, 0, 0));
+			patch(nNext);
+		}
+		n += 2;
+	}
+	compile(*function.getArg(n < nSize - 1 ? n + 1 : n), nReg_);
+	
+	for (JumpList::const_iterator it = listJump.begin(); it != listJump.end(); ++it)
+		patch(*it);
+}
+
+void qm::MacroProgram::Compiler::compileCompare(const MacroFunction& function,
+												Op op,
+												unsigned int nFlags)
+{
+	size_t nSize = function.getArgSize();
+	if (nSize < 2 || 3 < nSize || nReg_ + 3 > MAX_REGISTER) {
+		emitEval(function);
+		return;
+	}
+	
+	// Each argument is compiled to a register above those which hold
+	// the preceding arguments, in the same order as the function evaluates
+	// them. A non-constant flag of case sensitivity is kept in nReg_.
+	unsigned int nLhs = nReg_;
+	if (nSize == 3) {
+		Instruction constant;
+		if (compileConstant(*function.getArg(2), nReg_, &constant)) {
+			Register reg;
+			getConstant(constant, &reg);
+			if (MacroProgram::boolean(reg))
+				nFlags |= FLAG_CASE;
+		}
+		else {
+			nFlags |= FLAG_CASEREGISTER;
+			++nLhs;
+		}
+	}
+	unsigned int nRhs = nLhs + 1;
+	
+	Instruction constantLhs;
+	bool bConstantLhs = compileConstant(*function.getArg(0), nLhs, &constantLhs);
+	Instruction constantRhs;
+	bool bConstantRhs = compileConstant(*function.getArg(1), nRhs, &constantRhs);
+	
+	if (bConstantLhs && bConstantRhs && !(nFlags & FLAG_CASEREGISTER)) {
+		Register lhs;
+		getConstant(constantLhs, &lhs);
+		Register rhs;
+		getConstant(constantRhs, &rhs);
+		
+		bool bResult = false;
+		if (op == OP_EQUAL) {
+			bResult = MacroProgram::equal(lhs, rhs, (nFlags & FLAG_CASE) != 0);
+		}
+		else {
+			WCHAR wszLhs[32];
+			MacroValue::String wstrLhs(MacroProgram::string(lhs, wszLhs, countof(wszLhs)));
+			WCHAR wszRhs[32];
+			MacroValue::String wstrRhs(MacroProgram::string(rhs, wszRhs, countof(wszRhs)));
+			bResult = MacroProgram::contain(wstrLhs.get(), wstrRhs.get(), nFlags);
+		}
+		emit(OP_BOOLEAN, nReg_, 0, 0, bResult);
+		return;
+	}
+	
+	if (bConstantLhs)
+		emitConstant(constantLhs, nLhs);
+	
+	if (op == OP_CONTAIN && bConstantRhs &&
+		!(nFlags & FLAG_CASEREGISTER) && !(nFlags & FLAG_BEGINWITH)) {
+		// Create a table to find the pattern once instead of each time
+		Register rhs;
+		getConstant(constantRhs, &rhs);
+		WCHAR wszRhs[32];
+		MacroValue::String wstrRhs(MacroProgram::string(rhs, wszRhs, countof(wszRhs)));
+		size_t nLen = wcslen(wstrRhs.get());
+		if (nLen == 0) {
+			emit(OP_BOOLEAN, nReg_, 0, 0, true);
+		}
+		else {
+			std::auto_ptr<BMFindString<WSTRING> > pFind(new BMFindString<WSTRING>(wstrRhs.get(), nLen,
+				nFlags & FLAG_CASE ? 0 : BMFindString<WSTRING>::FLAG_IGNORECASE));
+			pProgram_->listFind_.push_back(pFind.get());
+			pFind.release();
+			size_t n = emit(OP_CONTAIN, nReg_, nLhs, -1, nFlags);
+			pProgram_->listInstruction_[n].nIndex_ = static_cast<unsigned int>(pProgram_->listFind_.size() - 1);
+		}
+		return;
+	}
+	
+	if (bConstantRhs)
+		emitConstant(constantRhs, nRhs);
+	
+	emit(op, nReg_, nLhs, nRhs, nFlags);
+}
+
+void qm::MacroProgram::Compiler::emitConstant(const Instruction& constant,
+											  unsigned int nReg)
+{
+	Instruction inst(constant);
+	inst.nReg_ = nReg;
+	pProgram_->listInstruction_.push_back(inst);
+}
+
+void qm::MacroProgram::Compiler::emitEval(const MacroExpr& expr)
+{
+	size_t n = emit(OP_EVAL, nReg_, 0, 0, 0);
+	pProgram_->listInstruction_[n].pExpr_ = &expr;
+}
+
+size_t qm::MacroProgram::Compiler::emit(Op op,
+										unsigned int nReg,
+										unsigned int nReg2,
+										unsigned int nReg3,
+										unsigned int nValue)
+{
+	assert(nReg < MAX_REGISTER);
+	
+	Instruction inst = {
+		op,
+		nReg,
+		nReg2,
+		nReg3,
+		nValue,
+		0,
+		0
+	};
+	pProgram_->listInstruction_.push_back(inst);
+	return pProgram_->listInstruction_.size() - 1;
+}
+
+void qm::MacroProgram::Compiler::patch(size_t n)
+{
+	InstructionList& l = pProgram_->listInstruction_;
+	assert(n < l.size());
+	assert(l[n].op_ == OP_JUMP || l[n].op_ == OP_JUMPIFTRUE || l[n].op_ == OP_JUMPIFFALSE);
+	l[n].nValue_ = static_cast<unsigned int>(l.size());
+}
+
+void qm::MacroProgram::Compiler::getConstant(const Instruction& constant,
+											 Register* pReg) const
+{
+	assert(pReg);
+	
+	pReg->type_ = MacroValue::TYPE_BOOLEAN;
+	pReg->b_ = false;
+	pReg->n_ = 0;
+	pReg->pwsz_ = 0;
+	pReg->pValue_ = 0;
+	
+	switch (constant.op_) {
+	case OP_BOOLEAN:
+		pReg->b_ = constant.nValue_ != 0;
+		break;
+	case OP_NUMBER:
+		pReg->type_ = MacroValue::TYPE_NUMBER;
+		pReg->n_ = constant.nValue_;
+		break;
+	case OP_STRING:
+		pReg->type_ = MacroValue::TYPE_STRING;
+		pReg->pwsz_ = pProgram_->listString_[constant.nValue_];
+		break;
+	default:
+		assert(false);
+		break;
+	}
+}
+
+
 /****************************************************************************
  *
  * MacroErrorHandler
@@ -1338,6 +2257,90 @@ qm::MacroErrorHandler::~MacroErrorHandler()
 }
 
 
+/****************************************************************************
+ *
+ * MacroFieldPlan
+ *
+ */
+
+qm::MacroFieldPlan::MacroFieldPlan() :
+	type_(MacroContext::MESSAGETYPE_NONE),
+	bAllFields_(false),
+	nIndex_(0)
+{
+}
+
+qm::MacroFieldPlan::~MacroFieldPlan()
+{
+	std::for_each(listField_.begin(), listField_.end(), &freeWString);
+}
+
+MacroContext::MessageType qm::MacroFieldPlan::getMessageType() const
+{
+	return type_;
+}
+
+bool qm::MacroFieldPlan::isAllFields() const
+{
+	return bAllFields_;
+}
+
+const MacroFieldPlan::FieldList& qm::MacroFieldPlan::getFields() const
+{
+	return listField_;
+}
+
+bool qm::MacroFieldPlan::isField(const WCHAR* pwszName) const
+{
+	assert(pwszName);
+	
+	if (bAllFields_)
+		return true;
+	
+	for (FieldList::const_iterator it = listField_.begin(); it != listField_.end(); ++it) {
+		if (_wcsicmp(*it, pwszName) == 0)
+			return true;
+	}
+	return false;
+}
+
+bool qm::MacroFieldPlan::isIndex(MessageIndexName name) const
+{
+	assert(name < NAME_MAX);
+	return (nIndex_ & (1 << name)) != 0;
+}
+
+void qm::MacroFieldPlan::addMessageType(MacroContext::MessageType type)
+{
+	if (type == MacroContext::MESSAGETYPE_NONE)
+		return;
+	
+	type_ = QSMAX(type_, type);
+	
+	// Which fields are referred is unknown
+	bAllFields_ = true;
+}
+
+void qm::MacroFieldPlan::addField(const WCHAR* pwszName)
+{
+	assert(pwszName);
+	
+	type_ = QSMAX(type_, MacroContext::MESSAGETYPE_HEADER);
+	
+	if (!isField(pwszName)) {
+		wstring_ptr wstrName(allocWString(pwszName));
+		listField_.push_back(wstrName.get());
+		wstrName.release();
+	}
+}
+
+void qm::MacroFieldPlan::addIndex(MessageIndexName name)
+{
+	assert(name < NAME_MAX);
+	nIndex_ |= 1 << name;
+}
+
+
 /****************************************************************************
  *
  * Macro
@@ -1345,19 +2348,25 @@ qm::MacroErrorHandler::~MacroErrorHandler()
  */
 
 qm::Macro::Macro(MacroExprPtr pExpr) :
-	pExpr_(pExpr.release())
+	pExpr_(pExpr.release()),
+	pProgram_(MacroProgram::compile(*pExpr_).release())
 {
+	pExpr_->getFieldPlan(&plan_);
 }
 
 qm::Macro::~Macro()
 {
+	delete pProgram_;
 	pExpr_->release();
 }
 
 MacroValuePtr qm::Macro::value(MacroContext* pContext) const
 {
 	assert(pContext);
-	return pExpr_->value(pContext);
+	if (pProgram_)
+		return pProgram_->run(pContext);
+	else
+		return pExpr_->value(pContext);
 }
 
 wstring_ptr qm::Macro::getString() const
@@ -1367,7 +2376,12 @@ wstring_ptr qm::Macro::getString() const
 
 MacroContext::MessageType qm::Macro::getMessageTypeHint() const
 {
-	return pExpr_->getMessageTypeHint();
+	return plan_.getMessageType();
+}
+
+const MacroFieldPlan& qm::Macro::getFieldPlan() const
+{
+	return plan_;
 }
 
 const MacroExpr* qm::Macro::getExpr() const
@@ -1812,6 +2826,20 @@ Message* qm::MacroContext::getMessage(MessageType type,
 	return pMessage_;
 }
 
+wstring_ptr qm::MacroContext::getIndex(MessageIndexName name) const
+{
+	if (!pmh_)
+		return 0;
+	
+	// The index of an enveloped message is made from its outer header,
+	// which may be different from the header after it is processed
+	if (pmh_->getFlags() & MessageHolderBase::FLAG_ENVELOPED &&
+		getSecurityMode() != SECURITYMODE_NONE)
+		return 0;
+	
+	return pmh_->getIndex(name);
+}
+
 void qm::MacroContext::clearMessage()
 {
 	pmh_ = 0;
@@ -11,6 +11,7 @@
 #include <qmmacro.h>
 
 #include <qsregex.h>
+#include <qsstring.h>
 
 #include <vector>
 #include <utility>
@@ -123,10 +124,12 @@ class MacroExpr;
 		class MacroFunctionVariable;
 		class MacroFunctionWhile;
 class MacroExprVisitor;
+	class ReadOnlyMacroExprVisitor;
 class MacroExprPtr;
 class MacroExprInvoker;
 class MacroFunctionFactory;
 class MacroConstantFactory;
+class MacroProgram;
 
 class AddressBook;
 class AddressBookCategory;
@@ -333,7 +336,7 @@ public:
 	virtual MacroValuePtr value(MacroContext* pContext) const = 0;
 	virtual qs::wstring_ptr getString() const = 0;
 	virtual void release();
-	virtual MacroContext::MessageType getMessageTypeHint() const;
+	virtual void getFieldPlan(MacroFieldPlan* pPlan) const;
 	virtual void visit(MacroExprVisitor* pVisitor) const = 0;
 
 protected:
@@ -360,7 +363,7 @@ public:
 public:
 	virtual MacroValuePtr value(MacroContext* pContext) const;
 	virtual qs::wstring_ptr getString() const;
-	virtual MacroContext::MessageType getMessageTypeHint() const;
+	virtual void getFieldPlan(MacroFieldPlan* pPlan) const;
 	virtual void visit(MacroExprVisitor* pVisitor) const;
 
 private:
@@ -405,6 +408,7 @@ public:
 public:
 	virtual MacroValuePtr value(MacroContext* pContext) const;
 	virtual qs::wstring_ptr getString() const;
+	virtual void getFieldPlan(MacroFieldPlan* pPlan) const;
 	virtual void visit(MacroExprVisitor* pVisitor) const;
 
 public:
@@ -620,12 +624,13 @@ public:
 
 public:
 	virtual qs::wstring_ptr getString() const;
-	virtual MacroContext::MessageType getMessageTypeHint() const;
+	virtual void getFieldPlan(MacroFieldPlan* pPlan) const;
 	virtual void visit(MacroExprVisitor* pVisitor) const;
 
 protected:
 	virtual const WCHAR* getName() const = 0;
 	virtual MacroContext::MessageType getFunctionMessageTypeHint() const;
+	virtual void getFunctionFieldPlan(MacroFieldPlan* pPlan) const;
 
 public:
 	const WCHAR* getFunctionName() const;
@@ -645,6 +650,8 @@ protected:
 	Message* getMessage(MacroContext* pContext,
 						MacroContext::MessageType type,
 						const WCHAR* pwszField) const;
+	void addFieldArg(size_t n,
+					 MacroFieldPlan* pPlan) const;
 
 private:
 	qs::wstring_ptr getArgString() const;
@@ -1296,7 +1303,7 @@ public:
 
 protected:
 	virtual const WCHAR* getName() const;
-	virtual MacroContext::MessageType getFunctionMessageTypeHint() const;
+	virtual void getFunctionFieldPlan(MacroFieldPlan* pPlan) const;
 
 private:
 	MacroFunctionExist(const MacroFunctionExist&);
@@ -1345,7 +1352,7 @@ public:
 
 protected:
 	virtual const WCHAR* getName() const;
-	virtual MacroContext::MessageType getFunctionMessageTypeHint() const;
+	virtual void getFunctionFieldPlan(MacroFieldPlan* pPlan) const;
 
 private:
 	MacroFunctionField(const MacroFunctionField&);
@@ -1370,7 +1377,7 @@ public:
 
 protected:
 	virtual const WCHAR* getName() const;
-	virtual MacroContext::MessageType getFunctionMessageTypeHint() const;
+	virtual void getFunctionFieldPlan(MacroFieldPlan* pPlan) const;
 
 private:
 	MacroFunctionFieldParameter(const MacroFunctionFieldParameter&);
@@ -1892,6 +1899,7 @@ public:
 
 protected:
 	virtual const WCHAR* getName() const;
+	virtual void getFunctionFieldPlan(MacroFieldPlan* pPlan) const;
 
 private:
 	MacroFunctionLabel(const MacroFunctionLabel&);
@@ -2039,6 +2047,7 @@ public:
 
 protected:
 	virtual const WCHAR* getName() const;
+	virtual void getFunctionFieldPlan(MacroFieldPlan* pPlan) const;
 
 private:
 	MacroFunctionMessageId(const MacroFunctionMessageId&);
@@ -2405,7 +2414,7 @@ public:
 
 protected:
 	virtual const WCHAR* getName() const;
-	virtual MacroContext::MessageType getFunctionMessageTypeHint() const;
+	virtual void getFunctionFieldPlan(MacroFieldPlan* pPlan) const;
 
 private:
 	MacroFunctionReferences(const MacroFunctionReferences&);
@@ -2773,7 +2782,7 @@ public:
 
 protected:
 	virtual const WCHAR* getName() const;
-	virtual MacroContext::MessageType getFunctionMessageTypeHint() const;
+	virtual void getFunctionFieldPlan(MacroFieldPlan* pPlan) const;
 
 private:
 	MacroFunctionSubject(const MacroFunctionSubject&);
@@ -3019,6 +3028,61 @@ public:
 };
 
 
+/****************************************************************************
+ *
+ * ReadOnlyMacroExprVisitor
+ *
+ * Check if an expression only reads the message and its folder. Such an
+ * expression can be evaluated by worker threads against MessageHolderSnapshot
+ * as long as each of them uses its own MacroContext, because it doesn't lock
+ * the account when the message holder is a snapshot. The field plan of the
+ * expression must be used to load the snapshots. Local variables and functions
+ * are allowed because they are held by the context. Parts compiled with the
+ * expression, such as regex patterns, are shared by the threads, so they
+ * must not be modified while they are evaluated.
+ *
+ */
+
+class ReadOnlyMacroExprVisitor : public MacroExprVisitor
+{
+public:
+	ReadOnlyMacroExprVisitor();
+	virtual ~ReadOnlyMacroExprVisitor();
+
+public:
+	bool isReadOnly() const;
+
+public:
+	virtual void visitField(const MacroField& field);
+	virtual void visitFieldCache(const MacroFieldCache& fieldCache);
+	virtual void visitLiteral(const MacroLiteral& literal);
+	virtual void visitNumber(const MacroNumber& number);
+	virtual void visitBoolean(const MacroBoolean& boolean);
+	virtual void visitRegex(const MacroRegex& regex);
+	virtual void visitVariable(const MacroVariable& variable);
+	virtual void visitConstant(const MacroConstant& constant);
+	virtual void visitFunction(const MacroFunction& function);
+
+public:
+	static bool isReadOnly(const MacroExpr* pExpr);
+
+private:
+	bool isDefined(const WCHAR* pwszName) const;
+
+private:
+	ReadOnlyMacroExprVisitor(const ReadOnlyMacroExprVisitor&);
+	ReadOnlyMacroExprVisitor& operator=(const ReadOnlyMacroExprVisitor&);
+
+private:
+	typedef std::vector<const WCHAR*> NameList;
+
+private:
+	bool bReadOnly_;
+	const WCHAR* pwszLiteral_;
+	NameList listFunction_;
+};
+
+
 /****************************************************************************
  *
  * MacroExprPtr
@@ -3134,6 +3198,192 @@ private:
 	static MacroConstantFactory factory__;
 };
 
+
+/****************************************************************************
+ *
+ * MacroProgram
+ *
+ * Flat program compiled from a tree of expressions. @And, @Or, @Not, @If,
+ * @Equal, @Contain and @BeginWith are run on registers which hold unboxed
+ * booleans, numbers and constant strings, and are folded if their arguments
+ * are constant. The other expressions are evaluated as they are.
+ *
+ */
+
+class MacroProgram
+{
+public:
+	enum {
+		MAX_REGISTER	= 16
+	};
+
+private:
+	enum Op {
+		OP_BOOLEAN,
+		OP_NUMBER,
+		OP_STRING,
+		OP_EVAL,
+		OP_TEST,
+		OP_NOT,
+		OP_JUMP,
+		OP_JUMPIFTRUE,
+		OP_JUMPIFFALSE,
+		OP_EQUAL,
+		OP_CONTAIN
+	};
+	
+	enum Flag {
+		FLAG_CASE			= 0x01,
+		FLAG_CASEREGISTER	= 0x02,
+		FLAG_BEGINWITH		= 0x04
+	};
+	
+	struct Instruction
+	{
+		Op op_;
+		unsigned int nReg_;
+		unsigned int nReg2_;
+		unsigned int nReg3_;
+		unsigned int nValue_;
+		unsigned int nIndex_;
+		const MacroExpr* pExpr_;
+	};
+	
+	struct Register
+	{
+		MacroValue::Type type_;
+		bool b_;
+		unsigned int n_;
+		const WCHAR* pwsz_;
+		MacroValue* pValue_;
+	};
+	
+	class Registers
+	{
+	public:
+		Registers();
+		~Registers();
+	
+	public:
+		Register& operator[](unsigned int n);
+	
+	public:
+		void set(unsigned int n,
+				 MacroValuePtr pValue);
+		void setBoolean(unsigned int n,
+						bool b);
+		void setNumber(unsigned int n,
+					   unsigned int nValue);
+		void setString(unsigned int n,
+					   const WCHAR* pwsz);
+		MacroValuePtr get(unsigned int n);
+	
+	private:
+		void clear(unsigned int n);
+	
+	private:
+		Registers(const Registers&);
+		Registers& operator=(const Registers&);
+	
+	private:
+		Register r_[MAX_REGISTER];
+	};
+	
+	class Compiler : public MacroExprVisitor
+	{
+	public:
+		explicit Compiler(MacroProgram* pProgram);
+		virtual ~Compiler();
+	
+	public:
+		void compile(const MacroExpr& expr,
+					 unsigned int nReg);
+	
+	public:
+		virtual void visitField(const MacroField& field);
+		virtual void visitFieldCache(const MacroFieldCache& fieldCache);
+		virtual void visitLiteral(const MacroLiteral& literal);
+		virtual void visitNumber(const MacroNumber& number);
+		virtual void visitBoolean(const MacroBoolean& boolean);
+		virtual void visitRegex(const MacroRegex& regex);
+		virtual void visitVariable(const MacroVariable& variable);
+		virtual void visitConstant(const MacroConstant& constant);
+		virtual void visitFunction(const MacroFunction& function);
+	
+	private:
+		bool compileConstant(const MacroExpr& expr,
+							 unsigned int nReg,
+							 Instruction* pConstant);
+		void compileLogical(const MacroFunction& function,
+							bool bAnd);
+		void compileNot(const MacroFunction& function);
+		void compileIf(const MacroFunction& function);
+		void compileCompare(const MacroFunction& function,
+							Op op,
+							unsigned int nFlags);
+		void emitConstant(const Instruction& constant,
+						  unsigned int nReg);
+		void emitEval(const MacroExpr& expr);
+		size_t emit(Op op,
+					unsigned int nReg,
+					unsigned int nReg2,
+					unsigned int nReg3,
+					unsigned int nValue);
+		void patch(size_t n);
+		void getConstant(const Instruction& constant,
+						 Register* pReg) const;
+	
+	private:
+		Compiler(const Compiler&);
+		Compiler& operator=(const Compiler&);
+	
+	private:
+		MacroProgram* pProgram_;
+		const MacroExpr* pExpr_;
+		unsigned int nReg_;
+	};
+	friend class Compiler;
+
+private:
+	MacroProgram();
+
+public:
+	~MacroProgram();
+
+public:
+	MacroValuePtr run(MacroContext* pContext) const;
+
+public:
+	static std::auto_ptr<MacroProgram> compile(const MacroExpr& expr);
+
+private:
+	static bool boolean(const Register& reg);
+	static unsigned int number(const Register& reg);
+	static MacroValue::String string(const Register& reg,
+									 WCHAR* pwszBuf,
+									 size_t nBufLen);
+	static bool equal(const Register& lhs,
+					  const Register& rhs,
+					  bool bCase);
+	static bool contain(const WCHAR* pwszLhs,
+						const WCHAR* pwszRhs,
+						unsigned int nFlags);
+
+private:
+	MacroProgram(const MacroProgram&);
+	MacroProgram& operator=(const MacroProgram&);
+
+private:
+	typedef std::vector<Instruction> InstructionList;
+	typedef std::vector<qs::WSTRING> StringList;
+	typedef std::vector<qs::BMFindString<qs::WSTRING>*> FindList;
+
+private:
+	InstructionList listInstruction_;
+	StringList listString_;
+	FindList listFind_;
+};
+
 }
 
 #endif // __MACRO_H__
@@ -108,12 +108,11 @@ wstring_ptr qm::MacroFunction::getString() const
 	return concat(c, countof(c));
 }
 
-MacroContext::MessageType qm::MacroFunction::getMessageTypeHint() const
+void qm::MacroFunction::getFieldPlan(MacroFieldPlan* pPlan) const
 {
-	MacroContext::MessageType type = getFunctionMessageTypeHint();
+	getFunctionFieldPlan(pPlan);
 	for (ArgList::const_iterator it = listArg_.begin(); it != listArg_.end(); ++it)
-		type = QSMAX(type, (*it)->getMessageTypeHint());
-	return type;
+		(*it)->getFieldPlan(pPlan);
 }
 
 void qm::MacroFunction::visit(MacroExprVisitor* pVisitor) const
@@ -126,6 +125,11 @@ MacroContext::MessageType qm::MacroFunction::getFunctionMessageTypeHint() const
 	return MacroContext::MESSAGETYPE_NONE;
 }
 
+void qm::MacroFunction::getFunctionFieldPlan(MacroFieldPlan* pPlan) const
+{
+	pPlan->addMessageType(getFunctionMessageTypeHint());
+}
+
 const WCHAR* qm::MacroFunction::getFunctionName() const
 {
 	return getName();
@@ -209,6 +213,38 @@ Message* qm::MacroFunction::getMessage(MacroContext* pContext,
 	return pMessage;
 }
 
+void qm::MacroFunction::addFieldArg(size_t n,
+									MacroFieldPlan* pPlan) const
+{
+	struct LiteralVisitor : public MacroExprVisitor
+	{
+		LiteralVisitor() :
+			pwszValue_(0)
+		{
+		}
+		
+		virtual void visitField(const MacroField& field) {}
+		virtual void visitFieldCache(const MacroFieldCache& fieldCache) {}
+		virtual void visitLiteral(const MacroLiteral& literal) { pwszValue_ = literal.getValue(); }
+		virtual void visitNumber(const MacroNumber& number) {}
+		virtual void visitBoolean(const MacroBoolean& boolean) {}
+		virtual void visitRegex(const MacroRegex& regex) {}
+		virtual void visitVariable(const MacroVariable& variable) {}
+		virtual void visitConstant(const MacroConstant& constant) {}
+		virtual void visitFunction(const MacroFunction& function) {}
+		
+		const WCHAR* pwszValue_;
+	} visitor;
+	
+	// Only the field whose name is a literal can be known before evaluating
+	if (n < getArgSize())
+		getArg(n)->visit(&visitor);
+	if (visitor.pwszValue_)
+		pPlan->addField(visitor.pwszValue_);
+	else
+		pPlan->addMessageType(MacroContext::MESSAGETYPE_HEADER);
+}
+
 wstring_ptr qm::MacroFunction::getArgString() const
 {
 	StringBuffer<WSTRING> buf;
@@ -1646,9 +1682,9 @@ const WCHAR* qm::MacroFunctionExist::getName() const
 	return L"Exist";
 }
 
-MacroContext::MessageType qm::MacroFunctionExist::getFunctionMessageTypeHint() const
+void qm::MacroFunctionExist::getFunctionFieldPlan(MacroFieldPlan* pPlan) const
 {
-	return MacroContext::MESSAGETYPE_HEADER;
+	addFieldArg(0, pPlan);
 }
 
 
@@ -1741,9 +1777,10 @@ const WCHAR* qm::MacroFunctionField::getName() const
 	return L"Field";
 }
 
-MacroContext::MessageType qm::MacroFunctionField::getFunctionMessageTypeHint() const
+void qm::MacroFunctionField::getFunctionFieldPlan(MacroFieldPlan* pPlan) const
 {
-	return MacroContext::MESSAGETYPE_HEADER;
+	if (getArgSize() < 2)
+		addFieldArg(0, pPlan);
 }
 
 
@@ -1821,9 +1858,10 @@ const WCHAR* qm::MacroFunctionFieldParameter::getName() const
 	return L"FieldParameter";
 }
 
-MacroContext::MessageType qm::MacroFunctionFieldParameter::getFunctionMessageTypeHint() const
+void qm::MacroFunctionFieldParameter::getFunctionFieldPlan(MacroFieldPlan* pPlan) const
 {
-	return MacroContext::MESSAGETYPE_HEADER;
+	if (getArgSize() < 3)
+		addFieldArg(0, pPlan);
 }
 
 
@@ -3150,9 +3188,9 @@ MacroValuePtr qm::MacroFunctionLabel::value(MacroContext* pContext) const
 			return error(*pContext, MacroErrorHandler::CODE_FAIL);
 	}
 	else {
-		if (pmh && pmh->getMessageHolder())
-			wstrLabel = pmh->getMessageHolder()->getLabel();
-		else
+		if (pmh)
+			wstrLabel = pmh->getIndex(NAME_LABEL);
+		if (!wstrLabel.get())
 			wstrLabel = allocWString(L"");
 	}
 	
@@ -3164,6 +3202,12 @@ const WCHAR* qm::MacroFunctionLabel::getName() const
 	return L"Label";
 }
 
+void qm::MacroFunctionLabel::getFunctionFieldPlan(MacroFieldPlan* pPlan) const
+{
+	if (getArgSize() == 0)
+		pPlan->addIndex(NAME_LABEL);
+}
+
 
 /****************************************************************************
  *
@@ -3543,16 +3587,22 @@ MacroValuePtr qm::MacroFunctionMessageId::value(MacroContext* pContext) const
 	if (!pContext->getMessage())
 		return error(*pContext, MacroErrorHandler::CODE_NOCONTEXTMESSAGE);
 	
-	Message* pMessage = getMessage(pContext,
-		MacroContext::MESSAGETYPE_HEADER, L"Message-Id");
-	if (!pMessage)
-		return error(*pContext, MacroErrorHandler::CODE_GETMESSAGE);
+	wstring_ptr wstrMessageId(pContext->getIndex(NAME_MESSAGEID));
+	if (!wstrMessageId.get()) {
+		Message* pMessage = getMessage(pContext,
+			MacroContext::MESSAGETYPE_HEADER, L"Message-Id");
+		if (!pMessage)
+			return error(*pContext, MacroErrorHandler::CODE_GETMESSAGE);
+		
+		MessageIdParser messageId;
+		if (pMessage->getField(L"Message-Id", &messageId) == Part::FIELD_EXIST)
+			wstrMessageId = allocWString(messageId.getMessageId());
+	}
 	
 	StringBuffer<WSTRING> buf;
-	MessageIdParser messageId;
-	if (pMessage->getField(L"Message-Id", &messageId) == Part::FIELD_EXIST) {
+	if (wstrMessageId.get() && *wstrMessageId.get()) {
 		buf.append(L'<');
-		buf.append(messageId.getMessageId());
+		buf.append(wstrMessageId.get());
 		buf.append(L'>');
 	}
 	return MacroValueFactory::getFactory().newString(buf.getString());
@@ -3563,6 +3613,11 @@ const WCHAR* qm::MacroFunctionMessageId::getName() const
 	return L"MessageId";
 }
 
+void qm::MacroFunctionMessageId::getFunctionFieldPlan(MacroFieldPlan* pPlan) const
+{
+	pPlan->addIndex(NAME_MESSAGEID);
+}
+
 
 /****************************************************************************
  *
@@ -4463,9 +4518,9 @@ const WCHAR* qm::MacroFunctionReferences::getName() const
 	return L"References";
 }
 
-MacroContext::MessageType qm::MacroFunctionReferences::getFunctionMessageTypeHint() const
+void qm::MacroFunctionReferences::getFunctionFieldPlan(MacroFieldPlan* pPlan) const
 {
-	return MacroContext::MESSAGETYPE_HEADER;
+	pPlan->addField(L"References");
 }
 
 
@@ -5415,10 +5470,19 @@ MacroValuePtr qm::MacroFunctionSubject::value(MacroContext* pContext) const
 	if (!pContext->getMessage())
 		return error(*pContext, MacroErrorHandler::CODE_NOCONTEXTMESSAGE);
 	
-	Message* pMessage = getMessage(pContext,
-		MacroContext::MESSAGETYPE_HEADER, L"Subject");
-	if (!pMessage)
-		return error(*pContext, MacroErrorHandler::CODE_GETMESSAGE);
+	// The subject in the index is the same as the unstructured value of
+	// the field, so that it's used instead of loading the header
+	wstring_ptr wstrValue(pContext->getIndex(NAME_SUBJECT));
+	if (!wstrValue.get()) {
+		Message* pMessage = getMessage(pContext,
+			MacroContext::MESSAGETYPE_HEADER, L"Subject");
+		if (!pMessage)
+			return error(*pContext, MacroErrorHandler::CODE_GETMESSAGE);
+		
+		UnstructuredParser subject;
+		if (pMessage->getField(L"Subject", &subject) == Part::FIELD_EXIST)
+			wstrValue = allocWString(subject.getValue());
+	}
 	
 	bool bRemoveRe = false;
 	bool bRemoveMl = false;
@@ -5431,12 +5495,10 @@ MacroValuePtr qm::MacroFunctionSubject::value(MacroContext* pContext) const
 		bRemoveRe = pValue->boolean();
 	}
 	
-	UnstructuredParser subject;
-	Part::Field field = pMessage->getField(L"Subject", &subject);
 	wstring_ptr wstrSubject;
 	const WCHAR* pwszSubject = 0;
-	if (field == Part::FIELD_EXIST) {
-		pwszSubject = subject.getValue();
+	if (wstrValue.get()) {
+		pwszSubject = wstrValue.get();
 		if (bRemoveRe || bRemoveMl) {
 			const WCHAR* pwszSep = L"^[: ";
 			for (int n = 0; n < 2; ++n) {
@@ -5491,9 +5553,9 @@ const WCHAR* qm::MacroFunctionSubject::getName() const
 	return L"Subject";
 }
 
-MacroContext::MessageType qm::MacroFunctionSubject::getFunctionMessageTypeHint() const
+void qm::MacroFunctionSubject::getFunctionFieldPlan(MacroFieldPlan* pPlan) const
 {
-	return MacroContext::MESSAGETYPE_HEADER;
+	pPlan->addIndex(NAME_SUBJECT);
 }
 
 
@@ -10,7 +10,9 @@
 #include <qmmacro.h>
 #include <qmmessage.h>
 
+#include <qsinit.h>
 #include <qsstl.h>
+#include <qsthread.h>
 
 #include <algorithm>
 
@@ -28,7 +30,8 @@ using namespace qs;
 
 qm::MacroValue::MacroValue(Type type) :
 	type_(type),
-	nRef_(0)
+	nRef_(0),
+	pPool_(0)
 {
 }
 
@@ -54,6 +57,17 @@ void qm::MacroValue::release()
 		MacroValueFactory::getFactory().deleteValue(this);
 }
 
+MacroValuePool* qm::MacroValue::getPool() const
+{
+	return pPool_;
+}
+
+void qm::MacroValue::setPool(MacroValuePool* pPool)
+{
+	assert(!pPool_);
+	pPool_ = pPool;
+}
+
 void qm::MacroValue::initRef()
 {
 	assert(nRef_ == 0);
@@ -180,19 +194,20 @@ unsigned int qm::MacroValueBoolean::number() const
  */
 
 qm::MacroValueString::MacroValueString() :
-	MacroValue(TYPE_STRING)
+	MacroValue(TYPE_STRING),
+	bInline_(false)
 {
 }
 
 qm::MacroValueString::~MacroValueString()
 {
-	assert(!wstr_.get() && !wxstr_.get());
+	assert(!wstr_.get() && !wxstr_.get() && !bInline_);
 }
 
 void qm::MacroValueString::init(wstring_ptr wstr)
 {
 	assert(wstr.get());
-	assert(!wstr_.get() && !wxstr_.get());
+	assert(!wstr_.get() && !wxstr_.get() && !bInline_);
 	
 	initRef();
 	wstr_ = wstr;
@@ -201,18 +216,32 @@ void qm::MacroValueString::init(wstring_ptr wstr)
 void qm::MacroValueString::init(wxstring_ptr wxstr)
 {
 	assert(wxstr.get());
-	assert(!wstr_.get() && !wxstr_.get());
+	assert(!wstr_.get() && !wxstr_.get() && !bInline_);
 	
 	initRef();
 	wxstr_ = wxstr;
 }
 
+void qm::MacroValueString::init(const WCHAR* pwsz,
+								size_t nLen)
+{
+	assert(pwsz);
+	assert(nLen < INLINE_SIZE);
+	assert(!wstr_.get() && !wxstr_.get() && !bInline_);
+	
+	initRef();
+	wcsncpy(wszInline_, pwsz, nLen);
+	wszInline_[nLen] = L'\0';
+	bInline_ = true;
+}
+
 void qm::MacroValueString::term()
 {
-	assert(wstr_.get() || wxstr_.get());
+	assert(wstr_.get() || wxstr_.get() || bInline_);
 	
 	wstr_.reset(0);
 	wxstr_.reset(0);
+	bInline_ = false;
 }
 
 MacroValue::String qm::MacroValueString::string() const
@@ -239,9 +268,11 @@ unsigned int qm::MacroValueString::number() const
 
 const WCHAR* qm::MacroValueString::get() const
 {
-	assert(wstr_.get() || wxstr_.get());
+	assert(wstr_.get() || wxstr_.get() || bInline_);
 	
-	if (wstr_.get())
+	if (bInline_)
+		return wszInline_;
+	else if (wstr_.get())
 		return wstr_.get();
 	else
 		return wxstr_.get();
@@ -825,11 +856,16 @@ void qm::MacroValuePtr::reset(MacroValue* pValue)
 
 /****************************************************************************
  *
- * MacroValueFactoryImpl
+ * MacroValuePool
+ *
+ * Free values owned by a thread. Only the owner thread touches the free
+ * lists, so that allocating and releasing values doesn't need any lock.
+ * Other threads put values back to the queue of the owner, which is moved
+ * to the free lists when they become empty.
  *
  */
 
-struct qm::MacroValueFactoryImpl
+struct qm::MacroValuePool
 {
 public:
 	typedef std::vector<MacroValueBoolean*> BooleanList;
@@ -841,6 +877,17 @@ public:
 	typedef std::vector<MacroValueTime*> TimeList;
 	typedef std::vector<MacroValuePart*> PartList;
 	typedef std::vector<MacroValueMessageList*> MessageListList;
+	typedef std::vector<MacroValue*> ValueList;
+
+public:
+	MacroValuePool();
+	~MacroValuePool();
+
+public:
+	void push(MacroValue* pmv);
+	void pushRemote(MacroValue* pmv);
+	void drain();
+	void reserve();
 
 public:
 	BooleanList listBoolean_;
@@ -861,9 +908,245 @@ public:
 	unsigned int nPart_;
 	MessageListList listMessageList_;
 	unsigned int nMessageList_;
+	ValueList listRemote_;
+	unsigned int nValue_;
+	volatile LONG nRemote_;
 	SpinLock lock_;
+	
+	unsigned int nAllocation_;
+	unsigned int nStringAllocation_;
+	unsigned int nRemoteRelease_;
+	unsigned int nDrain_;
 };
 
+qm::MacroValuePool::MacroValuePool() :
+	nBoolean_(0),
+	nString_(0),
+	nNumber_(0),
+	nRegex_(0),
+	nField_(0),
+	nAddress_(0),
+	nTime_(0),
+	nPart_(0),
+	nMessageList_(0),
+	nValue_(0),
+	nRemote_(0),
+	nAllocation_(0),
+	nStringAllocation_(0),
+	nRemoteRelease_(0),
+	nDrain_(0)
+{
+}
+
+qm::MacroValuePool::~MacroValuePool()
+{
+	drain();
+	
+	std::for_each(listBoolean_.begin(), listBoolean_.end(),
+		boost::checked_deleter<MacroValueBoolean>());
+	std::for_each(listString_.begin(), listString_.end(),
+		boost::checked_deleter<MacroValueString>());
+	std::for_each(listNumber_.begin(), listNumber_.end(),
+		boost::checked_deleter<MacroValueNumber>());
+	std::for_each(listRegex_.begin(), listRegex_.end(),
+		boost::checked_deleter<MacroValueRegex>());
+	std::for_each(listField_.begin(), listField_.end(),
+		boost::checked_deleter<MacroValueField>());
+	std::for_each(listAddress_.begin(), listAddress_.end(),
+		boost::checked_deleter<MacroValueAddress>());
+	std::for_each(listTime_.begin(), listTime_.end(),
+		boost::checked_deleter<MacroValueTime>());
+	std::for_each(listPart_.begin(), listPart_.end(),
+		boost::checked_deleter<MacroValuePart>());
+	std::for_each(listMessageList_.begin(), listMessageList_.end(),
+		boost::checked_deleter<MacroValueMessageList>());
+}
+
+void qm::MacroValuePool::push(MacroValue* pmv)
+{
+	// Capacities of the lists have been reserved when the values were
+	// allocated, so that these never throw
+	switch (pmv->getType()) {
+	case MacroValue::TYPE_BOOLEAN:
+		listBoolean_.push_back(static_cast<MacroValueBoolean*>(pmv));
+		break;
+	case MacroValue::TYPE_STRING:
+		listString_.push_back(static_cast<MacroValueString*>(pmv));
+		break;
+	case MacroValue::TYPE_NUMBER:
+		listNumber_.push_back(static_cast<MacroValueNumber*>(pmv));
+		break;
+	case MacroValue::TYPE_REGEX:
+		listRegex_.push_back(static_cast<MacroValueRegex*>(pmv));
+		break;
+	case MacroValue::TYPE_FIELD:
+		listField_.push_back(static_cast<MacroValueField*>(pmv));
+		break;
+	case MacroValue::TYPE_ADDRESS:
+		listAddress_.push_back(static_cast<MacroValueAddress*>(pmv));
+		break;
+	case MacroValue::TYPE_TIME:
+		listTime_.push_back(static_cast<MacroValueTime*>(pmv));
+		break;
+	case MacroValue::TYPE_PART:
+		listPart_.push_back(static_cast<MacroValuePart*>(pmv));
+		break;
+	case MacroValue::TYPE_MESSAGELIST:
+		listMessageList_.push_back(static_cast<MacroValueMessageList*>(pmv));
+		break;
+	default:
+		assert(false);
+		break;
+	}
+}
+
+void qm::MacroValuePool::pushRemote(MacroValue* pmv)
+{
+	Lock<SpinLock> lock(lock_);
+	
+	assert(listRemote_.capacity() >= listRemote_.size() + 1);
+	listRemote_.push_back(pmv);
+	nRemote_ = static_cast<LONG>(listRemote_.size());
+	++nRemoteRelease_;
+}
+
+void qm::MacroValuePool::drain()
+{
+	if (nRemote_ == 0)
+		return;
+	
+	Lock<SpinLock> lock(lock_);
+	
+	for (ValueList::const_iterator it = listRemote_.begin(); it != listRemote_.end(); ++it)
+		push(*it);
+	listRemote_.clear();
+	nRemote_ = 0;
+	++nDrain_;
+}
+
+void qm::MacroValuePool::reserve()
+{
+	Lock<SpinLock> lock(lock_);
+	
+	listRemote_.reserve(++nValue_);
+	++nAllocation_;
+}
+
+
+/****************************************************************************
+ *
+ * MacroValueFactoryImpl
+ *
+ */
+
+struct qm::MacroValueFactoryImpl
+{
+public:
+	typedef std::vector<MacroValuePool*> PoolList;
+
+public:
+	MacroValuePool* getPool();
+	void releasePool();
+	void release(MacroValue* pmv);
+
+public:
+	ThreadLocal<MacroValuePool*> pool_;
+	PoolList listPool_;
+	PoolList listFreePool_;
+	CriticalSection cs_;
+
+public:
+	static class InitializerImpl : public Initializer
+	{
+	public:
+		InitializerImpl();
+		virtual ~InitializerImpl();
+	
+	public:
+		virtual bool init();
+		virtual void term();
+		virtual void termThread();
+	} init__;
+};
+
+MacroValueFactoryImpl::InitializerImpl qm::MacroValueFactoryImpl::init__;
+
+MacroValuePool* qm::MacroValueFactoryImpl::getPool()
+{
+	MacroValuePool* pPool = pool_.get();
+	if (pPool)
+		return pPool;
+	
+	{
+		Lock<CriticalSection> lock(cs_);
+		
+		// Reuse a pool of a thread which has exited, because values in it
+		// may be still used by other threads
+		if (!listFreePool_.empty()) {
+			pPool = listFreePool_.back();
+			listFreePool_.pop_back();
+		}
+		else {
+			std::auto_ptr<MacroValuePool> p(new MacroValuePool());
+			listPool_.push_back(p.get());
+			listFreePool_.reserve(listPool_.size());
+			pPool = p.release();
+		}
+	}
+	pool_.set(pPool);
+	
+	return pPool;
+}
+
+void qm::MacroValueFactoryImpl::releasePool()
+{
+	MacroValuePool* pPool = pool_.get();
+	if (!pPool)
+		return;
+	
+	Lock<CriticalSection> lock(cs_);
+	listFreePool_.push_back(pPool);
+	pool_.set(0);
+}
+
+void qm::MacroValueFactoryImpl::release(MacroValue* pmv)
+{
+	MacroValuePool* pPool = pmv->getPool();
+	if (pPool == pool_.get())
+		pPool->push(pmv);
+	else
+		pPool->pushRemote(pmv);
+}
+
+
+/****************************************************************************
+ *
+ * MacroValueFactoryImpl::InitializerImpl
+ *
+ */
+
+qm::MacroValueFactoryImpl::InitializerImpl::InitializerImpl()
+{
+}
+
+qm::MacroValueFactoryImpl::InitializerImpl::~InitializerImpl()
+{
+}
+
+bool qm::MacroValueFactoryImpl::InitializerImpl::init()
+{
+	return true;
+}
+
+void qm::MacroValueFactoryImpl::InitializerImpl::term()
+{
+}
+
+void qm::MacroValueFactoryImpl::InitializerImpl::termThread()
+{
+	MacroValueFactory::getFactory().pImpl_->releasePool();
+}
+
 
 /****************************************************************************
  *
@@ -872,16 +1155,21 @@ public:
  */
 
 template<class Value>
-MacroValuePtr newValue(SpinLock& l,
+MacroValuePtr newValue(MacroValuePool* pPool,
 					   std::vector<Value*>& v,
 					   unsigned int& n)
 {
-	Lock<SpinLock> lock(l);
-
+	if (v.empty())
+		pPool->drain();
+	
 	MacroValuePtr pValue;
 	if (v.empty()) {
-		pValue.reset(new Value());
-		v.reserve(++n);
+		std::auto_ptr<Value> p(new Value());
+		p->setPool(pPool);
+		v.reserve(n + 1);
+		pPool->reserve();
+		++n;
+		pValue.reset(p.release());
 	}
 	else {
 		pValue.reset(v.back());
@@ -891,17 +1179,13 @@ MacroValuePtr newValue(SpinLock& l,
 }
 
 template<class Value>
-void deleteValue(SpinLock& l,
-				 std::vector<Value*>& v,
+void deleteValue(MacroValueFactoryImpl* pImpl,
 				 Value* pValue)
 {
 	assert(pValue);
 	
-	Lock<SpinLock> lock(l);
-	
 	pValue->term();
-	assert(v.capacity() >= v.size() + 1);
-	v.push_back(pValue);
+	pImpl->release(pValue);
 }
 
 MacroValueFactory qm::MacroValueFactory::factory__;
@@ -910,53 +1194,29 @@ qm::MacroValueFactory::MacroValueFactory() :
 	pImpl_(0)
 {
 	pImpl_ = new MacroValueFactoryImpl();
-	pImpl_->nBoolean_ = 0;
-	pImpl_->nString_ = 0;
-	pImpl_->nNumber_ = 0;
-	pImpl_->nRegex_ = 0;
-	pImpl_->nField_ = 0;
-	pImpl_->nAddress_ = 0;
-	pImpl_->nTime_ = 0;
-	pImpl_->nPart_ = 0;
-	pImpl_->nMessageList_ = 0;
 }
 
 qm::MacroValueFactory::~MacroValueFactory()
 {
 	if (pImpl_) {
-		std::for_each(pImpl_->listBoolean_.begin(), pImpl_->listBoolean_.end(),
-			boost::checked_deleter<MacroValueBoolean>());
-		std::for_each(pImpl_->listString_.begin(), pImpl_->listString_.end(),
-			boost::checked_deleter<MacroValueString>());
-		std::for_each(pImpl_->listNumber_.begin(), pImpl_->listNumber_.end(),
-			boost::checked_deleter<MacroValueNumber>());
-		std::for_each(pImpl_->listRegex_.begin(), pImpl_->listRegex_.end(),
-			boost::checked_deleter<MacroValueRegex>());
-		std::for_each(pImpl_->listField_.begin(), pImpl_->listField_.end(),
-			boost::checked_deleter<MacroValueField>());
-		std::for_each(pImpl_->listAddress_.begin(), pImpl_->listAddress_.end(),
-			boost::checked_deleter<MacroValueAddress>());
-		std::for_each(pImpl_->listTime_.begin(), pImpl_->listTime_.end(),
-			boost::checked_deleter<MacroValueTime>());
-		std::for_each(pImpl_->listPart_.begin(), pImpl_->listPart_.end(),
-			boost::checked_deleter<MacroValuePart>());
-		std::for_each(pImpl_->listMessageList_.begin(), pImpl_->listMessageList_.end(),
-			boost::checked_deleter<MacroValueMessageList>());
+		std::for_each(pImpl_->listPool_.begin(), pImpl_->listPool_.end(),
+			boost::checked_deleter<MacroValuePool>());
 		delete pImpl_;
 	}
 }
 
 MacroValuePtr qm::MacroValueFactory::newBoolean(bool b)
 {
+	MacroValuePool* pPool = pImpl_->getPool();
 	MacroValuePtr pValue(newValue<MacroValueBoolean>(
-		pImpl_->lock_, pImpl_->listBoolean_, pImpl_->nBoolean_));
+		pPool, pPool->listBoolean_, pPool->nBoolean_));
 	static_cast<MacroValueBoolean*>(pValue.get())->init(b);
 	return pValue;
 }
 
 void qm::MacroValueFactory::deleteBoolean(MacroValueBoolean* pmvb)
 {
-	::deleteValue<MacroValueBoolean>(pImpl_->lock_, pImpl_->listBoolean_, pmvb);
+	::deleteValue<MacroValueBoolean>(pImpl_, pmvb);
 }
 
 MacroValuePtr qm::MacroValueFactory::newString(const WCHAR* pwsz)
@@ -967,123 +1227,143 @@ MacroValuePtr qm::MacroValueFactory::newString(const WCHAR* pwsz)
 MacroValuePtr qm::MacroValueFactory::newString(const WCHAR* pwsz,
 											   size_t nLen)
 {
-	wstring_ptr wstr(allocWString(pwsz, nLen));
-	return newString(wstr);
+	if (nLen == -1)
+		nLen = wcslen(pwsz);
+	if (nLen >= MacroValueString::INLINE_SIZE) {
+		wstring_ptr wstr(allocWString(pwsz, nLen));
+		return newString(wstr);
+	}
+	
+	MacroValuePool* pPool = pImpl_->getPool();
+	MacroValuePtr pValue(newValue<MacroValueString>(
+		pPool, pPool->listString_, pPool->nString_));
+	static_cast<MacroValueString*>(pValue.get())->init(pwsz, nLen);
+	return pValue;
 }
 
 MacroValuePtr qm::MacroValueFactory::newString(qs::wstring_ptr wstr)
 {
+	MacroValuePool* pPool = pImpl_->getPool();
 	MacroValuePtr pValue(newValue<MacroValueString>(
-		pImpl_->lock_, pImpl_->listString_, pImpl_->nString_));
+		pPool, pPool->listString_, pPool->nString_));
 	static_cast<MacroValueString*>(pValue.get())->init(wstr);
+	++pPool->nStringAllocation_;
 	return pValue;
 }
 
 MacroValuePtr qm::MacroValueFactory::newString(qs::wxstring_ptr wstr)
 {
+	MacroValuePool* pPool = pImpl_->getPool();
 	MacroValuePtr pValue(newValue<MacroValueString>(
-		pImpl_->lock_, pImpl_->listString_, pImpl_->nString_));
+		pPool, pPool->listString_, pPool->nString_));
 	static_cast<MacroValueString*>(pValue.get())->init(wstr);
+	++pPool->nStringAllocation_;
 	return pValue;
 }
 
 void qm::MacroValueFactory::deleteString(MacroValueString* pmvs)
 {
-	::deleteValue<MacroValueString>(pImpl_->lock_, pImpl_->listString_, pmvs);
+	::deleteValue<MacroValueString>(pImpl_, pmvs);
 }
 
 MacroValuePtr qm::MacroValueFactory::newNumber(unsigned int n)
 {
+	MacroValuePool* pPool = pImpl_->getPool();
 	MacroValuePtr pValue(newValue<MacroValueNumber>(
-		pImpl_->lock_, pImpl_->listNumber_, pImpl_->nNumber_));
+		pPool, pPool->listNumber_, pPool->nNumber_));
 	static_cast<MacroValueNumber*>(pValue.get())->init(n);
 	return pValue;
 }
 
 void qm::MacroValueFactory::deleteNumber(MacroValueNumber* pmvn)
 {
-	::deleteValue<MacroValueNumber>(pImpl_->lock_, pImpl_->listNumber_, pmvn);
+	::deleteValue<MacroValueNumber>(pImpl_, pmvn);
 }
 
 MacroValuePtr qm::MacroValueFactory::newRegex(const WCHAR* pwszPattern,
 											  const RegexPattern* pPattern)
 {
+	MacroValuePool* pPool = pImpl_->getPool();
 	MacroValuePtr pValue(newValue<MacroValueRegex>(
-		pImpl_->lock_, pImpl_->listRegex_, pImpl_->nRegex_));
+		pPool, pPool->listRegex_, pPool->nRegex_));
 	static_cast<MacroValueRegex*>(pValue.get())->init(pwszPattern, pPattern);
 	return pValue;
 }
 
 void qm::MacroValueFactory::deleteRegex(MacroValueRegex* pmvr)
 {
-	::deleteValue<MacroValueRegex>(pImpl_->lock_, pImpl_->listRegex_, pmvr);
+	::deleteValue<MacroValueRegex>(pImpl_, pmvr);
 }
 
 MacroValuePtr qm::MacroValueFactory::newField(const WCHAR* pwszName,
 											  const CHAR* pszField)
 {
+	MacroValuePool* pPool = pImpl_->getPool();
 	MacroValuePtr pValue(newValue<MacroValueField>(
-		pImpl_->lock_, pImpl_->listField_, pImpl_->nField_));
+		pPool, pPool->listField_, pPool->nField_));
 	static_cast<MacroValueField*>(pValue.get())->init(pwszName, pszField);
 	return pValue;
 }
 
 void qm::MacroValueFactory::deleteField(MacroValueField* pmvf)
 {
-	::deleteValue<MacroValueField>(pImpl_->lock_, pImpl_->listField_, pmvf);
+	::deleteValue<MacroValueField>(pImpl_, pmvf);
 }
 
 MacroValuePtr qm::MacroValueFactory::newAddress(MacroValueAddress::AddressList& l)
 {
+	MacroValuePool* pPool = pImpl_->getPool();
 	MacroValuePtr pValue(newValue<MacroValueAddress>(
-		pImpl_->lock_, pImpl_->listAddress_, pImpl_->nAddress_));
+		pPool, pPool->listAddress_, pPool->nAddress_));
 	static_cast<MacroValueAddress*>(pValue.get())->init(l);
 	return pValue;
 }
 
 void qm::MacroValueFactory::deleteAddress(MacroValueAddress* pmva)
 {
-	::deleteValue<MacroValueAddress>(pImpl_->lock_, pImpl_->listAddress_, pmva);
+	::deleteValue<MacroValueAddress>(pImpl_, pmva);
 }
 
 MacroValuePtr qm::MacroValueFactory::newTime(const Time& time)
 {
+	MacroValuePool* pPool = pImpl_->getPool();
 	MacroValuePtr pValue(newValue<MacroValueTime>(
-		pImpl_->lock_, pImpl_->listTime_, pImpl_->nTime_));
+		pPool, pPool->listTime_, pPool->nTime_));
 	static_cast<MacroValueTime*>(pValue.get())->init(time);
 	return pValue;
 }
 
 void qm::MacroValueFactory::deleteTime(MacroValueTime* pmvt)
 {
-	::deleteValue<MacroValueTime>(pImpl_->lock_, pImpl_->listTime_, pmvt);
+	::deleteValue<MacroValueTime>(pImpl_, pmvt);
 }
 
 MacroValuePtr qm::MacroValueFactory::newPart(const Part* pPart)
 {
+	MacroValuePool* pPool = pImpl_->getPool();
 	MacroValuePtr pValue(newValue<MacroValuePart>(
-		pImpl_->lock_, pImpl_->listPart_, pImpl_->nPart_));
+		pPool, pPool->listPart_, pPool->nPart_));
 	static_cast<MacroValuePart*>(pValue.get())->init(pPart);
 	return pValue;
 }
 
 void qm::MacroValueFactory::deletePart(MacroValuePart* pmvp)
 {
-	::deleteValue<MacroValuePart>(pImpl_->lock_, pImpl_->listPart_, pmvp);
+	::deleteValue<MacroValuePart>(pImpl_, pmvp);
 }
 
 MacroValuePtr qm::MacroValueFactory::newMessageList(MacroValueMessageList::MessageList& l)
 {
+	MacroValuePool* pPool = pImpl_->getPool();
 	MacroValuePtr pValue(newValue<MacroValueMessageList>(
-		pImpl_->lock_, pImpl_->listMessageList_, pImpl_->nMessageList_));
+		pPool, pPool->listMessageList_, pPool->nMessageList_));
 	static_cast<MacroValueMessageList*>(pValue.get())->init(l);
 	return pValue;
 }
 
 void qm::MacroValueFactory::deleteMessageList(MacroValueMessageList* pmvml)
 {
-	::deleteValue<MacroValueMessageList>(
-		pImpl_->lock_, pImpl_->listMessageList_, pmvml);
+	::deleteValue<MacroValueMessageList>(pImpl_, pmvml);
 }
 
 void qm::MacroValueFactory::deleteValue(MacroValue* pmv)
@@ -1119,6 +1399,24 @@ void qm::MacroValueFactory::deleteValue(MacroValue* pmv)
 	}
 }
 
+void qm::MacroValueFactory::getStats(Stats* pStats) const
+{
+	assert(pStats);
+	
+	Stats stats = { 0, 0, 0, 0 };
+	
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	for (MacroValueFactoryImpl::PoolList::const_iterator it = pImpl_->listPool_.begin(); it != pImpl_->listPool_.end(); ++it) {
+		MacroValuePool* pPool = *it;
+		Lock<SpinLock> lockPool(pPool->lock_);
+		stats.nAllocation_ += pPool->nAllocation_;
+		stats.nStringAllocation_ += pPool->nStringAllocation_;
+		stats.nRemoteRelease_ += pPool->nRemoteRelease_;
+		stats.nDrain_ += pPool->nDrain_;
+	}
+	*pStats = stats;
+}
+
 MacroValueFactory& qm::MacroValueFactory::getFactory()
 {
 	return factory__;
@@ -63,6 +63,12 @@ void qm::ActiveSyncInvoker::messageCopied(NormalFolder* pFolderFrom,
 		sync(pFolderTo);
 }
 
+void qm::ActiveSyncInvoker::remoteFolderChanged(NormalFolder* pFolder)
+{
+	if (isSync(pFolder, Account::OPFLAG_ACTIVE))
+		sync(pFolder);
+}
+
 void qm::ActiveSyncInvoker::accountListChanged(const AccountManagerEvent& event)
 {
 	switch (event.getType()) {
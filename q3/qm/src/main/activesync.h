@@ -44,6 +44,7 @@ public:
 	virtual void messageCopied(NormalFolder* pFolderFrom,
 							   NormalFolder* pFolderTo,
 							   unsigned int nCopyFlags);
+	virtual void remoteFolderChanged(NormalFolder* pFolder);
 
 public:
 	virtual void accountListChanged(const AccountManagerEvent& event);
@@ -50,6 +50,7 @@
 #endif
 #include "../model/dataobject.h"
 #include "../model/tempfilecleaner.h"
+#include "../search/fulltextsearch.h"
 #include "../sync/autopilot.h"
 #include "../sync/syncmanager.h"
 #include "../sync/syncqueue.h"
@@ -165,6 +166,9 @@ public:
 	std::auto_ptr<FolderImage> pFolderImage_;
 	std::auto_ptr<ActiveRuleInvoker> pActiveRuleInvoker_;
 	std::auto_ptr<ActiveSyncInvoker> pActiveSyncInvoker_;
+#ifndef _WIN32_WCE
+	std::auto_ptr<FullTextIndexer> pFullTextIndexer_;
+#endif
 	std::auto_ptr<UIManager> pUIManager_;
 	MainWindow* pMainWindow_;
 	HINSTANCE hInstAtl_;
@@ -941,6 +945,10 @@ bool qm::Application::initialize(int nLogLevel,
 		pImpl_->pMainWindow_->getHandle(), pImpl_->pProfile_.get()));
 	pImpl_->pActiveSyncInvoker_.reset(new ActiveSyncInvoker(
 		pImpl_->pDocument_.get(), pImpl_->pSyncQueue_.get()));
+#ifndef _WIN32_WCE
+	pImpl_->pFullTextIndexer_.reset(new FullTextIndexer(
+		pImpl_->pDocument_.get(), pImpl_->pProfile_.get()));
+#endif
 	
 	if (!bQuiet) {
 		pImpl_->pMainWindow_->updateWindow();
@@ -976,6 +984,9 @@ void qm::Application::uninitialize()
 	
 	pImpl_->pFolderImage_.reset(0);
 	pImpl_->pUIManager_.reset(0);
+#ifndef _WIN32_WCE
+	pImpl_->pFullTextIndexer_.reset(0);
+#endif
 	pImpl_->pActiveSyncInvoker_.reset(0);
 	pImpl_->pActiveRuleInvoker_.reset(0);
 	pImpl_->pTempFileCleaner_.reset(0);
@@ -158,8 +158,8 @@ const qs::Profile::Default defaultProfiles[] = {
 	{ L"FolderWindow",	L"ExpandedFolders",			L""			},
 	
 #ifndef _WIN32_WCE
-	{ L"FullTextSearch",	L"Command",			L"namazu -l -a \"$condition\" \"$index\""	},
-	{ L"FullTextSearch",	L"IndexCommand",	L"mknmz.bat -a -h -O \"$index\" \"$msg\""	},
+	{ L"FullTextSearch",	L"Command",			L""	},
+	{ L"FullTextSearch",	L"IndexCommand",	L""	},
 #endif
 	
 	{ L"Global",	L"Action",							L""													},
@@ -211,6 +211,7 @@ const qs::Profile::Default defaultProfiles[] = {
 	{ L"Global",	L"PrintExtension",					L"html"												},
 	{ L"Global",	L"Quote",							L"> "												},
 	{ L"Global",	L"RFC2231",							L"0"												},
+	{ L"Global",	L"RuleThreadCount",					L"0"												},
 	{ L"Global",	L"SaveMessageViewModePerFolder",	L"1"												},
 	{ L"Global",	L"SaveOnDeactivate",				L"1"												},
 	{ L"Global",	L"ShowUnseenCountOnWelcome",		L"0"												},
@@ -287,6 +288,7 @@ const qs::Profile::Default defaultProfiles[] = {
 	{ L"ListWindow",	L"SingleClickOpen",					L"0"				},
 #endif
 	{ L"ListWindow",	L"TimeFormat",						L"%Y2/%M0/%D %h:%m"	},
+	{ L"ListWindow",	L"ThreadCount",						L"0"				},
 	
 #ifndef _WIN32_WCE
 	{ L"MacroDialog",	L"Height",	L"300"	},
@@ -305,6 +307,7 @@ const qs::Profile::Default defaultProfiles[] = {
 	{ L"MacroSearch",	L"SearchHeader",	L"0"		},
 	{ L"MacroSearch",	L"SearchBody",		L"0"		},
 	{ L"MacroSearch",	L"SearchMacro",		SEARCHMACRO	},
+	{ L"MacroSearch",	L"ThreadCount",		L"0"		},
 	
 #ifndef _WIN32_WCE
 	{ L"MainWindow",	L"Height",	L"0"	},
@@ -563,8 +566,13 @@ const qs::Profile::Default defaultAccountProfiles[] = {
 	{ L"Global",	L"AutoApplyRules",				L"0"						},
 	{ L"Global",	L"BlockSize",					L"0"						},
 	{ L"Global",	L"Class",						L""							},
+	{ L"Global",	L"CompactBatch",				L"64"						},
+	{ L"Global",	L"CompactTarget",				L"10"						},
+	{ L"Global",	L"CompressMessage",				L"0"						},
+	{ L"Global",	L"DeduplicatePart",				L"0"						},
 	{ L"Global",	L"Identity",					L""							},
 	{ L"Global",	L"IndexBlockSize",				L"-1"						},
+	{ L"Global",	L"IndexMaxMemory",				L"-1"						},
 	{ L"Global",	L"IndexMaxSize",				L"-1"						},
 	{ L"Global",	L"LogTimeFormat",				L"%Y4/%M0/%D-%h:%m:%s%z"	},
 	{ L"Global",	L"MessageStorePath",			L""							},
@@ -575,6 +583,7 @@ const qs::Profile::Default defaultAccountProfiles[] = {
 	{ L"Global",	L"SslOption",					L"0"						},
 	{ L"Global",	L"StoreDecodedMessage",			L"0"						},
 	{ L"Global",	L"SubAccount",					L""							},
+	{ L"Global",	L"SyncSession",					L"1"						},
 	{ L"Global",	L"Timeout",						L"60"						},
 	{ L"Global",	L"TransferEncodingFor8Bit",		L""							},
 	{ L"Global",	L"TreatAsSent",					L"1"						},
@@ -589,13 +598,18 @@ const qs::Profile::Default defaultAccountProfiles[] = {
 	{ L"Imap4",	L"AdditionalFields", 	L""			},
 	{ L"Imap4",	L"AuthMethods",			L""			},
 	{ L"Imap4",	L"CloseFolder",			L"0"		},
+	{ L"Imap4",	L"Compress",			L"1"		},
 	{ L"Imap4",	L"DraftboxFolder",		L"Outbox"	},
 	{ L"Imap4",	L"FetchCount",			L"100"		},
 	{ L"Imap4",	L"ForceDisconnect",		L"0"		},
+	{ L"Imap4",	L"Idle",				L"1"		},
+	{ L"Imap4",	L"IdleMaxSession",		L"1"		},
+	{ L"Imap4",	L"IdleTimeout",			L"1740"		},
 	{ L"Imap4",	L"JunkFolder",			L"Junk"		},
 	{ L"Imap4",	L"MaxSession",			L"5"		},
 	{ L"Imap4",	L"Option",				L"255"		},
 	{ L"Imap4",	L"OutboxFolder",		L"Outbox"	},
+	{ L"Imap4",	L"Pipeline",			L"16"		},
 	{ L"Imap4",	L"Reselect",			L"1"		},
 	{ L"Imap4",	L"RootFolder",			L""			},
 	{ L"Imap4",	L"RootFolderSeparator",	L"/"		},
@@ -21,18 +21,22 @@ const WCHAR* qm::FileNames::AUTOPILOT_XML	= L"autopilot.xml";
 const WCHAR* qm::FileNames::BOX_EXT			= L".box";
 const WCHAR* qm::FileNames::CA_PEM			= L"ca.pem";
 const WCHAR* qm::FileNames::CERT			= L"cert";
+const WCHAR* qm::FileNames::CHANGES			= L"changes";
 const WCHAR* qm::FileNames::CHECK			= L"check";
+const WCHAR* qm::FileNames::CHECKPOINT_EXT	= L".cpt";
 const WCHAR* qm::FileNames::COLORS_XML		= L"colors.xml";
 const WCHAR* qm::FileNames::COMPACT			= L"compact";
 const WCHAR* qm::FileNames::FILTERS_XML		= L"filters.xml";
 const WCHAR* qm::FileNames::FOLDER_BMP		= L"folder.bmp";
 const WCHAR* qm::FileNames::FOLDERS_XML		= L"folders.xml";
 const WCHAR* qm::FileNames::FONTS_XML		= L"fonts.xml";
+const WCHAR* qm::FileNames::FULLTEXT			= L"fulltext";
 const WCHAR* qm::FileNames::GOROUND_XML		= L"goround.xml";
 const WCHAR* qm::FileNames::HEADER_XML		= L"header.xml";
 const WCHAR* qm::FileNames::HEADEREDIT_XML	= L"headeredit.xml";
 const WCHAR* qm::FileNames::INDEX			= L"index";
 const WCHAR* qm::FileNames::INDEX_EXT		= L".idx";
+const WCHAR* qm::FileNames::JOURNAL_EXT		= L".jnl";
 const WCHAR* qm::FileNames::KEY				= L"key";
 const WCHAR* qm::FileNames::KEYMAP_XML		= L"keymap.xml";
 const WCHAR* qm::FileNames::LIST_BMP		= L"list.bmp";
@@ -41,15 +45,19 @@ const WCHAR* qm::FileNames::MAP_EXT			= L".map";
 const WCHAR* qm::FileNames::MENUS_XML		= L"menus.xml";
 const WCHAR* qm::FileNames::MSG				= L"msg";
 const WCHAR* qm::FileNames::NOTIFY_BMP		= L"notify.bmp";
+const WCHAR* qm::FileNames::PART			= L"part";
 const WCHAR* qm::FileNames::PASSWORDS_XML	= L"passwords.xml";
 const WCHAR* qm::FileNames::PEM_EXT			= L".pem";
 const WCHAR* qm::FileNames::QMAIL_XML		= L"qmail.xml";
+const WCHAR* qm::FileNames::REF_EXT			= L".ref";
 const WCHAR* qm::FileNames::RESOURCES_XML	= L"resources.xml";
 const WCHAR* qm::FileNames::RULES_XML		= L"rules.xml";
+const WCHAR* qm::FileNames::SEGMENT_EXT		= L".seg";
 const WCHAR* qm::FileNames::SIGNATURES_XML	= L"signatures.xml";
 const WCHAR* qm::FileNames::SYNCFILTERS_XML	= L"syncfilters.xml";
 const WCHAR* qm::FileNames::TABS_XML		= L"tabs.xml";
 const WCHAR* qm::FileNames::TEXTS_XML		= L"texts.xml";
+const WCHAR* qm::FileNames::THREAD_EXT		= L".thd";
 const WCHAR* qm::FileNames::TOOLBAR_BMP		= L"toolbar.bmp";
 const WCHAR* qm::FileNames::TOOLBARS_XML	= L"toolbars.xml";
 const WCHAR* qm::FileNames::VIEW_XML		= L"view.xml";
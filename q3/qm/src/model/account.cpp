@@ -28,6 +28,7 @@
 #include <qsthread.h>
 
 #include <algorithm>
+#include <functional>
 
 #include <boost/bind.hpp>
 #include <boost/lambda/construct.hpp>
@@ -36,6 +37,8 @@
 #include <boost/lambda/lambda.hpp>
 
 #include "account.h"
+#include "changefeed.h"
+#include "compactor.h"
 #include "messageindex.h"
 #include "messagestore.h"
 #include "modelresource.h"
@@ -157,6 +160,8 @@ public:
 	std::auto_ptr<MessageStore> pMessageStore_;
 	std::auto_ptr<MessageIndex> pMessageIndex_;
 	std::auto_ptr<ProtocolDriver> pProtocolDriver_;
+	std::auto_ptr<AccountCompactor> pCompactor_;
+	std::auto_ptr<MessageChangeFeed> pChangeFeed_;
 	AccountHandlerList listAccountHandler_;
 	MessageHolderHandlerList listMessageHolderHandler_;
 	AccountHook* pHook_;
@@ -1126,21 +1131,30 @@ qm::Account::Account(const WCHAR* pwszPath,
 	else
 		pImpl_->wstrMessageStorePath_ = allocWString(pwszPath);
 	
+	bool bCompress = pProfile->getInt(L"Global", L"CompressMessage") != 0;
+	bool bDeduplicate = pProfile->getInt(L"Global", L"DeduplicatePart") != 0;
+	
 	pImpl_->bMultiMessageStore_ = nBlockSize == 0;
 	if (pImpl_->bMultiMessageStore_)
 		pImpl_->pMessageStore_.reset(new MultiMessageStore(
 			pImpl_->wstrMessageStorePath_.get(),
-			pwszPath, nIndexBlockSize));
+			pwszPath, nIndexBlockSize, bCompress, bDeduplicate));
 	else
 		pImpl_->pMessageStore_.reset(new SingleMessageStore(
 			pImpl_->wstrMessageStorePath_.get(),
-			nBlockSize, pwszPath, nIndexBlockSize));
+			nBlockSize, pwszPath, nIndexBlockSize, bCompress, bDeduplicate));
 	
 	pImpl_->bStoreDecodedMessage_ = pImpl_->bMultiMessageStore_ &&
 		pProfile->getInt(L"Global", L"StoreDecodedMessage") != 0;
 	
 	size_t nIndexMaxSize = pProfile->getInt(L"Global", L"IndexMaxSize");
-	pImpl_->pMessageIndex_.reset(new MessageIndex(pImpl_->pMessageStore_.get(), nIndexMaxSize));
+	size_t nIndexMaxMemory = pProfile->getInt(L"Global", L"IndexMaxMemory");
+	if (nIndexMaxMemory != -1)
+		nIndexMaxMemory *= 1024;
+	pImpl_->pMessageIndex_.reset(new MessageIndex(
+		pImpl_->pMessageStore_.get(), nIndexMaxSize, nIndexMaxMemory));
+	
+	pImpl_->pChangeFeed_.reset(new MessageChangeFeed(pwszPath));
 	
 	pImpl_->wstrClass_ = pProfile->getString(L"Global", L"Class");
 	pImpl_->wstrType_[HOST_SEND] = pProfile->getString(L"Send", L"Type");
@@ -1169,6 +1183,12 @@ qm::Account::Account(const WCHAR* pwszPath,
 qm::Account::~Account()
 {
 	if (pImpl_) {
+		stopCompaction();
+		
+		// Stop the driver first because it may have threads which
+		// access the folders and handle events of this account
+		pImpl_->pProtocolDriver_.reset(0);
+		
 		std::for_each(pImpl_->listSubAccount_.begin(),
 			pImpl_->listSubAccount_.end(), boost::checked_deleter<SubAccount>());
 		std::for_each(pImpl_->listFolder_.begin(),
@@ -1780,50 +1800,107 @@ bool qm::Account::compact(MessageOperationCallback* pCallback)
 {
 	assert(pCallback);
 	
-	Lock<Account> lock(*this);
-	
-	if (!save(false))
+	if (!startCompaction())
 		return false;
 	
-	MessageStore::DataList listData;
-	if (!pImpl_->getDataList(&listData))
-		return false;
+	pCallback->setCount(100);
+	pCallback->show();
 	
-	if (!pImpl_->pMessageStore_->compact(&listData, pCallback))
-		return false;
+	// Wait for the compactor without locking the account, so that
+	// the account can be used while compacting
+	unsigned int nPos = 0;
+	while (isCompacting()) {
+		if (pCallback->isCanceled()) {
+			stopCompaction();
+			return true;
+		}
+		
+		unsigned int nProgress = getCompactionProgress();
+		if (nProgress > nPos) {
+			pCallback->step(nProgress - nPos);
+			nPos = nProgress;
+		}
+		::Sleep(AccountCompactor::WAIT_INTERVAL);
+	}
 	
-	MessageStore::DataList::size_type d = 0;
-	for (FolderList::const_iterator it = pImpl_->listFolder_.begin(); it != pImpl_->listFolder_.end(); ++it) {
-		Folder* pFolder = *it;
-		if (pFolder->getType() == Folder::TYPE_NORMAL) {
-			unsigned int nCount = pFolder->getCount();
-			for (unsigned int n = 0; n < nCount; ++n) {
-				const MessageStore::Data& data = listData[d++];
-				
-				MessageHolder* pmh = pFolder->getMessage(n);
-				
-				MessageHolder::MessageIndexKey indexKey = pmh->getMessageIndexKey();
-				if (indexKey.nKey_ != data.nIndexKey_)
-					pImpl_->pMessageIndex_->remove(indexKey.nKey_);
-				indexKey.nKey_ = data.nIndexKey_;
-				
-				MessageHolder::MessageBoxKey boxKey = pmh->getMessageBoxKey();
-				boxKey.nOffset_ = data.nOffset_;
-				
-				pmh->setKeys(indexKey, boxKey);
-			}
+	return !pImpl_->pCompactor_->isFailed();
+}
+
+bool qm::Account::compactPartially(const MessageHolderList& l)
+{
+	Lock<Account> lock(*this);
+	
+	for (MessageHolderList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		MessageHolder* pmh = *it;
+		
+		MessageHolder::MessageIndexKey indexKey = pmh->getMessageIndexKey();
+		MessageHolder::MessageBoxKey boxKey = pmh->getMessageBoxKey();
+		MessageStore::Data data = {
+			boxKey.nOffset_,
+			boxKey.nLength_,
+			indexKey.nKey_,
+			indexKey.nLength_
+		};
+		bool bMoved = pImpl_->pMessageStore_->move(&data);
+		
+		// The old data has been freed when it has been moved, so the keys
+		// are updated even when moving the other data fails
+		if (data.nIndexKey_ != indexKey.nKey_ || data.nOffset_ != boxKey.nOffset_) {
+			if (data.nIndexKey_ != indexKey.nKey_)
+				pImpl_->pMessageIndex_->remove(indexKey.nKey_);
+			indexKey.nKey_ = data.nIndexKey_;
+			boxKey.nOffset_ = data.nOffset_;
+			pmh->setKeys(indexKey, boxKey);
 		}
+		if (!bMoved)
+			return false;
 	}
 	
-	if (!save(false))
-		return false;
+	return true;
+}
+
+bool qm::Account::startCompaction()
+{
+	if (isCompacting())
+		return true;
+	
+	unsigned int nTarget = pImpl_->pProfile_->getInt(L"Global", L"CompactTarget");
+	unsigned int nBatch = pImpl_->pProfile_->getInt(L"Global", L"CompactBatch");
+	
+	stopCompaction();
 	
-	if (!pImpl_->pMessageStore_->freeUnused())
+	std::auto_ptr<AccountCompactor> pCompactor(new AccountCompactor(this, nTarget, nBatch));
+	if (!pCompactor->start())
 		return false;
+	pImpl_->pCompactor_ = pCompactor;
 	
 	return true;
 }
 
+void qm::Account::stopCompaction()
+{
+	if (pImpl_->pCompactor_.get()) {
+		pImpl_->pCompactor_->stop();
+		pImpl_->pCompactor_.reset(0);
+	}
+}
+
+bool qm::Account::isCompacting() const
+{
+	return pImpl_->pCompactor_.get() && pImpl_->pCompactor_->isRunning();
+}
+
+unsigned int qm::Account::getCompactionProgress() const
+{
+	return pImpl_->pCompactor_.get() ? pImpl_->pCompactor_->getProgress() : 100;
+}
+
+unsigned int qm::Account::getFragmentation() const
+{
+	Lock<Account> lock(*this);
+	return pImpl_->pMessageStore_->getFragmentation();
+}
+
 bool qm::Account::salvage(NormalFolder* pFolder,
 						  MessageOperationCallback* pCallback)
 {
@@ -2022,6 +2099,16 @@ bool qm::Account::save(bool bForce) const
 	
 	if (!saveMessages(bForce))
 		return false;
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::Account");
+	if (log.isDebugEnabled()) {
+		MessageIndex::Stats stats;
+		pImpl_->pMessageIndex_->getStats(&stats);
+		log.debugf(L"Index cache: %s, hit: %u, miss: %u, eviction: %u, count: %u, size: %u",
+			pImpl_->wstrName_.get(), stats.nHit_, stats.nMiss_, stats.nEviction_,
+			static_cast<unsigned int>(stats.nCount_), static_cast<unsigned int>(stats.nSize_));
+	}
+	
 	if (!pImpl_->saveFolders() && !bForce)
 		return false;
 	if (!pImpl_->saveSubAccounts(bForce))
@@ -2048,7 +2135,20 @@ bool qm::Account::saveMessages(bool bForce) const
 bool qm::Account::flushMessageStore() const
 {
 	Lock<Account> lock(*this);
-	return pImpl_->pMessageStore_->flush();
+	return pImpl_->pMessageStore_->flush() &&
+		pImpl_->pChangeFeed_->flush();
+}
+
+bool qm::Account::freeUnusedMessageStore()
+{
+	Lock<Account> lock(*this);
+	
+	MessageStore::DataList listData;
+	if (!pImpl_->getDataList(&listData) ||
+		!pImpl_->pMessageStore_->freeUnrefered(listData))
+		return false;
+	
+	return pImpl_->pMessageStore_->freeUnused();
 }
 
 bool qm::Account::importMessage(NormalFolder* pFolder,
@@ -2383,17 +2483,31 @@ bool qm::Account::isIndexPrepared(const MessageHolder* pmh) const
 
 void qm::Account::prepareIndex(MessageHolderList& l)
 {
-	std::sort(l.begin(), l.end(),
-		boost::bind(&MessageHolder::MessageIndexKey::nKey_,
-			boost::bind(&MessageHolder::getMessageIndexKey, _1)) <
-		boost::bind(&MessageHolder::MessageIndexKey::nKey_,
-			boost::bind(&MessageHolder::getMessageIndexKey, _2)));
-	std::for_each(l.begin(), l.end(),
-		boost::bind(&MessageIndex::prepare, pImpl_->pMessageIndex_.get(),
-			boost::bind(&MessageHolder::MessageIndexKey::nKey_,
-				boost::bind(&MessageHolder::getMessageIndexKey, _1)),
-			boost::bind(&MessageHolder::MessageIndexKey::nLength_,
-				boost::bind(&MessageHolder::getMessageIndexKey, _1))));
+	assert(isLocked());
+	
+	MessageIndexKeyList listKey;
+	listKey.reserve(l.size());
+	for (MessageHolderList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		const MessageHolder::MessageIndexKey& key = (*it)->getMessageIndexKey();
+		listKey.push_back(std::make_pair(key.nKey_, key.nLength_));
+	}
+	prepareIndex(listKey, getIndexGeneration());
+}
+
+void qm::Account::prepareIndex(const MessageIndexKeyList& l,
+							   unsigned int nGeneration)
+{
+	pImpl_->pMessageIndex_->prepare(l, nGeneration);
+}
+
+unsigned int qm::Account::getIndexGeneration() const
+{
+	return pImpl_->pMessageIndex_->getGeneration();
+}
+
+MessageChangeFeed* qm::Account::getChangeFeed() const
+{
+	return pImpl_->pChangeFeed_.get();
 }
 
 void qm::Account::addAccountHandler(AccountHandler* pHandler)
@@ -2436,6 +2550,7 @@ void qm::Account::removeMessageHolderHandler(MessageHolderHandler* pHandler)
 
 void qm::Account::setHook(AccountHook* pHook)
 {
+	Lock<Account> lock(*this);
 	pImpl_->pHook_ = pHook;
 }
 
@@ -2471,7 +2586,11 @@ void qm::Account::deletePermanent(bool bDeleteContent)
 {
 	Log log(InitThread::getInitThread().getLogger(), L"qm::Account");
 	
+	stopCompaction();
+	
 	if (bDeleteContent) {
+		if (!pImpl_->pChangeFeed_->close())
+			log.error(L"Failed to close changes.");
 		pImpl_->pMessageIndex_.reset(0);
 		pImpl_->pMessageStore_.reset(0);
 		pImpl_->pProtocolDriver_.reset(0);
@@ -2637,6 +2756,8 @@ void qm::Account::fireMessageHolderFlagsChanged(MessageHolder* pmh,
 {
 	assert(isLocked());
 	
+	pImpl_->pChangeFeed_->add(MessageChangeFeed::TYPE_FLAGS, pmh);
+	
 	MessageHolderEvent event(pmh, nOldFlags, nNewFlags);
 	std::for_each(pImpl_->listMessageHolderHandler_.begin(), pImpl_->listMessageHolderHandler_.end(),
 		boost::bind(&MessageHolderHandler::messageHolderFlagsChanged, _1, boost::cref(event)));
@@ -2646,6 +2767,8 @@ void qm::Account::fireMessageHolderKeysChanged(MessageHolder* pmh)
 {
 	assert(isLocked());
 	
+	pImpl_->pChangeFeed_->add(MessageChangeFeed::TYPE_UPDATE, pmh);
+	
 	MessageHolderEvent event(pmh);
 	std::for_each(pImpl_->listMessageHolderHandler_.begin(), pImpl_->listMessageHolderHandler_.end(),
 		boost::bind(&MessageHolderHandler::messageHolderKeysChanged, _1, boost::cref(event)));
@@ -2677,7 +2800,6 @@ MessageHolder* qm::Account::storeMessage(NormalFolder* pFolder,
 										 unsigned int* pnResultFlags)
 {
 	assert(pFolder);
-	assert(isLocked());
 	assert(pszMessage);
 	assert((nFlags & ~(MessageHolder::FLAG_USER_MASK |
 		MessageHolder::FLAG_PARTIAL_MASK | MessageHolder::FLAG_LOCAL)) == 0);
@@ -2710,16 +2832,6 @@ MessageHolder* qm::Account::storeMessage(NormalFolder* pFolder,
 			nFlags |= MessageHolder::FLAG_ENVELOPED;
 	}
 	
-	unsigned int nOffset = -1;
-	unsigned int nLength = 0;
-	unsigned int nHeaderLength = 0;
-	unsigned int nIndexKey = -1;
-	unsigned int nIndexLength = 0;
-	if (!pImpl_->pMessageStore_->save(pszMessage, nLen, pHeader, pwszLabel,
-		(nStoreFlags & STOREFLAG_INDEXONLY) != 0, &nOffset,
-		&nLength, &nHeaderLength, &nIndexKey, &nIndexLength))
-		return 0;
-	
 	SubAccount* pSubAccount = getCurrentSubAccount();
 	const WCHAR* pwszFields[] = {
 		L"To",
@@ -2750,6 +2862,20 @@ MessageHolder* qm::Account::storeMessage(NormalFolder* pFolder,
 		pTime = &time;
 	}
 	
+	// Parsing the header above doesn't need the lock, so that messages
+	// stored into different folders in parallel don't wait for each other
+	Lock<Account> lock(*this);
+	
+	unsigned int nOffset = -1;
+	unsigned int nLength = 0;
+	unsigned int nHeaderLength = 0;
+	unsigned int nIndexKey = -1;
+	unsigned int nIndexLength = 0;
+	if (!pImpl_->pMessageStore_->save(pszMessage, nLen, pHeader, pwszLabel,
+		(nStoreFlags & STOREFLAG_INDEXONLY) != 0, &nOffset,
+		&nLength, &nHeaderLength, &nIndexKey, &nIndexLength))
+		return 0;
+	
 	if (nId == -1) {
 		nId = pFolder->generateId();
 		if (nId == -1)
@@ -2911,6 +3037,16 @@ unsigned int qm::Account::generateFolderId() const
 	return nId + 1;
 }
 
+void qm::Account::fireRemoteFolderChanged(NormalFolder* pFolder)
+{
+	assert(pFolder);
+	
+	Lock<Account> lock(*this);
+	
+	if (pImpl_->pHook_)
+		pImpl_->pHook_->remoteFolderChanged(pFolder);
+}
+
 std::auto_ptr<Logger> qm::Account::openLogger(Host host) const
 {
 	Time time(Time::getCurrentTime());
@@ -3208,6 +3344,7 @@ qm::FolderContentHandler::FolderContentHandler(Account* pAccount,
 	nUnseenCount_(0),
 	cSeparator_(L'\0'),
 	nValidity_(0),
+	nHighestModSeq_(0),
 	nDownloadCount_(0),
 	nDeletedCount_(0),
 	bRecursive_(false)
@@ -3241,6 +3378,7 @@ bool qm::FolderContentHandler::startElement(const WCHAR* pwszNamespaceURI,
 		{ L"separator",		STATE_NORMALFOLDER | STATE_QUERYFOLDER,	STATE_SEPARATOR		},
 		{ L"name",			STATE_NORMALFOLDER | STATE_QUERYFOLDER,	STATE_NAME			},
 		{ L"validity",		STATE_NORMALFOLDER,						STATE_VALIDITY		},
+		{ L"highestModSeq",	STATE_NORMALFOLDER,						STATE_HIGHESTMODSEQ	},
 		{ L"downloadCount",	STATE_NORMALFOLDER,						STATE_DOWNLOADCOUNT	},
 		{ L"deletedCount",	STATE_NORMALFOLDER,						STATE_DELETEDCOUNT	},
 		{ L"driver",		STATE_QUERYFOLDER,						STATE_DRIVER		},
@@ -3265,6 +3403,7 @@ bool qm::FolderContentHandler::startElement(const WCHAR* pwszNamespaceURI,
 		
 		bNormal_ = true;
 		nItem_ = 0;
+		nHighestModSeq_ = 0;
 		state_ = STATE_NORMALFOLDER;
 	}
 	else if (wcscmp(pwszLocalName, L"queryFolder") == 0) {
@@ -3326,13 +3465,15 @@ bool qm::FolderContentHandler::endElement(const WCHAR* pwszNamespaceURI,
 	else if (wcscmp(pwszLocalName, L"normalFolder") == 0) {
 		assert(state_ == STATE_NORMALFOLDER);
 		
-		if (nItem_ != 10 && nItem_ != 11)
+		// highestModSeq is optional because it didn't exist in old versions
+		if (nItem_ < 10 || 12 < nItem_)
 			return false;
 		
 		Folder* pParent = nParentId_ != 0 ? getFolder(nParentId_) : 0;
 		std::auto_ptr<NormalFolder> pFolder(new NormalFolder(nId_,
 			wstrName_.get(), cSeparator_, nFlags_, nCount_, nUnseenCount_,
 			nValidity_, nDownloadCount_, nDeletedCount_, pParent, pAccount_));
+		pFolder->setHighestModSeq(nHighestModSeq_);
 		pFolder->setParams(listParam_);
 		pList_->push_back(pFolder.get());
 		pFolder.release();
@@ -3433,6 +3574,21 @@ bool qm::FolderContentHandler::endElement(const WCHAR* pwszNamespaceURI,
 		
 		state_ = STATE_NORMALFOLDER;
 	}
+	else if (wcscmp(pwszLocalName, L"highestModSeq") == 0) {
+		assert(state_ == STATE_HIGHESTMODSEQ);
+		assert(bNormal_);
+		
+		if (buffer_.getLength() == 0)
+			return false;
+		
+		WCHAR* pEnd = 0;
+		nHighestModSeq_ = _wcstoui64(buffer_.getCharArray(), &pEnd, 10);
+		buffer_.remove();
+		if (*pEnd)
+			return false;
+		
+		state_ = STATE_NORMALFOLDER;
+	}
 	else if (wcscmp(pwszLocalName, L"downloadCount") == 0) {
 		assert(state_ == STATE_DOWNLOADCOUNT);
 		assert(bNormal_);
@@ -3525,6 +3681,7 @@ bool qm::FolderContentHandler::characters(const WCHAR* pwsz,
 		state_ == STATE_SEPARATOR ||
 		state_ == STATE_NAME ||
 		state_ == STATE_VALIDITY ||
+		state_ == STATE_HIGHESTMODSEQ ||
 		state_ == STATE_DOWNLOADCOUNT ||
 		state_ == STATE_DELETEDCOUNT ||
 		state_ == STATE_DRIVER ||
@@ -3648,6 +3805,10 @@ bool qm::FolderWriter::write(const Account::FolderList& l)
 				NormalFolder* pNormalFolder = static_cast<NormalFolder*>(pFolder);
 				if (!HandlerHelper::numberElement(&handler_, L"validity", pNormalFolder->getValidity()))
 					return false;
+				WCHAR wszHighestModSeq[32];
+				_snwprintf(wszHighestModSeq, countof(wszHighestModSeq), L"%I64u", pNormalFolder->getHighestModSeq());
+				if (!HandlerHelper::textElement(&handler_, L"highestModSeq", wszHighestModSeq, -1))
+					return false;
 				if (!HandlerHelper::numberElement(&handler_, L"downloadCount", pNormalFolder->getDownloadCount()))
 					return false;
 				if (!HandlerHelper::numberElement(&handler_, L"deletedCount", pNormalFolder->getDeletedCount()))
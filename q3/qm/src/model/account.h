@@ -135,6 +135,7 @@ private:
 		STATE_SEPARATOR,
 		STATE_NAME,
 		STATE_VALIDITY,
+		STATE_HIGHESTMODSEQ,
 		STATE_DOWNLOADCOUNT,
 		STATE_DELETEDCOUNT,
 		STATE_DRIVER,
@@ -187,6 +188,7 @@ private:
 	WCHAR cSeparator_;
 	qs::wstring_ptr wstrName_;
 	unsigned int nValidity_;
+	unsigned __int64 nHighestModSeq_;
 	unsigned int nDownloadCount_;
 	unsigned int nDeletedCount_;
 	qs::wstring_ptr wstrDriver_;
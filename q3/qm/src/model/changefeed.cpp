@@ -0,0 +1,641 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qmfilenames.h>
+#include <qmfolder.h>
+#include <qmmessageholder.h>
+
+#include <qsfile.h>
+#include <qsinit.h>
+#include <qslog.h>
+#include <qsstream.h>
+#include <qsthread.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include "changefeed.h"
+
+using namespace qm;
+using namespace qs;
+
+
+/****************************************************************************
+ *
+ * MessageChangeFeedImpl
+ *
+ */
+
+struct qm::MessageChangeFeedImpl
+{
+	enum {
+		MAGIC	= 0x43460001,
+		VERSION	= 1
+	};
+	
+	enum {
+		BATCH_SIZE		= 256,
+		TRIM_THRESHOLD	= 4096,
+		MAX_CHANGES		= 65536,
+		MAX_NAME		= 32
+	};
+	
+	typedef MessageChangeFeed::Sequence Sequence;
+	typedef MessageChangeFeed::Change Change;
+	typedef MessageChangeFeed::ChangeList ChangeList;
+	
+	struct Header
+	{
+		unsigned int nMagic_;
+		unsigned int nVersion_;
+		Sequence nFirst_;
+		unsigned int nClean_;
+		unsigned int nReserved_;
+	};
+	
+	struct Checkpoint
+	{
+		WCHAR wszName_[MAX_NAME];
+		Sequence nSequence_;
+	};
+	
+	typedef std::vector<Checkpoint> CheckpointList;
+	typedef std::vector<MessageChangeFeedHandler*> HandlerList;
+	
+	void add(const Change& change);
+	bool prepare();
+	bool write();
+	bool trim();
+	bool writeHeader(BinaryFile* pFile,
+					 bool bClean) const;
+	bool loadCheckpoints();
+	bool saveCheckpoints() const;
+	Sequence getEnd() const;
+	wstring_ptr getPath(const WCHAR* pwszExt) const;
+	
+	MessageChangeFeed* pThis_;
+	wstring_ptr wstrPath_;
+	Sequence nFirst_;
+	unsigned int nCount_;
+	ChangeList listPending_;
+	bool bLoaded_;
+	bool bDirty_;
+	CheckpointList listCheckpoint_;
+	bool bCheckpointLoaded_;
+	HandlerList listHandler_;
+	CriticalSection cs_;
+};
+
+void qm::MessageChangeFeedImpl::add(const Change& change)
+{
+	bool bFlush = false;
+	{
+		Lock<CriticalSection> lock(cs_);
+		listPending_.push_back(change);
+		bFlush = listPending_.size() >= BATCH_SIZE;
+	}
+	if (bFlush) {
+		if (!pThis_->flush()) {
+			Log log(InitThread::getInitThread().getLogger(), L"qm::MessageChangeFeed");
+			log.errorf(L"Failed to flush changes: %s", wstrPath_.get());
+		}
+	}
+}
+
+bool qm::MessageChangeFeedImpl::prepare()
+{
+	if (bLoaded_)
+		return true;
+	
+	if (!loadCheckpoints())
+		return false;
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::MessageChangeFeed");
+	
+	// Without a valid log, start after all the checkpoints so that every
+	// consumer is told that it has lost changes
+	nFirst_ = 1;
+	for (CheckpointList::const_iterator it = listCheckpoint_.begin(); it != listCheckpoint_.end(); ++it)
+		nFirst_ = QSMAX(nFirst_, (*it).nSequence_ + 1);
+	nCount_ = 0;
+	
+	wstring_ptr wstrPath(getPath(FileNames::JOURNAL_EXT));
+	if (File::isFileExisting(wstrPath.get())) {
+		BinaryFile file(wstrPath.get(), BinaryFile::MODE_READ | BinaryFile::MODE_WRITE, 0);
+		if (!file) {
+			log.errorf(L"Failed to open file: %s", wstrPath.get());
+			return false;
+		}
+		File::Offset nSize = file.getSize();
+		if (nSize == -1)
+			return false;
+		
+		Header header;
+		if (file.read(reinterpret_cast<unsigned char*>(&header), sizeof(header)) == sizeof(header) &&
+			header.nMagic_ == MAGIC &&
+			header.nVersion_ == VERSION) {
+			// A torn change at the end is overwritten by the next write
+			unsigned int nCount = static_cast<unsigned int>((nSize - sizeof(header))/sizeof(Change));
+			if (header.nClean_) {
+				nFirst_ = header.nFirst_;
+				nCount_ = nCount;
+			}
+			else {
+				// Changes made just before the crash may not have been
+				// written, so none of the changes can be relied on
+				log.warnf(L"Changes were not closed cleanly, discarding: %s", wstrPath.get());
+				nFirst_ = QSMAX(nFirst_, header.nFirst_ + nCount + 1);
+			}
+		}
+		else {
+			log.warnf(L"Failed to load changes, discarding: %s", wstrPath.get());
+		}
+		
+		if (nCount_ == 0) {
+			if (!writeHeader(&file, true) || !file.setEndOfFile())
+				return false;
+		}
+		if (!file.close())
+			return false;
+	}
+	
+	bLoaded_ = true;
+	
+	return true;
+}
+
+bool qm::MessageChangeFeedImpl::write()
+{
+	if (!prepare())
+		return false;
+	
+	if (listPending_.empty())
+		return true;
+	
+	wstring_ptr wstrPath(getPath(FileNames::JOURNAL_EXT));
+	BinaryFile file(wstrPath.get(), BinaryFile::MODE_WRITE, 0);
+	if (!file)
+		return false;
+	
+	// Mark the log as not closed cleanly until it's closed
+	if (!bDirty_) {
+		if (!writeHeader(&file, false))
+			return false;
+		bDirty_ = true;
+	}
+	
+	File::Offset nPosition = sizeof(Header) + static_cast<File::Offset>(nCount_)*sizeof(Change);
+	size_t nSize = listPending_.size()*sizeof(Change);
+	if (file.setPosition(nPosition, File::SEEKORIGIN_BEGIN) == -1 ||
+		file.write(reinterpret_cast<const unsigned char*>(&listPending_[0]), nSize) != nSize ||
+		!file.setEndOfFile() ||
+		!file.close())
+		return false;
+	
+	nCount_ += static_cast<unsigned int>(listPending_.size());
+	listPending_.clear();
+	
+	if (nCount_ >= TRIM_THRESHOLD) {
+		if (!trim()) {
+			Log log(InitThread::getInitThread().getLogger(), L"qm::MessageChangeFeed");
+			log.errorf(L"Failed to trim changes: %s", wstrPath.get());
+		}
+	}
+	
+	return true;
+}
+
+bool qm::MessageChangeFeedImpl::trim()
+{
+	if (!loadCheckpoints())
+		return false;
+	
+	// Keep changes which some consumers haven't read yet, but not more
+	// than MAX_CHANGES. Consumers whose changes have already been lost
+	// don't hold changes.
+	Sequence nEnd = nFirst_ + nCount_;
+	Sequence nTrim = nEnd > MAX_CHANGES ? nEnd - MAX_CHANGES : 0;
+	Sequence nMin = nEnd;
+	for (CheckpointList::const_iterator it = listCheckpoint_.begin(); it != listCheckpoint_.end(); ++it) {
+		Sequence nSequence = (*it).nSequence_;
+		if (nFirst_ <= nSequence && nSequence < nMin)
+			nMin = nSequence;
+	}
+	nTrim = QSMAX(nTrim, nMin);
+	
+	// Rewriting the log is worth only when it halves the log
+	if (nTrim <= nFirst_ || nTrim - nFirst_ < nCount_/2)
+		return true;
+	
+	unsigned int nSkip = static_cast<unsigned int>(nTrim - nFirst_);
+	ChangeList l(nCount_ - nSkip);
+	
+	wstring_ptr wstrPath(getPath(FileNames::JOURNAL_EXT));
+	if (!l.empty()) {
+		BinaryFile file(wstrPath.get(), BinaryFile::MODE_READ, 0);
+		size_t nSize = l.size()*sizeof(Change);
+		if (!file ||
+			file.setPosition(sizeof(Header) + static_cast<File::Offset>(nSkip)*sizeof(Change),
+				File::SEEKORIGIN_BEGIN) == -1 ||
+			file.read(reinterpret_cast<unsigned char*>(&l[0]), nSize) != nSize)
+			return false;
+	}
+	
+	TemporaryFileRenamer renamer(wstrPath.get());
+	{
+		BinaryFile file(renamer.getPath(), BinaryFile::MODE_WRITE | BinaryFile::MODE_CREATE, 0);
+		if (!file)
+			return false;
+		
+		Sequence nFirst = nFirst_;
+		nFirst_ = nTrim;
+		bool bHeader = writeHeader(&file, !bDirty_);
+		nFirst_ = nFirst;
+		if (!bHeader)
+			return false;
+		
+		size_t nSize = l.size()*sizeof(Change);
+		if ((nSize != 0 && file.write(reinterpret_cast<const unsigned char*>(&l[0]), nSize) != nSize) ||
+			!file.close())
+			return false;
+	}
+	if (!renamer.rename())
+		return false;
+	
+	nFirst_ = nTrim;
+	nCount_ -= nSkip;
+	
+	return true;
+}
+
+bool qm::MessageChangeFeedImpl::writeHeader(BinaryFile* pFile,
+											bool bClean) const
+{
+	assert(pFile);
+	
+	Header header = {
+		MAGIC,
+		VERSION,
+		nFirst_,
+		bClean ? 1 : 0,
+		0
+	};
+	return pFile->setPosition(0, File::SEEKORIGIN_BEGIN) != -1 &&
+		pFile->write(reinterpret_cast<const unsigned char*>(&header), sizeof(header)) == sizeof(header);
+}
+
+bool qm::MessageChangeFeedImpl::loadCheckpoints()
+{
+	if (bCheckpointLoaded_)
+		return true;
+	
+	wstring_ptr wstrPath(getPath(FileNames::CHECKPOINT_EXT));
+	if (File::isFileExisting(wstrPath.get())) {
+		FileInputStream fileStream(wstrPath.get());
+		if (!fileStream)
+			return false;
+		BufferedInputStream stream(&fileStream, false);
+		
+		while (true) {
+			Checkpoint checkpoint;
+			size_t nRead = stream.read(reinterpret_cast<unsigned char*>(&checkpoint), sizeof(checkpoint));
+			if (nRead == -1)
+				return false;
+			else if (nRead != sizeof(checkpoint))
+				break;
+			checkpoint.wszName_[MAX_NAME - 1] = L'\0';
+			listCheckpoint_.push_back(checkpoint);
+		}
+	}
+	
+	bCheckpointLoaded_ = true;
+	
+	return true;
+}
+
+bool qm::MessageChangeFeedImpl::saveCheckpoints() const
+{
+	wstring_ptr wstrPath(getPath(FileNames::CHECKPOINT_EXT));
+	TemporaryFileRenamer renamer(wstrPath.get());
+	
+	FileOutputStream fileStream(renamer.getPath());
+	if (!fileStream)
+		return false;
+	BufferedOutputStream stream(&fileStream, false);
+	
+	for (CheckpointList::const_iterator it = listCheckpoint_.begin(); it != listCheckpoint_.end(); ++it) {
+		if (stream.write(reinterpret_cast<const unsigned char*>(&*it), sizeof(Checkpoint)) == -1)
+			return false;
+	}
+	if (!stream.close())
+		return false;
+	
+	if (!renamer.rename())
+		return false;
+	
+	return true;
+}
+
+MessageChangeFeedImpl::Sequence qm::MessageChangeFeedImpl::getEnd() const
+{
+	return nFirst_ + nCount_ + listPending_.size();
+}
+
+wstring_ptr qm::MessageChangeFeedImpl::getPath(const WCHAR* pwszExt) const
+{
+	ConcatW c[] = {
+		{ wstrPath_.get(),		-1	},
+		{ L"\\",				1	},
+		{ FileNames::CHANGES,	-1	},
+		{ pwszExt,				-1	}
+	};
+	return concat(c, countof(c));
+}
+
+
+/****************************************************************************
+ *
+ * MessageChangeFeed
+ *
+ */
+
+qm::MessageChangeFeed::MessageChangeFeed(const WCHAR* pwszPath)
+{
+	pImpl_ = new MessageChangeFeedImpl();
+	pImpl_->pThis_ = this;
+	pImpl_->wstrPath_ = allocWString(pwszPath);
+	pImpl_->nFirst_ = 1;
+	pImpl_->nCount_ = 0;
+	pImpl_->bLoaded_ = false;
+	pImpl_->bDirty_ = false;
+	pImpl_->bCheckpointLoaded_ = false;
+}
+
+qm::MessageChangeFeed::~MessageChangeFeed()
+{
+	if (!close()) {
+		Log log(InitThread::getInitThread().getLogger(), L"qm::MessageChangeFeed");
+		log.errorf(L"Failed to close changes: %s", pImpl_->wstrPath_.get());
+	}
+	delete pImpl_;
+}
+
+void qm::MessageChangeFeed::add(Type type,
+								const MessageHolder* pmh)
+{
+	assert(type != TYPE_MOVE);
+	assert(pmh);
+	
+	Change change = {
+		type,
+		pmh->getFolder()->getId(),
+		pmh->getId(),
+		pmh->getFlags(),
+		pmh->getMessageBoxKey().nOffset_,
+		static_cast<unsigned int>(-1),
+		static_cast<unsigned int>(-1)
+	};
+	pImpl_->add(change);
+}
+
+void qm::MessageChangeFeed::addMove(unsigned int nOldFolderId,
+									unsigned int nOldMessageId,
+									const MessageHolder* pmh)
+{
+	assert(pmh);
+	
+	Change change = {
+		TYPE_MOVE,
+		pmh->getFolder()->getId(),
+		pmh->getId(),
+		pmh->getFlags(),
+		pmh->getMessageBoxKey().nOffset_,
+		nOldFolderId,
+		nOldMessageId
+	};
+	pImpl_->add(change);
+}
+
+bool qm::MessageChangeFeed::flush()
+{
+	Sequence nNext = 0;
+	MessageChangeFeedImpl::HandlerList listHandler;
+	{
+		Lock<CriticalSection> lock(pImpl_->cs_);
+		
+		if (pImpl_->listPending_.empty())
+			return true;
+		if (!pImpl_->write())
+			return false;
+		
+		nNext = pImpl_->getEnd();
+		listHandler = pImpl_->listHandler_;
+	}
+	
+	// Handlers are called without locking so that they can read changes
+	MessageChangeFeedEvent event(this, nNext);
+	std::for_each(listHandler.begin(), listHandler.end(),
+		boost::bind(&MessageChangeFeedHandler::changesFlushed, _1, boost::cref(event)));
+	
+	return true;
+}
+
+bool qm::MessageChangeFeed::close()
+{
+	if (!flush())
+		return false;
+	
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	if (!pImpl_->bDirty_)
+		return true;
+	
+	wstring_ptr wstrPath(pImpl_->getPath(FileNames::JOURNAL_EXT));
+	BinaryFile file(wstrPath.get(), BinaryFile::MODE_WRITE, 0);
+	if (!file ||
+		!pImpl_->writeHeader(&file, true) ||
+		!file.close())
+		return false;
+	pImpl_->bDirty_ = false;
+	
+	return true;
+}
+
+MessageChangeFeed::Sequence qm::MessageChangeFeed::getNext()
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	if (!pImpl_->prepare())
+		return 0;
+	
+	return pImpl_->getEnd();
+}
+
+bool qm::MessageChangeFeed::read(Sequence nSequence,
+								 size_t nMax,
+								 ChangeList* pList,
+								 Sequence* pnNext,
+								 bool* pbLost)
+{
+	assert(pList);
+	assert(pnNext);
+	assert(pbLost);
+	
+	pList->clear();
+	*pnNext = nSequence;
+	*pbLost = false;
+	
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	if (!pImpl_->prepare())
+		return false;
+	
+	Sequence nWritten = pImpl_->nFirst_ + pImpl_->nCount_;
+	Sequence nEnd = pImpl_->getEnd();
+	if (nSequence < pImpl_->nFirst_ || nEnd < nSequence) {
+		*pbLost = true;
+		*pnNext = nEnd;
+		return true;
+	}
+	
+	if (nSequence < nWritten) {
+		ChangeList l(static_cast<size_t>(QSMIN(static_cast<Sequence>(nMax), nWritten - nSequence)));
+		if (!l.empty()) {
+			wstring_ptr wstrPath(pImpl_->getPath(FileNames::JOURNAL_EXT));
+			BinaryFile file(wstrPath.get(), BinaryFile::MODE_READ, 0);
+			size_t nSize = l.size()*sizeof(Change);
+			if (!file ||
+				file.setPosition(sizeof(MessageChangeFeedImpl::Header) +
+					static_cast<File::Offset>(nSequence - pImpl_->nFirst_)*sizeof(Change),
+					File::SEEKORIGIN_BEGIN) == -1 ||
+				file.read(reinterpret_cast<unsigned char*>(&l[0]), nSize) != nSize)
+				return false;
+		}
+		pList->swap(l);
+	}
+	
+	const ChangeList& listPending = pImpl_->listPending_;
+	Sequence nPending = nSequence + pList->size();
+	if (pList->size() < nMax && nPending < nEnd) {
+		ChangeList::const_iterator it = listPending.begin() + static_cast<size_t>(nPending - nWritten);
+		size_t nCount = QSMIN(nMax - pList->size(), static_cast<size_t>(listPending.end() - it));
+		pList->insert(pList->end(), it, it + nCount);
+	}
+	
+	*pnNext = nSequence + pList->size();
+	
+	return true;
+}
+
+MessageChangeFeed::Sequence qm::MessageChangeFeed::getCheckpoint(const WCHAR* pwszName)
+{
+	assert(pwszName);
+	
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	if (!pImpl_->loadCheckpoints())
+		return 0;
+	
+	const MessageChangeFeedImpl::CheckpointList& l = pImpl_->listCheckpoint_;
+	for (MessageChangeFeedImpl::CheckpointList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		if (wcscmp((*it).wszName_, pwszName) == 0)
+			return (*it).nSequence_;
+	}
+	return 0;
+}
+
+bool qm::MessageChangeFeed::setCheckpoint(const WCHAR* pwszName,
+										  Sequence nSequence)
+{
+	assert(pwszName);
+	assert(wcslen(pwszName) < MessageChangeFeedImpl::MAX_NAME);
+	
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	if (!pImpl_->loadCheckpoints())
+		return false;
+	
+	MessageChangeFeedImpl::CheckpointList& l = pImpl_->listCheckpoint_;
+	MessageChangeFeedImpl::CheckpointList::iterator it = l.begin();
+	while (it != l.end() && wcscmp((*it).wszName_, pwszName) != 0)
+		++it;
+	if (it != l.end()) {
+		if ((*it).nSequence_ == nSequence)
+			return true;
+		(*it).nSequence_ = nSequence;
+	}
+	else {
+		MessageChangeFeedImpl::Checkpoint checkpoint = { L"", nSequence };
+		wcsncpy(checkpoint.wszName_, pwszName, countof(checkpoint.wszName_) - 1);
+		l.push_back(checkpoint);
+	}
+	
+	return pImpl_->saveCheckpoints();
+}
+
+void qm::MessageChangeFeed::addMessageChangeFeedHandler(MessageChangeFeedHandler* pHandler)
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	assert(std::find(pImpl_->listHandler_.begin(),
+		pImpl_->listHandler_.end(), pHandler) ==
+		pImpl_->listHandler_.end());
+	pImpl_->listHandler_.push_back(pHandler);
+}
+
+void qm::MessageChangeFeed::removeMessageChangeFeedHandler(MessageChangeFeedHandler* pHandler)
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	MessageChangeFeedImpl::HandlerList& l = pImpl_->listHandler_;
+	MessageChangeFeedImpl::HandlerList::iterator it =
+		std::remove(l.begin(), l.end(), pHandler);
+	assert(it != l.end());
+	l.erase(it, l.end());
+}
+
+
+/****************************************************************************
+ *
+ * MessageChangeFeedHandler
+ *
+ */
+
+qm::MessageChangeFeedHandler::~MessageChangeFeedHandler()
+{
+}
+
+
+/****************************************************************************
+ *
+ * MessageChangeFeedEvent
+ *
+ */
+
+qm::MessageChangeFeedEvent::MessageChangeFeedEvent(MessageChangeFeed* pFeed,
+												   MessageChangeFeed::Sequence nNext) :
+	pFeed_(pFeed),
+	nNext_(nNext)
+{
+}
+
+qm::MessageChangeFeedEvent::~MessageChangeFeedEvent()
+{
+}
+
+MessageChangeFeed* qm::MessageChangeFeedEvent::getFeed() const
+{
+	return pFeed_;
+}
+
+MessageChangeFeed::Sequence qm::MessageChangeFeedEvent::getNext() const
+{
+	return nNext_;
+}
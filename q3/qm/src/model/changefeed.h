@@ -0,0 +1,222 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#ifndef __CHANGEFEED_H__
+#define __CHANGEFEED_H__
+
+#include <qm.h>
+
+#include <qs.h>
+
+#include <vector>
+
+
+namespace qm {
+
+class MessageChangeFeed;
+class MessageChangeFeedHandler;
+class MessageChangeFeedEvent;
+
+class MessageHolder;
+
+
+/****************************************************************************
+ *
+ * MessageChangeFeed
+ *
+ * Sequence of changes of messages in an account, which indexers consume
+ * to keep up with the account without scanning all the messages. Changes
+ * are buffered and appended to a log in batches. Each change has its own
+ * sequence number, and a consumer keeps the sequence number of the next
+ * change to read as its checkpoint. The log is trimmed as consumers
+ * proceed, and changes which have been trimmed or lost because the
+ * account wasn't closed cleanly are reported as lost, in which case
+ * the consumer has to scan the account again.
+ *
+ * Changes are added while the account is locked, but they can be read
+ * from any thread without locking the account.
+ *
+ */
+
+class MessageChangeFeed
+{
+public:
+	enum Type {
+		TYPE_APPEND	= 1,
+		TYPE_REMOVE	= 2,
+		TYPE_MOVE	= 3,
+		TYPE_FLAGS	= 4,
+		TYPE_UPDATE	= 5
+	};
+
+public:
+	typedef unsigned __int64 Sequence;
+	
+	struct Change
+	{
+		unsigned int nType_;
+		unsigned int nFolderId_;
+		unsigned int nMessageId_;
+		unsigned int nFlags_;
+		unsigned int nOffset_;
+		unsigned int nOldFolderId_;
+		unsigned int nOldMessageId_;
+	};
+
+public:
+	typedef std::vector<Change> ChangeList;
+
+public:
+	/**
+	 * Create instance.
+	 *
+	 * @param pwszPath [in] Path of the directory where the log is stored.
+	 */
+	explicit MessageChangeFeed(const WCHAR* pwszPath);
+	~MessageChangeFeed();
+
+public:
+	/**
+	 * Add a change of the message. The folder, the id, the flags and
+	 * the offset are taken from the message as it is now.
+	 *
+	 * @param type [in] Type of the change. This must not be TYPE_MOVE.
+	 * @param pmh [in] Message.
+	 */
+	void add(Type type,
+			 const MessageHolder* pmh);
+	
+	/**
+	 * Add a change that the message has been moved.
+	 *
+	 * @param nOldFolderId [in] Id of the folder where the message was.
+	 * @param nOldMessageId [in] Id of the message in the old folder.
+	 * @param pmh [in] Message which has been moved.
+	 */
+	void addMove(unsigned int nOldFolderId,
+				 unsigned int nOldMessageId,
+				 const MessageHolder* pmh);
+	
+	/**
+	 * Write buffered changes to the log and notify handlers.
+	 *
+	 * @return true if success, false otherwise.
+	 */
+	bool flush();
+	
+	/**
+	 * Flush and mark the log as closed cleanly.
+	 *
+	 * @return true if success, false otherwise.
+	 */
+	bool close();
+	
+	/**
+	 * Get the sequence number of the change which will be added next.
+	 * A consumer which scans the account takes this while the account is
+	 * locked, and then reads changes from it.
+	 */
+	Sequence getNext();
+	
+	/**
+	 * Read changes.
+	 *
+	 * @param nSequence [in] Sequence number of the first change to read.
+	 * @param nMax [in] Max number of changes to read.
+	 * @param pList [out] Changes.
+	 * @param pnNext [out] Sequence number of the change after them.
+	 * @param pbLost [out] true if some changes after nSequence have been
+	 *                     lost and the consumer has to scan the account.
+	 * @return true if success, false otherwise.
+	 */
+	bool read(Sequence nSequence,
+			  size_t nMax,
+			  ChangeList* pList,
+			  Sequence* pnNext,
+			  bool* pbLost);
+	
+	/**
+	 * Get the checkpoint of the consumer.
+	 *
+	 * @param pwszName [in] Name of the consumer.
+	 * @return Checkpoint. 0 if not found, which is always treated as lost.
+	 */
+	Sequence getCheckpoint(const WCHAR* pwszName);
+	
+	/**
+	 * Save the checkpoint of the consumer. Changes before the oldest
+	 * checkpoint can be trimmed.
+	 *
+	 * @param pwszName [in] Name of the consumer.
+	 * @param nSequence [in] Checkpoint.
+	 * @return true if success, false otherwise.
+	 */
+	bool setCheckpoint(const WCHAR* pwszName,
+					   Sequence nSequence);
+	
+	/**
+	 * Add a handler which is notified after changes are flushed. It's
+	 * called on the thread which flushes changes, usually with the account
+	 * locked, so it should only wake up its consumer.
+	 */
+	void addMessageChangeFeedHandler(MessageChangeFeedHandler* pHandler);
+	void removeMessageChangeFeedHandler(MessageChangeFeedHandler* pHandler);
+
+private:
+	MessageChangeFeed(const MessageChangeFeed&);
+	MessageChangeFeed& operator=(const MessageChangeFeed&);
+
+private:
+	struct MessageChangeFeedImpl* pImpl_;
+};
+
+
+/****************************************************************************
+ *
+ * MessageChangeFeedHandler
+ *
+ */
+
+class MessageChangeFeedHandler
+{
+public:
+	virtual ~MessageChangeFeedHandler();
+
+public:
+	virtual void changesFlushed(const MessageChangeFeedEvent& event) = 0;
+};
+
+
+/****************************************************************************
+ *
+ * MessageChangeFeedEvent
+ *
+ */
+
+class MessageChangeFeedEvent
+{
+public:
+	MessageChangeFeedEvent(MessageChangeFeed* pFeed,
+						   MessageChangeFeed::Sequence nNext);
+	~MessageChangeFeedEvent();
+
+public:
+	MessageChangeFeed* getFeed() const;
+	MessageChangeFeed::Sequence getNext() const;
+
+private:
+	MessageChangeFeedEvent(const MessageChangeFeedEvent&);
+	MessageChangeFeedEvent& operator=(const MessageChangeFeedEvent&);
+
+private:
+	MessageChangeFeed* pFeed_;
+	MessageChangeFeed::Sequence nNext_;
+};
+
+}
+
+#endif // __CHANGEFEED_H__
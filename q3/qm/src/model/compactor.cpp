@@ -0,0 +1,191 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qmaccount.h>
+#include <qmfolder.h>
+#include <qmmessageholder.h>
+
+#include <qsinit.h>
+#include <qslog.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include "compactor.h"
+
+using namespace qm;
+using namespace qs;
+
+
+/****************************************************************************
+ *
+ * AccountCompactor
+ *
+ */
+
+qm::AccountCompactor::AccountCompactor(Account* pAccount,
+									   unsigned int nTarget,
+									   unsigned int nBatch) :
+	pAccount_(pAccount),
+	nTarget_(nTarget),
+	nBatch_(nBatch != 0 ? nBatch : 1),
+	bRunning_(true),
+	bFailed_(false),
+	bStop_(false),
+	nCount_(0),
+	nProcessed_(0)
+{
+}
+
+qm::AccountCompactor::~AccountCompactor()
+{
+}
+
+bool qm::AccountCompactor::isRunning() const
+{
+	return bRunning_;
+}
+
+bool qm::AccountCompactor::isFailed() const
+{
+	return bFailed_;
+}
+
+void qm::AccountCompactor::stop()
+{
+	bStop_ = true;
+	join();
+}
+
+unsigned int qm::AccountCompactor::getProgress() const
+{
+	if (!bRunning_)
+		return 100;
+	
+	unsigned int nCount = nCount_;
+	if (nCount == 0)
+		return 0;
+	return QSMIN(static_cast<unsigned int>(static_cast<__int64>(nProcessed_)*100/nCount), 100U);
+}
+
+void qm::AccountCompactor::run()
+{
+	InitThread init(0);
+	
+	if (!compact()) {
+		Log log(InitThread::getInitThread().getLogger(), L"qm::AccountCompactor");
+		log.errorf(L"Failed to compact: %s", pAccount_->getName());
+		bFailed_ = true;
+	}
+	
+	bRunning_ = false;
+}
+
+bool qm::AccountCompactor::compact()
+{
+	Log log(InitThread::getInitThread().getLogger(), L"qm::AccountCompactor");
+	
+	unsigned int nFragmentation = pAccount_->getFragmentation();
+	if (nFragmentation <= nTarget_)
+		return true;
+	log.infof(L"Start compacting: %s, %u%%", pAccount_->getName(), nFragmentation);
+	
+	ItemList listItem;
+	{
+		Lock<Account> lock(*pAccount_);
+		
+		const Account::FolderList& l = pAccount_->getFolders();
+		for (Account::FolderList::const_iterator itF = l.begin(); itF != l.end(); ++itF) {
+			Folder* pFolder = *itF;
+			if (pFolder->getType() != Folder::TYPE_NORMAL)
+				continue;
+			
+			NormalFolder* pNormalFolder = static_cast<NormalFolder*>(pFolder);
+			if (!pNormalFolder->loadMessageHolders())
+				return false;
+			
+			const MessageHolderList& listMessageHolder = pNormalFolder->getMessages();
+			listItem.reserve(listItem.size() + listMessageHolder.size());
+			for (MessageHolderList::const_iterator itM = listMessageHolder.begin(); itM != listMessageHolder.end(); ++itM) {
+				MessageHolder* pmh = *itM;
+				Item item = {
+					static_cast<unsigned __int64>(pmh->getMessageBoxKey().nOffset_) << 32 |
+						pmh->getMessageIndexKey().nKey_,
+					pFolder->getId(),
+					pmh->getId()
+				};
+				listItem.push_back(item);
+			}
+		}
+	}
+	
+	// Messages stored at the end of the storage are moved first, so that
+	// the storage can be truncated when it finishes
+	std::sort(listItem.begin(), listItem.end(),
+		boost::bind(&Item::nKey_, _1) > boost::bind(&Item::nKey_, _2));
+	nCount_ = static_cast<unsigned int>(listItem.size());
+	
+	DWORD dwSave = ::GetTickCount();
+	for (ItemList::size_type n = 0; n < listItem.size() && !bStop_; n += nBatch_) {
+		{
+			Lock<Account> lock(*pAccount_);
+			
+			MessageHolderList l;
+			ItemList::size_type nEnd = QSMIN(n + nBatch_, listItem.size());
+			for (ItemList::size_type m = n; m < nEnd; ++m) {
+				const Item& item = listItem[m];
+				Folder* pFolder = pAccount_->getFolderById(item.nFolderId_);
+				if (!pFolder || pFolder->getType() != Folder::TYPE_NORMAL)
+					continue;
+				
+				NormalFolder* pNormalFolder = static_cast<NormalFolder*>(pFolder);
+				if (!pNormalFolder->loadMessageHolders())
+					return false;
+				
+				MessageHolder* pmh = pNormalFolder->getMessageHolderById(item.nMessageId_);
+				if (pmh)
+					l.push_back(pmh);
+			}
+			if (!pAccount_->compactPartially(l))
+				return false;
+			nProcessed_ = static_cast<unsigned int>(nEnd);
+		}
+		
+		if (pAccount_->getFragmentation() <= nTarget_)
+			break;
+		
+		// Keys of moved messages and the map of the store are saved
+		// together in Account::saveMessages
+		if (::GetTickCount() - dwSave > SAVE_INTERVAL) {
+			if (!save())
+				return false;
+			log.debugf(L"Compacting: %s, %u/%u", pAccount_->getName(),
+				static_cast<unsigned int>(n),
+				static_cast<unsigned int>(listItem.size()));
+			dwSave = ::GetTickCount();
+		}
+		
+		// Give other threads waiting for the lock a chance to take it
+		::Sleep(0);
+	}
+	
+	if (!save() || !pAccount_->freeUnusedMessageStore())
+		return false;
+	
+	log.infof(L"Finish compacting: %s, %u%%", pAccount_->getName(), pAccount_->getFragmentation());
+	
+	return true;
+}
+
+bool qm::AccountCompactor::save()
+{
+	Lock<Account> lock(*pAccount_);
+	return pAccount_->saveMessages(false);
+}
@@ -0,0 +1,111 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#ifndef __COMPACTOR_H__
+#define __COMPACTOR_H__
+
+#include <qm.h>
+
+#include <qsthread.h>
+
+#include <vector>
+
+
+namespace qm {
+
+class AccountCompactor;
+
+class Account;
+
+
+/****************************************************************************
+ *
+ * AccountCompactor
+ *
+ * Compact the message store of an account in background. This moves
+ * a small batch of messages at a time and releases the lock of the account
+ * between batches, so that the account can be used while compacting.
+ * Messages are taken from the end of the storage once when it starts,
+ * and blocks which are no longer used are released when it finishes.
+ * It stops once fragmentation gets below the target.
+ *
+ */
+
+class AccountCompactor : public qs::Thread
+{
+public:
+	enum {
+		SAVE_INTERVAL	= 10*1000,
+		WAIT_INTERVAL	= 100
+	};
+
+public:
+	/**
+	 * Create an instance.
+	 *
+	 * @param pAccount [in] Account.
+	 * @param nTarget [in] Stop compacting when fragmentation gets below this
+	 *                     in percent.
+	 * @param nBatch [in] The number of messages moved at a time.
+	 */
+	AccountCompactor(Account* pAccount,
+					 unsigned int nTarget,
+					 unsigned int nBatch);
+	virtual ~AccountCompactor();
+
+public:
+	bool isRunning() const;
+	bool isFailed() const;
+	void stop();
+	
+	/**
+	 * Get progress.
+	 *
+	 * @return Progress in percent.
+	 */
+	unsigned int getProgress() const;
+
+public:
+	virtual void run();
+
+private:
+	/**
+	 * Message to be moved. It's identified by its ids because folders
+	 * and messages can be removed while the account is unlocked between
+	 * batches.
+	 */
+	struct Item
+	{
+		unsigned __int64 nKey_;
+		unsigned int nFolderId_;
+		unsigned int nMessageId_;
+	};
+	
+	typedef std::vector<Item> ItemList;
+
+private:
+	bool compact();
+	bool save();
+
+private:
+	AccountCompactor(const AccountCompactor&);
+	AccountCompactor& operator=(const AccountCompactor&);
+
+private:
+	Account* pAccount_;
+	unsigned int nTarget_;
+	unsigned int nBatch_;
+	volatile bool bRunning_;
+	volatile bool bFailed_;
+	volatile bool bStop_;
+	volatile unsigned int nCount_;
+	volatile unsigned int nProcessed_;
+};
+
+}
+
+#endif // __COMPACTOR_H__
@@ -131,8 +131,11 @@ qm::Document::Document(Profile* pProfile,
 	pImpl_->pThis_ = this;
 	pImpl_->pProfile_ = pProfile;
 	pImpl_->pPasswordManager_ = pPasswordManager;
+	int nRuleThreadCount = pProfile->getInt(L"Global", L"RuleThreadCount");
+	if (nRuleThreadCount < 0)
+		nRuleThreadCount = 0;
 	pImpl_->pRuleManager_.reset(new RuleManager(
-		app.getProfilePath(FileNames::RULES_XML).get()));
+		app.getProfilePath(FileNames::RULES_XML).get(), nRuleThreadCount));
 	pImpl_->pTemplateManager_.reset(new TemplateManager(pwszMailFolder));
 	pImpl_->pScriptManager_.reset(new ScriptManager(pwszMailFolder));
 	pImpl_->pSignatureManager_.reset(new SignatureManager(
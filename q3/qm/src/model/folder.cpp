@@ -32,6 +32,9 @@
 #include <boost/lambda/bind.hpp>
 #include <boost/lambda/lambda.hpp>
 
+#include "changefeed.h"
+#include "folderjournal.h"
+
 using namespace qm;
 using namespace qs;
 
@@ -402,9 +405,25 @@ FolderImpl* qm::Folder::getImpl() const
 struct qm::NormalFolderImpl : public DefaultMessageHolderHandler
 {
 public:
-	wstring_ptr getPath() const;
+	enum {
+		JOURNAL_MIN_ENTRIES	= 1024,
+		JOURNAL_RATIO		= 8
+	};
+
+public:
+	typedef std::vector<unsigned int> IdList;
+
+public:
+	wstring_ptr getPath(const WCHAR* pwszExt) const;
 	bool unstoreMessages(const MessageHolderList& l);
 	bool unstoreAllMessages();
+	void countMessages(const MessageHolder::Init* pInit,
+					   size_t nCount);
+	void setModified(unsigned int nId);
+	unsigned int getJournalLimit() const;
+	bool saveJournal();
+	bool saveCheckpoint();
+	void waitCheckpoint();
 
 public:
 	virtual void messageHolderFlagsChanged(const MessageHolderEvent& event);
@@ -413,6 +432,7 @@ public:
 public:
 	NormalFolder* pThis_;
 	unsigned int nValidity_;
+	unsigned __int64 nHighestModSeq_;
 	volatile unsigned int nCount_;
 	volatile unsigned int nUnseenCount_;
 	unsigned int nDownloadCount_;
@@ -423,12 +443,15 @@ public:
 	unsigned int nMaxId_;
 	mutable bool bModified_;
 	FolderHook* pHook_;
+	IdList listModifiedId_;
+	unsigned int nJournalCount_;
+	std::auto_ptr<FolderCheckpointThread> pCheckpointThread_;
 };
 
-wstring_ptr qm::NormalFolderImpl::getPath() const
+wstring_ptr qm::NormalFolderImpl::getPath(const WCHAR* pwszExt) const
 {
 	WCHAR wsz[32];
-	_snwprintf(wsz, countof(wsz), L"\\%03d%s", pThis_->getId(), FileNames::INDEX_EXT);
+	_snwprintf(wsz, countof(wsz), L"\\%03d%s", pThis_->getId(), pwszExt);
 	return concat(pThis_->getAccount()->getPath(), wsz);
 }
 
@@ -443,6 +466,141 @@ bool qm::NormalFolderImpl::unstoreAllMessages()
 	return unstoreMessages(l);
 }
 
+void qm::NormalFolderImpl::countMessages(const MessageHolder::Init* pInit,
+										 size_t nCount)
+{
+	// Scan the flags without touching MessageHolders. This loop has no
+	// branch in its body so that a compiler can vectorize it.
+	unsigned int nSeenMask = MessageHolder::FLAG_SEEN;
+	if (pThis_->getAccount()->isSeen(MessageHolder::FLAG_DELETED))
+		nSeenMask |= MessageHolder::FLAG_DELETED;
+	const unsigned int nDownloadMask = MessageHolder::FLAG_DOWNLOAD | MessageHolder::FLAG_DOWNLOADTEXT;
+	
+	unsigned int nUnseenCount = 0;
+	unsigned int nDownloadCount = 0;
+	unsigned int nDeletedCount = 0;
+	for (size_t n = 0; n < nCount; ++n) {
+		unsigned int nFlags = pInit[n].nFlags_;
+		nUnseenCount += (nFlags & nSeenMask) == 0;
+		nDownloadCount += (nFlags & nDownloadMask) != 0;
+		nDeletedCount += (nFlags & MessageHolder::FLAG_DELETED) != 0;
+	}
+	
+	nCount_ = static_cast<unsigned int>(nCount);
+	nUnseenCount_ = nUnseenCount;
+	nDownloadCount_ = nDownloadCount;
+	nDeletedCount_ = nDeletedCount;
+}
+
+void qm::NormalFolderImpl::setModified(unsigned int nId)
+{
+	bModified_ = true;
+	
+	listModifiedId_.push_back(nId);
+	if (listModifiedId_.size() > nCount_ + JOURNAL_MIN_ENTRIES) {
+		std::sort(listModifiedId_.begin(), listModifiedId_.end());
+		listModifiedId_.erase(std::unique(listModifiedId_.begin(),
+			listModifiedId_.end()), listModifiedId_.end());
+	}
+}
+
+unsigned int qm::NormalFolderImpl::getJournalLimit() const
+{
+	return QSMAX(static_cast<unsigned int>(JOURNAL_MIN_ENTRIES), nCount_/JOURNAL_RATIO);
+}
+
+bool qm::NormalFolderImpl::saveJournal()
+{
+	if (listModifiedId_.empty())
+		return true;
+	
+	std::sort(listModifiedId_.begin(), listModifiedId_.end());
+	listModifiedId_.erase(std::unique(listModifiedId_.begin(),
+		listModifiedId_.end()), listModifiedId_.end());
+	
+	FolderJournal::EntryList l;
+	l.reserve(listModifiedId_.size());
+	for (IdList::const_iterator it = listModifiedId_.begin(); it != listModifiedId_.end(); ++it) {
+		FolderJournal::Entry entry = { FolderJournal::TYPE_REMOVE, { *it } };
+		MessageHolder* pmh = pThis_->getMessageHolderById(*it);
+		if (pmh) {
+			entry.nType_ = FolderJournal::TYPE_UPDATE;
+			pmh->getInit(&entry.init_);
+		}
+		l.push_back(entry);
+	}
+	
+	wstring_ptr wstrPath(getPath(FileNames::JOURNAL_EXT));
+	if (!FolderJournal::append(wstrPath.get(), l))
+		return false;
+	
+	nJournalCount_ += static_cast<unsigned int>(l.size());
+	IdList().swap(listModifiedId_);
+	
+	return true;
+}
+
+bool qm::NormalFolderImpl::saveCheckpoint()
+{
+	assert(listModifiedId_.empty());
+	
+	if (pCheckpointThread_.get()) {
+		// Keep journaling until the running checkpoint finishes
+		if (pCheckpointThread_->isRunning())
+			return true;
+		waitCheckpoint();
+	}
+	
+	FolderJournal::InitList l;
+	l.resize(listMessageHolder_.size());
+	for (MessageHolderList::size_type n = 0; n < listMessageHolder_.size(); ++n)
+		listMessageHolder_[n]->getInit(&l[n]);
+	
+	wstring_ptr wstrPath(getPath(FileNames::INDEX_EXT));
+	wstring_ptr wstrJournalPath(getPath(FileNames::JOURNAL_EXT));
+	wstring_ptr wstrCheckpointPath(getPath(FileNames::CHECKPOINT_EXT));
+	
+	if (File::isFileExisting(wstrCheckpointPath.get())) {
+		// The previous checkpoint has not completed. Both journals have
+		// to be replayed on the old index, so rewrite the index here.
+		if (!FolderJournal::write(wstrPath.get(), l) ||
+			!FolderJournal::remove(wstrCheckpointPath.get()) ||
+			!FolderJournal::remove(wstrJournalPath.get()))
+			return false;
+	}
+	else {
+		// Freeze the current journal and rewrite the index in background.
+		// Entries appended after this go to a new journal which is
+		// replayed after the frozen one.
+		if (File::isFileExisting(wstrJournalPath.get()) &&
+			!FolderJournal::rename(wstrJournalPath.get(), wstrCheckpointPath.get()))
+			return false;
+		
+		std::auto_ptr<FolderCheckpointThread> pThread(new FolderCheckpointThread(
+			wstrPath.get(), wstrCheckpointPath.get(), l));
+		if (!pThread->start())
+			pThread->run();
+		pCheckpointThread_ = pThread;
+	}
+	
+	nJournalCount_ = 0;
+	
+	return true;
+}
+
+void qm::NormalFolderImpl::waitCheckpoint()
+{
+	if (!pCheckpointThread_.get())
+		return;
+	
+	pCheckpointThread_->join();
+	if (!pCheckpointThread_->isSucceeded()) {
+		Log log(InitThread::getInitThread().getLogger(), L"qm::NormalFolder");
+		log.errorf(L"Failed to write checkpoint of folder: %u", pThis_->getId());
+	}
+	pCheckpointThread_.reset(0);
+}
+
 void qm::NormalFolderImpl::messageHolderFlagsChanged(const MessageHolderEvent& event)
 {
 	MessageHolder* pmh = event.getMessageHolder();
@@ -479,7 +637,7 @@ void qm::NormalFolderImpl::messageHolderFlagsChanged(const MessageHolderEvent& e
 				pThis_->getImpl()->fireUnseenCountChanged();
 		}
 		
-		bModified_ = true;
+		setModified(pmh->getId());
 	}
 }
 
@@ -487,7 +645,7 @@ void qm::NormalFolderImpl::messageHolderKeysChanged(const MessageHolderEvent& ev
 {
 	MessageHolder* pmh = event.getMessageHolder();
 	if (pmh->getFolder() == pThis_)
-		bModified_ = true;
+		setModified(pmh->getId());
 }
 
 
@@ -514,6 +672,7 @@ qm::NormalFolder::NormalFolder(unsigned int nId,
 	pImpl_ = new NormalFolderImpl();
 	pImpl_->pThis_ = this;
 	pImpl_->nValidity_ = nValidity;
+	pImpl_->nHighestModSeq_ = 0;
 	pImpl_->nCount_ = nCount;
 	pImpl_->nUnseenCount_ = nUnseenCount;
 	pImpl_->nDownloadCount_ = nDownloadCount;
@@ -523,6 +682,7 @@ qm::NormalFolder::NormalFolder(unsigned int nId,
 	pImpl_->nMaxId_ = 0;
 	pImpl_->bModified_ = false;
 	pImpl_->pHook_ = 0;
+	pImpl_->nJournalCount_ = 0;
 	
 	getAccount()->addMessageHolderHandler(pImpl_);
 }
@@ -530,6 +690,7 @@ qm::NormalFolder::NormalFolder(unsigned int nId,
 qm::NormalFolder::~NormalFolder()
 {
 	if (pImpl_) {
+		pImpl_->waitCheckpoint();
 		getAccount()->removeMessageHolderHandler(pImpl_);
 		std::for_each(pImpl_->listMessageHolder_.begin(),
 			pImpl_->listMessageHolder_.end(),
@@ -553,10 +714,23 @@ bool qm::NormalFolder::setValidity(unsigned int nValidity)
 		return false;
 	
 	pImpl_->nValidity_ = nValidity;
+	pImpl_->nHighestModSeq_ = 0;
 	
 	return true;
 }
 
+unsigned __int64 qm::NormalFolder::getHighestModSeq() const
+{
+	Lock<Account> lock(*getAccount());
+	return pImpl_->nHighestModSeq_;
+}
+
+void qm::NormalFolder::setHighestModSeq(unsigned __int64 nHighestModSeq)
+{
+	Lock<Account> lock(*getAccount());
+	pImpl_->nHighestModSeq_ = nHighestModSeq;
+}
+
 unsigned int qm::NormalFolder::getDownloadCount() const
 {
 	Lock<Account> lock(*getAccount());
@@ -661,6 +835,31 @@ bool qm::NormalFolder::updateMessageInfos(const MessageInfoList& listMessageInfo
 	return true;
 }
 
+bool qm::NormalFolder::updateMessageFlags(const MessageInfoList& listMessageInfo)
+{
+	Lock<Account> lock(*getAccount());
+	
+	if (!loadMessageHolders())
+		return false;
+	
+	const unsigned int nMask = MessageHolder::FLAG_SEEN |
+		MessageHolder::FLAG_REPLIED | MessageHolder::FLAG_DRAFT |
+		MessageHolder::FLAG_DELETED | MessageHolder::FLAG_MARKED;
+	
+	// Unlike updateMessageInfos, the list contains only messages which have
+	// been changed, so messages which are not in the list are kept as they are
+	for (MessageInfoList::const_iterator it = listMessageInfo.begin(); it != listMessageInfo.end(); ++it) {
+		MessageHolder* pmh = getMessageHolderById((*it).nId_);
+		if (pmh) {
+			pmh->setFlags((*it).nFlags_, nMask);
+			if (!pmh->setLabel((*it).wstrLabel_))
+				return false;
+		}
+	}
+	
+	return true;
+}
+
 void qm::NormalFolder::setHook(FolderHook* pHook)
 {
 	pImpl_->pHook_ = pHook;
@@ -719,70 +918,63 @@ bool qm::NormalFolder::loadMessageHolders()
 	
 	pImpl_->bModified_ = false;
 	
-	wstring_ptr wstrPath(pImpl_->getPath());
-	
-	MessageHolderList l;
-	CONTAINER_DELETER(deleter, l);
+	wstring_ptr wstrPath(pImpl_->getPath(FileNames::INDEX_EXT));
 	
-	unsigned int nUnseenCount = 0;
-	unsigned int nDownloadCount = 0;
-	unsigned int nDeletedCount = 0;
+	FolderIndexMapping mapping(wstrPath.get());
+	if (!mapping)
+		return false;
 	
-	W2T(wstrPath.get(), ptszPath);
-	WIN32_FIND_DATA fd;
-	AutoFindHandle hFind(::FindFirstFile(ptszPath, &fd));
-	if (hFind.get()) {
-		hFind.close();
-		
-		l.reserve(fd.nFileSizeLow/sizeof(MessageHolder::Init));
-		
-		Log log(InitThread::getInitThread().getLogger(), L"qm::Folder");
-		
-		FileInputStream fileStream(wstrPath.get());
-		if (!fileStream) {
-			log.errorf(L"Failed to open file: %s", wstrPath.get());
+	const MessageHolder::Init* pInit = mapping.getInits();
+	size_t nCount = mapping.getCount();
+	for (size_t n = 1; n < nCount; ++n) {
+		if (pInit[n].nId_ <= pInit[n - 1].nId_) {
+			Log log(InitThread::getInitThread().getLogger(), L"qm::Folder");
+			log.errorf(L"Message's ID is invalid: %s", wstrPath.get());
 			return false;
 		}
-		BufferedInputStream stream(&fileStream, false);
+	}
+	
+	// The index is used directly from the mapped view unless there are
+	// journals to be replayed over it.
+	FolderJournal::InitList listInit;
+	bool bCopied = false;
+	unsigned int nJournalCount = 0;
+	const WCHAR* pwszJournalExts[] = {
+		FileNames::CHECKPOINT_EXT,
+		FileNames::JOURNAL_EXT
+	};
+	for (int n = 0; n < countof(pwszJournalExts); ++n) {
+		wstring_ptr wstrJournalPath(pImpl_->getPath(pwszJournalExts[n]));
+		if (!File::isFileExisting(wstrJournalPath.get()))
+			continue;
 		
-		unsigned int nPrevId = 0;
-		while (true) {
-			MessageHolder::Init init;
-			size_t nRead = stream.read(reinterpret_cast<unsigned char*>(&init), sizeof(init));
-			if (nRead == 0) {
-				break;
-			}
-			else if (nRead != sizeof(init)) {
-				log.errorf(L"Failed to read message index: %s", wstrPath.get());
-				return false;
-			}
-			else if (nPrevId != 0 && init.nId_ <= nPrevId) {
-				log.errorf(L"Message's ID is invalid: %s", wstrPath.get());
-				return false;
-			}
-			nPrevId = init.nId_;
-			
-			std::auto_ptr<MessageHolder> pmh(new MessageHolder(this, init));
-			l.push_back(pmh.get());
-			MessageHolder* p = pmh.release();
-			
-			if (!p->isSeen())
-				++nUnseenCount;
-			if (p->isFlag(MessageHolder::FLAG_DOWNLOAD) ||
-				p->isFlag(MessageHolder::FLAG_DOWNLOADTEXT))
-				++nDownloadCount;
-			if (p->isFlag(MessageHolder::FLAG_DELETED))
-				++nDeletedCount;
+		if (!bCopied) {
+			listInit.assign(pInit, pInit + nCount);
+			bCopied = true;
 		}
+		unsigned int nJournal = 0;
+		if (!FolderJournal::replay(wstrJournalPath.get(), &listInit, &nJournal))
+			return false;
+		nJournalCount += nJournal;
+		
+		pInit = listInit.empty() ? 0 : &listInit[0];
+		nCount = listInit.size();
+	}
+	
+	MessageHolderList l;
+	CONTAINER_DELETER(deleter, l);
+	l.reserve(nCount);
+	for (size_t n = 0; n < nCount; ++n) {
+		std::auto_ptr<MessageHolder> pmh(new MessageHolder(this, pInit[n]));
+		l.push_back(pmh.get());
+		pmh.release();
 	}
 	
 	pImpl_->nMaxId_ = l.empty() ? 0 : l.back()->getId();
 	pImpl_->listMessageHolder_.swap(l);
 	
-	pImpl_->nCount_ = static_cast<unsigned int>(pImpl_->listMessageHolder_.size());
-	pImpl_->nUnseenCount_ = nUnseenCount;
-	pImpl_->nDownloadCount_ = nDownloadCount;
-	pImpl_->nDeletedCount_ = nDeletedCount;
+	pImpl_->countMessages(pInit, nCount);
+	pImpl_->nJournalCount_ = nJournalCount;
 	
 	pImpl_->bLoad_ = true;
 	
@@ -796,27 +988,14 @@ bool qm::NormalFolder::saveMessageHolders()
 	if (!pImpl_->bLoad_ || !pImpl_->bModified_)
 		return true;
 	
-	wstring_ptr wstrPath(pImpl_->getPath());
-	
-	TemporaryFileRenamer renamer(wstrPath.get());
-	
-	FileOutputStream fileStream(renamer.getPath());
-	if (!fileStream)
+	// Only the modified messages are appended to the journal. The index
+	// itself is rewritten when the journal grows too large.
+	if (!pImpl_->saveJournal())
 		return false;
-	BufferedOutputStream stream(&fileStream, false);
-	
-	MessageHolder::Init init;
-	const MessageHolderList& l = pImpl_->listMessageHolder_;
-	for (MessageHolderList::const_iterator it = l.begin(); it != l.end(); ++it) {
-		(*it)->getInit(&init);
-		if (stream.write(reinterpret_cast<unsigned char*>(&init), sizeof(init)) == -1)
+	if (pImpl_->nJournalCount_ > pImpl_->getJournalLimit()) {
+		if (!pImpl_->saveCheckpoint())
 			return false;
 	}
-	if (!stream.close())
-		return false;
-	
-	if (!renamer.rename())
-		return false;
 	
 	pImpl_->bModified_ = false;
 	
@@ -830,9 +1009,19 @@ bool qm::NormalFolder::deletePermanent()
 	if (!pImpl_->unstoreAllMessages())
 		return false;
 	
-	wstring_ptr wstrPath(pImpl_->getPath());
-	W2T(wstrPath.get(), ptszPath);
-	::DeleteFile(ptszPath);
+	pImpl_->waitCheckpoint();
+	
+	const WCHAR* pwszExts[] = {
+		FileNames::INDEX_EXT,
+		FileNames::JOURNAL_EXT,
+		FileNames::CHECKPOINT_EXT,
+		FileNames::THREAD_EXT
+	};
+	for (int n = 0; n < countof(pwszExts); ++n) {
+		wstring_ptr wstrPath(pImpl_->getPath(pwszExts[n]));
+		W2T(wstrPath.get(), ptszPath);
+		::DeleteFile(ptszPath);
+	}
 	
 	getImpl()->fireFolderDestroyed();
 	
@@ -871,7 +1060,7 @@ bool qm::NormalFolder::appendMessage(std::auto_ptr<MessageHolder> pmh,
 	if (!loadMessageHolders())
 		return false;
 	
-	pImpl_->bModified_ = true;
+	pImpl_->setModified(pmh->getId());
 	
 	assert(pImpl_->listMessageHolder_.empty() ||
 		pImpl_->listMessageHolder_.back()->getId() < pmh->getId());
@@ -890,6 +1079,8 @@ bool qm::NormalFolder::appendMessage(std::auto_ptr<MessageHolder> pmh,
 	
 	pImpl_->nMaxId_ = p->getId();
 	
+	getAccount()->getChangeFeed()->add(MessageChangeFeed::TYPE_APPEND, p);
+	
 	MessageHolderList l(1, p);
 	getImpl()->fireMessageAdded(l);
 	
@@ -907,13 +1098,16 @@ void qm::NormalFolder::removeMessages(const MessageHolderList& l)
 	assert(pImpl_->bLoad_);
 	assert(getAccount()->isLocked());
 	
-	pImpl_->bModified_ = true;
+	MessageChangeFeed* pChangeFeed = getAccount()->getChangeFeed();
 	
 	for (MessageHolderList::const_iterator it = l.begin(); it != l.end(); ++it) {
 		MessageHolder* pmh = *it;
 		assert(pmh);
 		assert(pmh->getFolder() == this);
 		
+		pChangeFeed->add(MessageChangeFeed::TYPE_REMOVE, pmh);
+		pImpl_->setModified(pmh->getId());
+		
 		MessageHolderList::iterator itD = std::lower_bound(
 			pImpl_->listMessageHolder_.begin(), pImpl_->listMessageHolder_.end(), pmh,
 			boost::bind(&MessageHolder::getId, _1) < boost::bind(&MessageHolder::getId, _2));
@@ -964,13 +1158,12 @@ bool qm::NormalFolder::moveMessages(const MessageHolderList& l,
 	if (!pFolder->loadMessageHolders())
 		return false;
 	
-	pImpl_->bModified_ = true;
-	pFolder->pImpl_->bModified_ = true;
-	
 	MessageHolderList& listFrom = pImpl_->listMessageHolder_;
 	MessageHolderList& listTo = pFolder->pImpl_->listMessageHolder_;
 	listTo.reserve(listTo.size() + l.size());
 	
+	MessageChangeFeed* pChangeFeed = getAccount()->getChangeFeed();
+	
 	for (MessageHolderList::const_iterator it = l.begin(); it != l.end(); ++it) {
 		MessageHolder* pmh = *it;
 		assert(pmh->getFolder() == this);
@@ -985,9 +1178,13 @@ bool qm::NormalFolder::moveMessages(const MessageHolderList& l,
 			boost::bind(&MessageHolder::getId, _2));
 		assert(itM != listFrom.end() && *itM == pmh);
 		listFrom.erase(itM);
+		unsigned int nOldId = pmh->getId();
+		pImpl_->setModified(nOldId);
 		pmh->setFolder(pFolder);
 		pmh->setId(nId);
+		pChangeFeed->addMove(getId(), nOldId, pmh);
 		listTo.push_back(pmh);
+		pFolder->pImpl_->setModified(nId);
 		
 		--pImpl_->nCount_;
 		++pFolder->pImpl_->nCount_;
@@ -1026,6 +1223,39 @@ bool qm::NormalFolder::moveMessages(const MessageHolderList& l,
 
 struct qm::QueryFolderImpl : public DefaultMessageHolderHandler
 {
+public:
+	class Callback : public SearchCallback
+	{
+	public:
+		Callback(QueryFolderImpl* pImpl,
+				 MessageOperationCallback* pCallback);
+		virtual ~Callback();
+	
+	public:
+		size_t getFoundCount() const;
+	
+	public:
+		virtual bool isCanceled();
+		virtual void setCancelable(bool bCancelable);
+		virtual void setCount(size_t nCount);
+		virtual void step(size_t nStep);
+		virtual void show();
+		virtual void found(const MessageHolderList& l);
+	
+	private:
+		Callback(const Callback&);
+		Callback& operator=(const Callback&);
+	
+	private:
+		QueryFolderImpl* pImpl_;
+		MessageOperationCallback* pCallback_;
+		size_t nFound_;
+	};
+
+public:
+	void add(const MessageHolderList& l);
+	void set(const MessageHolderList& l);
+
 public:
 	virtual void messageHolderFlagsChanged(const MessageHolderEvent& event);
 	virtual void messageHolderDestroyed(const MessageHolderEvent& event);
@@ -1041,6 +1271,38 @@ public:
 	volatile unsigned int nUnseenCount_;
 };
 
+void qm::QueryFolderImpl::add(const MessageHolderList& l)
+{
+	assert(pThis_->getAccount()->isLocked());
+	
+	MessageHolderList::size_type nSize = listMessageHolder_.size();
+	listMessageHolder_.insert(listMessageHolder_.end(), l.begin(), l.end());
+	std::sort(listMessageHolder_.begin() + nSize, listMessageHolder_.end());
+	std::inplace_merge(listMessageHolder_.begin(),
+		listMessageHolder_.begin() + nSize, listMessageHolder_.end());
+	
+	nCount_ += static_cast<unsigned int>(l.size());
+	nUnseenCount_ += static_cast<unsigned int>(std::count_if(l.begin(),
+		l.end(), std::not1(std::mem_fun(&MessageHolder::isSeen))));
+	
+	pThis_->getImpl()->fireMessageAdded(l);
+}
+
+void qm::QueryFolderImpl::set(const MessageHolderList& l)
+{
+	assert(pThis_->getAccount()->isLocked());
+	
+	listMessageHolder_.assign(l.begin(), l.end());
+	std::sort(listMessageHolder_.begin(), listMessageHolder_.end());
+	
+	nCount_ = static_cast<unsigned int>(listMessageHolder_.size());
+	nUnseenCount_ = static_cast<unsigned int>(
+		std::count_if(listMessageHolder_.begin(), listMessageHolder_.end(),
+			std::not1(std::mem_fun(&MessageHolder::isSeen))));
+	
+	pThis_->getImpl()->fireMessageRefreshed();
+}
+
 void qm::QueryFolderImpl::messageHolderFlagsChanged(const MessageHolderEvent& event)
 {
 	MessageHolder* pmh = event.getMessageHolder();
@@ -1078,6 +1340,65 @@ void qm::QueryFolderImpl::messageHolderDestroyed(const MessageHolderEvent& event
 }
 
 
+/****************************************************************************
+ *
+ * QueryFolderImpl::Callback
+ *
+ */
+
+qm::QueryFolderImpl::Callback::Callback(QueryFolderImpl* pImpl,
+										MessageOperationCallback* pCallback) :
+	pImpl_(pImpl),
+	pCallback_(pCallback),
+	nFound_(0)
+{
+}
+
+qm::QueryFolderImpl::Callback::~Callback()
+{
+}
+
+size_t qm::QueryFolderImpl::Callback::getFoundCount() const
+{
+	return nFound_;
+}
+
+bool qm::QueryFolderImpl::Callback::isCanceled()
+{
+	return pCallback_ && pCallback_->isCanceled();
+}
+
+void qm::QueryFolderImpl::Callback::setCancelable(bool bCancelable)
+{
+	if (pCallback_)
+		pCallback_->setCancelable(bCancelable);
+}
+
+void qm::QueryFolderImpl::Callback::setCount(size_t nCount)
+{
+	if (pCallback_)
+		pCallback_->setCount(nCount);
+}
+
+void qm::QueryFolderImpl::Callback::step(size_t nStep)
+{
+	if (pCallback_)
+		pCallback_->step(nStep);
+}
+
+void qm::QueryFolderImpl::Callback::show()
+{
+	if (pCallback_)
+		pCallback_->show();
+}
+
+void qm::QueryFolderImpl::Callback::found(const MessageHolderList& l)
+{
+	pImpl_->add(l);
+	nFound_ += l.size();
+}
+
+
 /****************************************************************************
  *
  * QueryFolder
@@ -1159,11 +1480,12 @@ bool qm::QueryFolder::search(Document* pDocument,
 							 ActionInvoker* pActionInvoker,
 							 HWND hwnd,
 							 Profile* pProfile,
-							 unsigned int nSecurityMode)
+							 unsigned int nSecurityMode,
+							 MessageOperationCallback* pCallback)
 {
 	Lock<Account> lock(*getAccount());
 	
-	pImpl_->listMessageHolder_.clear();
+	pImpl_->set(MessageHolderList());
 	
 	std::auto_ptr<SearchDriver> pDriver(SearchDriverFactory::getDriver(
 		pImpl_->wstrDriver_.get(), pDocument,
@@ -1171,19 +1493,16 @@ bool qm::QueryFolder::search(Document* pDocument,
 	if (!pDriver.get())
 		return true;
 	
-	SearchContext context(pImpl_->wstrCondition_.get(),
-		pImpl_->wstrTargetFolder_.get(), pImpl_->bRecursive_, nSecurityMode);
-	if (!pDriver->search(context, &pImpl_->listMessageHolder_))
+	// Messages found are added while searching if the driver reports them,
+	// and these messages have been kept up to date since then
+	QueryFolderImpl::Callback callback(pImpl_, pCallback);
+	SearchContext context(pImpl_->wstrCondition_.get(), pImpl_->wstrTargetFolder_.get(),
+		pImpl_->bRecursive_, nSecurityMode, &callback);
+	MessageHolderList l;
+	if (!pDriver->search(context, &l))
 		return false;
-	std::sort(pImpl_->listMessageHolder_.begin(), pImpl_->listMessageHolder_.end());
-	
-	pImpl_->nCount_ = static_cast<unsigned int>(pImpl_->listMessageHolder_.size());
-	pImpl_->nUnseenCount_ = static_cast<unsigned int>(
-		std::count_if(pImpl_->listMessageHolder_.begin(),
-			pImpl_->listMessageHolder_.end(),
-			std::not1(std::mem_fun(&MessageHolder::isSeen))));
-	
-	getImpl()->fireMessageRefreshed();
+	if (callback.getFoundCount() != l.size())
+		pImpl_->set(l);
 	
 	return true;
 }
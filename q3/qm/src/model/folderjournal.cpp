@@ -0,0 +1,346 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qsconv.h>
+#include <qsfile.h>
+#include <qsinit.h>
+#include <qslog.h>
+#include <qsosutil.h>
+#include <qsstream.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include "folderjournal.h"
+
+using namespace qm;
+using namespace qs;
+
+
+/****************************************************************************
+ *
+ * FolderJournal
+ *
+ */
+
+bool qm::FolderJournal::append(const WCHAR* pwszPath,
+							   const EntryList& l)
+{
+	assert(pwszPath);
+	
+	if (l.empty())
+		return true;
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::FolderJournal");
+	
+	// BinaryFile::flush doesn't flush the file buffers of the system,
+	// so write the journal through a handle to flush them here.
+	W2T(pwszPath, ptszPath);
+	AutoHandle hFile(::CreateFile(ptszPath, GENERIC_WRITE, 0, 0,
+		OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0));
+	if (!hFile.get()) {
+		log.errorf(L"Failed to open file: %s, %x", pwszPath, ::GetLastError());
+		return false;
+	}
+	
+	DWORD dwSize = ::GetFileSize(hFile.get(), 0);
+	if (dwSize == 0xffffffff) {
+		log.errorf(L"Failed to get size of file: %s", pwszPath);
+		return false;
+	}
+	
+	// Cut a torn entry written by the previous crash off
+	// so that the entries appended here can be replayed.
+	dwSize -= dwSize%sizeof(Entry);
+	if (::SetFilePointer(hFile.get(), dwSize, 0, FILE_BEGIN) == 0xffffffff) {
+		log.errorf(L"Failed to seek file: %s", pwszPath);
+		return false;
+	}
+	
+	DWORD dwWrite = static_cast<DWORD>(l.size()*sizeof(Entry));
+	DWORD dwWritten = 0;
+	if (!::WriteFile(hFile.get(), &l[0], dwWrite, &dwWritten, 0) ||
+		dwWritten != dwWrite ||
+		!::SetEndOfFile(hFile.get()) ||
+		!::FlushFileBuffers(hFile.get())) {
+		log.errorf(L"Failed to write journal: %s, %x", pwszPath, ::GetLastError());
+		return false;
+	}
+	
+	return true;
+}
+
+bool qm::FolderJournal::replay(const WCHAR* pwszPath,
+							   InitList* pList,
+							   unsigned int* pnCount)
+{
+	assert(pwszPath);
+	assert(pList);
+	assert(pnCount);
+	
+	*pnCount = 0;
+	
+	if (!File::isFileExisting(pwszPath))
+		return true;
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::FolderJournal");
+	
+	FileInputStream fileStream(pwszPath);
+	if (!fileStream) {
+		log.errorf(L"Failed to open file: %s", pwszPath);
+		return false;
+	}
+	BufferedInputStream stream(&fileStream, false);
+	
+	while (true) {
+		Entry entry;
+		size_t nRead = stream.read(reinterpret_cast<unsigned char*>(&entry), sizeof(entry));
+		if (nRead == -1) {
+			log.errorf(L"Failed to read journal: %s", pwszPath);
+			return false;
+		}
+		else if (nRead != sizeof(entry)) {
+			if (nRead != 0)
+				log.warnf(L"Ignored a torn entry at the end of journal: %s", pwszPath);
+			break;
+		}
+		
+		if (!apply(entry, pList)) {
+			log.warnf(L"Ignored an invalid entry and following entries in journal: %s", pwszPath);
+			break;
+		}
+		++*pnCount;
+	}
+	
+	return true;
+}
+
+bool qm::FolderJournal::write(const WCHAR* pwszPath,
+							  const InitList& l)
+{
+	assert(pwszPath);
+	
+	TemporaryFileRenamer renamer(pwszPath);
+	
+	FileOutputStream fileStream(renamer.getPath());
+	if (!fileStream)
+		return false;
+	BufferedOutputStream stream(&fileStream, false);
+	
+	for (InitList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		if (stream.write(reinterpret_cast<const unsigned char*>(&*it), sizeof(*it)) == -1)
+			return false;
+	}
+	if (!stream.close())
+		return false;
+	
+	return renamer.rename();
+}
+
+bool qm::FolderJournal::rename(const WCHAR* pwszFrom,
+							   const WCHAR* pwszTo)
+{
+	assert(pwszFrom);
+	assert(pwszTo);
+	
+	W2T(pwszFrom, ptszFrom);
+	W2T(pwszTo, ptszTo);
+	if (!::MoveFile(ptszFrom, ptszTo)) {
+		Log log(InitThread::getInitThread().getLogger(), L"qm::FolderJournal");
+		log.errorf(L"Could not move file: %s, %s, %x", pwszFrom, pwszTo, ::GetLastError());
+		return false;
+	}
+	return true;
+}
+
+bool qm::FolderJournal::remove(const WCHAR* pwszPath)
+{
+	assert(pwszPath);
+	
+	W2T(pwszPath, ptszPath);
+	if (!::DeleteFile(ptszPath) && ::GetLastError() != ERROR_FILE_NOT_FOUND) {
+		Log log(InitThread::getInitThread().getLogger(), L"qm::FolderJournal");
+		log.errorf(L"Could not delete file: %s, %x", pwszPath, ::GetLastError());
+		return false;
+	}
+	return true;
+}
+
+bool qm::FolderJournal::apply(const Entry& entry,
+							  InitList* pList)
+{
+	assert(pList);
+	
+	unsigned int nId = entry.init_.nId_;
+	if (nId == 0)
+		return false;
+	
+	InitList::iterator it = std::lower_bound(pList->begin(), pList->end(), entry.init_,
+		boost::bind(&MessageHolder::Init::nId_, _1) < boost::bind(&MessageHolder::Init::nId_, _2));
+	bool bFound = it != pList->end() && (*it).nId_ == nId;
+	
+	switch (entry.nType_) {
+	case TYPE_UPDATE:
+		if (bFound)
+			*it = entry.init_;
+		else
+			pList->insert(it, entry.init_);
+		break;
+	case TYPE_REMOVE:
+		if (bFound)
+			pList->erase(it);
+		break;
+	default:
+		return false;
+	}
+	
+	return true;
+}
+
+
+/****************************************************************************
+ *
+ * FolderCheckpointThread
+ *
+ */
+
+qm::FolderCheckpointThread::FolderCheckpointThread(const WCHAR* pwszPath,
+												   const WCHAR* pwszCheckpointPath,
+												   FolderJournal::InitList& listInit) :
+	bRunning_(true),
+	bSucceeded_(false)
+{
+	wstrPath_ = allocWString(pwszPath);
+	wstrCheckpointPath_ = allocWString(pwszCheckpointPath);
+	listInit_.swap(listInit);
+}
+
+qm::FolderCheckpointThread::~FolderCheckpointThread()
+{
+}
+
+bool qm::FolderCheckpointThread::isRunning() const
+{
+	return bRunning_;
+}
+
+bool qm::FolderCheckpointThread::isSucceeded() const
+{
+	return bSucceeded_;
+}
+
+void qm::FolderCheckpointThread::run()
+{
+	InitThread init(0);
+	
+	// The journal which has been frozen as the checkpoint journal is removed
+	// only after the new index has been renamed. If we crash in between,
+	// the checkpoint journal is replayed on the new index, which is harmless
+	// because each entry holds the final state of the message.
+	if (FolderJournal::write(wstrPath_.get(), listInit_) &&
+		FolderJournal::remove(wstrCheckpointPath_.get()))
+		bSucceeded_ = true;
+	
+	FolderJournal::InitList().swap(listInit_);
+	
+	bRunning_ = false;
+}
+
+
+/****************************************************************************
+ *
+ * FolderIndexMapping
+ *
+ */
+
+qm::FolderIndexMapping::FolderIndexMapping(const WCHAR* pwszPath) :
+	hFile_(INVALID_HANDLE_VALUE),
+	hMapping_(0),
+	pInits_(0),
+	nCount_(0),
+	bOpened_(false)
+{
+	assert(pwszPath);
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::FolderIndexMapping");
+	
+	W2T(pwszPath, ptszPath);
+#ifdef _WIN32_WCE
+	hFile_ = ::CreateFileForMapping(ptszPath, GENERIC_READ, FILE_SHARE_READ,
+		0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+#else
+	hFile_ = ::CreateFile(ptszPath, GENERIC_READ, FILE_SHARE_READ,
+		0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+#endif
+	if (hFile_ == INVALID_HANDLE_VALUE) {
+		DWORD dwError = ::GetLastError();
+		if (dwError == ERROR_FILE_NOT_FOUND || dwError == ERROR_PATH_NOT_FOUND)
+			bOpened_ = true;
+		else
+			log.errorf(L"Failed to open file: %s, %x", pwszPath, dwError);
+		return;
+	}
+	
+	DWORD dwSize = ::GetFileSize(hFile_, 0);
+	if (dwSize == 0xffffffff) {
+		log.errorf(L"Failed to get size of file: %s", pwszPath);
+		return;
+	}
+	else if (dwSize % sizeof(MessageHolder::Init) != 0) {
+		log.errorf(L"Failed to read message index: %s", pwszPath);
+		return;
+	}
+	else if (dwSize == 0) {
+		// An empty file cannot be mapped
+		bOpened_ = true;
+		return;
+	}
+	
+	hMapping_ = ::CreateFileMapping(hFile_, 0, PAGE_READONLY, 0, 0, 0);
+	if (!hMapping_) {
+		log.errorf(L"Failed to map file: %s, %x", pwszPath, ::GetLastError());
+		return;
+	}
+	
+	pInits_ = static_cast<const MessageHolder::Init*>(
+		::MapViewOfFile(hMapping_, FILE_MAP_READ, 0, 0, 0));
+	if (!pInits_) {
+		log.errorf(L"Failed to map file: %s, %x", pwszPath, ::GetLastError());
+		return;
+	}
+	
+	nCount_ = dwSize/sizeof(MessageHolder::Init);
+	bOpened_ = true;
+}
+
+qm::FolderIndexMapping::~FolderIndexMapping()
+{
+	if (pInits_)
+		::UnmapViewOfFile(const_cast<MessageHolder::Init*>(pInits_));
+	if (hMapping_)
+		::CloseHandle(hMapping_);
+	if (hFile_ != INVALID_HANDLE_VALUE)
+		::CloseHandle(hFile_);
+}
+
+bool qm::FolderIndexMapping::operator!() const
+{
+	return !bOpened_;
+}
+
+const MessageHolder::Init* qm::FolderIndexMapping::getInits() const
+{
+	return pInits_;
+}
+
+size_t qm::FolderIndexMapping::getCount() const
+{
+	return nCount_;
+}
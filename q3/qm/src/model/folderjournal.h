@@ -0,0 +1,182 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#ifndef __FOLDERJOURNAL_H__
+#define __FOLDERJOURNAL_H__
+
+#include <qmmessageholder.h>
+
+#include <qs.h>
+#include <qsstring.h>
+#include <qsthread.h>
+
+#include <vector>
+
+
+namespace qm {
+
+class FolderJournal;
+class FolderCheckpointThread;
+class FolderIndexMapping;
+
+
+/****************************************************************************
+ *
+ * FolderJournal
+ *
+ */
+
+class FolderJournal
+{
+public:
+	enum Type {
+		TYPE_UPDATE	= 0x4a4e0001,
+		TYPE_REMOVE	= 0x4a4e0002
+	};
+	
+	struct Entry
+	{
+		unsigned int nType_;
+		MessageHolder::Init init_;
+	};
+
+public:
+	typedef std::vector<MessageHolder::Init> InitList;
+	typedef std::vector<Entry> EntryList;
+
+public:
+	/**
+	 * Append entries to the journal and flush it to the disk.
+	 *
+	 * @param pwszPath [in] Path of the journal.
+	 * @param l [in] Entries to append.
+	 * @return true if success, false otherwise.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	static bool append(const WCHAR* pwszPath,
+					   const EntryList& l);
+	
+	/**
+	 * Apply entries in the journal to the list of init records.
+	 * A torn entry at the end of the journal is silently ignored.
+	 *
+	 * @param pwszPath [in] Path of the journal. It's ok if it doesn't exist.
+	 * @param pList [in] List sorted by id. This is updated in place.
+	 * @param pnCount [out] The number of entries applied.
+	 * @return true if success, false otherwise.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	static bool replay(const WCHAR* pwszPath,
+					   InitList* pList,
+					   unsigned int* pnCount);
+	
+	/**
+	 * Write init records as a new folder index file.
+	 *
+	 * @param pwszPath [in] Path of the folder index.
+	 * @param l [in] Init records sorted by id.
+	 * @return true if success, false otherwise.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	static bool write(const WCHAR* pwszPath,
+					  const InitList& l);
+	
+	/**
+	 * Rename a file. Fails if the destination already exists.
+	 *
+	 * @return true if success, false otherwise.
+	 */
+	static bool rename(const WCHAR* pwszFrom,
+					   const WCHAR* pwszTo);
+	
+	/**
+	 * Remove a file. It's ok if it doesn't exist.
+	 *
+	 * @return true if success, false otherwise.
+	 */
+	static bool remove(const WCHAR* pwszPath);
+
+private:
+	static bool apply(const Entry& entry,
+					  InitList* pList);
+};
+
+
+/****************************************************************************
+ *
+ * FolderCheckpointThread
+ *
+ */
+
+class FolderCheckpointThread : public qs::Thread
+{
+public:
+	FolderCheckpointThread(const WCHAR* pwszPath,
+						   const WCHAR* pwszCheckpointPath,
+						   FolderJournal::InitList& listInit);
+	virtual ~FolderCheckpointThread();
+
+public:
+	bool isRunning() const;
+	bool isSucceeded() const;
+
+public:
+	virtual void run();
+
+private:
+	FolderCheckpointThread(const FolderCheckpointThread&);
+	FolderCheckpointThread& operator=(const FolderCheckpointThread&);
+
+private:
+	qs::wstring_ptr wstrPath_;
+	qs::wstring_ptr wstrCheckpointPath_;
+	FolderJournal::InitList listInit_;
+	volatile bool bRunning_;
+	volatile bool bSucceeded_;
+};
+
+
+/****************************************************************************
+ *
+ * FolderIndexMapping
+ *
+ */
+
+class FolderIndexMapping
+{
+public:
+	/**
+	 * Map the folder index file into memory read-only.
+	 * If the file doesn't exist, the mapping is empty but valid.
+	 *
+	 * @param pwszPath [in] Path of the folder index.
+	 */
+	explicit FolderIndexMapping(const WCHAR* pwszPath);
+	~FolderIndexMapping();
+
+public:
+	bool operator!() const;
+
+public:
+	const MessageHolder::Init* getInits() const;
+	size_t getCount() const;
+
+private:
+	FolderIndexMapping(const FolderIndexMapping&);
+	FolderIndexMapping& operator=(const FolderIndexMapping&);
+
+private:
+	HANDLE hFile_;
+	HANDLE hMapping_;
+	const MessageHolder::Init* pInits_;
+	size_t nCount_;
+	bool bOpened_;
+};
+
+}
+
+#endif // __FOLDERJOURNAL_H__
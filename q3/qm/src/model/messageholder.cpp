@@ -62,6 +62,11 @@ qm::MessageHolderBase::~MessageHolderBase()
 {
 }
 
+wstring_ptr qm::MessageHolderBase::getIndex(MessageIndexName name) const
+{
+	return 0;
+}
+
 
 /****************************************************************************
  *
@@ -193,6 +198,11 @@ unsigned int qm::MessageHolder::getReferenceHash() const
 	return nReferenceHash_;
 }
 
+unsigned int qm::MessageHolder::hashMessageId(const WCHAR* pwszMessageId)
+{
+	return MessageHolderImpl::hash(pwszMessageId);
+}
+
 void qm::MessageHolder::getInit(Init* pInit) const
 {
 	Lock<Account> lock(*getAccount());
@@ -0,0 +1,211 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#include <qmaccount.h>
+#include <qmmacro.h>
+#include <qmmessage.h>
+#include <qmmessageholder.h>
+
+#include <qsassert.h>
+
+#include "messageholdersnapshot.h"
+
+using namespace qm;
+using namespace qs;
+
+
+/****************************************************************************
+ *
+ * MessageHolderSnapshot
+ *
+ */
+
+qm::MessageHolderSnapshot::MessageHolderSnapshot() :
+	pmh_(0),
+	nId_(0),
+	nFlags_(0),
+	nSize_(0),
+	nTextSize_(0)
+{
+}
+
+qm::MessageHolderSnapshot::~MessageHolderSnapshot()
+{
+}
+
+bool qm::MessageHolderSnapshot::load(MessageHolder* pmh,
+									 const MacroFieldPlan& plan,
+									 unsigned int nSecurityMode)
+{
+	assert(pmh);
+	assert(pmh->getAccount()->isLocked());
+	
+	pmh_ = pmh;
+	nId_ = pmh->getId();
+	nFlags_ = pmh->getFlags();
+	pmh->getDate(&date_);
+	nSize_ = pmh->getSize();
+	nTextSize_ = pmh->getTextSize();
+	
+	for (int n = 0; n < NAME_MAX; ++n) {
+		MessageIndexName name = static_cast<MessageIndexName>(n);
+		if (plan.isIndex(name))
+			wstrIndex_[n] = pmh->getIndex(name);
+		else
+			wstrIndex_[n].reset(0);
+	}
+	
+	msg_.clear();
+	
+	unsigned int nFlags = 0;
+	switch (plan.getMessageType()) {
+	case MacroContext::MESSAGETYPE_NONE:
+		break;
+	case MacroContext::MESSAGETYPE_HEADER:
+		nFlags = Account::GMF_HEADER;
+		break;
+	case MacroContext::MESSAGETYPE_TEXT:
+		nFlags = Account::GMF_TEXT;
+		break;
+	case MacroContext::MESSAGETYPE_ALL:
+		nFlags = Account::GMF_ALL;
+		break;
+	default:
+		assert(false);
+		break;
+	}
+	if (nFlags && !pmh->getMessage(nFlags, 0, nSecurityMode, &msg_))
+		return false;
+	
+	return true;
+}
+
+MessageHolder* qm::MessageHolderSnapshot::getOriginal() const
+{
+	return pmh_;
+}
+
+Message* qm::MessageHolderSnapshot::getMessage()
+{
+	return &msg_;
+}
+
+unsigned int qm::MessageHolderSnapshot::getId() const
+{
+	return nId_;
+}
+
+unsigned int qm::MessageHolderSnapshot::getFlags() const
+{
+	return nFlags_;
+}
+
+wstring_ptr qm::MessageHolderSnapshot::getFrom() const
+{
+	wstring_ptr wstrFrom(getIndex(NAME_FROM));
+	if (!wstrFrom.get())
+		wstrFrom = allocWString(L"");
+	return wstrFrom;
+}
+
+wstring_ptr qm::MessageHolderSnapshot::getTo() const
+{
+	wstring_ptr wstrTo(getIndex(NAME_TO));
+	if (!wstrTo.get())
+		wstrTo = allocWString(L"");
+	return wstrTo;
+}
+
+wstring_ptr qm::MessageHolderSnapshot::getFromTo() const
+{
+	if (nFlags_ & FLAG_SENT)
+		return getTo();
+	else
+		return getFrom();
+}
+
+wstring_ptr qm::MessageHolderSnapshot::getSubject() const
+{
+	wstring_ptr wstrSubject(getIndex(NAME_SUBJECT));
+	if (!wstrSubject.get())
+		wstrSubject = allocWString(L"");
+	return wstrSubject;
+}
+
+void qm::MessageHolderSnapshot::getDate(Time* pTime) const
+{
+	assert(pTime);
+	*pTime = date_;
+}
+
+unsigned int qm::MessageHolderSnapshot::getSize() const
+{
+	return nSize_;
+}
+
+unsigned int qm::MessageHolderSnapshot::getTextSize() const
+{
+	return nTextSize_;
+}
+
+NormalFolder* qm::MessageHolderSnapshot::getFolder() const
+{
+	assert(pmh_);
+	return pmh_->getFolder();
+}
+
+Account* qm::MessageHolderSnapshot::getAccount() const
+{
+	assert(pmh_);
+	return pmh_->getAccount();
+}
+
+bool qm::MessageHolderSnapshot::getMessage(unsigned int nFlags,
+										   const WCHAR* pwszField,
+										   unsigned int nSecurityMode,
+										   Message* pMessage)
+{
+	assert(pMessage);
+	
+	// Nothing is loaded here because the account is not locked. A part
+	// which the field plan refers has been loaded by load.
+	int nMethod = nFlags & Account::GMF_METHOD_MASK;
+	switch (pMessage->getFlag()) {
+	case Message::FLAG_EMPTY:
+		return false;
+	case Message::FLAG_NONE:
+		return true;
+	case Message::FLAG_HEADERONLY:
+		return nMethod == Account::GMF_HEADER;
+	case Message::FLAG_TEXTONLY:
+		return nMethod == Account::GMF_HEADER ||
+			nMethod == Account::GMF_TEXT;
+	case Message::FLAG_HTMLONLY:
+		return nMethod == Account::GMF_HEADER ||
+			nMethod == Account::GMF_TEXT ||
+			nMethod == Account::GMF_HTML;
+	case Message::FLAG_TEMPORARY:
+		return false;
+	default:
+		assert(false);
+		return false;
+	}
+}
+
+MessageHolder* qm::MessageHolderSnapshot::getMessageHolder()
+{
+	return 0;
+}
+
+wstring_ptr qm::MessageHolderSnapshot::getIndex(MessageIndexName name) const
+{
+	assert(name < NAME_MAX);
+	
+	if (!wstrIndex_[name].get())
+		return 0;
+	return allocWString(wstrIndex_[name].get());
+}
@@ -0,0 +1,101 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#ifndef __MESSAGEHOLDERSNAPSHOT_H__
+#define __MESSAGEHOLDERSNAPSHOT_H__
+
+#include <qm.h>
+#include <qmmessage.h>
+#include <qmmessageholder.h>
+#include <qmmessageindex.h>
+
+#include <qs.h>
+#include <qsstring.h>
+#include <qsutil.h>
+
+
+namespace qm {
+
+class MessageHolderSnapshot;
+
+class MacroFieldPlan;
+
+
+/****************************************************************************
+ *
+ * MessageHolderSnapshot
+ *
+ * Copy of a message holder which is taken while the account is locked.
+ * Values of the index and parts of the message which a field plan refers
+ * are copied by load, so that a macro can be evaluated against it by
+ * another thread without locking the account. getMessageHolder returns
+ * null so that a function which modifies the message fails instead of
+ * touching the original message holder.
+ *
+ */
+
+class MessageHolderSnapshot : public MessageHolderBase
+{
+public:
+	MessageHolderSnapshot();
+	virtual ~MessageHolderSnapshot();
+
+public:
+	/**
+	 * Copy the message holder.
+	 * The account must be locked.
+	 *
+	 * @param pmh [in] Message holder.
+	 * @param plan [in] Field plan which tells what is copied.
+	 * @param nSecurityMode [in] Security mode.
+	 * @return true if success, false otherwise.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	bool load(MessageHolder* pmh,
+			  const MacroFieldPlan& plan,
+			  unsigned int nSecurityMode);
+	
+	MessageHolder* getOriginal() const;
+	Message* getMessage();
+
+public:
+	virtual unsigned int getId() const;
+	virtual unsigned int getFlags() const;
+	virtual qs::wstring_ptr getFrom() const;
+	virtual qs::wstring_ptr getTo() const;
+	virtual qs::wstring_ptr getFromTo() const;
+	virtual qs::wstring_ptr getSubject() const;
+	virtual void getDate(qs::Time* pTime) const;
+	virtual unsigned int getSize() const;
+	virtual unsigned int getTextSize() const;
+	virtual NormalFolder* getFolder() const;
+	virtual Account* getAccount() const;
+	virtual bool getMessage(unsigned int nFlags,
+							const WCHAR* pwszField,
+							unsigned int nSecurityMode,
+							Message* pMessage);
+	virtual MessageHolder* getMessageHolder();
+	virtual qs::wstring_ptr getIndex(MessageIndexName name) const;
+
+private:
+	MessageHolderSnapshot(const MessageHolderSnapshot&);
+	MessageHolderSnapshot& operator=(const MessageHolderSnapshot&);
+
+private:
+	MessageHolder* pmh_;
+	unsigned int nId_;
+	unsigned int nFlags_;
+	qs::Time date_;
+	unsigned int nSize_;
+	unsigned int nTextSize_;
+	qs::wstring_ptr wstrIndex_[NAME_MAX];
+	Message msg_;
+};
+
+}
+
+#endif // __MESSAGEHOLDERSNAPSHOT_H__
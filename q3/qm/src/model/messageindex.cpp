@@ -7,6 +7,8 @@
 
 #pragma warning(disable:4786)
 
+#include <algorithm>
+
 #include <boost/bind.hpp>
 
 #include "messageindex.h"
@@ -23,91 +25,102 @@ using namespace qs;
  */
 
 qm::MessageIndex::MessageIndex(MessageStore* pMessageStore,
-							   size_t nMaxSize) :
+							   size_t nMaxSize,
+							   size_t nMaxMemory) :
 	pMessageStore_(pMessageStore),
 	nMaxSize_(nMaxSize),
-	pNewFirst_(0),
-	pNewLast_(0),
-	pLastGotten_(0)
+	nMaxMemory_(nMaxMemory),
+	nGeneration_(0)
 {
-	pNewFirst_ = new MessageIndexItem(-1);
-	pNewFirst_->pNewNext_ = pNewFirst_;
-	pNewFirst_->pNewPrev_ = pNewFirst_;
-	pNewLast_ = pNewFirst_;
+	// Limits are applied to each shard
+	if (nMaxSize_ != 0 && nMaxSize_ != -1)
+		nMaxSize_ = QSMAX(nMaxSize_/SHARD_COUNT, static_cast<size_t>(1));
+	if (nMaxMemory_ != -1)
+		nMaxMemory_ /= SHARD_COUNT;
+	
+	for (int n = 0; n < SHARD_COUNT; ++n) {
+		Shard& shard = shards_[n];
+		shard.pNewFirst_ = new MessageIndexItem(-1);
+		shard.pNewFirst_->pNewNext_ = shard.pNewFirst_;
+		shard.pNewFirst_->pNewPrev_ = shard.pNewFirst_;
+		shard.pNewLast_ = shard.pNewFirst_;
+		shard.pLastGotten_ = 0;
+		shard.nSize_ = 0;
+		shard.nHit_ = 0;
+		shard.nMiss_ = 0;
+		shard.nEviction_ = 0;
+	}
 }
 
 qm::MessageIndex::~MessageIndex()
 {
+	for (int n = 0; n < SHARD_COUNT; ++n) {
+		Shard& shard = shards_[n];
 #if defined _WIN32_WCE && _MSC_VER == 1202 && defined MIPS
-	for (ItemMap::const_iterator it = map_.begin(); it != map_.end(); ++it)
-		delete (*it).second;
+		for (ItemMap::const_iterator it = shard.map_.begin(); it != shard.map_.end(); ++it)
+			delete (*it).second;
 #else
-	std::for_each(map_.begin(), map_.end(),
-		boost::bind(boost::checked_deleter<MessageIndexItem>(),
-			boost::bind(&ItemMap::value_type::second, _1)));
+		std::for_each(shard.map_.begin(), shard.map_.end(),
+			boost::bind(boost::checked_deleter<MessageIndexItem>(),
+				boost::bind(&ItemMap::value_type::second, _1)));
 #endif
-	delete pNewLast_;
+		delete shard.pNewLast_;
+	}
 }
 
 wstring_ptr qm::MessageIndex::get(unsigned int nKey,
 								  unsigned int nLength,
 								  MessageIndexName name)
 {
-	wstring_ptr wstrValue;
+	Shard& shard = getShard(nKey);
+	unsigned int nGeneration = getGeneration();
 	
-	MessageIndexItem* pItem = getItem(nKey);
-	if (pItem) {
-		const WCHAR* pwszValue = pItem->getValue(name);
-		wstrValue = allocWString(pwszValue ? pwszValue : L"");
+	{
+		Lock<CriticalSection> lock(shard.cs_);
 		
-		if (pItem != pNewFirst_) {
-			MessageIndexItem* pNext = pItem->pNewNext_;
-			MessageIndexItem* pPrev = pItem->pNewPrev_;
-			pNext->pNewPrev_ = pPrev;
-			pPrev->pNewNext_ = pNext;
+		MessageIndexItem* pItem = getItem(shard, nKey);
+		if (pItem) {
+			++shard.nHit_;
+			touch(shard, pItem);
+			shard.pLastGotten_ = pItem;
 			
-			MessageIndexItem* pFirst = pNewFirst_;
-			pNewFirst_ = pItem;
-			pItem->pNewPrev_ = pNewLast_;
-			pItem->pNewNext_ = pFirst;
-			pFirst->pNewPrev_ = pItem;
+			const WCHAR* pwszValue = pItem->getValue(name);
+			return allocWString(pwszValue ? pwszValue : L"");
 		}
+		++shard.nMiss_;
 	}
-	else {
-		malloc_ptr<unsigned char> pData(pMessageStore_->readIndex(nKey, nLength));
-		if (!pData.get())
-			return allocWString(L"");
-		
-		const WCHAR* pwszValues[NAME_MAX] = { 0 };
-		parseValues(reinterpret_cast<WCHAR*>(pData.get()), nLength/sizeof(WCHAR), pwszValues);
-		
-		if (nMaxSize_ != 0) {
-			std::auto_ptr<MessageIndexItem> p(new MessageIndexItem(nKey, pData, pwszValues));
-			pItem = p.get();
-			insert(p);
-			if (map_.size() > nMaxSize_)
-				remove(pNewLast_->pNewPrev_->getKey());
-		}
-		
-		const WCHAR* pwszValue = pwszValues[name];
-		wstrValue = allocWString(pwszValue ? pwszValue : L"");
+	
+	std::auto_ptr<MessageIndexItem> pItem(loadItem(nKey, nLength));
+	if (!pItem.get())
+		return allocWString(L"");
+	
+	const WCHAR* pwszValue = pItem->getValue(name);
+	wstring_ptr wstrValue(allocWString(pwszValue ? pwszValue : L""));
+	
+	if (nMaxSize_ != 0) {
+		Lock<CriticalSection> lock(shard.cs_);
+		insert(shard, pItem, nGeneration);
 	}
-	if (pItem)
-		pLastGotten_ = pItem;
 	
 	return wstrValue;
 }
 
 void qm::MessageIndex::remove(unsigned int nKey)
 {
-	ItemMap::iterator it = map_.find(nKey);
-	if (it != map_.end())
-		remove(it);
+	::InterlockedIncrement(const_cast<LONG*>(&nGeneration_));
+	
+	Shard& shard = getShard(nKey);
+	Lock<CriticalSection> lock(shard.cs_);
+	ItemMap::iterator it = shard.map_.find(nKey);
+	if (it != shard.map_.end())
+		remove(shard, it);
 }
 
 bool qm::MessageIndex::isPrepared(unsigned int nKey) const
 {
-	return getItem(nKey) != 0;
+	Shard& shard = getShard(nKey);
+	Lock<CriticalSection> lock(shard.cs_);
+	return getItem(shard, nKey) != 0;
 }
 
 void qm::MessageIndex::prepare(unsigned int nKey,
@@ -116,20 +129,77 @@ void qm::MessageIndex::prepare(unsigned int nKey,
 	if (nMaxSize_ == 0)
 		return;
 	
-	MessageIndexItem* pItem = getItem(nKey);
-	if (!pItem) {
-		malloc_ptr<unsigned char> pData(pMessageStore_->readIndex(nKey, nLength));
-		if (!pData.get())
+	Shard& shard = getShard(nKey);
+	unsigned int nGeneration = getGeneration();
+	
+	{
+		Lock<CriticalSection> lock(shard.cs_);
+		if (getItem(shard, nKey))
 			return;
-		
-		const WCHAR* pwszValues[NAME_MAX] = { 0 };
-		parseValues(reinterpret_cast<WCHAR*>(pData.get()), nLength/sizeof(WCHAR), pwszValues);
-		
-		std::auto_ptr<MessageIndexItem> pItem(new MessageIndexItem(nKey, pData, pwszValues));
-		insert(pItem);
-		if (map_.size() > nMaxSize_)
-			remove(pNewLast_->pNewPrev_->getKey());
 	}
+	
+	std::auto_ptr<MessageIndexItem> pItem(loadItem(nKey, nLength));
+	if (!pItem.get())
+		return;
+	
+	Lock<CriticalSection> lock(shard.cs_);
+	insert(shard, pItem, nGeneration);
+}
+
+void qm::MessageIndex::prepare(const MessageIndexKeyList& l,
+							   unsigned int nGeneration)
+{
+	if (nMaxSize_ == 0)
+		return;
+	
+	MessageIndexKeyList listKey;
+	for (MessageIndexKeyList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		Shard& shard = getShard((*it).first);
+		Lock<CriticalSection> lock(shard.cs_);
+		if (!getItem(shard, (*it).first))
+			listKey.push_back(*it);
+	}
+	if (listKey.empty())
+		return;
+	std::sort(listKey.begin(), listKey.end());
+	
+	class CallbackImpl : public MessageStoreReadIndexCallback
+	{
+	public:
+		CallbackImpl(MessageIndex* pIndex,
+					 unsigned int nGeneration) :
+			pIndex_(pIndex),
+			nGeneration_(nGeneration)
+		{
+		}
+		
+		virtual ~CallbackImpl()
+		{
+		}
+	
+	public:
+		virtual void read(unsigned int nKey,
+						  unsigned int nLength,
+						  malloc_ptr<unsigned char> pData)
+		{
+			std::auto_ptr<MessageIndexItem> pItem(createItem(nKey, nLength, pData));
+			
+			Shard& shard = pIndex_->getShard(nKey);
+			Lock<CriticalSection> lock(shard.cs_);
+			pIndex_->insert(shard, pItem, nGeneration_);
+		}
+	
+	private:
+		MessageIndex* pIndex_;
+		unsigned int nGeneration_;
+	} callback(this, nGeneration);
+	
+	pMessageStore_->readIndex(listKey, &callback);
+}
+
+unsigned int qm::MessageIndex::getGeneration() const
+{
+	return nGeneration_;
 }
 
 malloc_size_ptr<unsigned char> qm::MessageIndex::createReplacedIndex(unsigned int nKey,
@@ -137,31 +207,38 @@ malloc_size_ptr<unsigned char> qm::MessageIndex::createReplacedIndex(unsigned in
 																	 MessageIndexName name,
 																	 const WCHAR* pwszValue)
 {
-	ByteOutputStream stream;
-	
-	MessageIndexItem* pItem = getItem(nKey);
+	{
+		Shard& shard = getShard(nKey);
+		Lock<CriticalSection> lock(shard.cs_);
+		
+		MessageIndexItem* pItem = getItem(shard, nKey);
+		if (pItem)
+			return createReplacedIndex(pItem->pwszValues_, name, pwszValue);
+	}
 	
-	malloc_ptr<unsigned char> pData;
+	malloc_ptr<unsigned char> pData(pMessageStore_->readIndex(nKey, nLength));
+	if (!pData.get())
+		return malloc_size_ptr<unsigned char>();
 	const WCHAR* pwszValues[NAME_MAX] = { 0 };
-	if (!pItem) {
-		pData = pMessageStore_->readIndex(nKey, nLength);
-		if (!pData.get())
-			return malloc_size_ptr<unsigned char>();
-		parseValues(reinterpret_cast<WCHAR*>(pData.get()), nLength/sizeof(WCHAR), pwszValues);
-	}
+	parseValues(reinterpret_cast<WCHAR*>(pData.get()), nLength/sizeof(WCHAR), pwszValues);
 	
-	for (int n = 0; n < NAME_MAX; ++n) {
-		const WCHAR* p = 0;
-		if (n != name)
-			p = pItem ? pItem->getValue(static_cast<MessageIndexName>(n)) : pwszValues[n];
-		else
-			p = pwszValue;
-		if (!writeToStream(&stream, p))
-			return malloc_size_ptr<unsigned char>();
-	}
+	return createReplacedIndex(pwszValues, name, pwszValue);
+}
+
+void qm::MessageIndex::getStats(Stats* pStats) const
+{
+	assert(pStats);
 	
-	size_t nLen = stream.getLength();
-	return malloc_size_ptr<unsigned char>(stream.releaseBuffer(), nLen);
+	memset(pStats, 0, sizeof(*pStats));
+	for (int n = 0; n < SHARD_COUNT; ++n) {
+		const Shard& shard = shards_[n];
+		Lock<CriticalSection> lock(shard.cs_);
+		pStats->nHit_ += shard.nHit_;
+		pStats->nMiss_ += shard.nMiss_;
+		pStats->nEviction_ += shard.nEviction_;
+		pStats->nCount_ += shard.map_.size();
+		pStats->nSize_ += shard.nSize_;
+	}
 }
 
 malloc_size_ptr<unsigned char> qm::MessageIndex::createIndex(const Message& header,
@@ -196,60 +273,159 @@ malloc_size_ptr<unsigned char> qm::MessageIndex::createIndex(const Message& head
 	if (!writeToStream(&stream, pwszMessageId))
 		return malloc_size_ptr<unsigned char>();
 	
-	wstring_ptr wstrReference(PartUtil(header).getReference());
+	PartUtil util(header);
+	wstring_ptr wstrReference(util.getReference());
 	if (!writeToStream(&stream, wstrReference.get()))
 		return malloc_size_ptr<unsigned char>();
 	
 	if (!writeToStream(&stream, pwszLabel))
 		return malloc_size_ptr<unsigned char>();
 	
+	// All the references are written only when there are more than one,
+	// otherwise they are the same as the reference above
+	PartUtil::ReferenceList listReference;
+	CONTAINER_DELETER(free, listReference, &freeWString);
+	util.getReferences(&listReference);
+	StringBuffer<WSTRING> bufReferences;
+	if (listReference.size() > 1) {
+		for (PartUtil::ReferenceList::const_iterator it = listReference.begin(); it != listReference.end(); ++it) {
+			if (it != listReference.begin())
+				bufReferences.append(L' ');
+			bufReferences.append(*it);
+		}
+	}
+	if (!writeToStream(&stream, bufReferences.getCharArray()))
+		return malloc_size_ptr<unsigned char>();
+	
 	size_t nLen = stream.getLength();
 	return malloc_size_ptr<unsigned char>(stream.releaseBuffer(), nLen);
 }
 
-MessageIndexItem* qm::MessageIndex::getItem(unsigned int nKey) const
+MessageIndex::Shard& qm::MessageIndex::getShard(unsigned int nKey) const
+{
+	return shards_[nKey%SHARD_COUNT];
+}
+
+MessageIndexItem* qm::MessageIndex::getItem(Shard& shard,
+											unsigned int nKey) const
 {
 	MessageIndexItem* pItem = 0;
-	if (pLastGotten_ && pLastGotten_->getKey() == nKey)
-		pItem = pLastGotten_;
+	if (shard.pLastGotten_ && shard.pLastGotten_->getKey() == nKey)
+		pItem = shard.pLastGotten_;
 	if (!pItem) {
-		ItemMap::const_iterator it = map_.find(nKey);
-		if (it != map_.end())
+		ItemMap::const_iterator it = shard.map_.find(nKey);
+		if (it != shard.map_.end())
 			pItem = (*it).second;
 	}
 	return pItem;
 }
 
-void qm::MessageIndex::insert(std::auto_ptr<MessageIndexItem> pItem)
+std::auto_ptr<MessageIndexItem> qm::MessageIndex::loadItem(unsigned int nKey,
+														   unsigned int nLength) const
 {
-	map_.insert(std::make_pair(pItem->getKey(), pItem.get()));
+	malloc_ptr<unsigned char> pData(pMessageStore_->readIndex(nKey, nLength));
+	if (!pData.get())
+		return std::auto_ptr<MessageIndexItem>(0);
+	return createItem(nKey, nLength, pData);
+}
+
+void qm::MessageIndex::touch(Shard& shard,
+							 MessageIndexItem* pItem)
+{
+	if (pItem == shard.pNewFirst_)
+		return;
+	
+	MessageIndexItem* pNext = pItem->pNewNext_;
+	MessageIndexItem* pPrev = pItem->pNewPrev_;
+	pNext->pNewPrev_ = pPrev;
+	pPrev->pNewNext_ = pNext;
+	
+	MessageIndexItem* pFirst = shard.pNewFirst_;
+	shard.pNewFirst_ = pItem;
+	pItem->pNewPrev_ = shard.pNewLast_;
+	pItem->pNewNext_ = pFirst;
+	pFirst->pNewPrev_ = pItem;
+}
+
+void qm::MessageIndex::insert(Shard& shard,
+							  std::auto_ptr<MessageIndexItem> pItem,
+							  unsigned int nGeneration)
+{
+	// Don't cache an index read with a key which may have been freed
+	// and reused while reading it without the lock
+	if (nGeneration != getGeneration())
+		return;
+	if (shard.map_.find(pItem->getKey()) != shard.map_.end())
+		return;
+	
+	shard.map_.insert(std::make_pair(pItem->getKey(), pItem.get()));
 	MessageIndexItem* p = pItem.release();
+	shard.nSize_ += p->getSize();
 	
-	pNewFirst_->pNewPrev_ = p;
-	p->pNewNext_ = pNewFirst_;
-	pNewFirst_ = p;
+	shard.pNewFirst_->pNewPrev_ = p;
+	p->pNewPrev_ = shard.pNewLast_;
+	p->pNewNext_ = shard.pNewFirst_;
+	shard.pNewFirst_ = p;
+	
+	while (!shard.map_.empty() &&
+		(shard.map_.size() > nMaxSize_ || shard.nSize_ > nMaxMemory_)) {
+		remove(shard, shard.map_.find(shard.pNewLast_->pNewPrev_->getKey()));
+		++shard.nEviction_;
+	}
 }
 
-void qm::MessageIndex::remove(ItemMap::iterator it)
+void qm::MessageIndex::remove(Shard& shard,
+							  ItemMap::iterator it)
 {
-	assert(it != map_.end());
+	assert(it != shard.map_.end());
 	
 	std::auto_ptr<MessageIndexItem> pItem((*it).second);
 	
 #if defined _WIN32_WCE && _MSC_VER == 1202 && defined MIPS
-	map_.erase((*it).first);
+	shard.map_.erase((*it).first);
 #else
-	map_.erase(it);
+	shard.map_.erase(it);
 #endif
 	
-	if (pItem.get() == pNewFirst_)
-		pNewFirst_ = pItem->pNewNext_;
+	if (pItem.get() == shard.pNewFirst_)
+		shard.pNewFirst_ = pItem->pNewNext_;
 	else
 		pItem->pNewPrev_->pNewNext_ = pItem->pNewNext_;
 	pItem->pNewNext_->pNewPrev_ = pItem->pNewPrev_;
 	
-	if (pItem.get() == pLastGotten_)
-		pLastGotten_ = 0;
+	assert(shard.nSize_ >= pItem->getSize());
+	shard.nSize_ -= pItem->getSize();
+	
+	if (pItem.get() == shard.pLastGotten_)
+		shard.pLastGotten_ = 0;
+}
+
+std::auto_ptr<MessageIndexItem> qm::MessageIndex::createItem(unsigned int nKey,
+															 unsigned int nLength,
+															 malloc_ptr<unsigned char> pData)
+{
+	const WCHAR* pwszValues[NAME_MAX] = { 0 };
+	parseValues(reinterpret_cast<WCHAR*>(pData.get()), nLength/sizeof(WCHAR), pwszValues);
+	
+	size_t nSize = sizeof(MessageIndexItem) + nLength;
+	return std::auto_ptr<MessageIndexItem>(new MessageIndexItem(
+		nKey, pData, nSize, pwszValues));
+}
+
+malloc_size_ptr<unsigned char> qm::MessageIndex::createReplacedIndex(const WCHAR* const* ppwszValues,
+																	 MessageIndexName name,
+																	 const WCHAR* pwszValue)
+{
+	ByteOutputStream stream;
+	
+	for (int n = 0; n < NAME_MAX; ++n) {
+		const WCHAR* p = n != name ? ppwszValues[n] : pwszValue;
+		if (!writeToStream(&stream, p))
+			return malloc_size_ptr<unsigned char>();
+	}
+	
+	size_t nLen = stream.getLength();
+	return malloc_size_ptr<unsigned char>(stream.releaseBuffer(), nLen);
 }
 
 void qm::MessageIndex::parseValues(WCHAR* p,
@@ -295,6 +471,7 @@ bool qm::MessageIndex::writeToStream(OutputStream* pStream,
 
 qm::MessageIndexItem::MessageIndexItem(unsigned int nKey) :
 	nKey_(nKey),
+	nSize_(0),
 	pNewNext_(0),
 	pNewPrev_(0)
 {
@@ -303,9 +480,11 @@ qm::MessageIndexItem::MessageIndexItem(unsigned int nKey) :
 
 qm::MessageIndexItem::MessageIndexItem(unsigned int nKey,
 									   malloc_ptr<unsigned char> pData,
+									   size_t nSize,
 									   const WCHAR* pwszValues[]) :
 	nKey_(nKey),
 	pData_(pData),
+	nSize_(nSize),
 	pNewNext_(0),
 	pNewPrev_(0)
 {
@@ -326,3 +505,8 @@ const WCHAR* qm::MessageIndexItem::getValue(MessageIndexName name) const
 	assert(name < NAME_MAX);
 	return pwszValues_[name];
 }
+
+size_t qm::MessageIndexItem::getSize() const
+{
+	return nSize_;
+}
@@ -31,16 +31,58 @@ class MessageStore;
  *
  * MessageIndex
  *
+ * Cache of message indices. The cache is split into shards each of which
+ * has its own lock, and an index which is not cached is read from the store
+ * without holding any lock of the cache, so that it can be used by more than
+ * one thread at a time.
+ *
  */
 
 class MessageIndex
 {
+public:
+	enum {
+		SHARD_COUNT	= 16
+	};
+
+public:
+	struct Stats
+	{
+		unsigned int nHit_;
+		unsigned int nMiss_;
+		unsigned int nEviction_;
+		size_t nCount_;
+		size_t nSize_;
+	};
+
 public:
 	typedef std::hash_map<unsigned int, MessageIndexItem*> ItemMap;
 
+private:
+	struct Shard
+	{
+		ItemMap map_;
+		MessageIndexItem* pNewFirst_;
+		MessageIndexItem* pNewLast_;
+		MessageIndexItem* pLastGotten_;
+		size_t nSize_;
+		unsigned int nHit_;
+		unsigned int nMiss_;
+		unsigned int nEviction_;
+		qs::CriticalSection cs_;
+	};
+
 public:
+	/**
+	 * Create instance.
+	 *
+	 * @param pMessageStore [in] Message store.
+	 * @param nMaxSize [in] Max number of cached indices. 0 not to cache.
+	 * @param nMaxMemory [in] Max bytes used by cached indices.
+	 */
 	MessageIndex(MessageStore* pMessageStore,
-				 size_t nMaxSize);
+				 size_t nMaxSize,
+				 size_t nMaxMemory);
 	~MessageIndex();
 
 public:
@@ -51,21 +93,51 @@ public:
 	bool isPrepared(unsigned int nKey) const;
 	void prepare(unsigned int nKey,
 				 unsigned int nLength);
+	
+	/**
+	 * Read indices which are not cached at once and cache them.
+	 * This can be called without locking the account as long as
+	 * the generation is taken while the keys are valid. Indices are not
+	 * cached if any index has been removed since then.
+	 *
+	 * @param l [in] Keys and lengths.
+	 * @param nGeneration [in] Generation got by getGeneration.
+	 */
+	void prepare(const MessageIndexKeyList& l,
+				 unsigned int nGeneration);
+	
+	unsigned int getGeneration() const;
 	qs::malloc_size_ptr<unsigned char> createReplacedIndex(unsigned int nKey,
 														   unsigned int nLength,
 														   MessageIndexName name,
 														   const WCHAR* pwszValue);
+	void getStats(Stats* pStats) const;
 
 public:
 	static qs::malloc_size_ptr<unsigned char> createIndex(const Message& header,
 														  const WCHAR* pwszLabel);
 
 private:
-	MessageIndexItem* getItem(unsigned int nKey) const;
-	void insert(std::auto_ptr<MessageIndexItem> pItem);
-	void remove(ItemMap::iterator it);
+	Shard& getShard(unsigned int nKey) const;
+	MessageIndexItem* getItem(Shard& shard,
+							  unsigned int nKey) const;
+	std::auto_ptr<MessageIndexItem> loadItem(unsigned int nKey,
+											 unsigned int nLength) const;
+	void touch(Shard& shard,
+			   MessageIndexItem* pItem);
+	void insert(Shard& shard,
+				std::auto_ptr<MessageIndexItem> pItem,
+				unsigned int nGeneration);
+	void remove(Shard& shard,
+				ItemMap::iterator it);
 
 private:
+	static std::auto_ptr<MessageIndexItem> createItem(unsigned int nKey,
+													  unsigned int nLength,
+													  qs::malloc_ptr<unsigned char> pData);
+	static qs::malloc_size_ptr<unsigned char> createReplacedIndex(const WCHAR* const* ppwszValues,
+																  MessageIndexName name,
+																  const WCHAR* pwszValue);
 	static void parseValues(WCHAR* p,
 							size_t nLen,
 							const WCHAR** ppwszValues);
@@ -79,10 +151,9 @@ private:
 private:
 	MessageStore* pMessageStore_;
 	size_t nMaxSize_;
-	ItemMap map_;
-	MessageIndexItem* pNewFirst_;
-	MessageIndexItem* pNewLast_;
-	MessageIndexItem* pLastGotten_;
+	size_t nMaxMemory_;
+	mutable Shard shards_[SHARD_COUNT];
+	volatile LONG nGeneration_;
 };
 
 
@@ -98,12 +169,14 @@ public:
 	MessageIndexItem(unsigned int nKey);
 	MessageIndexItem(unsigned int nKey,
 					 qs::malloc_ptr<unsigned char> pData,
+					 size_t nSize,
 					 const WCHAR* pwszValues[]);
 	~MessageIndexItem();
 
 public:
 	unsigned int getKey() const;
 	const WCHAR* getValue(MessageIndexName name) const;
+	size_t getSize() const;
 
 private:
 	MessageIndexItem(const MessageIndexItem&);
@@ -112,6 +185,7 @@ private:
 private:
 	unsigned int nKey_;
 	qs::malloc_ptr<unsigned char> pData_;
+	size_t nSize_;
 	const WCHAR* pwszValues_[NAME_MAX];
 	MessageIndexItem* pNewNext_;
 	MessageIndexItem* pNewPrev_;
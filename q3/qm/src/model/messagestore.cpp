@@ -10,10 +10,14 @@
 #include <qmfilenames.h>
 
 #include <qsconv.h>
+#include <qsdeflate.h>
 #include <qsfile.h>
+#include <qsinit.h>
+#include <qslog.h>
 #include <qsosutil.h>
 #include <qsthread.h>
 
+#include <algorithm>
 #include <cstdio>
 
 #include <boost/bind.hpp>
@@ -90,11 +94,18 @@ struct qm::SingleMessageStoreImpl
 		SEPARATOR_SIZE	= 9
 	};
 	
+	bool getSharedParts(unsigned int nOffset,
+						unsigned int nLength,
+						PartStore::DigestList* pList);
+	
 	wstring_ptr wstrPath_;
 	wstring_ptr wstrIndexPath_;
 	unsigned int nIndexBlockSize_;
+	bool bCompress_;
+	bool bDeduplicate_;
 	std::auto_ptr<ClusterStorage> pStorage_;
 	std::auto_ptr<ClusterStorage> pIndexStorage_;
+	std::auto_ptr<PartStore> pPartStore_;
 	CriticalSection cs_;
 	
 	static const unsigned char szUsedSeparator__[];
@@ -104,6 +115,24 @@ struct qm::SingleMessageStoreImpl
 const unsigned char qm::SingleMessageStoreImpl::szUsedSeparator__[] = "\n\nFrom -\n";
 const unsigned char qm::SingleMessageStoreImpl::szUnusedSeparator__[] = "\n\nFrom *\n";
 
+bool qm::SingleMessageStoreImpl::getSharedParts(unsigned int nOffset,
+												unsigned int nLength,
+												PartStore::DigestList* pList)
+{
+	assert(pList);
+	
+	unsigned int nLoad = nLength + SEPARATOR_SIZE;
+	malloc_ptr<unsigned char> pBuf(static_cast<unsigned char*>(allocate(nLoad)));
+	if (!pBuf.get())
+		return false;
+	if (pStorage_->load(pBuf.get(), nOffset, nLoad) == -1)
+		return false;
+	
+	MessageStoreUtil::getSharedParts(pBuf.get() + SEPARATOR_SIZE, nLength, pList);
+	
+	return true;
+}
+
 
 /****************************************************************************
  *
@@ -114,7 +143,9 @@ const unsigned char qm::SingleMessageStoreImpl::szUnusedSeparator__[] = "\n\nFro
 qm::SingleMessageStore::SingleMessageStore(const WCHAR* pwszPath,
 										   unsigned int nBlockSize,
 										   const WCHAR* pwszIndexPath,
-										   unsigned int nIndexBlockSize)
+										   unsigned int nIndexBlockSize,
+										   bool bCompress,
+										   bool bDeduplicate)
 {
 	wstring_ptr wstrPath(allocWString(pwszPath));
 	wstring_ptr wstrIndexPath(allocWString(pwszIndexPath));
@@ -123,13 +154,17 @@ qm::SingleMessageStore::SingleMessageStore(const WCHAR* pwszPath,
 		FileNames::MSG, FileNames::BOX_EXT, FileNames::MAP_EXT, nBlockSize));
 	std::auto_ptr<ClusterStorage> pIndexStorage(new ClusterStorage(pwszIndexPath,
 		FileNames::INDEX, FileNames::BOX_EXT, FileNames::MAP_EXT, nIndexBlockSize));
+	std::auto_ptr<PartStore> pPartStore(new PartStore(pwszPath, nBlockSize));
 	
 	pImpl_ = new SingleMessageStoreImpl();
 	pImpl_->wstrPath_ = wstrPath;
 	pImpl_->wstrIndexPath_ = wstrIndexPath;
 	pImpl_->nIndexBlockSize_ = nIndexBlockSize;
+	pImpl_->bCompress_ = bCompress;
+	pImpl_->bDeduplicate_ = bDeduplicate;
 	pImpl_->pStorage_ = pStorage;
 	pImpl_->pIndexStorage_ = pIndexStorage;
+	pImpl_->pPartStore_ = pPartStore;
 }
 
 qm::SingleMessageStore::~SingleMessageStore()
@@ -145,13 +180,17 @@ qm::SingleMessageStore::~SingleMessageStore()
 bool qm::SingleMessageStore::close()
 {
 	Lock<CriticalSection> lock(pImpl_->cs_);
-	return pImpl_->pStorage_->close() && pImpl_->pIndexStorage_->close();
+	return pImpl_->pStorage_->close() &&
+		pImpl_->pIndexStorage_->close() &&
+		pImpl_->pPartStore_->close();
 }
 
 bool qm::SingleMessageStore::flush()
 {
 	Lock<CriticalSection> lock(pImpl_->cs_);
-	return pImpl_->pStorage_->close() && pImpl_->pIndexStorage_->close();
+	return pImpl_->pStorage_->close() &&
+		pImpl_->pIndexStorage_->close() &&
+		pImpl_->pPartStore_->flush();
 }
 
 bool qm::SingleMessageStore::load(unsigned int nOffset,
@@ -170,7 +209,8 @@ bool qm::SingleMessageStore::load(unsigned int nOffset,
 		return false;
 	unsigned char* p = pBuf.get() + SingleMessageStoreImpl::SEPARATOR_SIZE;
 	
-	return pMessage->create(reinterpret_cast<CHAR*>(p), nLength, Message::FLAG_NONE);
+	return MessageStoreUtil::createMessage(p, nLength,
+		pImpl_->pPartStore_.get(), pMessage);
 }
 
 bool qm::SingleMessageStore::save(const Message& header,
@@ -193,20 +233,54 @@ bool qm::SingleMessageStore::save(const Message& header,
 	const CHAR* pszHeader = header.getHeader();
 	size_t nHeaderLen = strlen(pszHeader);
 	
+	const unsigned char* pBody = reinterpret_cast<const unsigned char*>(pszBody);
+	PartStore::DigestList listDigest;
+	malloc_size_ptr<unsigned char> pSharedBody;
+	if (!bIndexOnly && pImpl_->bDeduplicate_) {
+		pSharedBody = MessageStoreUtil::shareParts(header, pszBody,
+			nBodyLen, pImpl_->pPartStore_.get(), &listDigest);
+		if (pSharedBody.get()) {
+			pBody = pSharedBody.get();
+			nBodyLen = pSharedBody.size();
+		}
+	}
+	
+	malloc_size_ptr<unsigned char> pEscapedBody;
+	if (!bIndexOnly && !pSharedBody.get() &&
+		MessageStoreUtil::isEscapeRequired(pBody, nBodyLen)) {
+		pEscapedBody = MessageStoreUtil::escapeBody(pBody, nBodyLen);
+		if (!pEscapedBody.get())
+			return false;
+		pBody = pEscapedBody.get();
+		nBodyLen = pEscapedBody.size();
+	}
+	
+	malloc_size_ptr<unsigned char> pCompressedBody;
+	if (!bIndexOnly && pImpl_->bCompress_) {
+		pCompressedBody = MessageStoreUtil::compressBody(
+			reinterpret_cast<const CHAR*>(pBody), nBodyLen);
+		if (pCompressedBody.get()) {
+			pBody = pCompressedBody.get();
+			nBodyLen = pCompressedBody.size();
+		}
+	}
+	
 	if (!bIndexOnly) {
 		*pnHeaderLength = static_cast<unsigned int>(nHeaderLen);
 		*pnLength = static_cast<unsigned int>(nHeaderLen + nBodyLen + 2);
 	}
 	
 	malloc_size_ptr<unsigned char> pIndex(MessageIndex::createIndex(header, pwszLabel));
-	if (!pIndex.get())
+	if (!pIndex.get()) {
+		pImpl_->pPartStore_->release(listDigest);
 		return false;
+	}
 	
 	const unsigned char* pMsg[] = {
 		SingleMessageStoreImpl::szUsedSeparator__,
 		reinterpret_cast<const unsigned char*>(pszHeader),
 		reinterpret_cast<const unsigned char*>("\r\n"),
-		reinterpret_cast<const unsigned char*>(pszBody),
+		pBody,
 		SingleMessageStoreImpl::szUnusedSeparator__
 	};
 	size_t nMsgLen[] = {
@@ -221,8 +295,10 @@ bool qm::SingleMessageStore::save(const Message& header,
 	
 	if (!bIndexOnly) {
 		*pnOffset = pImpl_->pStorage_->save(pMsg, nMsgLen, countof(pMsg));
-		if (*pnOffset == -1)
+		if (*pnOffset == -1) {
+			pImpl_->pPartStore_->release(listDigest);
 			return false;
+		}
 	}
 	
 	const unsigned char* p = pIndex.get();
@@ -247,6 +323,7 @@ bool qm::SingleMessageStore::updateIndex(unsigned int nOldIndexKey,
 										 unsigned int nIndexLength,
 										 unsigned int* pnIndexKey)
 {
+	Lock<CriticalSection> lock(pImpl_->cs_);
 	return MessageStoreUtil::updateIndex(pImpl_->pIndexStorage_.get(),
 		nOldIndexKey, nOldIndexLength, pIndex, nIndexLength, pnIndexKey);
 }
@@ -264,6 +341,18 @@ bool qm::SingleMessageStore::free(unsigned int nOffset,
 	}
 	
 	if (nOffset != -1) {
+		// The body is freed even when its shared parts cannot be released,
+		// so that the message can be removed. Those parts are freed when
+		// the references are counted again.
+		if (pImpl_->pPartStore_->hasPart()) {
+			PartStore::DigestList listDigest;
+			if (!pImpl_->getSharedParts(nOffset, nLength, &listDigest) ||
+				!pImpl_->pPartStore_->release(listDigest)) {
+				Log log(InitThread::getInitThread().getLogger(), L"qm::SingleMessageStore");
+				log.errorf(L"Failed to release shared parts: %u", nOffset);
+			}
+		}
+		
 		if (!pImpl_->pStorage_->free(nOffset,
 			nLength + SingleMessageStoreImpl::SEPARATOR_SIZE*2))
 			return false;
@@ -272,50 +361,25 @@ bool qm::SingleMessageStore::free(unsigned int nOffset,
 	return true;
 }
 
-bool qm::SingleMessageStore::compact(DataList* pListData,
-									 MessageOperationCallback* pCallback)
+bool qm::SingleMessageStore::freeUnrefered(const DataList& listData)
 {
-	assert(pListData);
-	assert(pCallback);
-	
-	pCallback->setCancelable(false);
-	pCallback->setCount(static_cast<int>(pListData->size()));
-	pCallback->show();
-	
 	Lock<CriticalSection> lock(pImpl_->cs_);
 	
-	std::auto_ptr<ClusterStorage> pIndexStorage(new ClusterStorage(
-		pImpl_->wstrIndexPath_.get(), FileNames::COMPACT,
-		FileNames::BOX_EXT, FileNames::MAP_EXT, pImpl_->nIndexBlockSize_));
-	ClusterStorage* pOldIndexStorage = pImpl_->pIndexStorage_.get();
+	MessageStoreUtil::freeUnrefered(pImpl_->pStorage_.get(),
+		listData, SingleMessageStoreImpl::SEPARATOR_SIZE*2);
+	MessageStoreUtil::freeUnreferedIndex(pImpl_->pIndexStorage_.get(), listData);
 	
-	for (DataList::iterator it = pListData->begin(); it != pListData->end(); ++it) {
-		Data& data = *it;
-		
-		data.nIndexKey_ = pIndexStorage->compact(
-			data.nIndexKey_, data.nIndexLength_, pOldIndexStorage);
-		if (data.nIndexKey_ == -1)
-			return false;
-		
-		if (data.nOffset_ != -1) {
-			size_t nLen = data.nLength_ + SingleMessageStoreImpl::SEPARATOR_SIZE*2;
-			data.nOffset_ = pImpl_->pStorage_->compact(data.nOffset_, nLen, 0);
-			if (data.nOffset_ == -1)
+	if (!pImpl_->pPartStore_->hasPart())
+		return true;
+	
+	PartStore::DigestList listDigest;
+	for (DataList::const_iterator it = listData.begin(); it != listData.end(); ++it) {
+		if ((*it).nOffset_ != -1) {
+			if (!pImpl_->getSharedParts((*it).nOffset_, (*it).nLength_, &listDigest))
 				return false;
 		}
-		
-		pCallback->step(1);
 	}
-	
-	if (!pImpl_->pIndexStorage_->close() ||
-		!pIndexStorage->rename(pImpl_->wstrIndexPath_.get(), FileNames::INDEX))
-		return false;
-	pImpl_->pIndexStorage_ = pIndexStorage;
-	
-	MessageStoreUtil::freeUnrefered(pImpl_->pStorage_.get(),
-		*pListData, SingleMessageStoreImpl::SEPARATOR_SIZE*2);
-	
-	return true;
+	return pImpl_->pPartStore_->freeUnrefered(listDigest);
 }
 
 bool qm::SingleMessageStore::salvage(const DataList& listData,
@@ -344,15 +408,59 @@ bool qm::SingleMessageStore::check(MessageStoreCheckCallback* pCallback)
 
 bool qm::SingleMessageStore::freeUnused()
 {
-	return pImpl_->pStorage_->freeUnused() && pImpl_->pStorage_->flush();
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	return pImpl_->pStorage_->freeUnused() && pImpl_->pStorage_->flush() &&
+		pImpl_->pIndexStorage_->freeUnused() && pImpl_->pIndexStorage_->flush();
+}
+
+bool qm::SingleMessageStore::move(Data* pData)
+{
+	assert(pData);
+	
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	// pData is updated as soon as each of them is moved, because the old
+	// one is freed then. The caller has to use the keys in pData even
+	// when it fails.
+	if (pData->nIndexKey_ != -1) {
+		unsigned int nIndexKey = pImpl_->pIndexStorage_->compact(
+			pData->nIndexKey_, pData->nIndexLength_, 0);
+		if (nIndexKey == -1)
+			return false;
+		pData->nIndexKey_ = nIndexKey;
+	}
+	
+	if (pData->nOffset_ != -1) {
+		size_t nLen = pData->nLength_ + SingleMessageStoreImpl::SEPARATOR_SIZE*2;
+		unsigned int nOffset = pImpl_->pStorage_->compact(pData->nOffset_, nLen, 0);
+		if (nOffset == -1)
+			return false;
+		pData->nOffset_ = nOffset;
+	}
+	
+	return true;
+}
+
+unsigned int qm::SingleMessageStore::getFragmentation()
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	return pImpl_->pStorage_->getFragmentation();
 }
 
 malloc_ptr<unsigned char> qm::SingleMessageStore::readIndex(unsigned int nKey,
 															unsigned int nLength)
 {
+	Lock<CriticalSection> lock(pImpl_->cs_);
 	return MessageStoreUtil::readIndex(pImpl_->pIndexStorage_.get(), nKey, nLength);
 }
 
+bool qm::SingleMessageStore::readIndex(const MessageIndexKeyList& listKey,
+									   MessageStoreReadIndexCallback* pCallback)
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	return MessageStoreUtil::readIndex(pImpl_->pIndexStorage_.get(), listKey, pCallback);
+}
+
 
 /****************************************************************************
  *
@@ -378,6 +486,9 @@ public:
 	void deleteFiles(unsigned int nOffset) const;
 	bool ensureDirectory(unsigned int nOffset) const;
 	void deleteEmptyDirectories(unsigned int nMaxOffset) const;
+	bool getSharedParts(unsigned int nOffset,
+						unsigned int nLength,
+						PartStore::DigestList* pList) const;
 	void freeUnrefered(const MessageStore::DataList& listData,
 					   unsigned int nMaxOffset,
 					   MessageOperationCallback* pCallback);
@@ -386,7 +497,10 @@ public:
 	wstring_ptr wstrPath_;
 	wstring_ptr wstrIndexPath_;
 	unsigned int nIndexBlockSize_;
+	bool bCompress_;
+	bool bDeduplicate_;
 	std::auto_ptr<ClusterStorage> pIndexStorage_;
+	std::auto_ptr<PartStore> pPartStore_;
 	unsigned int nOffset_;
 	CriticalSection cs_;
 	mutable DirList listDir_;
@@ -505,12 +619,34 @@ void qm::MultiMessageStoreImpl::deleteEmptyDirectories(unsigned int nMaxOffset)
 	}
 }
 
+bool qm::MultiMessageStoreImpl::getSharedParts(unsigned int nOffset,
+											   unsigned int nLength,
+											   PartStore::DigestList* pList) const
+{
+	assert(pList);
+	
+	wstring_ptr wstrPath(getPath(nOffset, false));
+	FileInputStream stream(wstrPath.get());
+	if (!stream)
+		return false;
+	
+	malloc_ptr<unsigned char> pBuf(static_cast<unsigned char*>(allocate(nLength)));
+	if (!pBuf.get())
+		return false;
+	
+	size_t nRead = stream.read(pBuf.get(), nLength);
+	if (nRead != nLength)
+		return false;
+	
+	MessageStoreUtil::getSharedParts(pBuf.get(), nRead, pList);
+	
+	return true;
+}
+
 void qm::MultiMessageStoreImpl::freeUnrefered(const MessageStore::DataList& listData,
 											  unsigned int nMaxOffset,
 											  MessageOperationCallback* pCallback)
 {
-	assert(pCallback);
-	
 	typedef std::vector<unsigned int> List;
 	List l;
 	l.resize(listData.size());
@@ -525,7 +661,8 @@ void qm::MultiMessageStoreImpl::freeUnrefered(const MessageStore::DataList& list
 		else
 			deleteFiles(n);
 		
-		pCallback->step(1);
+		if (pCallback)
+			pCallback->step(1);
 	}
 	
 	deleteEmptyDirectories(nMaxOffset);
@@ -540,18 +677,24 @@ void qm::MultiMessageStoreImpl::freeUnrefered(const MessageStore::DataList& list
 
 qm::MultiMessageStore::MultiMessageStore(const WCHAR* pwszPath,
 										 const WCHAR* pwszIndexPath,
-										 unsigned int nIndexBlockSize)
+										 unsigned int nIndexBlockSize,
+										 bool bCompress,
+										 bool bDeduplicate)
 {
 	wstring_ptr wstrPath(allocWString(pwszPath));
 	wstring_ptr wstrIndexPath(allocWString(pwszIndexPath));
 	std::auto_ptr<ClusterStorage> pIndexStorage(new ClusterStorage(pwszIndexPath,
 		FileNames::INDEX, FileNames::BOX_EXT, FileNames::MAP_EXT, nIndexBlockSize));
+	std::auto_ptr<PartStore> pPartStore(new PartStore(pwszPath, -1));
 	
 	pImpl_ = new MultiMessageStoreImpl();
 	pImpl_->wstrPath_ = wstrPath;
 	pImpl_->wstrIndexPath_ = wstrIndexPath;
 	pImpl_->nIndexBlockSize_ = nIndexBlockSize;
+	pImpl_->bCompress_ = bCompress;
+	pImpl_->bDeduplicate_ = bDeduplicate;
 	pImpl_->pIndexStorage_ = pIndexStorage;
+	pImpl_->pPartStore_ = pPartStore;
 	pImpl_->nOffset_ = -1;
 	
 	if (!pImpl_->init()) {
@@ -572,13 +715,13 @@ qm::MultiMessageStore::~MultiMessageStore()
 bool qm::MultiMessageStore::close()
 {
 	Lock<CriticalSection> lock(pImpl_->cs_);
-	return pImpl_->pIndexStorage_->close();
+	return pImpl_->pIndexStorage_->close() && pImpl_->pPartStore_->close();
 }
 
 bool qm::MultiMessageStore::flush()
 {
 	Lock<CriticalSection> lock(pImpl_->cs_);
-	return pImpl_->pIndexStorage_->close();
+	return pImpl_->pIndexStorage_->close() && pImpl_->pPartStore_->flush();
 }
 
 bool qm::MultiMessageStore::load(unsigned int nOffset,
@@ -602,7 +745,8 @@ bool qm::MultiMessageStore::load(unsigned int nOffset,
 	if (nRead != nLength)
 		return false;
 	
-	return pMessage->create(reinterpret_cast<CHAR*>(pBuf.get()), nRead, Message::FLAG_NONE);
+	return MessageStoreUtil::createMessage(pBuf.get(), nRead,
+		pImpl_->pPartStore_.get(), pMessage);
 }
 
 bool qm::MultiMessageStore::save(const Message& header,
@@ -625,30 +769,67 @@ bool qm::MultiMessageStore::save(const Message& header,
 	const CHAR* pszHeader = header.getHeader();
 	size_t nHeaderLen = strlen(pszHeader);
 	
+	const unsigned char* pBody = reinterpret_cast<const unsigned char*>(pszBody);
+	PartStore::DigestList listDigest;
+	malloc_size_ptr<unsigned char> pSharedBody;
+	if (!bIndexOnly && pImpl_->bDeduplicate_) {
+		pSharedBody = MessageStoreUtil::shareParts(header, pszBody,
+			nBodyLen, pImpl_->pPartStore_.get(), &listDigest);
+		if (pSharedBody.get()) {
+			pBody = pSharedBody.get();
+			nBodyLen = pSharedBody.size();
+		}
+	}
+	
+	malloc_size_ptr<unsigned char> pEscapedBody;
+	if (!bIndexOnly && !pSharedBody.get() &&
+		MessageStoreUtil::isEscapeRequired(pBody, nBodyLen)) {
+		pEscapedBody = MessageStoreUtil::escapeBody(pBody, nBodyLen);
+		if (!pEscapedBody.get())
+			return false;
+		pBody = pEscapedBody.get();
+		nBodyLen = pEscapedBody.size();
+	}
+	
+	malloc_size_ptr<unsigned char> pCompressedBody;
+	if (!bIndexOnly && pImpl_->bCompress_) {
+		pCompressedBody = MessageStoreUtil::compressBody(
+			reinterpret_cast<const CHAR*>(pBody), nBodyLen);
+		if (pCompressedBody.get()) {
+			pBody = pCompressedBody.get();
+			nBodyLen = pCompressedBody.size();
+		}
+	}
+	
 	if (!bIndexOnly) {
 		*pnHeaderLength = static_cast<unsigned int>(nHeaderLen);
 		*pnLength = static_cast<unsigned int>(nHeaderLen + nBodyLen + 2);
 	}
 	
 	malloc_size_ptr<unsigned char> pIndex(MessageIndex::createIndex(header, pwszLabel));
-	if (!pIndex.get())
+	if (!pIndex.get()) {
+		pImpl_->pPartStore_->release(listDigest);
 		return false;
+	}
 	
 	Lock<CriticalSection> lock(pImpl_->cs_);
 	
 	if (!bIndexOnly) {
 		*pnOffset = pImpl_->getOffset(true);
-		if (!pImpl_->ensureDirectory(*pnOffset))
+		if (!pImpl_->ensureDirectory(*pnOffset)) {
+			pImpl_->pPartStore_->release(listDigest);
 			return false;
+		}
 		wstring_ptr wstrPath(pImpl_->getPath(*pnOffset, false));
 		FileOutputStream stream(wstrPath.get());
-		if (!stream)
-			return false;
-		if (stream.write(reinterpret_cast<const unsigned char*>(pszHeader), nHeaderLen) == -1 ||
+		if (!stream ||
+			stream.write(reinterpret_cast<const unsigned char*>(pszHeader), nHeaderLen) == -1 ||
 			stream.write(reinterpret_cast<const unsigned char*>("\r\n"), 2) == -1 ||
-			stream.write(reinterpret_cast<const unsigned char*>(pszBody), nBodyLen) == -1 ||
-			!stream.close())
+			stream.write(pBody, nBodyLen) == -1 ||
+			!stream.close()) {
+			pImpl_->pPartStore_->release(listDigest);
 			return false;
+		}
 	}
 	
 	const unsigned char* p = pIndex.get();
@@ -693,6 +874,7 @@ bool qm::MultiMessageStore::updateIndex(unsigned int nOldIndexKey,
 										unsigned int nIndexLength,
 										unsigned int* pnIndexKey)
 {
+	Lock<CriticalSection> lock(pImpl_->cs_);
 	return MessageStoreUtil::updateIndex(pImpl_->pIndexStorage_.get(),
 		nOldIndexKey, nOldIndexLength, pIndex, nIndexLength, pnIndexKey);
 }
@@ -709,55 +891,72 @@ bool qm::MultiMessageStore::free(unsigned int nOffset,
 			return false;
 	}
 	
-	if (nOffset != -1)
+	if (nOffset != -1) {
+		// The body is freed even when its shared parts cannot be released,
+		// so that the message can be removed. Those parts are freed when
+		// the references are counted again.
+		if (pImpl_->pPartStore_->hasPart()) {
+			PartStore::DigestList listDigest;
+			if (!pImpl_->getSharedParts(nOffset, nLength, &listDigest) ||
+				!pImpl_->pPartStore_->release(listDigest)) {
+				Log log(InitThread::getInitThread().getLogger(), L"qm::MultiMessageStore");
+				log.errorf(L"Failed to release shared parts: %u", nOffset);
+			}
+		}
+		
 		pImpl_->deleteFiles(nOffset);
+	}
 	
 	return true;
 }
 
-bool qm::MultiMessageStore::compact(DataList* pListData,
-									MessageOperationCallback* pCallback)
+bool qm::MultiMessageStore::freeUnrefered(const DataList& listData)
 {
-	assert(pListData);
-	assert(pCallback);
+	Lock<CriticalSection> lock(pImpl_->cs_);
 	
-	unsigned int nOffset = pImpl_->getOffset(false);
+	pImpl_->freeUnrefered(listData, pImpl_->getOffset(false), 0);
+	MessageStoreUtil::freeUnreferedIndex(pImpl_->pIndexStorage_.get(), listData);
 	
-	pCallback->setCancelable(false);
-	pCallback->setCount(pListData->size() + nOffset);
-	pCallback->show();
+	if (!pImpl_->pPartStore_->hasPart())
+		return true;
 	
+	PartStore::DigestList listDigest;
+	for (DataList::const_iterator it = listData.begin(); it != listData.end(); ++it) {
+		if ((*it).nOffset_ != -1) {
+			if (!pImpl_->getSharedParts((*it).nOffset_, (*it).nLength_, &listDigest))
+				return false;
+		}
+	}
+	return pImpl_->pPartStore_->freeUnrefered(listDigest);
+}
+
+bool qm::MultiMessageStore::freeUnused()
+{
 	Lock<CriticalSection> lock(pImpl_->cs_);
+	return pImpl_->pIndexStorage_->freeUnused() && pImpl_->pIndexStorage_->flush();
+}
+
+bool qm::MultiMessageStore::move(Data* pData)
+{
+	assert(pData);
 	
-	std::auto_ptr<ClusterStorage> pIndexStorage(new ClusterStorage(
-		pImpl_->wstrIndexPath_.get(), FileNames::COMPACT,
-		FileNames::BOX_EXT, FileNames::MAP_EXT, pImpl_->nIndexBlockSize_));
-	ClusterStorage* pOldIndexStorage = pImpl_->pIndexStorage_.get();
+	Lock<CriticalSection> lock(pImpl_->cs_);
 	
-	for (DataList::iterator it = pListData->begin(); it != pListData->end(); ++it) {
-		Data& data = *it;
-		
-		data.nIndexKey_ = pIndexStorage->compact(data.nIndexKey_,
-			data.nIndexLength_, pOldIndexStorage);
-		if (data.nIndexKey_ == -1)
+	if (pData->nIndexKey_ != -1) {
+		unsigned int nIndexKey = pImpl_->pIndexStorage_->compact(
+			pData->nIndexKey_, pData->nIndexLength_, 0);
+		if (nIndexKey == -1)
 			return false;
-		
-		pCallback->step(1);
+		pData->nIndexKey_ = nIndexKey;
 	}
 	
-	if (!pImpl_->pIndexStorage_->close() ||
-		!pIndexStorage->rename(pImpl_->wstrIndexPath_.get(), FileNames::INDEX))
-		return false;
-	pImpl_->pIndexStorage_ = pIndexStorage;
-	
-	pImpl_->freeUnrefered(*pListData, nOffset, pCallback);
-	
 	return true;
 }
 
-bool qm::MultiMessageStore::freeUnused()
+unsigned int qm::MultiMessageStore::getFragmentation()
 {
-	return true;
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	return pImpl_->pIndexStorage_->getFragmentation();
 }
 
 bool qm::MultiMessageStore::salvage(const DataList& listData,
@@ -792,6 +991,13 @@ bool qm::MultiMessageStore::salvage(const DataList& listData,
 					return false;
 				if (!pCallback->salvage(msg))
 					return false;
+				
+				if (pImpl_->pPartStore_->hasPart()) {
+					PartStore::DigestList listDigest;
+					if (!pImpl_->getSharedParts(n, fd.nFileSizeLow, &listDigest) ||
+						!pImpl_->pPartStore_->release(listDigest))
+						return false;
+				}
 				pImpl_->deleteFiles(n);
 			}
 		}
@@ -822,9 +1028,17 @@ bool qm::MultiMessageStore::check(MessageStoreCheckCallback* pCallback)
 malloc_ptr<unsigned char> qm::MultiMessageStore::readIndex(unsigned int nKey,
 														   unsigned int nLength)
 {
+	Lock<CriticalSection> lock(pImpl_->cs_);
 	return MessageStoreUtil::readIndex(pImpl_->pIndexStorage_.get(), nKey, nLength);
 }
 
+bool qm::MultiMessageStore::readIndex(const MessageIndexKeyList& listKey,
+									  MessageStoreReadIndexCallback* pCallback)
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	return MessageStoreUtil::readIndex(pImpl_->pIndexStorage_.get(), listKey, pCallback);
+}
+
 
 /****************************************************************************
  *
@@ -848,12 +1062,27 @@ qm::MessageStoreCheckCallback::~MessageStoreCheckCallback()
 }
 
 
+/****************************************************************************
+ *
+ * MessageStoreReadIndexCallback
+ *
+ */
+
+qm::MessageStoreReadIndexCallback::~MessageStoreReadIndexCallback()
+{
+}
+
+
 /****************************************************************************
  *
  * MessageStoreUtil
  *
  */
 
+const unsigned char qm::MessageStoreUtil::szCompressed__[] = "\0QZ\1";
+const unsigned char qm::MessageStoreUtil::szShared__[] = "\0QS\1";
+const unsigned char qm::MessageStoreUtil::szEscaped__[] = "\0QR\1";
+
 void qm::MessageStoreUtil::freeUnrefered(ClusterStorage* pStorage,
 										 const MessageStore::DataList& listData,
 										 unsigned int nSeparatorSize)
@@ -861,6 +1090,8 @@ void qm::MessageStoreUtil::freeUnrefered(ClusterStorage* pStorage,
 	ClusterStorage::ReferList l;
 	l.reserve(listData.size());
 	for (MessageStore::DataList::const_iterator it = listData.begin(); it != listData.end(); ++it) {
+		if ((*it).nOffset_ == -1)
+			continue;
 		ClusterStorage::Refer refer = {
 			(*it).nOffset_,
 			(*it).nLength_ + nSeparatorSize
@@ -871,6 +1102,24 @@ void qm::MessageStoreUtil::freeUnrefered(ClusterStorage* pStorage,
 	pStorage->freeUnrefered(l);
 }
 
+void qm::MessageStoreUtil::freeUnreferedIndex(ClusterStorage* pStorage,
+											  const MessageStore::DataList& listData)
+{
+	ClusterStorage::ReferList l;
+	l.reserve(listData.size());
+	for (MessageStore::DataList::const_iterator it = listData.begin(); it != listData.end(); ++it) {
+		if ((*it).nIndexKey_ == -1)
+			continue;
+		ClusterStorage::Refer refer = {
+			(*it).nIndexKey_,
+			(*it).nIndexLength_
+		};
+		l.push_back(refer);
+	}
+	
+	pStorage->freeUnrefered(l);
+}
+
 std::auto_ptr<ClusterStorage> qm::MessageStoreUtil::checkIndex(ClusterStorage* pStorage,
 															   const WCHAR* pwszPath,
 															   unsigned int nBlockSize,
@@ -928,6 +1177,60 @@ malloc_ptr<unsigned char> qm::MessageStoreUtil::readIndex(ClusterStorage* pStora
 	return p;
 }
 
+bool qm::MessageStoreUtil::readIndex(ClusterStorage* pStorage,
+									 const MessageIndexKeyList& listKey,
+									 MessageStoreReadIndexCallback* pCallback)
+{
+	assert(pStorage);
+	assert(pCallback);
+	
+	// Indices close to each other are read at once. Keys should be sorted
+	// so that the range can be extended.
+	MessageIndexKeyList::size_type n = 0;
+	while (n < listKey.size()) {
+		unsigned int nBegin = listKey[n].first;
+		unsigned __int64 nBeginPos = static_cast<unsigned __int64>(nBegin)*ClusterStorage::CLUSTER_SIZE;
+		unsigned __int64 nEndPos = nBeginPos + listKey[n].second;
+		MessageIndexKeyList::size_type m = n + 1;
+		while (m < listKey.size()) {
+			unsigned __int64 nPos = static_cast<unsigned __int64>(listKey[m].first)*ClusterStorage::CLUSTER_SIZE;
+			unsigned __int64 nPosEnd = nPos + listKey[m].second;
+			if (nPos < nEndPos || nPos - nEndPos > READINDEX_MAX_GAP ||
+				nPosEnd - nBeginPos > READINDEX_MAX_RANGE)
+				break;
+			nEndPos = nPosEnd;
+			++m;
+		}
+		
+		if (m == n + 1) {
+			malloc_ptr<unsigned char> p(readIndex(pStorage, nBegin, listKey[n].second));
+			if (!p.get())
+				return false;
+			pCallback->read(nBegin, listKey[n].second, p);
+		}
+		else {
+			size_t nLength = static_cast<size_t>(nEndPos - nBeginPos);
+			malloc_ptr<unsigned char> pBuf(readIndex(pStorage, nBegin, static_cast<unsigned int>(nLength)));
+			if (!pBuf.get())
+				return false;
+			
+			for (MessageIndexKeyList::size_type i = n; i < m; ++i) {
+				unsigned int nKey = listKey[i].first;
+				unsigned int nKeyLength = listKey[i].second;
+				malloc_ptr<unsigned char> p(static_cast<unsigned char*>(allocate(nKeyLength)));
+				if (!p.get())
+					return false;
+				memcpy(p.get(), pBuf.get() + (nKey - nBegin)*ClusterStorage::CLUSTER_SIZE, nKeyLength);
+				pCallback->read(nKey, nKeyLength, p);
+			}
+		}
+		
+		n = m;
+	}
+	
+	return true;
+}
+
 bool qm::MessageStoreUtil::updateIndex(ClusterStorage* pStorage,
 									   unsigned int nOldIndexKey,
 									   unsigned int nOldIndexLength,
@@ -949,3 +1252,370 @@ bool qm::MessageStoreUtil::updateIndex(ClusterStorage* pStorage,
 	
 	return true;
 }
+
+malloc_size_ptr<unsigned char> qm::MessageStoreUtil::compressBody(const CHAR* pszBody,
+																  size_t nBodyLen)
+{
+	if (nBodyLen < COMPRESS_MIN_SIZE)
+		return malloc_size_ptr<unsigned char>();
+	
+	malloc_size_ptr<unsigned char> pDeflated(Deflater::deflate(
+		reinterpret_cast<const unsigned char*>(pszBody), nBodyLen));
+	if (!pDeflated.get())
+		return malloc_size_ptr<unsigned char>();
+	
+	// Store it as it is unless it gets smaller by one eighth at least
+	size_t nLen = COMPRESS_HEADER_SIZE + pDeflated.size();
+	if (nLen > nBodyLen - nBodyLen/8)
+		return malloc_size_ptr<unsigned char>();
+	
+	malloc_ptr<unsigned char> p(static_cast<unsigned char*>(allocate(nLen)));
+	if (!p.get())
+		return malloc_size_ptr<unsigned char>();
+	memcpy(p.get(), szCompressed__, 4);
+	for (int n = 0; n < 4; ++n)
+		p.get()[4 + n] = static_cast<unsigned char>((nBodyLen >> (n*8)) & 0xff);
+	memcpy(p.get() + COMPRESS_HEADER_SIZE, pDeflated.get(), pDeflated.size());
+	
+	return malloc_size_ptr<unsigned char>(p.release(), nLen);
+}
+
+bool qm::MessageStoreUtil::isEscapeRequired(const unsigned char* p,
+											size_t nLen)
+{
+	assert(p);
+	
+	return nLen >= 4 &&
+		(memcmp(p, szCompressed__, 4) == 0 ||
+		 memcmp(p, szShared__, 4) == 0 ||
+		 memcmp(p, szEscaped__, 4) == 0);
+}
+
+malloc_size_ptr<unsigned char> qm::MessageStoreUtil::escapeBody(const unsigned char* p,
+																size_t nLen)
+{
+	assert(p);
+	
+	malloc_ptr<unsigned char> pEscaped(static_cast<unsigned char*>(allocate(nLen + 4)));
+	if (!pEscaped.get())
+		return malloc_size_ptr<unsigned char>();
+	memcpy(pEscaped.get(), szEscaped__, 4);
+	memcpy(pEscaped.get() + 4, p, nLen);
+	
+	return malloc_size_ptr<unsigned char>(pEscaped.release(), nLen + 4);
+}
+
+malloc_size_ptr<unsigned char> qm::MessageStoreUtil::shareParts(const Message& header,
+																const CHAR* pszBody,
+																size_t nBodyLen,
+																PartStore* pPartStore,
+																PartStore::DigestList* pList)
+{
+	assert(pszBody);
+	assert(pPartStore);
+	assert(pList);
+	
+	RangeList listRange;
+	getLeafParts(header, pszBody, nBodyLen, 0, &listRange);
+	if (listRange.empty())
+		return malloc_size_ptr<unsigned char>();
+	
+	ByteOutputStream stream;
+	if (stream.write(szShared__, 4) == -1)
+		return malloc_size_ptr<unsigned char>();
+	
+	const CHAR* p = pszBody;
+	for (RangeList::const_iterator it = listRange.begin(); it != listRange.end(); ++it) {
+		const unsigned char* pPart = reinterpret_cast<const unsigned char*>((*it).first);
+		size_t nPartLen = (*it).second;
+		
+		// A part which cannot be added is left in the body as it is
+		PartStore::Digest digest;
+		if (!pPartStore->add(pPart, nPartLen, &digest))
+			continue;
+		pList->push_back(digest);
+		
+		size_t nLen = (*it).first - p;
+		if ((nLen != 0 && !writeSegment(&stream, 'L',
+				reinterpret_cast<const unsigned char*>(p), nLen, nLen)) ||
+			!writeSegment(&stream, 'R', digest.digest_, PartStore::DIGEST_SIZE, nPartLen)) {
+			pPartStore->release(*pList);
+			pList->clear();
+			return malloc_size_ptr<unsigned char>();
+		}
+		p = (*it).first + nPartLen;
+	}
+	if (pList->empty())
+		return malloc_size_ptr<unsigned char>();
+	
+	size_t nLen = pszBody + nBodyLen - p;
+	if (nLen != 0 && !writeSegment(&stream, 'L',
+		reinterpret_cast<const unsigned char*>(p), nLen, nLen)) {
+		pPartStore->release(*pList);
+		pList->clear();
+		return malloc_size_ptr<unsigned char>();
+	}
+	
+	return stream.releaseSizeBuffer();
+}
+
+void qm::MessageStoreUtil::getSharedParts(const unsigned char* p,
+										  size_t nLen,
+										  PartStore::DigestList* pList)
+{
+	assert(p);
+	assert(pList);
+	
+	const CHAR* psz = reinterpret_cast<const CHAR*>(p);
+	const CHAR* pBody = Part::getBody(psz, nLen);
+	if (!pBody)
+		return;
+	
+	const unsigned char* pb = reinterpret_cast<const unsigned char*>(pBody);
+	size_t nBodyLen = nLen - (pBody - psz);
+	malloc_size_ptr<unsigned char> pInflated(inflateBody(pb, nBodyLen));
+	if (pInflated.get()) {
+		pb = pInflated.get();
+		nBodyLen = pInflated.size();
+	}
+	
+	SegmentList listSegment;
+	if (!parseSharedBody(pb, nBodyLen, &listSegment))
+		return;
+	
+	for (SegmentList::const_iterator it = listSegment.begin(); it != listSegment.end(); ++it) {
+		if ((*it).cType_ == 'R') {
+			PartStore::Digest digest;
+			memcpy(digest.digest_, (*it).p_, PartStore::DIGEST_SIZE);
+			pList->push_back(digest);
+		}
+	}
+}
+
+bool qm::MessageStoreUtil::createMessage(const unsigned char* p,
+										 size_t nLen,
+										 PartStore* pPartStore,
+										 Message* pMessage)
+{
+	assert(p);
+	assert(pPartStore);
+	assert(pMessage);
+	
+	const CHAR* psz = reinterpret_cast<const CHAR*>(p);
+	
+	// Only the body can be compressed or shared. When only the header is
+	// loaded, there is no body and it can be used as it is.
+	const CHAR* pBody = Part::getBody(psz, nLen);
+	if (pBody) {
+		size_t nHeaderLen = pBody - psz;
+		size_t nBodyLen = nLen - nHeaderLen;
+		const unsigned char* pb = reinterpret_cast<const unsigned char*>(pBody);
+		
+		malloc_size_ptr<unsigned char> pInflated(inflateBody(pb, nBodyLen));
+		if (pInflated.get()) {
+			pb = pInflated.get();
+			nBodyLen = pInflated.size();
+		}
+		
+		// A raw body which starts with any of the signatures has been
+		// escaped when it was saved
+		bool bEscaped = nBodyLen >= 4 && memcmp(pb, szEscaped__, 4) == 0;
+		if (bEscaped) {
+			pb += 4;
+			nBodyLen -= 4;
+		}
+		
+		SegmentList listSegment;
+		if (!bEscaped && parseSharedBody(pb, nBodyLen, &listSegment)) {
+			size_t nExpandedLen = 0;
+			for (SegmentList::const_iterator it = listSegment.begin(); it != listSegment.end(); ++it)
+				nExpandedLen += (*it).nLen_;
+			
+			malloc_ptr<CHAR> pMessageBuf(static_cast<CHAR*>(
+				allocate(nHeaderLen + nExpandedLen)));
+			if (!pMessageBuf.get())
+				return false;
+			memcpy(pMessageBuf.get(), psz, nHeaderLen);
+			
+			CHAR* pDst = pMessageBuf.get() + nHeaderLen;
+			for (SegmentList::const_iterator it = listSegment.begin(); it != listSegment.end(); ++it) {
+				const Segment& segment = *it;
+				if (segment.cType_ == 'R') {
+					PartStore::Digest digest;
+					memcpy(digest.digest_, segment.p_, PartStore::DIGEST_SIZE);
+					malloc_ptr<unsigned char> pPart(pPartStore->load(digest, segment.nLen_));
+					if (!pPart.get()) {
+						Log log(InitThread::getInitThread().getLogger(), L"qm::MessageStoreUtil");
+						log.error(L"Failed to load a shared part.");
+						return false;
+					}
+					memcpy(pDst, pPart.get(), segment.nLen_);
+				}
+				else {
+					memcpy(pDst, segment.p_, segment.nLen_);
+				}
+				pDst += segment.nLen_;
+			}
+			
+			return pMessage->create(pMessageBuf.get(),
+				nHeaderLen + nExpandedLen, Message::FLAG_NONE);
+		}
+		else if (pInflated.get() || bEscaped) {
+			malloc_ptr<CHAR> pMessageBuf(static_cast<CHAR*>(
+				allocate(nHeaderLen + nBodyLen)));
+			if (!pMessageBuf.get())
+				return false;
+			memcpy(pMessageBuf.get(), psz, nHeaderLen);
+			memcpy(pMessageBuf.get() + nHeaderLen, pb, nBodyLen);
+			return pMessage->create(pMessageBuf.get(),
+				nHeaderLen + nBodyLen, Message::FLAG_NONE);
+		}
+	}
+	
+	return pMessage->create(psz, nLen, Message::FLAG_NONE);
+}
+
+void qm::MessageStoreUtil::getLeafParts(const Part& part,
+										const CHAR* pBody,
+										size_t nBodyLen,
+										unsigned int nDepth,
+										RangeList* pList)
+{
+	assert(pBody);
+	assert(pList);
+	
+	const ContentTypeParser* pContentType = part.getContentType();
+	if (!pContentType || _wcsicmp(pContentType->getMediaType(), L"multipart") != 0) {
+		if (nBodyLen >= SHARE_MIN_SIZE)
+			pList->push_back(std::make_pair(pBody, nBodyLen));
+		return;
+	}
+	if (nDepth >= SHARE_MAX_DEPTH)
+		return;
+	
+	wstring_ptr wstrBoundary(pContentType->getParameter(L"boundary"));
+	if (!wstrBoundary.get())
+		return;
+	string_ptr strBoundary(wcs2mbs(wstrBoundary.get()));
+	string_ptr strDelimiter(concat("--", strBoundary.get()));
+	size_t nDelimiterLen = strlen(strDelimiter.get());
+	
+	const CHAR* pEnd = pBody + nBodyLen;
+	const CHAR* p = findDelimiter(pBody, pEnd, strDelimiter.get(), nDelimiterLen);
+	while (p) {
+		p += nDelimiterLen;
+		if (p + 2 <= pEnd && *p == '-' && *(p + 1) == '-')
+			break;
+		
+		const CHAR* pBegin = std::search(p, pEnd, "\r\n", "\r\n" + 2);
+		if (pBegin == pEnd)
+			break;
+		pBegin += 2;
+		
+		const CHAR* pNext = findDelimiter(pBegin, pEnd, strDelimiter.get(), nDelimiterLen);
+		if (!pNext)
+			break;
+		
+		// CRLF before the delimiter belongs to the delimiter
+		const CHAR* pPartEnd = pNext - pBegin >= 2 ? pNext - 2 : pBegin;
+		const CHAR* pPartBody = Part::getBody(pBegin, pPartEnd - pBegin);
+		if (pPartBody) {
+			string_ptr strHeader(allocString(pBegin, pPartBody - pBegin - 2));
+			Part childPart;
+			if (childPart.setHeader(strHeader.get()))
+				getLeafParts(childPart, pPartBody, pPartEnd - pPartBody, nDepth + 1, pList);
+		}
+		
+		p = pNext;
+	}
+}
+
+const CHAR* qm::MessageStoreUtil::findDelimiter(const CHAR* pBegin,
+												const CHAR* pEnd,
+												const CHAR* pszDelimiter,
+												size_t nDelimiterLen)
+{
+	const CHAR* p = pBegin;
+	while (true) {
+		p = std::search(p, pEnd, pszDelimiter, pszDelimiter + nDelimiterLen);
+		if (p == pEnd)
+			return 0;
+		else if (p == pBegin || (p - pBegin >= 2 && *(p - 2) == '\r' && *(p - 1) == '\n'))
+			return p;
+		++p;
+	}
+}
+
+bool qm::MessageStoreUtil::writeSegment(OutputStream* pStream,
+										unsigned char cType,
+										const unsigned char* p,
+										size_t nDataLen,
+										size_t nLen)
+{
+	assert(pStream);
+	assert(p);
+	
+	unsigned char buf[5] = { cType };
+	for (int n = 0; n < 4; ++n)
+		buf[1 + n] = static_cast<unsigned char>((nLen >> (n*8)) & 0xff);
+	
+	return pStream->write(buf, sizeof(buf)) != -1 &&
+		pStream->write(p, nDataLen) != -1;
+}
+
+bool qm::MessageStoreUtil::parseSharedBody(const unsigned char* p,
+										   size_t nLen,
+										   SegmentList* pList)
+{
+	assert(p);
+	assert(pList);
+	
+	if (nLen < 4 || memcmp(p, szShared__, 4) != 0)
+		return false;
+	
+	const unsigned char* pEnd = p + nLen;
+	p += 4;
+	while (p != pEnd) {
+		if (pEnd - p < 5)
+			return false;
+		
+		Segment segment = {
+			*p,
+			p + 5,
+			p[1] | (p[2] << 8) | (p[3] << 16) | (p[4] << 24)
+		};
+		p += 5;
+		
+		size_t nDataLen = 0;
+		switch (segment.cType_) {
+		case 'L':
+			nDataLen = segment.nLen_;
+			break;
+		case 'R':
+			nDataLen = PartStore::DIGEST_SIZE;
+			break;
+		default:
+			return false;
+		}
+		if (static_cast<size_t>(pEnd - p) < nDataLen)
+			return false;
+		p += nDataLen;
+		
+		pList->push_back(segment);
+	}
+	
+	return true;
+}
+
+malloc_size_ptr<unsigned char> qm::MessageStoreUtil::inflateBody(const unsigned char* p,
+																 size_t nLen)
+{
+	assert(p);
+	
+	if (nLen < COMPRESS_HEADER_SIZE || memcmp(p, szCompressed__, 4) != 0)
+		return malloc_size_ptr<unsigned char>();
+	
+	size_t nOriginalLen = p[4] | (p[5] << 8) | (p[6] << 16) | (p[7] << 24);
+	return Inflater::inflate(p + COMPRESS_HEADER_SIZE,
+		nLen - COMPRESS_HEADER_SIZE, nOriginalLen);
+}
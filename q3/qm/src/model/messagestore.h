@@ -14,8 +14,11 @@
 
 #include <qs.h>
 #include <qsclusterstorage.h>
+#include <qsstream.h>
 #include <qsstring.h>
 
+#include "partstore.h"
+
 
 namespace qm {
 
@@ -24,6 +27,7 @@ class MessageStore;
 	class MultiMessageStore;
 class MessageStoreSalvageCallback;
 class MessageStoreCheckCallback;
+class MessageStoreReadIndexCallback;
 class MessageStoreUtil;
 
 
@@ -77,15 +81,18 @@ public:
 					  unsigned int nLength,
 					  unsigned int nIndexKey,
 					  unsigned int nIndexLength) = 0;
-	virtual bool compact(DataList* pListData,
-						 MessageOperationCallback* pCallback) = 0;
+	virtual bool freeUnrefered(const DataList& listData) = 0;
 	virtual bool salvage(const DataList& listData,
 						 MessageStoreSalvageCallback* pCallback) = 0;
 	virtual bool isSalvageSupported() const = 0;
 	virtual bool check(MessageStoreCheckCallback* pCallback) = 0;
 	virtual bool freeUnused() = 0;
+	virtual bool move(Data* pData) = 0;
+	virtual unsigned int getFragmentation() = 0;
 	virtual qs::malloc_ptr<unsigned char> readIndex(unsigned int nKey,
 													unsigned int nLength) = 0;
+	virtual bool readIndex(const MessageIndexKeyList& listKey,
+						   MessageStoreReadIndexCallback* pCallback) = 0;
 
 public:
 	bool save(const CHAR* pszMessage,
@@ -113,7 +120,9 @@ public:
 	SingleMessageStore(const WCHAR* pwszPath,
 					   unsigned int nBlockSize,
 					   const WCHAR* pwszIndexPath,
-					   unsigned int nIndexBlockSize);
+					   unsigned int nIndexBlockSize,
+					   bool bCompress,
+					   bool bDeduplicate);
 	virtual ~SingleMessageStore();
 
 public:
@@ -143,15 +152,18 @@ public:
 					  unsigned int nLength,
 					  unsigned int nIndexKey,
 					  unsigned int nIndexLength);
-	virtual bool compact(DataList* pListData,
-						 MessageOperationCallback* pCallback);
+	virtual bool freeUnrefered(const DataList& listData);
 	virtual bool salvage(const DataList& listData,
 						 MessageStoreSalvageCallback* pCallback);
 	virtual bool isSalvageSupported() const;
 	virtual bool check(MessageStoreCheckCallback* pCallback);
 	virtual bool freeUnused();
+	virtual bool move(Data* pData);
+	virtual unsigned int getFragmentation();
 	virtual qs::malloc_ptr<unsigned char> readIndex(unsigned int nKey,
 													unsigned int nLength);
+	virtual bool readIndex(const MessageIndexKeyList& listKey,
+						   MessageStoreReadIndexCallback* pCallback);
 
 private:
 	SingleMessageStore(const SingleMessageStore&);
@@ -173,7 +185,9 @@ class MultiMessageStore : public MessageStore
 public:
 	MultiMessageStore(const WCHAR* pwszPath,
 					  const WCHAR* pwszIndexPath,
-					  unsigned int nIndexBlockSize);
+					  unsigned int nIndexBlockSize,
+					  bool bCompress,
+					  bool bDeduplicate);
 	virtual ~MultiMessageStore();
 
 public:
@@ -203,15 +217,18 @@ public:
 					  unsigned int nLength,
 					  unsigned int nIndexKey,
 					  unsigned int nIndexLength);
-	virtual bool compact(DataList* pListData,
-						 MessageOperationCallback* pCallback);
+	virtual bool freeUnrefered(const DataList& listData);
 	virtual bool salvage(const DataList& listData,
 						 MessageStoreSalvageCallback* pCallback);
 	virtual bool isSalvageSupported() const;
 	virtual bool check(MessageStoreCheckCallback* pCallback);
 	virtual bool freeUnused();
+	virtual bool move(Data* pData);
+	virtual unsigned int getFragmentation();
 	virtual qs::malloc_ptr<unsigned char> readIndex(unsigned int nKey,
 													unsigned int nLength);
+	virtual bool readIndex(const MessageIndexKeyList& listKey,
+						   MessageStoreReadIndexCallback* pCallback);
 
 private:
 	MultiMessageStore(const MultiMessageStore&);
@@ -263,6 +280,24 @@ public:
 };
 
 
+/****************************************************************************
+ *
+ * MessageStoreReadIndexCallback
+ *
+ */
+
+class MessageStoreReadIndexCallback
+{
+public:
+	virtual ~MessageStoreReadIndexCallback();
+
+public:
+	virtual void read(unsigned int nKey,
+					  unsigned int nLength,
+					  qs::malloc_ptr<unsigned char> pData) = 0;
+};
+
+
 /****************************************************************************
  *
  * MessageStoreUtil
@@ -271,10 +306,34 @@ public:
 
 class MessageStoreUtil
 {
+public:
+	enum {
+		COMPRESS_MIN_SIZE		= 512,
+		COMPRESS_HEADER_SIZE	= 8,
+		SHARE_MIN_SIZE			= 4096,
+		SHARE_MAX_DEPTH			= 8,
+		READINDEX_MAX_GAP		= 4096,
+		READINDEX_MAX_RANGE		= 64*1024
+	};
+
+private:
+	struct Segment
+	{
+		unsigned char cType_;
+		const unsigned char* p_;
+		size_t nLen_;
+	};
+
+private:
+	typedef std::vector<std::pair<const CHAR*, size_t> > RangeList;
+	typedef std::vector<Segment> SegmentList;
+
 public:
 	static void freeUnrefered(qs::ClusterStorage* pStorage,
 							  const MessageStore::DataList& listData,
 							  unsigned int nSeparatorSize);
+	static void freeUnreferedIndex(qs::ClusterStorage* pStorage,
+								   const MessageStore::DataList& listData);
 	static std::auto_ptr<qs::ClusterStorage> checkIndex(qs::ClusterStorage* pStorage,
 														const WCHAR* pwszPath,
 														unsigned int nBlockSize,
@@ -282,12 +341,59 @@ public:
 	static qs::malloc_ptr<unsigned char> readIndex(qs::ClusterStorage* pStorage,
 												   unsigned int nKey,
 												   unsigned int nLength);
+	static bool readIndex(qs::ClusterStorage* pStorage,
+						  const MessageIndexKeyList& listKey,
+						  MessageStoreReadIndexCallback* pCallback);
 	static bool updateIndex(qs::ClusterStorage* pStorage,
 							unsigned int nOldIndexKey,
 							unsigned int nOldIndexLength,
 							const unsigned char* pIndex,
 							unsigned int nIndexLength,
 							unsigned int* pnIndexKey);
+	static qs::malloc_size_ptr<unsigned char> compressBody(const CHAR* pszBody,
+														   size_t nBodyLen);
+	static bool isEscapeRequired(const unsigned char* p,
+								 size_t nLen);
+	static qs::malloc_size_ptr<unsigned char> escapeBody(const unsigned char* p,
+														 size_t nLen);
+	static qs::malloc_size_ptr<unsigned char> shareParts(const Message& header,
+														 const CHAR* pszBody,
+														 size_t nBodyLen,
+														 PartStore* pPartStore,
+														 PartStore::DigestList* pList);
+	static void getSharedParts(const unsigned char* p,
+							   size_t nLen,
+							   PartStore::DigestList* pList);
+	static bool createMessage(const unsigned char* p,
+							  size_t nLen,
+							  PartStore* pPartStore,
+							  Message* pMessage);
+
+private:
+	static void getLeafParts(const qs::Part& part,
+							 const CHAR* pBody,
+							 size_t nBodyLen,
+							 unsigned int nDepth,
+							 RangeList* pList);
+	static const CHAR* findDelimiter(const CHAR* pBegin,
+									 const CHAR* pEnd,
+									 const CHAR* pszDelimiter,
+									 size_t nDelimiterLen);
+	static bool writeSegment(qs::OutputStream* pStream,
+							 unsigned char cType,
+							 const unsigned char* p,
+							 size_t nDataLen,
+							 size_t nLen);
+	static bool parseSharedBody(const unsigned char* p,
+								size_t nLen,
+								SegmentList* pList);
+	static qs::malloc_size_ptr<unsigned char> inflateBody(const unsigned char* p,
+														  size_t nLen);
+
+private:
+	static const unsigned char szCompressed__[];
+	static const unsigned char szShared__[];
+	static const unsigned char szEscaped__[];
 };
 
 }
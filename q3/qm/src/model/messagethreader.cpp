@@ -0,0 +1,692 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qmaccount.h>
+#include <qmfilenames.h>
+#include <qmfolder.h>
+#include <qmmessageholder.h>
+
+#include <qsfile.h>
+#include <qsinit.h>
+#include <qslog.h>
+#include <qsstl.h>
+#include <qsstream.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+
+#include "messagethreader.h"
+
+using namespace qm;
+using namespace qs;
+
+
+namespace qm {
+struct MessageThreaderImpl;
+}
+
+
+/****************************************************************************
+ *
+ * MessageThreaderImpl
+ *
+ */
+
+struct qm::MessageThreaderImpl
+{
+	enum {
+		MAGIC				= 0x54480001,
+		VERSION				= 2,
+		MAX_MISSING_COUNT	= 1024
+	};
+	
+	struct Header
+	{
+		unsigned int nMagic_;
+		unsigned int nVersion_;
+		unsigned int nCount_;
+	};
+	
+	struct Record
+	{
+		unsigned int nId_;
+		unsigned int nParentId_;
+		unsigned int nMessageIdHash_;
+		unsigned int nMissingCount_;
+	};
+	
+	struct Container
+	{
+		MessageHolder* pmh_;
+		Container* pParent_;
+		const WCHAR* pwszMessageId_;
+	};
+	
+	typedef std::vector<unsigned int> HashList;
+	
+	/**
+	 * Threading result of a message. Hashes of message-ids which the message
+	 * refers but don't exist between the message and its parent are kept,
+	 * from the nearest to the farthest, so that messages whose parents may
+	 * change can be found when a message is added. The parent is looked up
+	 * by its id in a folder, and pParent_ is set only by thread, where
+	 * messages can be in different folders.
+	 */
+	struct Entry
+	{
+		MessageHolder* pmh_;
+		MessageHolder* pParent_;
+		unsigned int nId_;
+		unsigned int nParentId_;
+		unsigned int nMessageIdHash_;
+		HashList listMissing_;
+	};
+	
+	struct ParentLess : public std::binary_function<MessageThreader::ParentList::value_type, const MessageHolder*, bool>
+	{
+		bool operator()(const MessageThreader::ParentList::value_type& value,
+						const MessageHolder* pmh) const
+		{
+			return value.first < pmh;
+		}
+	};
+	
+	struct EntryLess : public std::binary_function<Entry, unsigned int, bool>
+	{
+		bool operator()(const Entry& entry,
+						unsigned int nId) const
+		{
+			return entry.nId_ < nId;
+		}
+	};
+	
+	typedef std::deque<Container> ContainerList;
+	typedef std::map<const WCHAR*, Container*, string_less<WCHAR> > ContainerMap;
+	typedef std::vector<WSTRING> StringList;
+	typedef std::vector<Entry> EntryList;
+	typedef std::vector<std::pair<unsigned int, MessageHolder*> > HashMap;
+	
+	static bool load(NormalFolder* pFolder,
+					 EntryList* pList);
+	static bool save(NormalFolder* pFolder,
+					 const EntryList& l);
+	static bool update(NormalFolder* pFolder,
+					   EntryList* pList,
+					   bool* pbModified);
+	static void thread(const MessageHolderList& l,
+					   EntryList* pList);
+	static void resolve(Entry* pEntry,
+						const EntryList& l,
+						const HashMap& mapHash);
+	static MessageHolder* findMessage(const WCHAR* pwszMessageId,
+									  const HashMap& mapHash);
+	static Entry* findEntry(EntryList& l,
+							unsigned int nId);
+	static const Entry* findEntry(const EntryList& l,
+								  unsigned int nId);
+	static bool isAncestorOf(unsigned int nId,
+							 unsigned int nParentId,
+							 const EntryList& l);
+	static wstring_ptr getPath(NormalFolder* pFolder);
+	static Container* createContainer(MessageHolder* pmh,
+									  const WCHAR* pwszMessageId,
+									  ContainerList* pList);
+	static Container* getContainer(const WCHAR* pwszMessageId,
+								   ContainerList* pList,
+								   ContainerMap* pMap,
+								   StringList* pStringList);
+	static bool isAncestorOf(const Container* pContainer1,
+							 const Container* pContainer2);
+};
+
+bool qm::MessageThreaderImpl::load(NormalFolder* pFolder,
+								   EntryList* pList)
+{
+	assert(pFolder);
+	assert(pList);
+	
+	wstring_ptr wstrPath(getPath(pFolder));
+	if (!File::isFileExisting(wstrPath.get()))
+		return false;
+	
+	FileInputStream fileStream(wstrPath.get());
+	if (!fileStream)
+		return false;
+	BufferedInputStream stream(&fileStream, false);
+	
+	Header header;
+	if (stream.read(reinterpret_cast<unsigned char*>(&header), sizeof(header)) != sizeof(header) ||
+		header.nMagic_ != MAGIC ||
+		header.nVersion_ != VERSION)
+		return false;
+	
+	EntryList l;
+	l.reserve(header.nCount_);
+	for (unsigned int n = 0; n < header.nCount_; ++n) {
+		Record record;
+		if (stream.read(reinterpret_cast<unsigned char*>(&record), sizeof(record)) != sizeof(record) ||
+			(!l.empty() && record.nId_ <= l.back().nId_) ||
+			record.nMissingCount_ > MAX_MISSING_COUNT)
+			return false;
+		
+		Entry entry = {
+			0,
+			0,
+			record.nId_,
+			record.nParentId_,
+			record.nMessageIdHash_
+		};
+		l.push_back(entry);
+		
+		HashList& listMissing = l.back().listMissing_;
+		if (record.nMissingCount_ != 0) {
+			listMissing.resize(record.nMissingCount_);
+			size_t nSize = listMissing.size()*sizeof(HashList::value_type);
+			if (stream.read(reinterpret_cast<unsigned char*>(&listMissing[0]), nSize) != nSize)
+				return false;
+		}
+	}
+	
+	pList->swap(l);
+	
+	return true;
+}
+
+bool qm::MessageThreaderImpl::save(NormalFolder* pFolder,
+								   const EntryList& l)
+{
+	assert(pFolder);
+	
+	wstring_ptr wstrPath(getPath(pFolder));
+	TemporaryFileRenamer renamer(wstrPath.get());
+	
+	FileOutputStream fileStream(renamer.getPath());
+	if (!fileStream)
+		return false;
+	BufferedOutputStream stream(&fileStream, false);
+	
+	Header header = {
+		MAGIC,
+		VERSION,
+		static_cast<unsigned int>(l.size())
+	};
+	if (stream.write(reinterpret_cast<const unsigned char*>(&header), sizeof(header)) == -1)
+		return false;
+	
+	for (EntryList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		const Entry& entry = *it;
+		Record record = {
+			entry.nId_,
+			entry.nParentId_,
+			entry.nMessageIdHash_,
+			static_cast<unsigned int>(entry.listMissing_.size())
+		};
+		if (stream.write(reinterpret_cast<const unsigned char*>(&record), sizeof(record)) == -1)
+			return false;
+		if (!entry.listMissing_.empty() &&
+			stream.write(reinterpret_cast<const unsigned char*>(&entry.listMissing_[0]),
+				entry.listMissing_.size()*sizeof(HashList::value_type)) == -1)
+			return false;
+	}
+	if (!stream.close())
+		return false;
+	
+	if (!renamer.rename())
+		return false;
+	
+	return true;
+}
+
+bool qm::MessageThreaderImpl::update(NormalFolder* pFolder,
+									 EntryList* pList,
+									 bool* pbModified)
+{
+	assert(pFolder);
+	assert(pList);
+	assert(pbModified);
+	
+	*pbModified = false;
+	
+	const EntryList& listOld = *pList;
+	const MessageHolderList& l = pFolder->getMessages();
+	
+	// Both of the messages and the saved entries are sorted by their ids
+	EntryList listEntry;
+	listEntry.reserve(l.size());
+	MessageHolderList listAdded;
+	bool bRemoved = false;
+	EntryList::const_iterator itO = listOld.begin();
+	for (MessageHolderList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		MessageHolder* pmh = *it;
+		unsigned int nId = pmh->getId();
+		while (itO != listOld.end() && (*itO).nId_ < nId) {
+			bRemoved = true;
+			++itO;
+		}
+		if (itO != listOld.end() && (*itO).nId_ == nId) {
+			listEntry.push_back(*itO);
+			++itO;
+		}
+		else {
+			Entry entry = {
+				0,
+				0,
+				nId,
+				-1,
+				0
+			};
+			listEntry.push_back(entry);
+			listAdded.push_back(pmh);
+		}
+		listEntry.back().pmh_ = pmh;
+	}
+	if (itO != listOld.end())
+		bRemoved = true;
+	
+	if (!bRemoved && listAdded.empty()) {
+		pList->swap(listEntry);
+		return true;
+	}
+	
+	// Threading all the messages again is faster than looking up messages
+	// one by one when many of them have been added
+	if (listAdded.size() > l.size()/4)
+		return false;
+	
+	// A message whose parent has been removed is linked to the nearest
+	// ancestor which still exists. The removed messages become missing.
+	if (bRemoved) {
+		for (EntryList::iterator it = listEntry.begin(); it != listEntry.end(); ++it) {
+			Entry& entry = *it;
+			if (entry.nParentId_ == -1 || findEntry(listEntry, entry.nParentId_))
+				continue;
+			
+			unsigned int nParentId = entry.nParentId_;
+			for (size_t n = 0; n < listOld.size() && nParentId != -1; ++n) {
+				const Entry* pParent = findEntry(listOld, nParentId);
+				if (!pParent) {
+					nParentId = -1;
+					break;
+				}
+				else if (findEntry(listEntry, nParentId)) {
+					break;
+				}
+				if (pParent->nMessageIdHash_ != 0)
+					entry.listMissing_.push_back(pParent->nMessageIdHash_);
+				entry.listMissing_.insert(entry.listMissing_.end(),
+					pParent->listMissing_.begin(), pParent->listMissing_.end());
+				nParentId = pParent->nParentId_;
+			}
+			if (nParentId != -1 && !findEntry(listEntry, nParentId))
+				nParentId = -1;
+			entry.nParentId_ = nParentId;
+		}
+	}
+	
+	if (!listAdded.empty()) {
+		pFolder->getAccount()->prepareIndex(listAdded);
+		
+		HashList listAddedHash;
+		for (MessageHolderList::const_iterator it = listAdded.begin(); it != listAdded.end(); ++it) {
+			Entry* pEntry = findEntry(listEntry, (*it)->getId());
+			pEntry->nMessageIdHash_ = (*it)->getMessageIdHash();
+			if (pEntry->nMessageIdHash_ != 0)
+				listAddedHash.push_back(pEntry->nMessageIdHash_);
+		}
+		std::sort(listAddedHash.begin(), listAddedHash.end());
+		
+		HashMap mapHash;
+		mapHash.reserve(listEntry.size());
+		for (EntryList::const_iterator it = listEntry.begin(); it != listEntry.end(); ++it) {
+			if ((*it).nMessageIdHash_ != 0)
+				mapHash.push_back(std::make_pair((*it).nMessageIdHash_, (*it).pmh_));
+		}
+		std::sort(mapHash.begin(), mapHash.end());
+		
+		// Messages which refer an added message as missing may be linked to it
+		MessageHolderList listAffected;
+		for (EntryList::const_iterator it = listEntry.begin(); it != listEntry.end(); ++it) {
+			const HashList& listMissing = (*it).listMissing_;
+			for (HashList::const_iterator itM = listMissing.begin(); itM != listMissing.end(); ++itM) {
+				if (std::binary_search(listAddedHash.begin(), listAddedHash.end(), *itM)) {
+					listAffected.push_back((*it).pmh_);
+					break;
+				}
+			}
+		}
+		pFolder->getAccount()->prepareIndex(listAffected);
+		
+		for (MessageHolderList::const_iterator it = listAdded.begin(); it != listAdded.end(); ++it)
+			resolve(findEntry(listEntry, (*it)->getId()), listEntry, mapHash);
+		for (MessageHolderList::const_iterator it = listAffected.begin(); it != listAffected.end(); ++it)
+			resolve(findEntry(listEntry, (*it)->getId()), listEntry, mapHash);
+	}
+	
+	pList->swap(listEntry);
+	*pbModified = true;
+	
+	return true;
+}
+
+void qm::MessageThreaderImpl::thread(const MessageHolderList& l,
+									 EntryList* pList)
+{
+	assert(pList);
+	
+	MessageThreaderImpl::ContainerList listContainer;
+	MessageThreaderImpl::ContainerMap mapContainer;
+	MessageThreaderImpl::StringList listString;
+	CONTAINER_DELETER(free, listString, &freeWString);
+	
+	// Register all the messages first, so that a message can be linked to
+	// a message which comes after it in the list
+	typedef std::vector<Container*> MessageContainerList;
+	MessageContainerList listMessageContainer;
+	listMessageContainer.reserve(l.size());
+	HashList listHash;
+	listHash.reserve(l.size());
+	for (MessageHolderList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		MessageHolder* pmh = *it;
+		Container* pContainer = 0;
+		unsigned int nHash = 0;
+		
+		wstring_ptr wstrMessageId(pmh->getMessageId());
+		if (wstrMessageId.get() && *wstrMessageId.get()) {
+			nHash = MessageHolder::hashMessageId(wstrMessageId.get());
+			MessageThreaderImpl::ContainerMap::const_iterator itC = mapContainer.find(wstrMessageId.get());
+			if (itC == mapContainer.end()) {
+				listString.push_back(wstrMessageId.get());
+				wstrMessageId.release();
+				pContainer = MessageThreaderImpl::createContainer(pmh, listString.back(), &listContainer);
+				mapContainer.insert(std::make_pair(listString.back(), pContainer));
+			}
+		}
+		// A message without message-id or with a duplicated message-id
+		// cannot be referred, but can still have its parent
+		if (!pContainer)
+			pContainer = MessageThreaderImpl::createContainer(pmh, 0, &listContainer);
+		
+		listMessageContainer.push_back(pContainer);
+		listHash.push_back(nHash);
+	}
+	
+	for (MessageContainerList::size_type n = 0; n < listMessageContainer.size(); ++n) {
+		Container* pContainer = listMessageContainer[n];
+		
+		MessageThreader::ReferenceList listReference;
+		wstring_ptr wstrReferences(MessageThreader::getReferences(pContainer->pmh_, &listReference));
+		
+		Container* pPrev = 0;
+		for (MessageThreader::ReferenceList::const_iterator it = listReference.begin(); it != listReference.end(); ++it) {
+			Container* pRefContainer = MessageThreaderImpl::getContainer(
+				*it, &listContainer, &mapContainer, &listString);
+			if (pPrev && !pRefContainer->pParent_ &&
+				!MessageThreaderImpl::isAncestorOf(pRefContainer, pPrev))
+				pRefContainer->pParent_ = pPrev;
+			pPrev = pRefContainer;
+		}
+		
+		// The last reference overrides the parent which has been guessed
+		// from references of other messages
+		if (pPrev && !MessageThreaderImpl::isAncestorOf(pContainer, pPrev))
+			pContainer->pParent_ = pPrev;
+	}
+	
+	EntryList listEntry;
+	listEntry.reserve(listMessageContainer.size());
+	for (MessageContainerList::size_type n = 0; n < listMessageContainer.size(); ++n) {
+		const Container* pContainer = listMessageContainer[n];
+		Entry entry = {
+			pContainer->pmh_,
+			0,
+			pContainer->pmh_->getId(),
+			-1,
+			listHash[n]
+		};
+		listEntry.push_back(entry);
+		
+		const Container* pParent = pContainer->pParent_;
+		while (pParent && !pParent->pmh_) {
+			listEntry.back().listMissing_.push_back(
+				MessageHolder::hashMessageId(pParent->pwszMessageId_));
+			pParent = pParent->pParent_;
+		}
+		if (pParent) {
+			listEntry.back().pParent_ = pParent->pmh_;
+			listEntry.back().nParentId_ = pParent->pmh_->getId();
+		}
+	}
+	
+	pList->swap(listEntry);
+}
+
+void qm::MessageThreaderImpl::resolve(Entry* pEntry,
+									  const EntryList& l,
+									  const HashMap& mapHash)
+{
+	assert(pEntry);
+	
+	// Link to the nearest message which the message refers and exists
+	pEntry->nParentId_ = -1;
+	pEntry->listMissing_.clear();
+	
+	MessageThreader::ReferenceList listReference;
+	wstring_ptr wstrReferences(MessageThreader::getReferences(pEntry->pmh_, &listReference));
+	for (MessageThreader::ReferenceList::reverse_iterator it = listReference.rbegin(); it != listReference.rend(); ++it) {
+		MessageHolder* pParent = findMessage(*it, mapHash);
+		if (pParent && pParent != pEntry->pmh_ &&
+			!isAncestorOf(pEntry->nId_, pParent->getId(), l)) {
+			pEntry->nParentId_ = pParent->getId();
+			break;
+		}
+		pEntry->listMissing_.push_back(MessageHolder::hashMessageId(*it));
+	}
+}
+
+MessageHolder* qm::MessageThreaderImpl::findMessage(const WCHAR* pwszMessageId,
+													const HashMap& mapHash)
+{
+	assert(pwszMessageId);
+	
+	unsigned int nHash = MessageHolder::hashMessageId(pwszMessageId);
+	HashMap::const_iterator it = std::lower_bound(mapHash.begin(), mapHash.end(),
+		std::make_pair(nHash, static_cast<MessageHolder*>(0)));
+	for (; it != mapHash.end() && (*it).first == nHash; ++it) {
+		wstring_ptr wstrMessageId((*it).second->getMessageId());
+		if (wstrMessageId.get() && wcscmp(wstrMessageId.get(), pwszMessageId) == 0)
+			return (*it).second;
+	}
+	return 0;
+}
+
+MessageThreaderImpl::Entry* qm::MessageThreaderImpl::findEntry(EntryList& l,
+															   unsigned int nId)
+{
+	EntryList::iterator it = std::lower_bound(l.begin(), l.end(), nId, EntryLess());
+	return it != l.end() && (*it).nId_ == nId ? &*it : 0;
+}
+
+const MessageThreaderImpl::Entry* qm::MessageThreaderImpl::findEntry(const EntryList& l,
+																	 unsigned int nId)
+{
+	EntryList::const_iterator it = std::lower_bound(l.begin(), l.end(), nId, EntryLess());
+	return it != l.end() && (*it).nId_ == nId ? &*it : 0;
+}
+
+bool qm::MessageThreaderImpl::isAncestorOf(unsigned int nId,
+										   unsigned int nParentId,
+										   const EntryList& l)
+{
+	for (size_t n = 0; n <= l.size() && nParentId != -1; ++n) {
+		if (nParentId == nId)
+			return true;
+		const Entry* pEntry = findEntry(l, nParentId);
+		if (!pEntry)
+			break;
+		nParentId = pEntry->nParentId_;
+	}
+	return false;
+}
+
+wstring_ptr qm::MessageThreaderImpl::getPath(NormalFolder* pFolder)
+{
+	WCHAR wsz[32];
+	_snwprintf(wsz, countof(wsz), L"\\%03d%s", pFolder->getId(), FileNames::THREAD_EXT);
+	return concat(pFolder->getAccount()->getPath(), wsz);
+}
+
+MessageThreaderImpl::Container* qm::MessageThreaderImpl::createContainer(MessageHolder* pmh,
+																		 const WCHAR* pwszMessageId,
+																		 ContainerList* pList)
+{
+	Container container = {
+		pmh,
+		0,
+		pwszMessageId
+	};
+	pList->push_back(container);
+	return &pList->back();
+}
+
+MessageThreaderImpl::Container* qm::MessageThreaderImpl::getContainer(const WCHAR* pwszMessageId,
+																	  ContainerList* pList,
+																	  ContainerMap* pMap,
+																	  StringList* pStringList)
+{
+	ContainerMap::iterator it = pMap->find(pwszMessageId);
+	if (it != pMap->end())
+		return (*it).second;
+	
+	// A container without a message stands for a message which is referred
+	// but doesn't exist, so that its children are still threaded together
+	wstring_ptr wstrMessageId(allocWString(pwszMessageId));
+	pStringList->push_back(wstrMessageId.get());
+	wstrMessageId.release();
+	Container* pContainer = createContainer(0, pStringList->back(), pList);
+	pMap->insert(std::make_pair(pStringList->back(), pContainer));
+	
+	return pContainer;
+}
+
+bool qm::MessageThreaderImpl::isAncestorOf(const Container* pContainer1,
+										   const Container* pContainer2)
+{
+	while (pContainer2) {
+		if (pContainer2 == pContainer1)
+			return true;
+		pContainer2 = pContainer2->pParent_;
+	}
+	return false;
+}
+
+
+/****************************************************************************
+ *
+ * MessageThreader
+ *
+ */
+
+void qm::MessageThreader::getParentList(Folder* pFolder,
+										ParentList* pList)
+{
+	assert(pFolder);
+	assert(pFolder->getAccount()->isLocked());
+	assert(pList);
+	
+	if (pFolder->getType() != Folder::TYPE_NORMAL) {
+		MessageHolderList l(pFolder->getMessages());
+		pFolder->getAccount()->prepareIndex(l);
+		makeParentList(l, pList);
+		return;
+	}
+	
+	NormalFolder* pNormalFolder = static_cast<NormalFolder*>(pFolder);
+	
+	// The saved result is updated with messages which have been added and
+	// removed since it was saved
+	MessageThreaderImpl::EntryList listEntry;
+	bool bModified = true;
+	if (!MessageThreaderImpl::load(pNormalFolder, &listEntry) ||
+		!MessageThreaderImpl::update(pNormalFolder, &listEntry, &bModified)) {
+		MessageHolderList l(pFolder->getMessages());
+		pFolder->getAccount()->prepareIndex(l);
+		MessageThreaderImpl::thread(l, &listEntry);
+		bModified = true;
+	}
+	
+	ParentList listParent;
+	listParent.reserve(listEntry.size());
+	for (MessageThreaderImpl::EntryList::const_iterator it = listEntry.begin(); it != listEntry.end(); ++it) {
+		MessageHolder* pParent = (*it).nParentId_ != -1 ?
+			pNormalFolder->getMessageHolderById((*it).nParentId_) : 0;
+		listParent.push_back(std::make_pair((*it).pmh_, pParent));
+	}
+	std::sort(listParent.begin(), listParent.end());
+	pList->swap(listParent);
+	
+	if (bModified && !MessageThreaderImpl::save(pNormalFolder, listEntry)) {
+		Log log(InitThread::getInitThread().getLogger(), L"qm::MessageThreader");
+		log.errorf(L"Failed to save threads: %s", pFolder->getName());
+	}
+}
+
+void qm::MessageThreader::makeParentList(const MessageHolderList& l,
+										 ParentList* pList)
+{
+	assert(pList);
+	
+	MessageThreaderImpl::EntryList listEntry;
+	MessageThreaderImpl::thread(l, &listEntry);
+	
+	ParentList listParent;
+	listParent.reserve(listEntry.size());
+	for (MessageThreaderImpl::EntryList::const_iterator it = listEntry.begin(); it != listEntry.end(); ++it)
+		listParent.push_back(std::make_pair((*it).pmh_, (*it).pParent_));
+	std::sort(listParent.begin(), listParent.end());
+	
+	pList->swap(listParent);
+}
+
+MessageHolder* qm::MessageThreader::getParent(const ParentList& l,
+											  const MessageHolder* pmh)
+{
+	ParentList::const_iterator it = std::lower_bound(l.begin(),
+		l.end(), pmh, MessageThreaderImpl::ParentLess());
+	return it != l.end() && (*it).first == pmh ? (*it).second : 0;
+}
+
+wstring_ptr qm::MessageThreader::getReferences(const MessageHolder* pmh,
+											   ReferenceList* pList)
+{
+	assert(pmh);
+	assert(pList);
+	
+	wstring_ptr wstrReferences(pmh->getReferences());
+	if (!wstrReferences.get() || !*wstrReferences.get())
+		wstrReferences = pmh->getReference();
+	if (!wstrReferences.get())
+		return 0;
+	
+	WCHAR* p = wstrReferences.get();
+	while (*p) {
+		while (*p == L' ')
+			++p;
+		if (!*p)
+			break;
+		pList->push_back(p);
+		
+		p = wcschr(p, L' ');
+		if (!p)
+			break;
+		*p++ = L'\0';
+	}
+	
+	return wstrReferences;
+}
@@ -0,0 +1,96 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#ifndef __MESSAGETHREADER_H__
+#define __MESSAGETHREADER_H__
+
+#include <qm.h>
+#include <qmmessageholderlist.h>
+
+#include <qs.h>
+#include <qsstring.h>
+
+#include <vector>
+
+
+namespace qm {
+
+class MessageThreader;
+
+class Folder;
+class MessageHolder;
+
+
+/****************************************************************************
+ *
+ * MessageThreader
+ *
+ * Thread messages using all the message-ids in References or In-Reply-To.
+ * A message whose direct parent doesn't exist is linked to the nearest
+ * ancestor which exists. The result of a normal folder is saved next to
+ * its index. When it's loaded, messages which have been added since it was
+ * saved are threaded and linked to messages which refer them, and children
+ * of messages which have been removed are linked to their ancestors, without
+ * threading all the messages again.
+ *
+ */
+
+class MessageThreader
+{
+public:
+	typedef std::vector<std::pair<MessageHolder*, MessageHolder*> > ParentList;
+	typedef std::vector<const WCHAR*> ReferenceList;
+
+public:
+	/**
+	 * Get parents of all the messages in the folder. The account must be
+	 * locked.
+	 *
+	 * @param pFolder [in] Folder.
+	 * @param pList [out] Pairs of a message and its parent sorted by
+	 *                    the message. The parent is null if not found.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	static void getParentList(Folder* pFolder,
+							  ParentList* pList);
+	
+	/**
+	 * Thread messages.
+	 *
+	 * @param l [in] Messages.
+	 * @param pList [out] Pairs of a message and its parent sorted by
+	 *                    the message. The parent is null if not found.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	static void makeParentList(const MessageHolderList& l,
+							   ParentList* pList);
+	
+	/**
+	 * Get the parent of the message in the list.
+	 *
+	 * @return Parent. null if the message doesn't have its parent or
+	 *         the message is not in the list.
+	 */
+	static MessageHolder* getParent(const ParentList& l,
+									const MessageHolder* pmh);
+	
+	/**
+	 * Get message-ids which the message refers, from the farthest to
+	 * the nearest.
+	 *
+	 * @param pmh [in] Message.
+	 * @param pList [out] Message-ids. They point to the returned buffer.
+	 * @return Buffer which holds message-ids. null if no reference.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	static qs::wstring_ptr getReferences(const MessageHolder* pmh,
+										 ReferenceList* pList);
+};
+
+}
+
+#endif // __MESSAGETHREADER_H__
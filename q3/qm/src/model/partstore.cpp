@@ -0,0 +1,316 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qmfilenames.h>
+
+#include <qsclusterstorage.h>
+#include <qsfile.h>
+#include <qsinit.h>
+#include <qslog.h>
+#include <qsmd5.h>
+#include <qsstream.h>
+#include <qsthread.h>
+
+#include <map>
+
+#include "partstore.h"
+
+using namespace qm;
+using namespace qs;
+
+
+/****************************************************************************
+ *
+ * PartStoreImpl
+ *
+ */
+
+struct qm::PartStoreImpl
+{
+	struct Entry
+	{
+		unsigned int nOffset_;
+		unsigned int nLength_;
+		unsigned int nRef_;
+	};
+	
+	struct Record
+	{
+		PartStore::Digest digest_;
+		Entry entry_;
+	};
+	
+	typedef std::map<PartStore::Digest, Entry> Map;
+	
+	bool prepare();
+	bool save();
+	bool free(Map::iterator it);
+	
+	wstring_ptr wstrPath_;
+	std::auto_ptr<ClusterStorage> pStorage_;
+	Map map_;
+	bool bLoaded_;
+	bool bModified_;
+	CriticalSection cs_;
+};
+
+bool qm::PartStoreImpl::prepare()
+{
+	if (bLoaded_)
+		return true;
+	
+	if (File::isFileExisting(wstrPath_.get())) {
+		Log log(InitThread::getInitThread().getLogger(), L"qm::PartStore");
+		
+		FileInputStream fileStream(wstrPath_.get());
+		if (!fileStream) {
+			log.errorf(L"Failed to open file: %s", wstrPath_.get());
+			return false;
+		}
+		BufferedInputStream stream(&fileStream, false);
+		
+		while (true) {
+			Record record;
+			size_t nRead = stream.read(reinterpret_cast<unsigned char*>(&record), sizeof(record));
+			if (nRead == -1) {
+				log.errorf(L"Failed to read file: %s", wstrPath_.get());
+				return false;
+			}
+			else if (nRead != sizeof(record)) {
+				break;
+			}
+			map_.insert(std::make_pair(record.digest_, record.entry_));
+		}
+	}
+	
+	bLoaded_ = true;
+	
+	return true;
+}
+
+bool qm::PartStoreImpl::save()
+{
+	if (!bModified_)
+		return true;
+	
+	TemporaryFileRenamer renamer(wstrPath_.get());
+	
+	FileOutputStream fileStream(renamer.getPath());
+	if (!fileStream)
+		return false;
+	BufferedOutputStream stream(&fileStream, false);
+	
+	for (Map::const_iterator it = map_.begin(); it != map_.end(); ++it) {
+		Record record = {
+			(*it).first,
+			(*it).second
+		};
+		if (stream.write(reinterpret_cast<const unsigned char*>(&record), sizeof(record)) == -1)
+			return false;
+	}
+	if (!stream.close())
+		return false;
+	
+	if (!renamer.rename())
+		return false;
+	
+	bModified_ = false;
+	
+	return true;
+}
+
+bool qm::PartStoreImpl::free(Map::iterator it)
+{
+	if (!pStorage_->free((*it).second.nOffset_, (*it).second.nLength_))
+		return false;
+	map_.erase(it);
+	bModified_ = true;
+	return true;
+}
+
+
+/****************************************************************************
+ *
+ * PartStore
+ *
+ */
+
+qm::PartStore::PartStore(const WCHAR* pwszPath,
+						 unsigned int nBlockSize)
+{
+	ConcatW c[] = {
+		{ pwszPath,				-1	},
+		{ L"\\",				1	},
+		{ FileNames::PART,		-1	},
+		{ FileNames::REF_EXT,	-1	}
+	};
+	wstring_ptr wstrPath(concat(c, countof(c)));
+	
+	std::auto_ptr<ClusterStorage> pStorage(new ClusterStorage(pwszPath,
+		FileNames::PART, FileNames::BOX_EXT, FileNames::MAP_EXT, nBlockSize));
+	
+	pImpl_ = new PartStoreImpl();
+	pImpl_->wstrPath_ = wstrPath;
+	pImpl_->pStorage_ = pStorage;
+	pImpl_->bLoaded_ = false;
+	pImpl_->bModified_ = false;
+}
+
+qm::PartStore::~PartStore()
+{
+	delete pImpl_;
+}
+
+bool qm::PartStore::close()
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	return pImpl_->pStorage_->close() && pImpl_->save();
+}
+
+bool qm::PartStore::flush()
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	return pImpl_->pStorage_->close() && pImpl_->save();
+}
+
+bool qm::PartStore::hasPart()
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	return pImpl_->prepare() && !pImpl_->map_.empty();
+}
+
+bool qm::PartStore::add(const unsigned char* p,
+						size_t nLen,
+						Digest* pDigest)
+{
+	assert(p);
+	assert(nLen != 0);
+	assert(pDigest);
+	
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	if (!pImpl_->prepare())
+		return false;
+	
+	MD5::md5(p, nLen, pDigest->digest_);
+	
+	PartStoreImpl::Map::iterator it = pImpl_->map_.find(*pDigest);
+	if (it != pImpl_->map_.end()) {
+		// Two bodies whose lengths are different but whose digests are the same
+		// cannot be distinguished. The caller stores it as it is in this case.
+		if ((*it).second.nLength_ != nLen)
+			return false;
+		++(*it).second.nRef_;
+	}
+	else {
+		const unsigned char* pData[] = { p };
+		size_t nDataLen[] = { nLen };
+		unsigned int nOffset = pImpl_->pStorage_->save(pData, nDataLen, countof(pData));
+		if (nOffset == -1)
+			return false;
+		
+		PartStoreImpl::Entry entry = {
+			nOffset,
+			static_cast<unsigned int>(nLen),
+			1
+		};
+		pImpl_->map_.insert(std::make_pair(*pDigest, entry));
+	}
+	pImpl_->bModified_ = true;
+	
+	return true;
+}
+
+bool qm::PartStore::release(const DigestList& l)
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	if (!pImpl_->prepare())
+		return false;
+	
+	for (DigestList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		PartStoreImpl::Map::iterator itE = pImpl_->map_.find(*it);
+		if (itE == pImpl_->map_.end())
+			continue;
+		
+		if (--(*itE).second.nRef_ == 0) {
+			if (!pImpl_->free(itE))
+				return false;
+		}
+		pImpl_->bModified_ = true;
+	}
+	
+	return true;
+}
+
+malloc_ptr<unsigned char> qm::PartStore::load(const Digest& digest,
+											  size_t nLen)
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	if (!pImpl_->prepare())
+		return malloc_ptr<unsigned char>(0);
+	
+	PartStoreImpl::Map::const_iterator it = pImpl_->map_.find(digest);
+	if (it == pImpl_->map_.end() || (*it).second.nLength_ != nLen)
+		return malloc_ptr<unsigned char>(0);
+	
+	malloc_ptr<unsigned char> p(static_cast<unsigned char*>(allocate(nLen)));
+	if (!p.get())
+		return malloc_ptr<unsigned char>(0);
+	
+	if (pImpl_->pStorage_->load(p.get(), (*it).second.nOffset_, nLen) != nLen)
+		return malloc_ptr<unsigned char>(0);
+	
+	return p;
+}
+
+bool qm::PartStore::freeUnrefered(const DigestList& l)
+{
+	Lock<CriticalSection> lock(pImpl_->cs_);
+	
+	if (!pImpl_->prepare())
+		return false;
+	
+	PartStoreImpl::Map& m = pImpl_->map_;
+	for (PartStoreImpl::Map::iterator it = m.begin(); it != m.end(); ++it)
+		(*it).second.nRef_ = 0;
+	
+	for (DigestList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		PartStoreImpl::Map::iterator itE = m.find(*it);
+		if (itE != m.end())
+			++(*itE).second.nRef_;
+	}
+	
+	PartStoreImpl::Map::iterator itE = m.begin();
+	while (itE != m.end()) {
+		PartStoreImpl::Map::iterator itNext = itE;
+		++itNext;
+		if ((*itE).second.nRef_ == 0) {
+			if (!pImpl_->free(itE))
+				return false;
+		}
+		itE = itNext;
+	}
+	pImpl_->bModified_ = true;
+	
+	return pImpl_->pStorage_->freeUnused() && pImpl_->save();
+}
+
+
+/****************************************************************************
+ *
+ * PartStore::Digest
+ *
+ */
+
+bool qm::PartStore::Digest::operator<(const Digest& digest) const
+{
+	return memcmp(digest_, digest.digest_, DIGEST_SIZE) < 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#ifndef __PARTSTORE_H__
+#define __PARTSTORE_H__
+
+#include <qm.h>
+
+#include <qs.h>
+#include <qsstring.h>
+
+#include <vector>
+
+
+namespace qm {
+
+class PartStore;
+
+
+/****************************************************************************
+ *
+ * PartStore
+ *
+ * Content addressed store of bodies of MIME parts. Each body is identified
+ * by its MD5 digest and stored only once with a reference count, so that
+ * the same attachment in copied messages or in messages posted to mailing
+ * lists doesn't take the space more than once.
+ *
+ */
+
+class PartStore
+{
+public:
+	enum {
+		DIGEST_SIZE	= 16
+	};
+
+public:
+	struct Digest
+	{
+		unsigned char digest_[DIGEST_SIZE];
+		
+		bool operator<(const Digest& digest) const;
+	};
+
+public:
+	typedef std::vector<Digest> DigestList;
+
+public:
+	/**
+	 * Create instance.
+	 *
+	 * @param pwszPath [in] Path of the directory where the store is created.
+	 * @param nBlockSize [in] Block size of the storage.
+	 */
+	PartStore(const WCHAR* pwszPath,
+			  unsigned int nBlockSize);
+	~PartStore();
+
+public:
+	bool close();
+	bool flush();
+	
+	/**
+	 * Check if there is any part in this store.
+	 */
+	bool hasPart();
+	
+	/**
+	 * Add a body. If the same body has already been stored, increment its
+	 * reference count instead of storing it again.
+	 *
+	 * @param p [in] Body.
+	 * @param nLen [in] Length of the body.
+	 * @param pDigest [out] Digest of the body.
+	 * @return true if success, false otherwise. This also fails when
+	 *         another body whose digest is the same exists.
+	 */
+	bool add(const unsigned char* p,
+			 size_t nLen,
+			 Digest* pDigest);
+	
+	/**
+	 * Decrement reference counts and free bodies which are no longer
+	 * referred.
+	 *
+	 * @param l [in] Digests. The same digest can appear more than once.
+	 * @return true if success, false otherwise.
+	 */
+	bool release(const DigestList& l);
+	
+	/**
+	 * Load a body.
+	 *
+	 * @param digest [in] Digest.
+	 * @param nLen [in] Length of the body.
+	 * @return Body. null if not found or failed.
+	 */
+	qs::malloc_ptr<unsigned char> load(const Digest& digest,
+									   size_t nLen);
+	
+	/**
+	 * Set reference counts to the number of occurrences in the specified
+	 * list and free bodies which are not referred.
+	 *
+	 * @param l [in] Digests referred by all the messages in the store.
+	 * @return true if success, false otherwise.
+	 */
+	bool freeUnrefered(const DigestList& l);
+
+private:
+	PartStore(const PartStore&);
+	PartStore& operator=(const PartStore&);
+
+private:
+	struct PartStoreImpl* pImpl_;
+};
+
+}
+
+#endif // __PARTSTORE_H__
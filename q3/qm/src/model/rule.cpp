@@ -20,15 +20,19 @@
 #include <qsfile.h>
 #include <qsinit.h>
 #include <qsosutil.h>
+#include <qsstl.h>
 #include <qsstream.h>
 #include <qsthread.h>
 
 #include <algorithm>
 
+#include "messageholdersnapshot.h"
 #include "modelresource.h"
 #include "rule.h"
+#include "ruleindex.h"
 #include "templatemanager.h"
 #include "undo.h"
+#include "../macro/macro.h"
 #include "../main/main.h"
 
 using namespace qm;
@@ -51,6 +55,15 @@ public:
 		FLAG_JUNKONLY	= 0x04,
 		FLAG_NEW		= 0x08
 	};
+	
+	enum {
+		BATCH_PER_THREAD	= 16
+	};
+
+public:
+	typedef std::vector<Rule*> RuleList;
+	typedef std::vector<size_t> IndexList;
+	typedef std::vector<MessageHolderSnapshot*> SnapshotList;
 
 public:
 	class Accessor
@@ -122,13 +135,74 @@ public:
 		MessagePtrList& l_;
 		bool bRequestResult_;
 	};
-
-public:
-	typedef std::vector<Rule*> RuleList;
+	
+	class Matcher
+	{
+	public:
+		Matcher(const RuleList& listRule,
+				const RuleIndex& index,
+				Account* pAccount,
+				SubAccount* pSubAccount,
+				Folder* pFolder,
+				Document* pDocument,
+				const ActionInvoker* pActionInvoker,
+				HWND hwnd,
+				Profile* pProfile,
+				unsigned int nMacroFlags,
+				unsigned int nSecurityMode,
+				MacroVariableHolder* pGlobalVariable);
+		~Matcher();
+	
+	public:
+		void match(MessageHolderBase* pmh,
+				   Message* pMessage,
+				   IndexList* pList) const;
+	
+	private:
+		Matcher(const Matcher&);
+		Matcher& operator=(const Matcher&);
+	
+	private:
+		const RuleList& listRule_;
+		const RuleIndex& index_;
+		Account* pAccount_;
+		SubAccount* pSubAccount_;
+		Folder* pFolder_;
+		Document* pDocument_;
+		const ActionInvoker* pActionInvoker_;
+		HWND hwnd_;
+		Profile* pProfile_;
+		unsigned int nMacroFlags_;
+		unsigned int nSecurityMode_;
+		MacroVariableHolder* pGlobalVariable_;
+	};
+	
+	class MatchRunnable : public Runnable
+	{
+	public:
+		MatchRunnable(const Matcher& matcher,
+					  const SnapshotList& listSnapshot,
+					  std::vector<IndexList>* pListMatch);
+		virtual ~MatchRunnable();
+	
+	public:
+		virtual void run();
+	
+	private:
+		MatchRunnable(const MatchRunnable&);
+		MatchRunnable& operator=(const MatchRunnable&);
+	
+	private:
+		const Matcher& matcher_;
+		const SnapshotList& listSnapshot_;
+		std::vector<IndexList>* pListMatch_;
+		volatile LONG nNext_;
+	};
 
 public:
 	RuleManagerImpl(RuleManager* pThis,
-					const WCHAR* pwszPath);
+					const WCHAR* pwszPath,
+					unsigned int nThreadCount);
 
 public:
 	bool load();
@@ -154,6 +228,13 @@ private:
 	static bool isNeedPrepare(Accessor* pAccessor,
 							  MacroContext::MessageType type);
 	static MacroContext::MessageType getMessageType(const RuleList& l);
+	static bool isReadOnly(const RuleList& l);
+	static void getFieldPlan(const RuleList& l,
+							 MacroFieldPlan* pPlan);
+	static size_t addMatch(size_t nMessage,
+						   const MessageHolderBase* pmh,
+						   const IndexList& listMatch,
+						   std::vector<IndexList>* pll);
 
 public:
 	RuleManager* pThis_;
@@ -161,13 +242,16 @@ public:
 	ReadWriteLock lock_;
 	ReadWriteWriteLock writeLock_;
 	ConfigHelper<RuleManager, RuleContentHandler, RuleWriter, ReadWriteWriteLock> helper_;
+	std::auto_ptr<ThreadPool> pThreadPool_;
 };
 
 qm::RuleManagerImpl::RuleManagerImpl(RuleManager* pThis,
-									 const WCHAR* pwszPath) :
+									 const WCHAR* pwszPath,
+									 unsigned int nThreadCount) :
 	pThis_(pThis),
 	writeLock_(lock_),
-	helper_(pwszPath, writeLock_)
+	helper_(pwszPath, writeLock_),
+	pThreadPool_(new ThreadPool(nThreadCount))
 {
 }
 
@@ -259,47 +343,117 @@ bool qm::RuleManagerImpl::apply(Folder* pFolder,
 		isNeedPrepare(pAccessor, getMessageType(listRule)))
 		pAccount->prepareGetMessage(static_cast<NormalFolder*>(pFolder));
 	
-	typedef std::vector<size_t> IndexList;
+	RuleIndex index(listRule);
+	log.debugf(L"%u rules are indexed.", index.getCount());
+	
 	typedef std::vector<IndexList> ListList;
 	ListList ll(listRule.size());
 	
+	unsigned int nMacroFlags = (bBackground ? MacroContext::FLAG_NONE :
+		MacroContext::FLAG_UITHREAD | MacroContext::FLAG_UI) |
+		(nFlags & FLAG_NEW ? MacroContext::FLAG_NEW : 0);
+	
+	// Counts of the macro value factory are read before and after
+	// evaluating conditions to log how they allocate values
+	MacroValueFactory::Stats statsStart = { 0, 0, 0, 0 };
+	if (log.isDebugEnabled())
+		MacroValueFactory::getFactory().getStats(&statsStart);
+	
 	size_t nMatch = 0;
 	MacroVariableHolder globalVariable;
-	for (size_t nMessage = 0; nMessage < nCount; ++nMessage) {
-		if (pCallback && nMessage % 10 == 0 && pCallback->isCanceled())
-			return true;
+	Matcher matcher(listRule, index, pAccount, pSubAccount, pFolder, pDocument,
+		pActionInvoker, hwnd, pProfile, nMacroFlags, nSecurityMode, &globalVariable);
+	if (bBackground &&
+		nSecurityMode == SECURITYMODE_NONE &&
+		pFolder->getType() == Folder::TYPE_NORMAL &&
+		!pAccount->isRemoteMessageFolder(static_cast<NormalFolder*>(pFolder)) &&
+		pThreadPool_->getThreadCount() > 1 &&
+		nCount > 1 &&
+		isReadOnly(listRule)) {
+		log.debugf(L"Conditions are evaluated by %u threads.", pThreadPool_->getThreadCount());
 		
-		if (pCallback)
-			pCallback->setPos(nMessage);
+		MacroFieldPlan plan;
+		getFieldPlan(listRule, &plan);
 		
-		MessagePtrLock mpl(pAccessor->getMessagePtr(nMessage));
-		MessageHolder* pmh = mpl ? mpl : pAccessor->getMessageHolder(nMessage);
-		if (pmh) {
-			Message msg;
-			for (RuleList::size_type nRule = 0; nRule < listRule.size(); ++nRule) {
-				const Rule* pRule = listRule[nRule];
-				if (!pRule->isEnabled())
-					continue;
-				
-				unsigned int nMacroFlags = (bBackground ? MacroContext::FLAG_NONE :
-					MacroContext::FLAG_UITHREAD | MacroContext::FLAG_UI) |
-					(nFlags & FLAG_NEW ? MacroContext::FLAG_NEW : 0);
-				MacroContext context(pmh, &msg, pAccount, pSubAccount,
-					MessageHolderList(), pFolder, pDocument, pActionInvoker, hwnd,
-					pProfile, 0, nMacroFlags, nSecurityMode, 0, &globalVariable);
-				bool bMatch = pRule->match(&context);
-				if (bMatch) {
-					ll[nRule].push_back(nMessage);
-					++nMatch;
-					log.debugf(L"Id=%u matches rule=%u.", pmh->getId(), nRule);
-					
-					if (!pRule->isContinue() || !pRule->isContinuable())
-						break;
-				}
+		size_t nBatch = pThreadPool_->getThreadCount()*BATCH_PER_THREAD;
+		SnapshotList listSnapshot;
+		CONTAINER_DELETER(free, listSnapshot);
+		listSnapshot.reserve(nBatch);
+		for (size_t n = 0; n < nBatch; ++n)
+			listSnapshot.push_back(new MessageHolderSnapshot());
+		
+		SnapshotList listLoaded;
+		ListList listMatch;
+		typedef std::vector<Runnable*> RunnableList;
+		for (size_t nBegin = 0; nBegin < nCount; nBegin += nBatch) {
+			if (pCallback) {
+				if (pCallback->isCanceled())
+					return true;
+				pCallback->setPos(nBegin);
+			}
+			
+			size_t nEnd = QSMIN(nBegin + nBatch, nCount);
+			
+			// Workers evaluate conditions against snapshots which are taken
+			// here, and never lock the account. This thread keeps it locked
+			// until they finish so that no message is removed meanwhile.
+			Lock<Account> lock(*pAccount);
+			
+			listLoaded.clear();
+			for (size_t nMessage = nBegin; nMessage < nEnd; ++nMessage) {
+				MessagePtrLock mpl(pAccessor->getMessagePtr(nMessage));
+				MessageHolder* pmh = mpl ? mpl : pAccessor->getMessageHolder(nMessage);
+				MessageHolderSnapshot* pSnapshot = listSnapshot[nMessage - nBegin];
+				if (pmh && pSnapshot->load(pmh, plan, nSecurityMode))
+					listLoaded.push_back(pSnapshot);
+				else
+					listLoaded.push_back(0);
+			}
+			listMatch.clear();
+			listMatch.resize(listLoaded.size());
+			
+			MatchRunnable runnable(matcher, listLoaded, &listMatch);
+			RunnableList listRunnable(pThreadPool_->getThreadCount(), &runnable);
+			if (!pThreadPool_->execute(&listRunnable[0], listRunnable.size())) {
+				log.error(L"Error occurred while evaluating conditions.");
+				return false;
+			}
+			
+			for (size_t n = 0; n < listMatch.size(); ++n) {
+				if (listLoaded[n])
+					nMatch += addMatch(nBegin + n, listLoaded[n], listMatch[n], &ll);
+			}
+		}
+	}
+	else {
+		IndexList listMatch;
+		for (size_t nMessage = 0; nMessage < nCount; ++nMessage) {
+			if (pCallback && nMessage % 10 == 0 && pCallback->isCanceled())
+				return true;
+			
+			if (pCallback)
+				pCallback->setPos(nMessage);
+			
+			MessagePtrLock mpl(pAccessor->getMessagePtr(nMessage));
+			MessageHolder* pmh = mpl ? mpl : pAccessor->getMessageHolder(nMessage);
+			if (pmh) {
+				Message msg;
+				listMatch.clear();
+				matcher.match(pmh, &msg, &listMatch);
+				nMatch += addMatch(nMessage, pmh, listMatch, &ll);
 			}
 		}
 	}
 	log.debugf(L"%u messages match.", nMatch);
+	if (log.isDebugEnabled()) {
+		MacroValueFactory::Stats stats;
+		MacroValueFactory::getFactory().getStats(&stats);
+		log.debugf(L"%u macro values (%u strings) are allocated, %u are released by other threads and drained %u times.",
+			stats.nAllocation_ - statsStart.nAllocation_,
+			stats.nStringAllocation_ - statsStart.nStringAllocation_,
+			stats.nRemoteRelease_ - statsStart.nRemoteRelease_,
+			stats.nDrain_ - statsStart.nDrain_);
+	}
 	if (nMatch == 0)
 		return true;
 	
@@ -416,6 +570,46 @@ MacroContext::MessageType qm::RuleManagerImpl::getMessageType(const RuleList& l)
 	return type;
 }
 
+bool qm::RuleManagerImpl::isReadOnly(const RuleList& l)
+{
+	for (RuleList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		const Rule* pRule = *it;
+		if (!pRule->isEnabled())
+			continue;
+		
+		if (!ReadOnlyMacroExprVisitor::isReadOnly(pRule->getCondition()->getExpr()))
+			return false;
+	}
+	return true;
+}
+
+void qm::RuleManagerImpl::getFieldPlan(const RuleList& l,
+									   MacroFieldPlan* pPlan)
+{
+	assert(pPlan);
+	
+	for (RuleList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		const Rule* pRule = *it;
+		if (pRule->isEnabled())
+			pRule->getCondition()->getExpr()->getFieldPlan(pPlan);
+	}
+}
+
+size_t qm::RuleManagerImpl::addMatch(size_t nMessage,
+									 const MessageHolderBase* pmh,
+									 const IndexList& listMatch,
+									 std::vector<IndexList>* pll)
+{
+	assert(pll);
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::RuleManagerImpl");
+	for (IndexList::const_iterator it = listMatch.begin(); it != listMatch.end(); ++it) {
+		(*pll)[*it].push_back(nMessage);
+		log.debugf(L"Id=%u matches rule=%u.", pmh->getId(), *it);
+	}
+	return listMatch.size();
+}
+
 
 /****************************************************************************
  *
@@ -556,16 +750,123 @@ void qm::RuleManagerImpl::ListAccessor::setMessageHolder(size_t n,
 }
 
 
+/****************************************************************************
+ *
+ * RuleManagerImpl::Matcher
+ *
+ */
+
+qm::RuleManagerImpl::Matcher::Matcher(const RuleList& listRule,
+									  const RuleIndex& index,
+									  Account* pAccount,
+									  SubAccount* pSubAccount,
+									  Folder* pFolder,
+									  Document* pDocument,
+									  const ActionInvoker* pActionInvoker,
+									  HWND hwnd,
+									  Profile* pProfile,
+									  unsigned int nMacroFlags,
+									  unsigned int nSecurityMode,
+									  MacroVariableHolder* pGlobalVariable) :
+	listRule_(listRule),
+	index_(index),
+	pAccount_(pAccount),
+	pSubAccount_(pSubAccount),
+	pFolder_(pFolder),
+	pDocument_(pDocument),
+	pActionInvoker_(pActionInvoker),
+	hwnd_(hwnd),
+	pProfile_(pProfile),
+	nMacroFlags_(nMacroFlags),
+	nSecurityMode_(nSecurityMode),
+	pGlobalVariable_(pGlobalVariable)
+{
+}
+
+qm::RuleManagerImpl::Matcher::~Matcher()
+{
+}
+
+void qm::RuleManagerImpl::Matcher::match(MessageHolderBase* pmh,
+										 Message* pMessage,
+										 IndexList* pList) const
+{
+	assert(pmh);
+	assert(pMessage);
+	assert(pList);
+	
+	// Rules which cannot match are skipped without being evaluated,
+	// but the others are still evaluated in order
+	MacroContext indexContext(pmh, pMessage, pAccount_, pSubAccount_,
+		MessageHolderList(), pFolder_, pDocument_, pActionInvoker_, hwnd_,
+		pProfile_, 0, nMacroFlags_, nSecurityMode_, 0, pGlobalVariable_);
+	RuleIndex::Candidates candidates(index_, &indexContext);
+	
+	for (RuleList::size_type nRule = 0; nRule < listRule_.size(); ++nRule) {
+		const Rule* pRule = listRule_[nRule];
+		if (!pRule->isEnabled() || !candidates.isCandidate(nRule))
+			continue;
+		
+		MacroContext context(pmh, pMessage, pAccount_, pSubAccount_,
+			MessageHolderList(), pFolder_, pDocument_, pActionInvoker_, hwnd_,
+			pProfile_, 0, nMacroFlags_, nSecurityMode_, 0, pGlobalVariable_);
+		if (pRule->match(&context)) {
+			pList->push_back(nRule);
+			if (!pRule->isContinue() || !pRule->isContinuable())
+				break;
+		}
+	}
+}
+
+
+/****************************************************************************
+ *
+ * RuleManagerImpl::MatchRunnable
+ *
+ */
+
+qm::RuleManagerImpl::MatchRunnable::MatchRunnable(const Matcher& matcher,
+												  const SnapshotList& listSnapshot,
+												  std::vector<IndexList>* pListMatch) :
+	matcher_(matcher),
+	listSnapshot_(listSnapshot),
+	pListMatch_(pListMatch),
+	nNext_(0)
+{
+	assert(pListMatch_->size() == listSnapshot_.size());
+}
+
+qm::RuleManagerImpl::MatchRunnable::~MatchRunnable()
+{
+}
+
+void qm::RuleManagerImpl::MatchRunnable::run()
+{
+	// The same runnable is run by all the threads, and each of them takes
+	// the next message until all the messages are taken
+	while (true) {
+		size_t n = ::InterlockedIncrement(const_cast<LONG*>(&nNext_)) - 1;
+		if (n >= listSnapshot_.size())
+			break;
+		
+		MessageHolderSnapshot* pSnapshot = listSnapshot_[n];
+		if (pSnapshot)
+			matcher_.match(pSnapshot, pSnapshot->getMessage(), &(*pListMatch_)[n]);
+	}
+}
+
+
 /****************************************************************************
  *
  * RuleManager
  *
  */
 
-qm::RuleManager::RuleManager(const WCHAR* pwszPath) :
+qm::RuleManager::RuleManager(const WCHAR* pwszPath,
+							 unsigned int nThreadCount) :
 	pImpl_(0)
 {
-	pImpl_ = new RuleManagerImpl(this, pwszPath);
+	pImpl_ = new RuleManagerImpl(this, pwszPath, nThreadCount);
 }
 
 qm::RuleManager::~RuleManager()
@@ -0,0 +1,563 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qmmacro.h>
+
+#include <qsstl.h>
+#include <qsstring.h>
+
+#include <algorithm>
+#include <deque>
+#include <hash_map>
+
+#include "rule.h"
+#include "ruleindex.h"
+#include "../macro/macro.h"
+
+using namespace qm;
+using namespace qs;
+
+
+/****************************************************************************
+ *
+ * RuleIndexImpl
+ *
+ */
+
+struct qm::RuleIndexImpl
+{
+	typedef std::vector<size_t> IndexList;
+	typedef std::vector<unsigned int> KeyIndexList;
+	typedef std::vector<bool> CandidateList;
+	typedef std::hash_map<unsigned int, IndexList> EqualMap;
+	
+	struct Node
+	{
+		typedef std::vector<std::pair<WCHAR, unsigned int> > GotoList;
+		
+		GotoList listGoto_;
+		unsigned int nFail_;
+		unsigned int nOutput_;
+		IndexList listRule_;
+	};
+	
+	typedef std::vector<Node> NodeList;
+	
+	struct Key
+	{
+		const MacroExpr* pExpr_;
+		wstring_ptr wstrName_;
+		IndexList listRule_;
+		EqualMap mapEqual_;
+		NodeList listNode_;
+	};
+	
+	typedef std::vector<Key*> KeyList;
+	
+	class TypeMacroExprVisitor : public MacroExprVisitor
+	{
+	public:
+		enum Type {
+			TYPE_FIELD,
+			TYPE_FIELDCACHE,
+			TYPE_LITERAL,
+			TYPE_NUMBER,
+			TYPE_BOOLEAN,
+			TYPE_REGEX,
+			TYPE_VARIABLE,
+			TYPE_CONSTANT,
+			TYPE_FUNCTION
+		};
+	
+	public:
+		explicit TypeMacroExprVisitor(const MacroExpr* pExpr);
+		virtual ~TypeMacroExprVisitor();
+	
+	public:
+		Type getType() const;
+	
+	public:
+		virtual void visitField(const MacroField& field);
+		virtual void visitFieldCache(const MacroFieldCache& fieldCache);
+		virtual void visitLiteral(const MacroLiteral& literal);
+		virtual void visitNumber(const MacroNumber& number);
+		virtual void visitBoolean(const MacroBoolean& boolean);
+		virtual void visitRegex(const MacroRegex& regex);
+		virtual void visitVariable(const MacroVariable& variable);
+		virtual void visitConstant(const MacroConstant& constant);
+		virtual void visitFunction(const MacroFunction& function);
+	
+	private:
+		TypeMacroExprVisitor(const TypeMacroExprVisitor&);
+		TypeMacroExprVisitor& operator=(const TypeMacroExprVisitor&);
+	
+	private:
+		Type type_;
+	};
+	
+	void add(size_t nRule,
+			 const Rule* pRule);
+	unsigned int getKey(const MacroExpr* pExpr);
+	
+	static const MacroFunction* getFunction(const MacroExpr* pExpr);
+	static bool isKey(const MacroExpr* pExpr);
+	static bool isConstant(const MacroExpr* pExpr);
+	static const WCHAR* getLiteral(const MacroExpr* pExpr);
+	static void addPattern(Key* pKey,
+						   const WCHAR* pwszPattern,
+						   size_t nRule);
+	static void build(Key* pKey);
+	static void evaluate(const Key& key,
+						 MacroContext* pContext,
+						 CandidateList* pList);
+	static void search(const Key& key,
+					   const WCHAR* pwsz,
+					   CandidateList* pList);
+	static unsigned int getGoto(const Node& node,
+								WCHAR c);
+	static void mark(const IndexList& l,
+					 CandidateList* pList);
+	static wstring_ptr fold(const WCHAR* pwsz);
+	static unsigned int hash(const WCHAR* pwsz);
+	
+	KeyList listKey_;
+	KeyIndexList listRuleKey_;
+	CandidateList listAlways_;
+	size_t nCount_;
+};
+
+void qm::RuleIndexImpl::add(size_t nRule,
+							const Rule* pRule)
+{
+	assert(pRule);
+	
+	if (!pRule->isEnabled())
+		return;
+	
+	const Macro* pCondition = pRule->getCondition();
+	const MacroFunction* pFunction = pCondition ? getFunction(pCondition->getExpr()) : 0;
+	
+	// Only the first argument of @And can be indexed, because skipping a rule
+	// must not skip side effects of arguments which would be evaluated before
+	while (pFunction &&
+		wcscmp(pFunction->getFunctionName(), L"And") == 0 &&
+		pFunction->getArgSize() != 0)
+		pFunction = getFunction(pFunction->getArg(0));
+	
+	if (pFunction) {
+		const WCHAR* pwszName = pFunction->getFunctionName();
+		size_t nArgSize = pFunction->getArgSize();
+		if (nArgSize == 2 || (nArgSize == 3 && isConstant(pFunction->getArg(2)))) {
+			const MacroExpr* pArg0 = pFunction->getArg(0);
+			const MacroExpr* pArg1 = pFunction->getArg(1);
+			if (wcscmp(pwszName, L"Equal") == 0) {
+				if (!isKey(pArg0))
+					std::swap(pArg0, pArg1);
+				const WCHAR* pwszValue = getLiteral(pArg1);
+				if (isKey(pArg0) && pwszValue) {
+					unsigned int nKey = getKey(pArg0);
+					Key* pKey = listKey_[nKey];
+					wstring_ptr wstrValue(fold(pwszValue));
+					pKey->mapEqual_[hash(wstrValue.get())].push_back(nRule);
+					pKey->listRule_.push_back(nRule);
+					listRuleKey_[nRule] = nKey;
+					++nCount_;
+					return;
+				}
+			}
+			else if (wcscmp(pwszName, L"Contain") == 0 ||
+				wcscmp(pwszName, L"BeginWith") == 0) {
+				// An empty literal is contained in any value
+				const WCHAR* pwszValue = getLiteral(pArg1);
+				if (isKey(pArg0) && pwszValue && *pwszValue) {
+					unsigned int nKey = getKey(pArg0);
+					Key* pKey = listKey_[nKey];
+					wstring_ptr wstrValue(fold(pwszValue));
+					addPattern(pKey, wstrValue.get(), nRule);
+					pKey->listRule_.push_back(nRule);
+					listRuleKey_[nRule] = nKey;
+					++nCount_;
+					return;
+				}
+			}
+		}
+	}
+	
+	listAlways_[nRule] = true;
+}
+
+unsigned int qm::RuleIndexImpl::getKey(const MacroExpr* pExpr)
+{
+	assert(pExpr);
+	
+	wstring_ptr wstrName(pExpr->getString());
+	for (KeyList::size_type n = 0; n < listKey_.size(); ++n) {
+		if (_wcsicmp(listKey_[n]->wstrName_.get(), wstrName.get()) == 0)
+			return static_cast<unsigned int>(n);
+	}
+	
+	std::auto_ptr<Key> pKey(new Key());
+	pKey->pExpr_ = pExpr;
+	pKey->wstrName_ = wstrName;
+	listKey_.push_back(pKey.get());
+	pKey.release();
+	return static_cast<unsigned int>(listKey_.size() - 1);
+}
+
+const MacroFunction* qm::RuleIndexImpl::getFunction(const MacroExpr* pExpr)
+{
+	if (!pExpr)
+		return 0;
+	
+	TypeMacroExprVisitor visitor(pExpr);
+	if (visitor.getType() != TypeMacroExprVisitor::TYPE_FUNCTION)
+		return 0;
+	return static_cast<const MacroFunction*>(pExpr);
+}
+
+bool qm::RuleIndexImpl::isKey(const MacroExpr* pExpr)
+{
+	assert(pExpr);
+	
+	TypeMacroExprVisitor visitor(pExpr);
+	switch (visitor.getType()) {
+	case TypeMacroExprVisitor::TYPE_FIELD:
+		return true;
+	case TypeMacroExprVisitor::TYPE_FIELDCACHE:
+		switch (static_cast<const MacroFieldCache*>(pExpr)->getType()) {
+		case MacroFieldCache::TYPE_FROM:
+		case MacroFieldCache::TYPE_TO:
+		case MacroFieldCache::TYPE_FROMTO:
+		case MacroFieldCache::TYPE_SUBJECT:
+			return true;
+		default:
+			return false;
+		}
+	default:
+		return false;
+	}
+}
+
+bool qm::RuleIndexImpl::isConstant(const MacroExpr* pExpr)
+{
+	assert(pExpr);
+	
+	TypeMacroExprVisitor visitor(pExpr);
+	switch (visitor.getType()) {
+	case TypeMacroExprVisitor::TYPE_LITERAL:
+	case TypeMacroExprVisitor::TYPE_NUMBER:
+	case TypeMacroExprVisitor::TYPE_BOOLEAN:
+		return true;
+	default:
+		return false;
+	}
+}
+
+const WCHAR* qm::RuleIndexImpl::getLiteral(const MacroExpr* pExpr)
+{
+	assert(pExpr);
+	
+	TypeMacroExprVisitor visitor(pExpr);
+	if (visitor.getType() != TypeMacroExprVisitor::TYPE_LITERAL)
+		return 0;
+	return static_cast<const MacroLiteral*>(pExpr)->getValue();
+}
+
+void qm::RuleIndexImpl::addPattern(Key* pKey,
+								   const WCHAR* pwszPattern,
+								   size_t nRule)
+{
+	assert(pKey);
+	assert(pwszPattern);
+	
+	NodeList& l = pKey->listNode_;
+	if (l.empty()) {
+		Node root = { Node::GotoList(), 0, static_cast<unsigned int>(-1), IndexList() };
+		l.push_back(root);
+	}
+	
+	unsigned int n = 0;
+	for (const WCHAR* p = pwszPattern; *p; ++p) {
+		unsigned int nNext = getGoto(l[n], *p);
+		if (nNext == -1) {
+			nNext = static_cast<unsigned int>(l.size());
+			Node node = { Node::GotoList(), 0, static_cast<unsigned int>(-1), IndexList() };
+			l.push_back(node);
+			
+			Node::GotoList& listGoto = l[n].listGoto_;
+			Node::GotoList::value_type value(*p, nNext);
+			listGoto.insert(std::lower_bound(listGoto.begin(), listGoto.end(), value), value);
+		}
+		n = nNext;
+	}
+	l[n].listRule_.push_back(nRule);
+}
+
+void qm::RuleIndexImpl::build(Key* pKey)
+{
+	assert(pKey);
+	
+	NodeList& l = pKey->listNode_;
+	if (l.empty())
+		return;
+	
+	// Nodes at depth one fail to the root, which never has any output
+	std::deque<unsigned int> queue;
+	const Node::GotoList& listRoot = l[0].listGoto_;
+	for (Node::GotoList::const_iterator it = listRoot.begin(); it != listRoot.end(); ++it)
+		queue.push_back((*it).second);
+	
+	while (!queue.empty()) {
+		unsigned int n = queue.front();
+		queue.pop_front();
+		
+		const Node::GotoList& listGoto = l[n].listGoto_;
+		for (Node::GotoList::const_iterator it = listGoto.begin(); it != listGoto.end(); ++it) {
+			WCHAR c = (*it).first;
+			unsigned int nChild = (*it).second;
+			
+			unsigned int nFail = l[n].nFail_;
+			unsigned int nNext = getGoto(l[nFail], c);
+			while (nNext == -1 && nFail != 0) {
+				nFail = l[nFail].nFail_;
+				nNext = getGoto(l[nFail], c);
+			}
+			
+			Node& child = l[nChild];
+			child.nFail_ = nNext != -1 ? nNext : 0;
+			const Node& fail = l[child.nFail_];
+			child.nOutput_ = !fail.listRule_.empty() ? child.nFail_ : fail.nOutput_;
+			
+			queue.push_back(nChild);
+		}
+	}
+}
+
+void qm::RuleIndexImpl::evaluate(const Key& key,
+								 MacroContext* pContext,
+								 CandidateList* pList)
+{
+	assert(pContext);
+	assert(pList);
+	
+	// Leave the rules to be evaluated if the field cannot be evaluated,
+	// so that the error is handled in the same way as before
+	MacroValuePtr pValue(key.pExpr_->value(pContext));
+	if (!pValue.get()) {
+		mark(key.listRule_, pList);
+		return;
+	}
+	
+	MacroValue::String wstrValue(pValue->string());
+	wstring_ptr wstr(fold(wstrValue.get()));
+	
+	EqualMap::const_iterator it = key.mapEqual_.find(hash(wstr.get()));
+	if (it != key.mapEqual_.end())
+		mark((*it).second, pList);
+	
+	search(key, wstr.get(), pList);
+}
+
+void qm::RuleIndexImpl::search(const Key& key,
+							   const WCHAR* pwsz,
+							   CandidateList* pList)
+{
+	assert(pwsz);
+	assert(pList);
+	
+	const NodeList& l = key.listNode_;
+	if (l.empty())
+		return;
+	
+	unsigned int n = 0;
+	for (const WCHAR* p = pwsz; *p; ++p) {
+		unsigned int nNext = getGoto(l[n], *p);
+		while (nNext == -1 && n != 0) {
+			n = l[n].nFail_;
+			nNext = getGoto(l[n], *p);
+		}
+		n = nNext != -1 ? nNext : 0;
+		
+		for (unsigned int m = !l[n].listRule_.empty() ? n : l[n].nOutput_; m != -1; m = l[m].nOutput_)
+			mark(l[m].listRule_, pList);
+	}
+}
+
+unsigned int qm::RuleIndexImpl::getGoto(const Node& node,
+										WCHAR c)
+{
+	Node::GotoList::value_type value(c, 0);
+	Node::GotoList::const_iterator it = std::lower_bound(
+		node.listGoto_.begin(), node.listGoto_.end(), value);
+	return it != node.listGoto_.end() && (*it).first == c ? (*it).second : -1;
+}
+
+void qm::RuleIndexImpl::mark(const IndexList& l,
+							 CandidateList* pList)
+{
+	assert(pList);
+	
+	for (IndexList::const_iterator it = l.begin(); it != l.end(); ++it)
+		(*pList)[*it] = true;
+}
+
+wstring_ptr qm::RuleIndexImpl::fold(const WCHAR* pwsz)
+{
+	assert(pwsz);
+	
+	// Values are compared by @Equal and @BeginWith with _wcsicmp and
+	// _wcsnicmp, and by @Contain with towlower. Folding them in the same way
+	// makes the index never miss a rule which can match.
+	wstring_ptr wstr(allocWString(pwsz));
+	for (WCHAR* p = wstr.get(); *p; ++p)
+		*p = CharTraits<WCHAR>::toLower(*p);
+	return wstr;
+}
+
+unsigned int qm::RuleIndexImpl::hash(const WCHAR* pwsz)
+{
+	assert(pwsz);
+	
+	unsigned int nHash = 0;
+	while (*pwsz)
+		nHash = nHash*31 + static_cast<unsigned int>(*pwsz++);
+	return nHash;
+}
+
+
+/****************************************************************************
+ *
+ * RuleIndexImpl::TypeMacroExprVisitor
+ *
+ */
+
+qm::RuleIndexImpl::TypeMacroExprVisitor::TypeMacroExprVisitor(const MacroExpr* pExpr) :
+	type_(TYPE_FUNCTION)
+{
+	pExpr->visit(this);
+}
+
+qm::RuleIndexImpl::TypeMacroExprVisitor::~TypeMacroExprVisitor()
+{
+}
+
+RuleIndexImpl::TypeMacroExprVisitor::Type qm::RuleIndexImpl::TypeMacroExprVisitor::getType() const
+{
+	return type_;
+}
+
+void qm::RuleIndexImpl::TypeMacroExprVisitor::visitField(const MacroField& field)
+{
+	type_ = TYPE_FIELD;
+}
+
+void qm::RuleIndexImpl::TypeMacroExprVisitor::visitFieldCache(const MacroFieldCache& fieldCache)
+{
+	type_ = TYPE_FIELDCACHE;
+}
+
+void qm::RuleIndexImpl::TypeMacroExprVisitor::visitLiteral(const MacroLiteral& literal)
+{
+	type_ = TYPE_LITERAL;
+}
+
+void qm::RuleIndexImpl::TypeMacroExprVisitor::visitNumber(const MacroNumber& number)
+{
+	type_ = TYPE_NUMBER;
+}
+
+void qm::RuleIndexImpl::TypeMacroExprVisitor::visitBoolean(const MacroBoolean& boolean)
+{
+	type_ = TYPE_BOOLEAN;
+}
+
+void qm::RuleIndexImpl::TypeMacroExprVisitor::visitRegex(const MacroRegex& regex)
+{
+	type_ = TYPE_REGEX;
+}
+
+void qm::RuleIndexImpl::TypeMacroExprVisitor::visitVariable(const MacroVariable& variable)
+{
+	type_ = TYPE_VARIABLE;
+}
+
+void qm::RuleIndexImpl::TypeMacroExprVisitor::visitConstant(const MacroConstant& constant)
+{
+	type_ = TYPE_CONSTANT;
+}
+
+void qm::RuleIndexImpl::TypeMacroExprVisitor::visitFunction(const MacroFunction& function)
+{
+	type_ = TYPE_FUNCTION;
+}
+
+
+/****************************************************************************
+ *
+ * RuleIndex
+ *
+ */
+
+qm::RuleIndex::RuleIndex(const RuleList& l)
+{
+	pImpl_ = new RuleIndexImpl();
+	pImpl_->listRuleKey_.resize(l.size(), static_cast<unsigned int>(-1));
+	pImpl_->listAlways_.resize(l.size(), false);
+	pImpl_->nCount_ = 0;
+	
+	for (RuleList::size_type n = 0; n < l.size(); ++n)
+		pImpl_->add(n, l[n]);
+	std::for_each(pImpl_->listKey_.begin(), pImpl_->listKey_.end(), &RuleIndexImpl::build);
+}
+
+qm::RuleIndex::~RuleIndex()
+{
+	std::for_each(pImpl_->listKey_.begin(), pImpl_->listKey_.end(),
+		boost::checked_deleter<RuleIndexImpl::Key>());
+	delete pImpl_;
+}
+
+size_t qm::RuleIndex::getCount() const
+{
+	return pImpl_->nCount_;
+}
+
+
+/****************************************************************************
+ *
+ * RuleIndex::Candidates
+ *
+ */
+
+qm::RuleIndex::Candidates::Candidates(const RuleIndex& index,
+									  MacroContext* pContext) :
+	index_(index),
+	pContext_(pContext),
+	listCandidate_(index.pImpl_->listAlways_),
+	listEvaluated_(index.pImpl_->listKey_.size(), false)
+{
+	assert(pContext);
+}
+
+qm::RuleIndex::Candidates::~Candidates()
+{
+}
+
+bool qm::RuleIndex::Candidates::isCandidate(size_t nRule)
+{
+	const RuleIndexImpl* pImpl = index_.pImpl_;
+	assert(nRule < pImpl->listRuleKey_.size());
+	
+	unsigned int nKey = pImpl->listRuleKey_[nRule];
+	if (nKey != -1 && !listEvaluated_[nKey]) {
+		RuleIndexImpl::evaluate(*pImpl->listKey_[nKey], pContext_, &listCandidate_);
+		listEvaluated_[nKey] = true;
+	}
+	return listCandidate_[nRule];
+}
@@ -0,0 +1,120 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#ifndef __RULEINDEX_H__
+#define __RULEINDEX_H__
+
+#include <qm.h>
+
+#include <qs.h>
+
+#include <vector>
+
+
+namespace qm {
+
+class RuleIndex;
+
+class MacroContext;
+class Rule;
+
+
+/****************************************************************************
+ *
+ * RuleIndex
+ *
+ * Index of simple predicates in conditions of rules. A predicate which is
+ * evaluated first in a condition and compares a field with a literal by
+ * @Equal, @Contain or @BeginWith is indexed by the field. Equal literals are
+ * put into a hash table and other literals are put into an Aho-Corasick
+ * automaton, so that each field is evaluated only once for all the rules.
+ * A rule whose predicate doesn't match cannot match, and doesn't need to be
+ * evaluated. All the other rules are always candidates.
+ *
+ */
+
+class RuleIndex
+{
+public:
+	/**
+	 * Candidates of a message.
+	 *
+	 * A field is evaluated when a rule indexed by it is checked first,
+	 * so that fields which only later rules are indexed by are not
+	 * evaluated if an earlier rule stops matching.
+	 */
+	class Candidates
+	{
+	public:
+		/**
+		 * Create instance.
+		 *
+		 * @param index [in] Index. It must be alive while this is used.
+		 * @param pContext [in] Context of the message. It must be alive
+		 *                      while this is used.
+		 * @exception std::bad_alloc Out of memory.
+		 */
+		Candidates(const RuleIndex& index,
+				   MacroContext* pContext);
+		~Candidates();
+	
+	public:
+		/**
+		 * Check if the rule can match the message.
+		 *
+		 * @param nRule [in] Index of the rule.
+		 * @return true if the rule can match and needs to be evaluated,
+		 *         false otherwise.
+		 * @exception std::bad_alloc Out of memory.
+		 */
+		bool isCandidate(size_t nRule);
+	
+	private:
+		Candidates(const Candidates&);
+		Candidates& operator=(const Candidates&);
+	
+	private:
+		typedef std::vector<bool> FlagList;
+	
+	private:
+		const RuleIndex& index_;
+		MacroContext* pContext_;
+		FlagList listCandidate_;
+		FlagList listEvaluated_;
+	};
+	friend class Candidates;
+
+public:
+	typedef std::vector<Rule*> RuleList;
+
+public:
+	/**
+	 * Create instance.
+	 *
+	 * @param l [in] Rules. They must be alive while this index is used.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	explicit RuleIndex(const RuleList& l);
+	~RuleIndex();
+
+public:
+	/**
+	 * Get the number of rules which are indexed.
+	 */
+	size_t getCount() const;
+
+private:
+	RuleIndex(const RuleIndex&);
+	RuleIndex& operator=(const RuleIndex&);
+
+private:
+	struct RuleIndexImpl* pImpl_;
+};
+
+}
+
+#endif // __RULEINDEX_H__
@@ -0,0 +1,1330 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qmaccount.h>
+#include <qmfilenames.h>
+#include <qmfolder.h>
+#include <qmmessage.h>
+#include <qmmessageholder.h>
+#include <qmsecurity.h>
+
+#include <qsfile.h>
+#include <qsinit.h>
+#include <qslog.h>
+#include <qsmime.h>
+#include <qsstl.h>
+#include <qsstream.h>
+#include <qsstring.h>
+
+#include <algorithm>
+#include <hash_map>
+#include <map>
+#include <set>
+
+#include "fulltextindex.h"
+#include "../model/changefeed.h"
+
+using namespace qm;
+using namespace qs;
+
+
+#ifndef _WIN32_WCE
+
+/****************************************************************************
+ *
+ * FullTextIndexImpl
+ *
+ */
+
+struct qm::FullTextIndexImpl
+{
+	enum {
+		MAGIC			= 0x46540001,
+		VERSION			= 2,
+		SEGMENT_MAGIC	= 0x46530001
+	};
+	
+	enum {
+		SEGMENT_SIZE		= 1000,
+		MAX_SEGMENT_COUNT	= 8,
+		MAX_TERM_LENGTH		= 64,
+		SEARCH_BUFFER_SIZE	= 256,
+		CHANGE_BATCH_SIZE	= 1024
+	};
+	
+	enum {
+		FLAG_DELETED	= 0x80000000
+	};
+	
+	enum Token {
+		TOKEN_LATIN,
+		TOKEN_CJK,
+		TOKEN_SEPARATOR
+	};
+	
+	struct Header
+	{
+		unsigned int nMagic_;
+		unsigned int nVersion_;
+		MessageChangeFeed::Sequence nSequence_;
+		unsigned int nNextSegment_;
+		unsigned int nSegmentCount_;
+		unsigned int nDocumentCount_;
+		unsigned int nReserved_;
+	};
+	
+	struct Document
+	{
+		unsigned int nFolderId_;
+		unsigned int nMessageId_;
+		unsigned int nFlags_;
+	};
+	
+	struct Segment
+	{
+		unsigned int nId_;
+		unsigned int nFirst_;
+		unsigned int nCount_;
+	};
+	
+	struct SegmentHeader
+	{
+		unsigned int nMagic_;
+		unsigned int nTermCount_;
+		unsigned int nTermOffset_;
+	};
+	
+	struct Term
+	{
+		unsigned __int64 nHash_;
+		unsigned int nOffset_;
+		unsigned int nLength_;
+	};
+	
+	typedef std::vector<Document> DocumentList;
+	typedef std::vector<Segment> SegmentList;
+	typedef std::vector<Term> TermList;
+	typedef std::vector<unsigned __int64> HashList;
+	typedef std::vector<unsigned int> IndexList;
+	typedef std::vector<unsigned char> Buffer;
+	typedef std::hash_map<unsigned __int64, IndexList> PostingMap;
+	typedef FullTextIndex::Key Key;
+	typedef FullTextIndex::KeySet KeySet;
+	
+	class SegmentWriter
+	{
+	public:
+		explicit SegmentWriter(const WCHAR* pwszPath);
+	
+	public:
+		bool operator!() const;
+		bool add(unsigned __int64 nHash,
+				 const IndexList& l);
+		bool close();
+	
+	private:
+		SegmentWriter(const SegmentWriter&);
+		SegmentWriter& operator=(const SegmentWriter&);
+	
+	private:
+		TemporaryFileRenamer renamer_;
+		BinaryFile file_;
+		bool bOpen_;
+		TermList listTerm_;
+		unsigned int nOffset_;
+		Buffer buf_;
+	};
+	
+	class SegmentReader
+	{
+	public:
+		SegmentReader(const WCHAR* pwszPath,
+					  size_t nBufferSize);
+	
+	public:
+		bool operator!() const;
+		bool getTerms(TermList* pList);
+		bool find(unsigned __int64 nHash,
+				  IndexList* pList);
+		bool read(const Term& term,
+				  IndexList* pList);
+	
+	private:
+		SegmentReader(const SegmentReader&);
+		SegmentReader& operator=(const SegmentReader&);
+	
+	private:
+		BinaryFile file_;
+		SegmentHeader header_;
+		bool bOpen_;
+		Buffer buf_;
+	};
+	
+	bool load();
+	bool save();
+	bool scan(KeySet* pSetAdd,
+			  unsigned int* pnRemoved);
+	bool apply(MessageChangeFeed* pChangeFeed,
+			   MessageChangeFeed::Sequence* pnSequence,
+			   KeySet* pSetAdd,
+			   unsigned int* pnRemoved,
+			   bool* pbLost);
+	bool resolve(KeySet* pSetAdd,
+				 size_t nMax,
+				 MessageHolderList* pListAdd);
+	bool add(const MessageHolderList& l);
+	bool flush(unsigned int nFirst,
+			   PostingMap* pMap);
+	bool merge();
+	bool match(SegmentReader* pReader,
+			   const HashList& listHash,
+			   IndexList* pList);
+	wstring_ptr getPath() const;
+	wstring_ptr getSegmentPath(unsigned int nId) const;
+	
+	static void getTerms(MessageHolder* pmh,
+						 HashList* pList);
+	static void getTerms(const WCHAR* pwsz,
+						 size_t nLen,
+						 bool bQuery,
+						 HashList* pList);
+	static Token getToken(WCHAR c);
+	static WCHAR fold(WCHAR c);
+	static unsigned __int64 hash(const WCHAR* p,
+								 size_t nLen);
+	static void encode(const IndexList& l,
+					   Buffer* pBuf);
+	static bool decode(const unsigned char* p,
+					   size_t nLen,
+					   IndexList* pList);
+	static void intersect(IndexList* pList,
+						  const IndexList& l);
+	
+	static const WCHAR* CHECKPOINT_NAME;
+	
+	Account* pAccount_;
+	wstring_ptr wstrPath_;
+	MessageChangeFeed::Sequence nSequence_;
+	unsigned int nNextSegment_;
+	SegmentList listSegment_;
+	DocumentList listDocument_;
+	bool bLoaded_;
+};
+
+const WCHAR* qm::FullTextIndexImpl::CHECKPOINT_NAME = L"fulltext";
+
+bool qm::FullTextIndexImpl::load()
+{
+	if (bLoaded_)
+		return true;
+	
+	wstring_ptr wstrPath(getPath());
+	if (File::isFileExisting(wstrPath.get())) {
+		Log log(InitThread::getInitThread().getLogger(), L"qm::FullTextIndex");
+		
+		FileInputStream fileStream(wstrPath.get());
+		if (!fileStream) {
+			log.errorf(L"Failed to open file: %s", wstrPath.get());
+			return false;
+		}
+		BufferedInputStream stream(&fileStream, false);
+		
+		// An index which cannot be read is rebuilt from scratch
+		Header header;
+		if (stream.read(reinterpret_cast<unsigned char*>(&header), sizeof(header)) == sizeof(header) &&
+			header.nMagic_ == MAGIC &&
+			header.nVersion_ == VERSION) {
+			SegmentList listSegment(header.nSegmentCount_);
+			DocumentList listDocument(header.nDocumentCount_);
+			size_t nSegmentSize = listSegment.size()*sizeof(Segment);
+			size_t nDocumentSize = listDocument.size()*sizeof(Document);
+			if ((nSegmentSize == 0 || stream.read(reinterpret_cast<unsigned char*>(&listSegment[0]), nSegmentSize) == nSegmentSize) &&
+				(nDocumentSize == 0 || stream.read(reinterpret_cast<unsigned char*>(&listDocument[0]), nDocumentSize) == nDocumentSize)) {
+				nSequence_ = header.nSequence_;
+				nNextSegment_ = header.nNextSegment_;
+				listSegment_.swap(listSegment);
+				listDocument_.swap(listDocument);
+			}
+			else {
+				log.warnf(L"Failed to load index, rebuilding: %s", wstrPath.get());
+			}
+		}
+		else {
+			log.warnf(L"Failed to load index, rebuilding: %s", wstrPath.get());
+		}
+	}
+	
+	bLoaded_ = true;
+	
+	return true;
+}
+
+bool qm::FullTextIndexImpl::save()
+{
+	if (!File::createDirectory(wstrPath_.get()))
+		return false;
+	
+	wstring_ptr wstrPath(getPath());
+	TemporaryFileRenamer renamer(wstrPath.get());
+	
+	FileOutputStream fileStream(renamer.getPath());
+	if (!fileStream)
+		return false;
+	BufferedOutputStream stream(&fileStream, false);
+	
+	Header header = {
+		MAGIC,
+		VERSION,
+		nSequence_,
+		nNextSegment_,
+		static_cast<unsigned int>(listSegment_.size()),
+		static_cast<unsigned int>(listDocument_.size()),
+		0
+	};
+	if (stream.write(reinterpret_cast<const unsigned char*>(&header), sizeof(header)) == -1)
+		return false;
+	if (!listSegment_.empty() &&
+		stream.write(reinterpret_cast<const unsigned char*>(&listSegment_[0]),
+			listSegment_.size()*sizeof(Segment)) == -1)
+		return false;
+	if (!listDocument_.empty() &&
+		stream.write(reinterpret_cast<const unsigned char*>(&listDocument_[0]),
+			listDocument_.size()*sizeof(Document)) == -1)
+		return false;
+	if (!stream.close())
+		return false;
+	
+	if (!renamer.rename())
+		return false;
+	
+	return true;
+}
+
+bool qm::FullTextIndexImpl::scan(KeySet* pSetAdd,
+								 unsigned int* pnRemoved)
+{
+	assert(pSetAdd);
+	assert(pnRemoved);
+	
+	typedef std::vector<std::pair<Key, unsigned int> > KeyList;
+	KeyList listKey;
+	listKey.reserve(listDocument_.size());
+	for (DocumentList::size_type n = 0; n < listDocument_.size(); ++n) {
+		const Document& document = listDocument_[n];
+		if (!(document.nFlags_ & FLAG_DELETED))
+			listKey.push_back(std::make_pair(Key(document.nFolderId_, document.nMessageId_),
+				static_cast<unsigned int>(n)));
+	}
+	std::sort(listKey.begin(), listKey.end());
+	
+	std::vector<bool> listExist(listDocument_.size());
+	const Account::FolderList& listFolder = pAccount_->getFolders();
+	for (Account::FolderList::const_iterator itF = listFolder.begin(); itF != listFolder.end(); ++itF) {
+		if ((*itF)->getType() != Folder::TYPE_NORMAL)
+			continue;
+		
+		NormalFolder* pFolder = static_cast<NormalFolder*>(*itF);
+		if (!pFolder->loadMessageHolders())
+			return false;
+		
+		const MessageHolderList& l = pFolder->getMessages();
+		for (MessageHolderList::const_iterator itM = l.begin(); itM != l.end(); ++itM) {
+			MessageHolder* pmh = *itM;
+			
+			Key key(pFolder->getId(), pmh->getId());
+			KeyList::const_iterator itK = std::lower_bound(listKey.begin(),
+				listKey.end(), std::make_pair(key, 0U));
+			if (itK != listKey.end() && (*itK).first == key) {
+				unsigned int nDocument = (*itK).second;
+				listExist[nDocument] = true;
+				
+				unsigned int nPartial = pmh->getFlags() & MessageHolder::FLAG_PARTIAL_MASK;
+				if (listDocument_[nDocument].nFlags_ != nPartial) {
+					listDocument_[nDocument].nFlags_ |= FLAG_DELETED;
+					pSetAdd->insert(key);
+				}
+			}
+			else {
+				pSetAdd->insert(key);
+			}
+		}
+	}
+	for (KeyList::const_iterator itK = listKey.begin(); itK != listKey.end(); ++itK) {
+		if (!listExist[(*itK).second]) {
+			listDocument_[(*itK).second].nFlags_ |= FLAG_DELETED;
+			++*pnRemoved;
+		}
+	}
+	
+	return true;
+}
+
+bool qm::FullTextIndexImpl::apply(MessageChangeFeed* pChangeFeed,
+								  MessageChangeFeed::Sequence* pnSequence,
+								  KeySet* pSetAdd,
+								  unsigned int* pnRemoved,
+								  bool* pbLost)
+{
+	assert(pChangeFeed);
+	assert(pnSequence);
+	assert(pSetAdd);
+	assert(pnRemoved);
+	assert(pbLost);
+	
+	typedef std::map<Key, unsigned int> KeyMap;
+	KeyMap mapKey;
+	for (DocumentList::size_type n = 0; n < listDocument_.size(); ++n) {
+		const Document& document = listDocument_[n];
+		if (!(document.nFlags_ & FLAG_DELETED))
+			mapKey.insert(std::make_pair(Key(document.nFolderId_, document.nMessageId_),
+				static_cast<unsigned int>(n)));
+	}
+	
+	// Messages to be added are looked up after all the changes are applied
+	// because they may have been moved or removed after they were added.
+	// Changes can be applied again after a crash, so a message which has
+	// already been indexed is not added again. Messages left by a partial
+	// update may also have been indexed by another update in the meantime.
+	KeySet& setAdd = *pSetAdd;
+	for (KeySet::iterator it = setAdd.begin(); it != setAdd.end(); ) {
+		if (mapKey.find(*it) != mapKey.end())
+			setAdd.erase(it++);
+		else
+			++it;
+	}
+	
+	MessageChangeFeed::Sequence nSequence = *pnSequence;
+	while (true) {
+		MessageChangeFeed::ChangeList l;
+		MessageChangeFeed::Sequence nNext = 0;
+		if (!pChangeFeed->read(nSequence, CHANGE_BATCH_SIZE, &l, &nNext, pbLost))
+			return false;
+		if (*pbLost)
+			return true;
+		else if (l.empty())
+			break;
+		
+		for (MessageChangeFeed::ChangeList::const_iterator it = l.begin(); it != l.end(); ++it) {
+			const MessageChangeFeed::Change& change = *it;
+			Key key(change.nFolderId_, change.nMessageId_);
+			KeyMap::iterator itK = mapKey.find(key);
+			switch (change.nType_) {
+			case MessageChangeFeed::TYPE_APPEND:
+				if (itK == mapKey.end())
+					setAdd.insert(key);
+				break;
+			case MessageChangeFeed::TYPE_REMOVE:
+				setAdd.erase(key);
+				if (itK != mapKey.end()) {
+					listDocument_[(*itK).second].nFlags_ |= FLAG_DELETED;
+					mapKey.erase(itK);
+					++*pnRemoved;
+				}
+				break;
+			case MessageChangeFeed::TYPE_MOVE:
+				{
+					Key keyOld(change.nOldFolderId_, change.nOldMessageId_);
+					KeyMap::iterator itO = mapKey.find(keyOld);
+					if (setAdd.erase(keyOld) != 0) {
+						setAdd.insert(key);
+					}
+					else if (itO != mapKey.end()) {
+						unsigned int nDocument = (*itO).second;
+						listDocument_[nDocument].nFolderId_ = change.nFolderId_;
+						listDocument_[nDocument].nMessageId_ = change.nMessageId_;
+						mapKey.erase(itO);
+						mapKey[key] = nDocument;
+					}
+					else if (itK == mapKey.end()) {
+						setAdd.insert(key);
+					}
+				}
+				break;
+			case MessageChangeFeed::TYPE_FLAGS:
+			case MessageChangeFeed::TYPE_UPDATE:
+				// A message which isn't indexed is the one which was removed
+				// from the index by the previous partial update
+				if (itK == mapKey.end()) {
+					setAdd.insert(key);
+				}
+				else if (listDocument_[(*itK).second].nFlags_ != (change.nFlags_ & MessageHolder::FLAG_PARTIAL_MASK)) {
+					listDocument_[(*itK).second].nFlags_ |= FLAG_DELETED;
+					mapKey.erase(itK);
+					setAdd.insert(key);
+				}
+				break;
+			default:
+				break;
+			}
+		}
+		
+		nSequence = nNext;
+	}
+	
+	*pnSequence = nSequence;
+	
+	return true;
+}
+
+bool qm::FullTextIndexImpl::resolve(KeySet* pSetAdd,
+									size_t nMax,
+									MessageHolderList* pListAdd)
+{
+	assert(pSetAdd);
+	assert(pListAdd);
+	
+	KeySet::iterator it = pSetAdd->begin();
+	while (it != pSetAdd->end() && pListAdd->size() < nMax) {
+		Folder* pFolder = pAccount_->getFolderById((*it).first);
+		if (pFolder && pFolder->getType() == Folder::TYPE_NORMAL) {
+			NormalFolder* pNormalFolder = static_cast<NormalFolder*>(pFolder);
+			if (!pNormalFolder->loadMessageHolders())
+				return false;
+			
+			MessageHolder* pmh = pNormalFolder->getMessageHolderById((*it).second);
+			if (pmh)
+				pListAdd->push_back(pmh);
+		}
+		pSetAdd->erase(it++);
+	}
+	
+	return true;
+}
+
+bool qm::FullTextIndexImpl::add(const MessageHolderList& l)
+{
+	PostingMap mapPosting;
+	unsigned int nFirst = static_cast<unsigned int>(listDocument_.size());
+	for (MessageHolderList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		MessageHolder* pmh = *it;
+		
+		HashList listHash;
+		getTerms(pmh, &listHash);
+		
+		unsigned int nDocument = static_cast<unsigned int>(listDocument_.size());
+		Document document = {
+			pmh->getFolder()->getId(),
+			pmh->getId(),
+			pmh->getFlags() & MessageHolder::FLAG_PARTIAL_MASK
+		};
+		listDocument_.push_back(document);
+		
+		for (HashList::const_iterator itH = listHash.begin(); itH != listHash.end(); ++itH)
+			mapPosting[*itH].push_back(nDocument);
+		
+		// Postings are written out periodically to limit memory used while
+		// indexing many messages at once
+		if (nDocument + 1 - nFirst >= SEGMENT_SIZE) {
+			if (!flush(nFirst, &mapPosting))
+				return false;
+			nFirst = nDocument + 1;
+		}
+	}
+	if (nFirst != listDocument_.size()) {
+		if (!flush(nFirst, &mapPosting))
+			return false;
+	}
+	
+	return true;
+}
+
+bool qm::FullTextIndexImpl::flush(unsigned int nFirst,
+								  PostingMap* pMap)
+{
+	assert(pMap);
+	
+	if (!File::createDirectory(wstrPath_.get()))
+		return false;
+	
+	HashList listHash;
+	listHash.reserve(pMap->size());
+	for (PostingMap::const_iterator it = pMap->begin(); it != pMap->end(); ++it)
+		listHash.push_back((*it).first);
+	std::sort(listHash.begin(), listHash.end());
+	
+	unsigned int nId = nNextSegment_;
+	wstring_ptr wstrPath(getSegmentPath(nId));
+	SegmentWriter writer(wstrPath.get());
+	if (!writer)
+		return false;
+	for (HashList::const_iterator it = listHash.begin(); it != listHash.end(); ++it) {
+		if (!writer.add(*it, (*pMap)[*it]))
+			return false;
+	}
+	if (!writer.close())
+		return false;
+	pMap->clear();
+	
+	Segment segment = {
+		nId,
+		nFirst,
+		static_cast<unsigned int>(listDocument_.size()) - nFirst
+	};
+	listSegment_.push_back(segment);
+	++nNextSegment_;
+	
+	return save();
+}
+
+bool qm::FullTextIndexImpl::merge()
+{
+	IndexList listMap;
+	listMap.reserve(listDocument_.size());
+	DocumentList listDocument;
+	for (DocumentList::const_iterator it = listDocument_.begin(); it != listDocument_.end(); ++it) {
+		if ((*it).nFlags_ & FLAG_DELETED) {
+			listMap.push_back(static_cast<unsigned int>(-1));
+		}
+		else {
+			listMap.push_back(static_cast<unsigned int>(listDocument.size()));
+			listDocument.push_back(*it);
+		}
+	}
+	
+	SegmentList listSegment;
+	unsigned int nNextSegment = nNextSegment_;
+	if (!listDocument.empty()) {
+		typedef std::vector<SegmentReader*> ReaderList;
+		ReaderList listReader;
+		CONTAINER_DELETER(deleter, listReader);
+		typedef std::vector<TermList> TermListList;
+		TermListList listTerms(listSegment_.size());
+		typedef std::vector<TermList::size_type> PositionList;
+		PositionList listPosition(listSegment_.size());
+		for (SegmentList::size_type n = 0; n < listSegment_.size(); ++n) {
+			wstring_ptr wstrPath(getSegmentPath(listSegment_[n].nId_));
+			std::auto_ptr<SegmentReader> pReader(new SegmentReader(wstrPath.get(), 0));
+			if (!*pReader || !pReader->getTerms(&listTerms[n]))
+				return false;
+			listReader.push_back(pReader.get());
+			pReader.release();
+		}
+		
+		unsigned int nId = nNextSegment++;
+		wstring_ptr wstrPath(getSegmentPath(nId));
+		SegmentWriter writer(wstrPath.get());
+		if (!writer)
+			return false;
+		
+		// Merge term tables sorted by hashes. Because segments hold
+		// documents in order, concatenating their postings keeps documents
+		// sorted.
+		IndexList listIndex;
+		IndexList listMerged;
+		while (true) {
+			bool bFound = false;
+			unsigned __int64 nHash = 0;
+			for (SegmentList::size_type n = 0; n < listSegment_.size(); ++n) {
+				if (listPosition[n] < listTerms[n].size() &&
+					(!bFound || listTerms[n][listPosition[n]].nHash_ < nHash)) {
+					nHash = listTerms[n][listPosition[n]].nHash_;
+					bFound = true;
+				}
+			}
+			if (!bFound)
+				break;
+			
+			listMerged.clear();
+			for (SegmentList::size_type n = 0; n < listSegment_.size(); ++n) {
+				if (listPosition[n] < listTerms[n].size() &&
+					listTerms[n][listPosition[n]].nHash_ == nHash) {
+					listIndex.clear();
+					if (!listReader[n]->read(listTerms[n][listPosition[n]], &listIndex))
+						return false;
+					for (IndexList::const_iterator it = listIndex.begin(); it != listIndex.end(); ++it) {
+						if (*it < listMap.size() && listMap[*it] != -1)
+							listMerged.push_back(listMap[*it]);
+					}
+					++listPosition[n];
+				}
+			}
+			if (!listMerged.empty()) {
+				if (!writer.add(nHash, listMerged))
+					return false;
+			}
+		}
+		if (!writer.close())
+			return false;
+		
+		Segment segment = {
+			nId,
+			0,
+			static_cast<unsigned int>(listDocument.size())
+		};
+		listSegment.push_back(segment);
+	}
+	
+	SegmentList listOld(listSegment_);
+	listSegment_.swap(listSegment);
+	listDocument_.swap(listDocument);
+	nNextSegment_ = nNextSegment;
+	if (!save())
+		return false;
+	
+	for (SegmentList::const_iterator it = listOld.begin(); it != listOld.end(); ++it) {
+		wstring_ptr wstrPath(getSegmentPath((*it).nId_));
+		W2T(wstrPath.get(), ptszPath);
+		::DeleteFile(ptszPath);
+	}
+	
+	return true;
+}
+
+bool qm::FullTextIndexImpl::match(SegmentReader* pReader,
+								  const HashList& listHash,
+								  IndexList* pList)
+{
+	assert(pReader);
+	assert(!listHash.empty());
+	assert(pList);
+	
+	IndexList listIndex;
+	for (HashList::const_iterator it = listHash.begin(); it != listHash.end(); ++it) {
+		listIndex.clear();
+		if (!pReader->find(*it, &listIndex))
+			return false;
+		if (it == listHash.begin())
+			pList->swap(listIndex);
+		else
+			intersect(pList, listIndex);
+		if (pList->empty())
+			break;
+	}
+	
+	return true;
+}
+
+wstring_ptr qm::FullTextIndexImpl::getPath() const
+{
+	ConcatW c[] = {
+		{ wstrPath_.get(),			-1	},
+		{ L"\\",					1	},
+		{ FileNames::FULLTEXT,		-1	},
+		{ FileNames::INDEX_EXT,		-1	}
+	};
+	return concat(c, countof(c));
+}
+
+wstring_ptr qm::FullTextIndexImpl::getSegmentPath(unsigned int nId) const
+{
+	WCHAR wsz[64];
+	_snwprintf(wsz, countof(wsz), L"\\%s%04u%s",
+		FileNames::FULLTEXT, nId, FileNames::SEGMENT_EXT);
+	return concat(wstrPath_.get(), wsz);
+}
+
+void qm::FullTextIndexImpl::getTerms(MessageHolder* pmh,
+									 HashList* pList)
+{
+	assert(pmh);
+	assert(pList);
+	
+	wstring_ptr wstrSubject(pmh->getSubject());
+	getTerms(wstrSubject.get(), -1, false, pList);
+	
+	// Only what has already been stored is indexed, and a message is
+	// indexed again after the rest of it is downloaded
+	Message msg;
+	if (!(pmh->getFlags() & MessageHolder::FLAG_INDEXONLY) &&
+		pmh->getMessage(Account::GMF_POSSIBLE, 0, SECURITYMODE_NONE, &msg)) {
+		const WCHAR* pwszFields[] = {
+			L"From",
+			L"To",
+			L"Cc"
+		};
+		for (int n = 0; n < countof(pwszFields); ++n) {
+			UnstructuredParser field;
+			if (msg.getField(pwszFields[n], &field) == Part::FIELD_EXIST)
+				getTerms(field.getValue(), -1, false, pList);
+		}
+		
+		wxstring_size_ptr wstrBody(PartUtil(msg).getAllText(0, 0, true));
+		if (wstrBody.get())
+			getTerms(wstrBody.get(), wstrBody.size(), false, pList);
+	}
+	else {
+		wstring_ptr wstrFrom(pmh->getFrom());
+		getTerms(wstrFrom.get(), -1, false, pList);
+		wstring_ptr wstrTo(pmh->getTo());
+		getTerms(wstrTo.get(), -1, false, pList);
+	}
+	
+	std::sort(pList->begin(), pList->end());
+	pList->erase(std::unique(pList->begin(), pList->end()), pList->end());
+}
+
+void qm::FullTextIndexImpl::getTerms(const WCHAR* pwsz,
+									 size_t nLen,
+									 bool bQuery,
+									 HashList* pList)
+{
+	assert(pwsz);
+	assert(pList);
+	
+	if (nLen == -1)
+		nLen = wcslen(pwsz);
+	
+	const WCHAR* p = pwsz;
+	const WCHAR* pEnd = p + nLen;
+	while (p < pEnd) {
+		switch (getToken(*p)) {
+		case TOKEN_LATIN:
+			{
+				WCHAR wsz[MAX_TERM_LENGTH];
+				size_t n = 0;
+				do {
+					if (n < MAX_TERM_LENGTH)
+						wsz[n] = fold(*p);
+					++n;
+					++p;
+				} while (p < pEnd && getToken(*p) == TOKEN_LATIN);
+				
+				// Too long words are likely to be encoded data
+				if (n <= MAX_TERM_LENGTH)
+					pList->push_back(hash(wsz, n));
+			}
+			break;
+		case TOKEN_CJK:
+			{
+				// Index both unigrams and bigrams so that a query of one
+				// character also matches. A query of more than one character
+				// is looked up by its bigrams.
+				WCHAR wsz[2] = { *p, L'\0' };
+				if (!bQuery)
+					pList->push_back(hash(wsz, 1));
+				bool bBigram = false;
+				++p;
+				while (p < pEnd) {
+					if (*p == L'\r' || *p == L'\n') {
+						++p;
+						continue;
+					}
+					if (getToken(*p) != TOKEN_CJK)
+						break;
+					
+					wsz[1] = *p;
+					pList->push_back(hash(wsz, 2));
+					if (!bQuery)
+						pList->push_back(hash(wsz + 1, 1));
+					wsz[0] = *p;
+					bBigram = true;
+					++p;
+				}
+				if (bQuery && !bBigram)
+					pList->push_back(hash(wsz, 1));
+			}
+			break;
+		case TOKEN_SEPARATOR:
+			do {
+				++p;
+			} while (p < pEnd && getToken(*p) == TOKEN_SEPARATOR);
+			break;
+		default:
+			assert(false);
+			break;
+		}
+	}
+}
+
+FullTextIndexImpl::Token qm::FullTextIndexImpl::getToken(WCHAR c)
+{
+	if ((L'a' <= c && c <= L'z') ||
+		(L'A' <= c && c <= L'Z') ||
+		(L'0' <= c && c <= L'9'))
+		return TOKEN_LATIN;
+	else if (c < 0xc0)
+		return TOKEN_SEPARATOR;
+	else if (c < 0x2000)
+		return TOKEN_LATIN;
+	else if ((0xff10 <= c && c <= 0xff19) ||	// Fullwidth Digit
+		(0xff21 <= c && c <= 0xff3a) ||			// Fullwidth Latin Capital
+		(0xff41 <= c && c <= 0xff5a))			// Fullwidth Latin Small
+		return TOKEN_LATIN;
+	else if (c < 0x2e80 ||						// Punctuations and Symbols
+		(0x3000 <= c && c <= 0x303f) ||			// CJK Symbols and Punctuation
+		(0xff00 <= c && c <= 0xff65))			// Fullwidth Forms
+		return TOKEN_SEPARATOR;
+	else
+		return TOKEN_CJK;
+}
+
+WCHAR qm::FullTextIndexImpl::fold(WCHAR c)
+{
+	if (0xff10 <= c && c <= 0xff5a)
+		c -= 0xfee0;
+	return CharTraits<WCHAR>::toLower(c);
+}
+
+unsigned __int64 qm::FullTextIndexImpl::hash(const WCHAR* p,
+											 size_t nLen)
+{
+	// 64bit FNV-1a
+	unsigned __int64 nHash = 0xcbf29ce484222325ui64;
+	for (const WCHAR* pEnd = p + nLen; p < pEnd; ++p) {
+		nHash ^= *p;
+		nHash *= 0x100000001b3ui64;
+	}
+	return nHash;
+}
+
+void qm::FullTextIndexImpl::encode(const IndexList& l,
+								   Buffer* pBuf)
+{
+	assert(pBuf);
+	
+	pBuf->clear();
+	
+	unsigned int nPrev = 0;
+	for (IndexList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		unsigned int n = *it - nPrev;
+		while (n >= 0x80) {
+			pBuf->push_back(static_cast<unsigned char>(n | 0x80));
+			n >>= 7;
+		}
+		pBuf->push_back(static_cast<unsigned char>(n));
+		nPrev = *it;
+	}
+}
+
+bool qm::FullTextIndexImpl::decode(const unsigned char* p,
+								   size_t nLen,
+								   IndexList* pList)
+{
+	assert(p || nLen == 0);
+	assert(pList);
+	
+	unsigned int nPrev = 0;
+	const unsigned char* pEnd = p + nLen;
+	while (p < pEnd) {
+		unsigned int n = 0;
+		for (int nShift = 0; ; nShift += 7) {
+			if (p == pEnd || nShift > 28)
+				return false;
+			unsigned char c = *p++;
+			n |= (c & 0x7f) << nShift;
+			if (!(c & 0x80))
+				break;
+		}
+		nPrev += n;
+		pList->push_back(nPrev);
+	}
+	
+	return true;
+}
+
+void qm::FullTextIndexImpl::intersect(IndexList* pList,
+									  const IndexList& l)
+{
+	assert(pList);
+	
+	IndexList listIntersection;
+	std::set_intersection(pList->begin(), pList->end(),
+		l.begin(), l.end(), std::back_inserter(listIntersection));
+	pList->swap(listIntersection);
+}
+
+
+/****************************************************************************
+ *
+ * FullTextIndexImpl::SegmentWriter
+ *
+ */
+
+qm::FullTextIndexImpl::SegmentWriter::SegmentWriter(const WCHAR* pwszPath) :
+	renamer_(pwszPath),
+	file_(renamer_.getPath(), BinaryFile::MODE_WRITE | BinaryFile::MODE_CREATE, 0),
+	bOpen_(false),
+	nOffset_(sizeof(SegmentHeader))
+{
+	// Reserve space for the header which is written when closed
+	SegmentHeader header = { 0 };
+	if (!!file_ &&
+		file_.write(reinterpret_cast<const unsigned char*>(&header), sizeof(header)) == sizeof(header))
+		bOpen_ = true;
+}
+
+bool qm::FullTextIndexImpl::SegmentWriter::operator!() const
+{
+	return !bOpen_;
+}
+
+bool qm::FullTextIndexImpl::SegmentWriter::add(unsigned __int64 nHash,
+											   const IndexList& l)
+{
+	assert(!l.empty());
+	assert(listTerm_.empty() || listTerm_.back().nHash_ < nHash);
+	
+	encode(l, &buf_);
+	if (file_.write(&buf_[0], buf_.size()) != buf_.size())
+		return false;
+	
+	Term term = {
+		nHash,
+		nOffset_,
+		static_cast<unsigned int>(buf_.size())
+	};
+	listTerm_.push_back(term);
+	nOffset_ += static_cast<unsigned int>(buf_.size());
+	
+	return true;
+}
+
+bool qm::FullTextIndexImpl::SegmentWriter::close()
+{
+	size_t nSize = listTerm_.size()*sizeof(Term);
+	if (nSize != 0 &&
+		file_.write(reinterpret_cast<const unsigned char*>(&listTerm_[0]), nSize) != nSize)
+		return false;
+	
+	SegmentHeader header = {
+		SEGMENT_MAGIC,
+		static_cast<unsigned int>(listTerm_.size()),
+		nOffset_
+	};
+	if (file_.setPosition(0, File::SEEKORIGIN_BEGIN) == -1 ||
+		file_.write(reinterpret_cast<const unsigned char*>(&header), sizeof(header)) != sizeof(header))
+		return false;
+	if (!file_.close())
+		return false;
+	
+	return renamer_.rename();
+}
+
+
+/****************************************************************************
+ *
+ * FullTextIndexImpl::SegmentReader
+ *
+ */
+
+qm::FullTextIndexImpl::SegmentReader::SegmentReader(const WCHAR* pwszPath,
+													size_t nBufferSize) :
+	file_(pwszPath, BinaryFile::MODE_READ, nBufferSize),
+	bOpen_(false)
+{
+	if (!!file_ &&
+		file_.read(reinterpret_cast<unsigned char*>(&header_), sizeof(header_)) == sizeof(header_) &&
+		header_.nMagic_ == SEGMENT_MAGIC)
+		bOpen_ = true;
+}
+
+bool qm::FullTextIndexImpl::SegmentReader::operator!() const
+{
+	return !bOpen_;
+}
+
+bool qm::FullTextIndexImpl::SegmentReader::getTerms(TermList* pList)
+{
+	assert(pList);
+	
+	TermList l(header_.nTermCount_);
+	size_t nSize = l.size()*sizeof(Term);
+	if (nSize != 0 &&
+		(file_.setPosition(header_.nTermOffset_, File::SEEKORIGIN_BEGIN) == -1 ||
+		 file_.read(reinterpret_cast<unsigned char*>(&l[0]), nSize) != nSize))
+		return false;
+	pList->swap(l);
+	
+	return true;
+}
+
+bool qm::FullTextIndexImpl::SegmentReader::find(unsigned __int64 nHash,
+												IndexList* pList)
+{
+	assert(pList);
+	
+	// Binary search in the term table on the disk, so that searching
+	// doesn't need to load whole the table
+	unsigned int nLow = 0;
+	unsigned int nHigh = header_.nTermCount_;
+	while (nLow < nHigh) {
+		unsigned int nMid = nLow + (nHigh - nLow)/2;
+		Term term;
+		if (file_.setPosition(header_.nTermOffset_ + static_cast<File::Offset>(nMid)*sizeof(Term),
+				File::SEEKORIGIN_BEGIN) == -1 ||
+			file_.read(reinterpret_cast<unsigned char*>(&term), sizeof(term)) != sizeof(term))
+			return false;
+		if (term.nHash_ < nHash)
+			nLow = nMid + 1;
+		else if (nHash < term.nHash_)
+			nHigh = nMid;
+		else
+			return read(term, pList);
+	}
+	
+	return true;
+}
+
+bool qm::FullTextIndexImpl::SegmentReader::read(const Term& term,
+												IndexList* pList)
+{
+	assert(pList);
+	
+	if (term.nLength_ == 0)
+		return true;
+	
+	buf_.resize(term.nLength_);
+	if (file_.setPosition(term.nOffset_, File::SEEKORIGIN_BEGIN) == -1 ||
+		file_.read(&buf_[0], buf_.size()) != buf_.size())
+		return false;
+	
+	return decode(&buf_[0], buf_.size(), pList);
+}
+
+
+/****************************************************************************
+ *
+ * FullTextIndex
+ *
+ */
+
+qm::FullTextIndex::FullTextIndex(Account* pAccount,
+								 const WCHAR* pwszPath)
+{
+	pImpl_ = new FullTextIndexImpl();
+	pImpl_->pAccount_ = pAccount;
+	pImpl_->wstrPath_ = allocWString(pwszPath);
+	pImpl_->nSequence_ = 0;
+	pImpl_->nNextSegment_ = 0;
+	pImpl_->bLoaded_ = false;
+}
+
+qm::FullTextIndex::~FullTextIndex()
+{
+	delete pImpl_;
+}
+
+bool qm::FullTextIndex::update()
+{
+	bool bMore = false;
+	return update(static_cast<size_t>(-1), 0, &bMore);
+}
+
+bool qm::FullTextIndex::update(size_t nMax,
+							   Pending* pPending,
+							   bool* pbMore)
+{
+	assert(pImpl_->pAccount_->isLocked());
+	assert(pbMore);
+	
+	typedef FullTextIndexImpl::KeySet KeySet;
+	
+	*pbMore = false;
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::FullTextIndex");
+	
+	DWORD dwStart = ::GetTickCount();
+	
+	if (!pImpl_->load())
+		return false;
+	
+	typedef FullTextIndexImpl::DocumentList DocumentList;
+	DocumentList& listDocument = pImpl_->listDocument_;
+	
+	// Changes are read from the older of the sequence saved with the index
+	// and the checkpoint, because either of them can be behind the other
+	// after a crash. Applying changes again is harmless.
+	MessageChangeFeed* pChangeFeed = pImpl_->pAccount_->getChangeFeed();
+	MessageChangeFeed::Sequence nSequence = QSMIN(pImpl_->nSequence_,
+		pChangeFeed->getCheckpoint(FullTextIndexImpl::CHECKPOINT_NAME));
+	
+	// Continue from the messages left by the previous partial update, so
+	// that only changes after it are applied instead of reading all the
+	// changes or scanning all the messages again
+	KeySet setAdd;
+	if (pPending && pPending->bValid_) {
+		setAdd.swap(pPending->setKey_);
+		nSequence = pPending->nSequence_;
+		pPending->bValid_ = false;
+	}
+	
+	unsigned int nRemoved = 0;
+	bool bLost = true;
+	if (nSequence != 0) {
+		if (!pImpl_->apply(pChangeFeed, &nSequence, &setAdd, &nRemoved, &bLost))
+			return false;
+	}
+	if (bLost) {
+		setAdd.clear();
+		nSequence = pChangeFeed->getNext();
+		if (!pImpl_->scan(&setAdd, &nRemoved))
+			return false;
+	}
+	
+	MessageHolderList listAdd;
+	if (!pImpl_->resolve(&setAdd, nMax, &listAdd))
+		return false;
+	
+	// When only a part of messages are indexed, the sequence saved with
+	// the index is left as it is, so that an update by another instance or
+	// after a restart applies the same changes again and finds the rest of
+	// them, which is harmless
+	*pbMore = !setAdd.empty();
+	if (*pbMore && pPending) {
+		pPending->setKey_.swap(setAdd);
+		pPending->nSequence_ = nSequence;
+		pPending->bValid_ = true;
+	}
+	
+	if (listAdd.empty() && nRemoved == 0 && nSequence == pImpl_->nSequence_)
+		return true;
+	
+	if (!pImpl_->add(listAdd)) {
+		log.errorf(L"Failed to update index: %s", pImpl_->wstrPath_.get());
+		return false;
+	}
+	if (!*pbMore)
+		pImpl_->nSequence_ = nSequence;
+	
+	size_t nDeleted = 0;
+	for (DocumentList::const_iterator it = listDocument.begin(); it != listDocument.end(); ++it) {
+		if ((*it).nFlags_ & FullTextIndexImpl::FLAG_DELETED)
+			++nDeleted;
+	}
+	bool bMerge = !*pbMore &&
+		(pImpl_->listSegment_.size() > FullTextIndexImpl::MAX_SEGMENT_COUNT ||
+		 nDeleted > listDocument.size()/2);
+	if (bMerge) {
+		if (!pImpl_->merge()) {
+			log.errorf(L"Failed to merge index: %s", pImpl_->wstrPath_.get());
+			return false;
+		}
+	}
+	else {
+		if (!pImpl_->save())
+			return false;
+	}
+	
+	if (!*pbMore && !pChangeFeed->setCheckpoint(FullTextIndexImpl::CHECKPOINT_NAME, nSequence))
+		log.errorf(L"Failed to save checkpoint: %s", pImpl_->wstrPath_.get());
+	
+	log.debugf(L"Updated index%s: %u added, %u removed, %u segments in %u ms",
+		bLost ? L" by scanning" : L"", static_cast<unsigned int>(listAdd.size()), nRemoved,
+		static_cast<unsigned int>(pImpl_->listSegment_.size()), ::GetTickCount() - dwStart);
+	
+	return true;
+}
+
+bool qm::FullTextIndex::search(const WCHAR* pwszCondition,
+							   const SearchContext::FolderList& listFolder,
+							   MessageHolderList* pList)
+{
+	assert(pwszCondition);
+	assert(pImpl_->pAccount_->isLocked());
+	assert(pList);
+	
+	typedef FullTextIndexImpl::HashList HashList;
+	typedef FullTextIndexImpl::IndexList IndexList;
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::FullTextIndex");
+	
+	DWORD dwStart = ::GetTickCount();
+	
+	if (!pImpl_->load())
+		return false;
+	
+	HashList listInclude;
+	typedef std::vector<HashList> HashListList;
+	HashListList listExclude;
+	const WCHAR* p = pwszCondition;
+	while (*p) {
+		while (*p == L' ' || *p == L'\t' || *p == 0x3000)
+			++p;
+		if (!*p)
+			break;
+		
+		const WCHAR* pBegin = p;
+		while (*p && *p != L' ' && *p != L'\t' && *p != 0x3000)
+			++p;
+		
+		if (*pBegin == L'-' && p - pBegin > 1) {
+			HashList l;
+			FullTextIndexImpl::getTerms(pBegin + 1, p - pBegin - 1, true, &l);
+			if (!l.empty())
+				listExclude.push_back(l);
+		}
+		else {
+			FullTextIndexImpl::getTerms(pBegin, p - pBegin, true, &listInclude);
+		}
+	}
+	if (listInclude.empty())
+		return true;
+	std::sort(listInclude.begin(), listInclude.end());
+	listInclude.erase(std::unique(listInclude.begin(), listInclude.end()), listInclude.end());
+	
+	IndexList listResult;
+	const FullTextIndexImpl::SegmentList& listSegment = pImpl_->listSegment_;
+	for (FullTextIndexImpl::SegmentList::const_iterator itS = listSegment.begin(); itS != listSegment.end(); ++itS) {
+		wstring_ptr wstrPath(pImpl_->getSegmentPath((*itS).nId_));
+		FullTextIndexImpl::SegmentReader reader(wstrPath.get(),
+			FullTextIndexImpl::SEARCH_BUFFER_SIZE);
+		if (!reader) {
+			log.errorf(L"Failed to open segment: %s", wstrPath.get());
+			return false;
+		}
+		
+		IndexList l;
+		if (!pImpl_->match(&reader, listInclude, &l))
+			return false;
+		for (HashListList::const_iterator itE = listExclude.begin(); itE != listExclude.end() && !l.empty(); ++itE) {
+			IndexList listExcluded;
+			if (!pImpl_->match(&reader, *itE, &listExcluded))
+				return false;
+			IndexList listDifference;
+			std::set_difference(l.begin(), l.end(), listExcluded.begin(),
+				listExcluded.end(), std::back_inserter(listDifference));
+			l.swap(listDifference);
+		}
+		listResult.insert(listResult.end(), l.begin(), l.end());
+	}
+	
+	typedef std::vector<std::pair<unsigned int, NormalFolder*> > FolderMap;
+	FolderMap mapFolder;
+	for (SearchContext::FolderList::const_iterator itF = listFolder.begin(); itF != listFolder.end(); ++itF)
+		mapFolder.push_back(std::make_pair((*itF)->getId(), *itF));
+	std::sort(mapFolder.begin(), mapFolder.end());
+	
+	const FullTextIndexImpl::DocumentList& listDocument = pImpl_->listDocument_;
+	for (IndexList::const_iterator it = listResult.begin(); it != listResult.end(); ++it) {
+		if (*it >= listDocument.size())
+			continue;
+		const FullTextIndexImpl::Document& document = listDocument[*it];
+		if (document.nFlags_ & FullTextIndexImpl::FLAG_DELETED)
+			continue;
+		
+		FolderMap::const_iterator itF = std::lower_bound(mapFolder.begin(), mapFolder.end(),
+			std::make_pair(document.nFolderId_, static_cast<NormalFolder*>(0)));
+		if (itF == mapFolder.end() || (*itF).first != document.nFolderId_)
+			continue;
+		
+		MessageHolder* pmh = (*itF).second->getMessageHolderById(document.nMessageId_);
+		if (pmh)
+			pList->push_back(pmh);
+	}
+	
+	log.debugf(L"Searched: %u messages found in %u ms",
+		static_cast<unsigned int>(pList->size()), ::GetTickCount() - dwStart);
+	
+	return true;
+}
+
+
+/****************************************************************************
+ *
+ * FullTextIndex::Pending
+ *
+ */
+
+qm::FullTextIndex::Pending::Pending() :
+	nSequence_(0),
+	bValid_(false)
+{
+}
+
+#endif // _WIN32_WCE
@@ -0,0 +1,130 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#ifndef __FULLTEXTINDEX_H__
+#define __FULLTEXTINDEX_H__
+
+#include <qm.h>
+#include <qmmessageholderlist.h>
+#include <qmsearch.h>
+
+#include <qs.h>
+
+#include <set>
+
+#include "../model/changefeed.h"
+
+#ifndef _WIN32_WCE
+
+namespace qm {
+
+class FullTextIndex;
+
+class Account;
+
+
+/****************************************************************************
+ *
+ * FullTextIndex
+ *
+ * Inverted index of messages in an account. Terms are words in latin text
+ * and unigrams and bigrams in CJK text, and each of them is mapped to
+ * a delta compressed list of documents. The index consists of immutable
+ * segments; an update adds a new segment for added messages and marks
+ * removed messages as deleted, and segments are merged into one when there
+ * are too many of them.
+ *
+ */
+
+class FullTextIndex
+{
+public:
+	typedef std::pair<unsigned int, unsigned int> Key;
+	typedef std::set<Key> KeySet;
+	
+	/**
+	 * Messages left by a partial update, and the sequence of the change
+	 * feed up to which changes have been applied to them.
+	 */
+	struct Pending
+	{
+		Pending();
+		
+		KeySet setKey_;
+		MessageChangeFeed::Sequence nSequence_;
+		bool bValid_;
+	};
+
+public:
+	/**
+	 * Create instance.
+	 *
+	 * @param pAccount [in] Account.
+	 * @param pwszPath [in] Path of the directory where the index is stored.
+	 */
+	FullTextIndex(Account* pAccount,
+				  const WCHAR* pwszPath);
+	~FullTextIndex();
+
+public:
+	/**
+	 * Update the index so that it reflects the messages in the account.
+	 * Messages which have been added or whose bodies have been downloaded
+	 * since the last update are indexed. Changes since the last update are
+	 * read from the change feed of the account, and all the messages are
+	 * scanned only when they have been lost. The account must be locked.
+	 *
+	 * @return true if success, false otherwise.
+	 */
+	bool update();
+	
+	/**
+	 * Update the index partially. Up to nMax messages are indexed, and the
+	 * rest of them are indexed by the next update. This is used to index
+	 * messages without locking the account for a long time. When the same
+	 * pending is passed to the next update, it continues from the messages
+	 * left in it. The account must be locked.
+	 *
+	 * @param nMax [in] Max number of messages to be indexed.
+	 * @param pPending [in, out] Messages left by the previous update.
+	 *                           Can be null.
+	 * @param pbMore [out] true if some messages are left to be indexed.
+	 * @return true if success, false otherwise.
+	 */
+	bool update(size_t nMax,
+				Pending* pPending,
+				bool* pbMore);
+	
+	/**
+	 * Search messages. A condition consists of terms separated by
+	 * whitespace, and messages which contain all of them are returned.
+	 * A term which starts with '-' excludes messages which contain it.
+	 * The account must be locked.
+	 *
+	 * @param pwszCondition [in] Condition.
+	 * @param listFolder [in] Folders to search. Their message holders must
+	 *                        have been loaded.
+	 * @param pList [out] Messages found.
+	 * @return true if success, false otherwise.
+	 */
+	bool search(const WCHAR* pwszCondition,
+				const SearchContext::FolderList& listFolder,
+				MessageHolderList* pList);
+
+private:
+	FullTextIndex(const FullTextIndex&);
+	FullTextIndex& operator=(const FullTextIndex&);
+
+private:
+	struct FullTextIndexImpl* pImpl_;
+};
+
+}
+
+#endif // _WIN32_WCE
+
+#endif // __FULLTEXTINDEX_H__
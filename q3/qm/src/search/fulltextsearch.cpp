@@ -8,16 +8,19 @@
 #pragma warning(disable:4786)
 
 #include <qmaccount.h>
+#include <qmdocument.h>
 #include <qmfolder.h>
 #include <qmuiutil.h>
 
 #include <qsfile.h>
 #include <qsinit.h>
+#include <qslog.h>
 #include <qsosutil.h>
 #include <qsstl.h>
 #include <qstextutil.h>
 #include <qsuiutil.h>
 
+#include "fulltextindex.h"
 #include "fulltextsearch.h"
 #include "../main/main.h"
 #include "../ui/resourceinc.h"
@@ -49,16 +52,18 @@ bool qm::FullTextSearchDriver::search(const SearchContext& context,
 									  MessageHolderList* pList)
 {
 	wstring_ptr wstrCommand(pProfile_->getString(L"FullTextSearch", L"Command"));
+	if (!*wstrCommand.get())
+		return searchIndex(context, pList);
 	
-	wstring_ptr wstrIndex(pAccount_->getPropertyString(L"FullTextSearch", L"Index"));
-	if (!*wstrIndex.get())
-		wstrIndex = concat(pAccount_->getPath(), L"\\index");
+	wstring_ptr wstrIndex(getIndexPath(pAccount_));
 	wstrCommand = TextUtil::replaceAll(wstrCommand.get(), L"$index", wstrIndex.get());
 	wstrCommand = TextUtil::replaceAll(wstrCommand.get(),
 		L"$encoding", Init::getInit().getSystemEncoding());
 	wstrCommand = TextUtil::replaceAll(wstrCommand.get(),
 		L"$condition", escapeQuote(context.getCondition()).get());
 	
+	DWORD dwStart = ::GetTickCount();
+	
 	wstring_ptr wstrOutput(Process::exec(wstrCommand.get(), 0));
 	if (!wstrOutput.get())
 		return false;
@@ -138,9 +143,38 @@ bool qm::FullTextSearchDriver::search(const SearchContext& context,
 		nPrevOffset = nOffset;
 	}
 	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::FullTextSearchDriver");
+	log.debugf(L"Searched: %u messages found in %u ms",
+		static_cast<unsigned int>(pList->size()), ::GetTickCount() - dwStart);
+	
 	return true;
 }
 
+wstring_ptr qm::FullTextSearchDriver::getIndexPath(Account* pAccount)
+{
+	assert(pAccount);
+	
+	wstring_ptr wstrIndex(pAccount->getPropertyString(L"FullTextSearch", L"Index"));
+	if (!*wstrIndex.get())
+		wstrIndex = concat(pAccount->getPath(), L"\\index");
+	return wstrIndex;
+}
+
+bool qm::FullTextSearchDriver::searchIndex(const SearchContext& context,
+										   MessageHolderList* pList)
+{
+	SearchContext::FolderList listFolder;
+	context.getTargetFolders(pAccount_, &listFolder);
+	
+	// Messages which haven't been indexed in background yet are indexed first
+	wstring_ptr wstrIndex(getIndexPath(pAccount_));
+	FullTextIndex index(pAccount_, wstrIndex.get());
+	if (!index.update())
+		return false;
+	
+	return index.search(context.getCondition(), listFolder, pList);
+}
+
 wstring_ptr qm::FullTextSearchDriver::escapeQuote(const WCHAR* pwsz)
 {
 	StringBuffer<WSTRING> buf;
@@ -273,10 +307,13 @@ LRESULT qm::FullTextSearchPage::onUpdateIndex()
 bool qm::FullTextSearchPage::updateIndex()
 {
 	wstring_ptr wstrCommand(pProfile_->getString(L"FullTextSearch", L"IndexCommand"));
+	wstring_ptr wstrIndex(FullTextSearchDriver::getIndexPath(pAccount_));
 	
-	wstring_ptr wstrIndex(pAccount_->getPropertyString(L"FullTextSearch", L"Index"));
-	if (!*wstrIndex.get())
-		wstrIndex = concat(pAccount_->getPath(), L"\\index");
+	if (!*wstrCommand.get()) {
+		WaitCursor cursor;
+		Lock<Account> lock(*pAccount_);
+		return FullTextIndex(pAccount_, wstrIndex.get()).update();
+	}
 	
 	if (!File::createDirectory(wstrIndex.get()))
 		return false;
@@ -333,8 +370,11 @@ std::auto_ptr<SearchDriver> qm::FullTextSearchDriverFactory::createDriver(Docume
 																		  HWND hwnd,
 																		  Profile* pProfile)
 {
+	// External engines index files of messages, but the built-in index
+	// works with any kind of message store
 	std::auto_ptr<SearchDriver> pDriver;
-	if (pAccount->isMultiMessageStore())
+	wstring_ptr wstrCommand(pProfile->getString(L"FullTextSearch", L"Command"));
+	if (!*wstrCommand.get() || pAccount->isMultiMessageStore())
 		pDriver.reset(new FullTextSearchDriver(pAccount, pProfile));
 	return pDriver;
 }
@@ -343,7 +383,8 @@ std::auto_ptr<SearchUI> qm::FullTextSearchDriverFactory::createUI(Account* pAcco
 																  Profile* pProfile)
 {
 	std::auto_ptr<SearchUI> pUI;
-	if (pAccount->isMultiMessageStore())
+	wstring_ptr wstrCommand(pProfile->getString(L"FullTextSearch", L"Command"));
+	if (!*wstrCommand.get() || pAccount->isMultiMessageStore())
 		pUI.reset(new FullTextSearchUI(pAccount, pProfile));
 	return pUI;
 }
@@ -368,4 +409,174 @@ void qm::FullTextSearchDriverFactory::InitializerImpl::term()
 	pFactory__ = 0;
 }
 
+
+/****************************************************************************
+ *
+ * FullTextIndexer
+ *
+ */
+
+qm::FullTextIndexer::FullTextIndexer(Document* pDocument,
+									 Profile* pProfile) :
+	pDocument_(pDocument),
+	pProfile_(pProfile)
+{
+	const Document::AccountList& l = pDocument_->getAccounts();
+	std::for_each(l.begin(), l.end(),
+		boost::bind(&FullTextIndexer::start, this, _1));
+	pDocument_->addAccountManagerHandler(this);
+}
+
+qm::FullTextIndexer::~FullTextIndexer()
+{
+	pDocument_->removeAccountManagerHandler(this);
+	stopAll();
+}
+
+void qm::FullTextIndexer::accountListChanged(const AccountManagerEvent& event)
+{
+	switch (event.getType()) {
+	case AccountManagerEvent::TYPE_ALL:
+		{
+			stopAll();
+			const Document::AccountList& l = pDocument_->getAccounts();
+			std::for_each(l.begin(), l.end(),
+				boost::bind(&FullTextIndexer::start, this, _1));
+		}
+		break;
+	case AccountManagerEvent::TYPE_ADD:
+		start(event.getAccount());
+		break;
+	case AccountManagerEvent::TYPE_REMOVE:
+		stop(event.getAccount());
+		break;
+	default:
+		assert(false);
+		break;
+	}
+}
+
+void qm::FullTextIndexer::start(Account* pAccount)
+{
+	assert(pAccount);
+	
+	std::auto_ptr<FullTextIndexThread> pThread(new FullTextIndexThread(pAccount, pProfile_));
+	if (!pThread->start()) {
+		Log log(InitThread::getInitThread().getLogger(), L"qm::FullTextIndexer");
+		log.errorf(L"Failed to start indexing: %s", pAccount->getName());
+		return;
+	}
+	
+	Lock<Account> lock(*pAccount);
+	pAccount->getChangeFeed()->addMessageChangeFeedHandler(pThread.get());
+	listThread_.push_back(pThread.release());
+}
+
+void qm::FullTextIndexer::stop(Account* pAccount)
+{
+	assert(pAccount);
+	
+	ThreadList::iterator it = std::find_if(listThread_.begin(), listThread_.end(),
+		boost::bind(&FullTextIndexThread::getAccount, _1) == pAccount);
+	if (it == listThread_.end())
+		return;
+	
+	std::auto_ptr<FullTextIndexThread> pThread(*it);
+	listThread_.erase(it);
+	
+	// Changes are flushed with the account locked, so the handler is
+	// removed with the account locked not to be called after it's deleted
+	{
+		Lock<Account> lock(*pAccount);
+		pAccount->getChangeFeed()->removeMessageChangeFeedHandler(pThread.get());
+	}
+	pThread->stop();
+	pThread->join();
+}
+
+void qm::FullTextIndexer::stopAll()
+{
+	while (!listThread_.empty())
+		stop(listThread_.back()->getAccount());
+}
+
+
+/****************************************************************************
+ *
+ * FullTextIndexThread
+ *
+ */
+
+qm::FullTextIndexThread::FullTextIndexThread(Account* pAccount,
+											 Profile* pProfile) :
+	pAccount_(pAccount),
+	pProfile_(pProfile),
+	bStop_(false),
+	event_(false, true)
+{
+}
+
+qm::FullTextIndexThread::~FullTextIndexThread()
+{
+}
+
+Account* qm::FullTextIndexThread::getAccount() const
+{
+	return pAccount_;
+}
+
+void qm::FullTextIndexThread::stop()
+{
+	bStop_ = true;
+	event_.set();
+}
+
+void qm::FullTextIndexThread::run()
+{
+	InitThread init(0);
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::FullTextIndexThread");
+	
+	// The event is set initially to catch up with changes made while
+	// the application wasn't running
+	while (true) {
+		event_.wait();
+		if (bStop_)
+			break;
+		
+		bool bMore = true;
+		while (bMore && !bStop_) {
+			if (!update(&bMore)) {
+				log.errorf(L"Failed to update index: %s", pAccount_->getName());
+				break;
+			}
+		}
+	}
+}
+
+void qm::FullTextIndexThread::changesFlushed(const MessageChangeFeedEvent& event)
+{
+	event_.set();
+}
+
+bool qm::FullTextIndexThread::update(bool* pbMore)
+{
+	assert(pbMore);
+	
+	*pbMore = false;
+	
+	// External engines maintain their indexes by themselves
+	wstring_ptr wstrCommand(pProfile_->getString(L"FullTextSearch", L"Command"));
+	if (*wstrCommand.get())
+		return true;
+	
+	wstring_ptr wstrIndex(FullTextSearchDriver::getIndexPath(pAccount_));
+	
+	// The index is loaded every time because a search updates it with
+	// its own instance. Messages left by the previous batch are kept in
+	// the pending, so that a batch doesn't scan all the messages again.
+	Lock<Account> lock(*pAccount_);
+	return FullTextIndex(pAccount_, wstrIndex.get()).update(BATCH_SIZE, &pending_, pbMore);
+}
+
 #endif // _WIN32_WCE
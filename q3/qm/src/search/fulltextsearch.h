@@ -8,14 +8,29 @@
 #ifndef __FULLTEXTSEARCH__
 #define __FULLTEXTSEARCH__
 
+#include <qmaccount.h>
 #include <qmsearch.h>
 
 #include <qsinit.h>
+#include <qsthread.h>
+
+#include "fulltextindex.h"
+#include "../model/changefeed.h"
 
 #ifndef _WIN32_WCE
 
 namespace qm {
 
+class FullTextSearchDriver;
+class FullTextSearchUI;
+class FullTextSearchPage;
+class FullTextSearchDriverFactory;
+class FullTextIndexer;
+class FullTextIndexThread;
+
+class Document;
+
+
 /****************************************************************************
  *
  * FullTextSearchDriver
@@ -33,6 +48,13 @@ public:
 	virtual bool search(const SearchContext& context,
 						MessageHolderList* pList);
 
+public:
+	static qs::wstring_ptr getIndexPath(Account* pAccount);
+
+private:
+	bool searchIndex(const SearchContext& context,
+					 MessageHolderList* pList);
+
 private:
 	static qs::wstring_ptr escapeQuote(const WCHAR* pwsz);
 
@@ -161,6 +183,100 @@ private:
 	friend class InitializerImpl;
 };
 
+
+
+/****************************************************************************
+ *
+ * FullTextIndexer
+ *
+ * Update the built-in full-text indexes of accounts in background when
+ * changes of their messages are flushed, so that a search doesn't have to
+ * index many messages. A search still updates the index before searching
+ * to catch up with changes which haven't been flushed yet.
+ *
+ */
+
+class FullTextIndexer : public DefaultAccountManagerHandler
+{
+public:
+	FullTextIndexer(Document* pDocument,
+					qs::Profile* pProfile);
+	virtual ~FullTextIndexer();
+
+public:
+	virtual void accountListChanged(const AccountManagerEvent& event);
+
+private:
+	void start(Account* pAccount);
+	void stop(Account* pAccount);
+	void stopAll();
+
+private:
+	FullTextIndexer(const FullTextIndexer&);
+	FullTextIndexer& operator=(const FullTextIndexer&);
+
+private:
+	typedef std::vector<FullTextIndexThread*> ThreadList;
+
+private:
+	Document* pDocument_;
+	qs::Profile* pProfile_;
+	ThreadList listThread_;
+};
+
+
+/****************************************************************************
+ *
+ * FullTextIndexThread
+ *
+ * Index messages of an account. A small batch of messages is indexed at
+ * a time, and the lock of the account is released between batches.
+ *
+ */
+
+class FullTextIndexThread :
+	public qs::Thread,
+	public MessageChangeFeedHandler
+{
+public:
+	enum {
+		BATCH_SIZE	= 500
+	};
+
+public:
+	FullTextIndexThread(Account* pAccount,
+						qs::Profile* pProfile);
+	virtual ~FullTextIndexThread();
+
+public:
+	Account* getAccount() const;
+	
+	/**
+	 * Request to stop. Call join to wait until it stops.
+	 */
+	void stop();
+
+public:
+	virtual void run();
+
+public:
+	virtual void changesFlushed(const MessageChangeFeedEvent& event);
+
+private:
+	bool update(bool* pbMore);
+
+private:
+	FullTextIndexThread(const FullTextIndexThread&);
+	FullTextIndexThread& operator=(const FullTextIndexThread&);
+
+private:
+	Account* pAccount_;
+	qs::Profile* pProfile_;
+	volatile bool bStop_;
+	qs::Event event_;
+	FullTextIndex::Pending pending_;
+};
+
 }
 
 #endif // _WIN32_WCE
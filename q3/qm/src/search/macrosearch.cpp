@@ -7,16 +7,22 @@
 
 #pragma warning(disable:4786)
 
+#include <qmaccount.h>
 #include <qmfolder.h>
 #include <qmmacro.h>
 #include <qmmessage.h>
+#include <qmsecurity.h>
 #include <qmuiutil.h>
 
+#include <qsinit.h>
+#include <qslog.h>
 #include <qsstl.h>
 #include <qsuiutil.h>
 
 #include "macrosearch.h"
+#include "../macro/macro.h"
 #include "../main/main.h"
+#include "../model/messageholdersnapshot.h"
 #include "../ui/resourceinc.h"
 
 using namespace qm;
@@ -33,12 +39,14 @@ qm::MacroSearchDriver::MacroSearchDriver(Document* pDocument,
 										 Account* pAccount,
 										 ActionInvoker* pActionInvoker,
 										 HWND hwnd,
-										 Profile* pProfile) :
+										 Profile* pProfile,
+										 ThreadPool* pThreadPool) :
 	pDocument_(pDocument),
 	pAccount_(pAccount),
 	pActionInvoker_(pActionInvoker),
 	hwnd_(hwnd),
-	pProfile_(pProfile)
+	pProfile_(pProfile),
+	pThreadPool_(pThreadPool)
 {
 }
 
@@ -50,6 +58,9 @@ bool qm::MacroSearchDriver::search(const SearchContext& context,
 								   MessageHolderList* pList)
 {
 	assert(pList);
+	assert(pAccount_->isLocked());
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qm::MacroSearchDriver");
 	
 	MacroParser parser;
 	std::auto_ptr<Macro> pMacro(parser.parse(context.getCondition()));
@@ -59,33 +70,216 @@ bool qm::MacroSearchDriver::search(const SearchContext& context,
 	SearchContext::FolderList listFolder;
 	context.getTargetFolders(pAccount_, &listFolder);
 	
+	size_t nCount = 0;
+	for (SearchContext::FolderList::const_iterator it = listFolder.begin(); it != listFolder.end(); ++it) {
+		if (!(*it)->loadMessageHolders())
+			return false;
+		nCount += (*it)->getCount();
+	}
+	
+	SearchCallback* pCallback = context.getCallback();
+	if (pCallback)
+		pCallback->setCount(nCount);
+	
+	// Workers evaluate the macro only when it never modifies anything
+	// and never shows any UI, otherwise it's evaluated by this thread
+	bool bParallel = pThreadPool_ &&
+		pThreadPool_->getThreadCount() > 1 &&
+		nCount > 1 &&
+		context.getSecurityMode() == SECURITYMODE_NONE &&
+		ReadOnlyMacroExprVisitor::isReadOnly(pMacro->getExpr());
+	if (bParallel)
+		log.debugf(L"The macro is evaluated by %u threads.", pThreadPool_->getThreadCount());
+	
+	unsigned int nMacroFlags = bParallel ? MacroContext::FLAG_NONE :
+		MacroContext::FLAG_UITHREAD | MacroContext::FLAG_UI;
 	MacroVariableHolder globalVariable;
+	Matcher matcher(pMacro.get(), pAccount_, pDocument_, pActionInvoker_,
+		hwnd_, pProfile_, nMacroFlags, context.getSecurityMode(), &globalVariable);
+	
+	size_t nBatch = bParallel ? pThreadPool_->getThreadCount()*BATCH_PER_THREAD : BATCH_SIZE;
 	
+	// Workers evaluate the macro against snapshots which are taken by this
+	// thread, because reading a message holder locks the account which this
+	// thread keeps locked while waiting for them
+	SnapshotList listSnapshot;
+	CONTAINER_DELETER(free, listSnapshot);
+	if (bParallel) {
+		listSnapshot.reserve(nBatch);
+		for (size_t n = 0; n < nBatch; ++n)
+			listSnapshot.push_back(new MessageHolderSnapshot());
+	}
+	
+	// Counts of the macro value factory are read before and after
+	// evaluating the macro to log how it allocates values
+	MacroValueFactory::Stats statsStart = { 0, 0, 0, 0 };
+	if (log.isDebugEnabled())
+		MacroValueFactory::getFactory().getStats(&statsStart);
+	
+	DWORD dwStart = ::GetTickCount();
+	Message msg;
+	MessageHolderList listMessageHolder;
+	SnapshotList listLoaded;
+	MatchList listMatch;
+	MessageHolderList listFound;
+	typedef std::vector<Runnable*> RunnableList;
 	for (SearchContext::FolderList::const_iterator it = listFolder.begin(); it != listFolder.end(); ++it) {
 		NormalFolder* pFolder = *it;
+		bool bRemote = pAccount_->isRemoteMessageFolder(pFolder);
 		
-		if (!pFolder->loadMessageHolders())
-			return false;
-		
-		unsigned int nCount = pFolder->getCount();
-		for (unsigned int n = 0; n < nCount; ++n) {
-			MessageHolder* pmh = pFolder->getMessage(n);
+		const MessageHolderList& l = pFolder->getMessages();
+		for (MessageHolderList::size_type nBegin = 0; nBegin < l.size(); nBegin += nBatch) {
+			if (pCallback) {
+				if (pCallback->isCanceled())
+					return true;
+				if (::GetTickCount() - dwStart > PROGRESS_DELAY)
+					pCallback->show();
+			}
+			
+			MessageHolderList::size_type nEnd = QSMIN(nBegin + nBatch, l.size());
+			listMessageHolder.assign(l.begin() + nBegin, l.begin() + nEnd);
+			listMatch.assign(listMessageHolder.size(), 0);
+			
+			// Messages in a remote folder may be fetched while evaluating
+			// the macro, and it's not done by workers
+			if (bParallel && !bRemote) {
+				listLoaded.clear();
+				for (MessageHolderList::size_type n = 0; n < listMessageHolder.size(); ++n) {
+					MessageHolderSnapshot* pSnapshot = listSnapshot[n];
+					if (pSnapshot->load(listMessageHolder[n], pMacro->getFieldPlan(), context.getSecurityMode()))
+						listLoaded.push_back(pSnapshot);
+					else
+						listLoaded.push_back(0);
+				}
+				
+				MatchRunnable runnable(matcher, listLoaded, &listMatch);
+				RunnableList listRunnable(pThreadPool_->getThreadCount(), &runnable);
+				if (!pThreadPool_->execute(&listRunnable[0], listRunnable.size())) {
+					log.error(L"Error occurred while evaluating the macro.");
+					return false;
+				}
+			}
+			else {
+				for (MessageHolderList::size_type n = 0; n < listMessageHolder.size(); ++n) {
+					msg.clear();
+					listMatch[n] = matcher.match(listMessageHolder[n], &msg);
+				}
+			}
 			
-			Message msg;
-			MacroContext context(pmh, &msg, pAccount_,  pAccount_->getCurrentSubAccount(),
-				MessageHolderList(), pFolder, pDocument_, pActionInvoker_, hwnd_,
-				pProfile_, 0, MacroContext::FLAG_UITHREAD | MacroContext::FLAG_UI,
-				context.getSecurityMode(), 0, &globalVariable);
-			MacroValuePtr pValue(pMacro->value(&context));
-			if (pValue.get() && pValue->boolean())
-				pList->push_back(pmh);
+			listFound.clear();
+			for (MessageHolderList::size_type n = 0; n < listMessageHolder.size(); ++n) {
+				if (listMatch[n])
+					listFound.push_back(listMessageHolder[n]);
+			}
+			if (!listFound.empty()) {
+				pList->insert(pList->end(), listFound.begin(), listFound.end());
+				if (pCallback)
+					pCallback->found(listFound);
+			}
+			
+			if (pCallback)
+				pCallback->step(nEnd - nBegin);
 		}
 	}
+	log.debugf(L"%u messages match in %u messages.", pList->size(), nCount);
+	if (log.isDebugEnabled()) {
+		MacroValueFactory::Stats stats;
+		MacroValueFactory::getFactory().getStats(&stats);
+		log.debugf(L"%u macro values (%u strings) are allocated, %u are released by other threads and drained %u times.",
+			stats.nAllocation_ - statsStart.nAllocation_,
+			stats.nStringAllocation_ - statsStart.nStringAllocation_,
+			stats.nRemoteRelease_ - statsStart.nRemoteRelease_,
+			stats.nDrain_ - statsStart.nDrain_);
+	}
 	
 	return true;
 }
 
 
+/****************************************************************************
+ *
+ * MacroSearchDriver::Matcher
+ *
+ */
+
+qm::MacroSearchDriver::Matcher::Matcher(const Macro* pMacro,
+										Account* pAccount,
+										Document* pDocument,
+										ActionInvoker* pActionInvoker,
+										HWND hwnd,
+										Profile* pProfile,
+										unsigned int nMacroFlags,
+										unsigned int nSecurityMode,
+										MacroVariableHolder* pGlobalVariable) :
+	pMacro_(pMacro),
+	pAccount_(pAccount),
+	pDocument_(pDocument),
+	pActionInvoker_(pActionInvoker),
+	hwnd_(hwnd),
+	pProfile_(pProfile),
+	nMacroFlags_(nMacroFlags),
+	nSecurityMode_(nSecurityMode),
+	pGlobalVariable_(pGlobalVariable)
+{
+}
+
+qm::MacroSearchDriver::Matcher::~Matcher()
+{
+}
+
+bool qm::MacroSearchDriver::Matcher::match(MessageHolderBase* pmh,
+										   Message* pMessage) const
+{
+	assert(pmh);
+	assert(pMessage);
+	
+	// A context is created for each message so that variables set by
+	// the macro don't leak
+	MacroContext context(pmh, pMessage, pAccount_, pAccount_->getCurrentSubAccount(),
+		MessageHolderList(), pmh->getFolder(), pDocument_, pActionInvoker_, hwnd_,
+		pProfile_, 0, nMacroFlags_, nSecurityMode_, 0, pGlobalVariable_);
+	MacroValuePtr pValue(pMacro_->value(&context));
+	return pValue.get() && pValue->boolean();
+}
+
+
+/****************************************************************************
+ *
+ * MacroSearchDriver::MatchRunnable
+ *
+ */
+
+qm::MacroSearchDriver::MatchRunnable::MatchRunnable(const Matcher& matcher,
+													const SnapshotList& listSnapshot,
+													MatchList* pListMatch) :
+	matcher_(matcher),
+	listSnapshot_(listSnapshot),
+	pListMatch_(pListMatch),
+	nNext_(0)
+{
+	assert(pListMatch_->size() == listSnapshot_.size());
+}
+
+qm::MacroSearchDriver::MatchRunnable::~MatchRunnable()
+{
+}
+
+void qm::MacroSearchDriver::MatchRunnable::run()
+{
+	// The same runnable is run by all the threads, and each of them takes
+	// the next message until all the messages are taken
+	while (true) {
+		size_t n = ::InterlockedIncrement(const_cast<LONG*>(&nNext_)) - 1;
+		if (n >= listSnapshot_.size())
+			break;
+		
+		MessageHolderSnapshot* pSnapshot = listSnapshot_[n];
+		if (pSnapshot)
+			(*pListMatch_)[n] = matcher_.match(pSnapshot, pSnapshot->getMessage());
+	}
+}
+
+
 /****************************************************************************
  *
  * MacroSearchUI
@@ -319,8 +513,15 @@ std::auto_ptr<SearchDriver> qm::MacroSearchDriverFactory::createDriver(Document*
 																	   HWND hwnd,
 																	   Profile* pProfile)
 {
-	return std::auto_ptr<SearchDriver>(new MacroSearchDriver(
-		pDocument, pAccount, pActionInvoker, hwnd, pProfile));
+	if (!pThreadPool_.get()) {
+		int nThreadCount = pProfile->getInt(L"MacroSearch", L"ThreadCount");
+		if (nThreadCount < 0)
+			nThreadCount = 0;
+		pThreadPool_.reset(new ThreadPool(nThreadCount));
+	}
+	
+	return std::auto_ptr<SearchDriver>(new MacroSearchDriver(pDocument,
+		pAccount, pActionInvoker, hwnd, pProfile, pThreadPool_.get()));
 }
 
 std::auto_ptr<SearchUI> qm::MacroSearchDriverFactory::createUI(Account* pAccount,
@@ -8,13 +8,20 @@
 #ifndef __MACROSEARCH_H__
 #define __MACROSEARCH_H__
 
+#include <qmmacro.h>
 #include <qmsearch.h>
 
 #include <qsinit.h>
+#include <qsthread.h>
+
+#include <vector>
 
 
 namespace qm {
 
+class MessageHolderSnapshot;
+
+
 /****************************************************************************
  *
  * MacroSearchDriver
@@ -23,12 +30,24 @@ namespace qm {
 
 class MacroSearchDriver : public SearchDriver
 {
+private:
+	enum {
+		BATCH_SIZE			= 64,
+		BATCH_PER_THREAD	= 16,
+		PROGRESS_DELAY		= 500
+	};
+
+private:
+	typedef std::vector<unsigned char> MatchList;
+	typedef std::vector<MessageHolderSnapshot*> SnapshotList;
+
 public:
 	MacroSearchDriver(Document* pDocument,
 					  Account* pAccount,
 					  ActionInvoker* pActionInvoker,
 					  HWND hwnd,
-					  qs::Profile* pProfile);
+					  qs::Profile* pProfile,
+					  qs::ThreadPool* pThreadPool);
 	virtual ~MacroSearchDriver();
 
 public:
@@ -39,12 +58,70 @@ private:
 	MacroSearchDriver(const MacroSearchDriver&);
 	MacroSearchDriver& operator=(const MacroSearchDriver&);
 
+private:
+	class Matcher
+	{
+	public:
+		Matcher(const Macro* pMacro,
+				Account* pAccount,
+				Document* pDocument,
+				ActionInvoker* pActionInvoker,
+				HWND hwnd,
+				qs::Profile* pProfile,
+				unsigned int nMacroFlags,
+				unsigned int nSecurityMode,
+				MacroVariableHolder* pGlobalVariable);
+		~Matcher();
+	
+	public:
+		bool match(MessageHolderBase* pmh,
+				   Message* pMessage) const;
+	
+	private:
+		Matcher(const Matcher&);
+		Matcher& operator=(const Matcher&);
+	
+	private:
+		const Macro* pMacro_;
+		Account* pAccount_;
+		Document* pDocument_;
+		ActionInvoker* pActionInvoker_;
+		HWND hwnd_;
+		qs::Profile* pProfile_;
+		unsigned int nMacroFlags_;
+		unsigned int nSecurityMode_;
+		MacroVariableHolder* pGlobalVariable_;
+	};
+	
+	class MatchRunnable : public qs::Runnable
+	{
+	public:
+		MatchRunnable(const Matcher& matcher,
+					  const SnapshotList& listSnapshot,
+					  MatchList* pListMatch);
+		virtual ~MatchRunnable();
+	
+	public:
+		virtual void run();
+	
+	private:
+		MatchRunnable(const MatchRunnable&);
+		MatchRunnable& operator=(const MatchRunnable&);
+	
+	private:
+		const Matcher& matcher_;
+		const SnapshotList& listSnapshot_;
+		MatchList* pListMatch_;
+		volatile LONG nNext_;
+	};
+
 private:
 	Document* pDocument_;
 	Account* pAccount_;
 	ActionInvoker* pActionInvoker_;
 	HWND hwnd_;
 	qs::Profile* pProfile_;
+	qs::ThreadPool* pThreadPool_;
 };
 
 
@@ -147,6 +224,9 @@ private:
 	MacroSearchDriverFactory(const MacroSearchDriverFactory&);
 	MacroSearchDriverFactory& operator=(const MacroSearchDriverFactory&);
 
+private:
+	std::auto_ptr<qs::ThreadPool> pThreadPool_;
+
 private:
 	static MacroSearchDriverFactory* pFactory__;
 	static class InitializerImpl : public qs::Initializer
@@ -35,6 +35,17 @@ qm::SearchDriver::~SearchDriver()
 }
 
 
+/****************************************************************************
+ *
+ * SearchCallback
+ *
+ */
+
+qm::SearchCallback::~SearchCallback()
+{
+}
+
+
 /****************************************************************************
  *
  * SearchUI
@@ -412,9 +423,11 @@ void qm::SearchDriverFactory::unregisterFactory(const WCHAR* pwszName)
 qm::SearchContext::SearchContext(const WCHAR* pwszCondition,
 								 const WCHAR* pwszTargetFolder,
 								 bool bRecursive,
-								 unsigned int nSecurityMode) :
+								 unsigned int nSecurityMode,
+								 SearchCallback* pCallback) :
 	bRecursive_(bRecursive),
-	nSecurityMode_(nSecurityMode)
+	nSecurityMode_(nSecurityMode),
+	pCallback_(pCallback)
 {
 	wstrCondition_ = (allocWString(pwszCondition));
 	if (pwszTargetFolder)
@@ -445,6 +458,11 @@ unsigned int qm::SearchContext::getSecurityMode() const
 	return nSecurityMode_;
 }
 
+SearchCallback* qm::SearchContext::getCallback() const
+{
+	return pCallback_;
+}
+
 void qm::SearchContext::getTargetFolders(Account* pAccount,
 										 FolderList* pList) const
 {
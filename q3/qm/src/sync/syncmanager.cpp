@@ -926,6 +926,25 @@ void qm::SyncManager::syncSlotData(const SyncData* pData,
 				
 				pSubAccount = pSyncItem->getSubAccount();
 			}
+			
+			if (pItem->getType() == SyncDataItem::TYPE_RECEIVE &&
+				pSyncItem->getAccount()->isSupport(Account::SUPPORT_PARALLELSYNC)) {
+				SyncData::ItemList::const_iterator itEnd = it;
+				while (itEnd != listItem.end() &&
+					(*itEnd)->getType() == SyncDataItem::TYPE_RECEIVE &&
+					(*itEnd)->getSubAccount() == pSubAccount)
+					++itEnd;
+				unsigned int nSession = pSubAccount->getPropertyInt(L"Global", L"SyncSession");
+				if (nSession > 1 && itEnd - it > 1) {
+					SyncData::ItemList::const_iterator itNext = syncFolders(
+						nId, pData, it, itEnd, session.get(), nSession);
+					if (pCallback->isCanceled(nId, false) || itNext == it)
+						break;
+					it = itNext - 1;
+					continue;
+				}
+			}
+			
 			if (!syncFolder(nId, pData->getDocument(), pCallback, pSyncItem, session.get()))
 				continue;
 			if (pCallback->isCanceled(nId, false))
@@ -1026,6 +1045,146 @@ bool qm::SyncManager::syncFolder(unsigned int nId,
 	return true;
 }
 
+SyncData::ItemList::const_iterator qm::SyncManager::syncFolders(unsigned int nId,
+																const SyncData* pData,
+																SyncData::ItemList::const_iterator itBegin,
+																SyncData::ItemList::const_iterator itEnd,
+																ReceiveSession* pSession,
+																unsigned int nSession)
+{
+	assert(pData);
+	assert(itBegin != itEnd);
+	assert(pSession);
+	assert(nSession > 1);
+	
+	SyncManagerCallback* pCallback = pData->getCallback();
+	
+	SyncFolderQueue queue(itBegin, itEnd);
+	
+	{
+		typedef std::vector<Thread*> ThreadList;
+		ThreadList listThread;
+		
+		struct Wait
+		{
+			typedef std::vector<Thread*> ThreadList;
+			
+			Wait(const ThreadList& l) :
+				l_(l)
+			{
+			}
+			
+			~Wait()
+			{
+				for (ThreadList::const_iterator it = l_.begin(); it != l_.end(); ++it) {
+					std::auto_ptr<Thread> pThread(*it);
+					pThread->join();
+				}
+			}
+			
+			const ThreadList& l_;
+		} wait(listThread);
+		
+		// The session which has already been opened is used in this thread,
+		// and other sessions are opened in their own threads. They take
+		// folders from the queue one by one until it becomes empty.
+		const SyncItem* pFirstItem = (*itBegin)->getSyncItem();
+		unsigned int nThread = QSMIN(nSession, static_cast<unsigned int>(itEnd - itBegin)) - 1;
+		listThread.reserve(nThread);
+		for (unsigned int n = 0; n < nThread; ++n) {
+			std::auto_ptr<ParallelFolderSyncThread> pThread(
+				new ParallelFolderSyncThread(this, pData, pFirstItem, &queue));
+			if (!pThread->start())
+				break;
+			listThread.push_back(pThread.release());
+		}
+		
+		while (!pCallback->isCanceled(nId, false)) {
+			const SyncItem* pItem = queue.get();
+			if (!pItem)
+				break;
+			syncFolder(nId, pData->getDocument(), pCallback, pItem, pSession);
+			if (!pSession->isConnected())
+				break;
+		}
+	}
+	
+	return queue.getPosition();
+}
+
+void qm::SyncManager::syncQueuedFolders(const SyncData* pData,
+										const SyncItem* pFirstItem,
+										SyncFolderQueue* pQueue)
+{
+	assert(pData);
+	assert(pFirstItem);
+	assert(pQueue);
+	
+	SyncManagerCallback* pCallback = pData->getCallback();
+	assert(pCallback);
+	
+	unsigned int nId = ::GetCurrentThreadId();
+	
+	struct CallbackCaller
+	{
+		CallbackCaller(SyncManagerCallback* pCallback,
+					   unsigned int nId,
+					   SyncData::Type type) :
+			pCallback_(pCallback),
+			nId_(nId)
+		{
+			pCallback_->startThread(nId_, type);
+		}
+		
+		~CallbackCaller()
+		{
+			pCallback_->endThread(nId_);
+		}
+		
+		SyncManagerCallback* pCallback_;
+		unsigned int nId_;
+	} caller(pCallback, nId, pData->getType());
+	
+	std::auto_ptr<Logger> pLogger;
+	std::auto_ptr<ReceiveSessionCallback> pReceiveCallback;
+	std::auto_ptr<ReceiveSession> pSession;
+	if (!openReceiveSession(nId, pData->getDocument(), pCallback,
+		pFirstItem, pData->getType(), &pSession, &pReceiveCallback, &pLogger))
+		return;
+	
+	struct ReceiveSessionTerm
+	{
+		ReceiveSessionTerm(ReceiveSession* pSession) :
+			pSession_(pSession),
+			bConnected_(false)
+		{
+		}
+		
+		~ReceiveSessionTerm()
+		{
+			if (bConnected_)
+				pSession_->disconnect();
+			pSession_->term();
+		}
+		
+		ReceiveSession* pSession_;
+		bool bConnected_;
+	} term(pSession.get());
+	
+	if (pCallback->isCanceled(nId, false) || !pSession->connect())
+		return;
+	term.bConnected_ = true;
+	
+	while (!pCallback->isCanceled(nId, false)) {
+		const SyncItem* pItem = pQueue->get();
+		if (!pItem)
+			break;
+		syncFolder(nId, pData->getDocument(), pCallback, pItem, pSession.get());
+		if (!pSession->isConnected())
+			break;
+	}
+}
+
 bool qm::SyncManager::send(unsigned int nId,
 						   Document* pDocument,
 						   SyncManagerCallback* pSyncManagerCallback,
@@ -1388,6 +1547,68 @@ void qm::SyncManager::ParallelSyncThread::run()
 }
 
 
+/****************************************************************************
+ *
+ * SyncManager::SyncFolderQueue
+ *
+ */
+
+qm::SyncManager::SyncFolderQueue::SyncFolderQueue(SyncData::ItemList::const_iterator itBegin,
+												  SyncData::ItemList::const_iterator itEnd) :
+	it_(itBegin),
+	itEnd_(itEnd)
+{
+}
+
+qm::SyncManager::SyncFolderQueue::~SyncFolderQueue()
+{
+}
+
+const SyncItem* qm::SyncManager::SyncFolderQueue::get()
+{
+	Lock<CriticalSection> lock(cs_);
+	
+	if (it_ == itEnd_)
+		return 0;
+	return (*it_++)->getSyncItem();
+}
+
+SyncData::ItemList::const_iterator qm::SyncManager::SyncFolderQueue::getPosition() const
+{
+	Lock<CriticalSection> lock(cs_);
+	return it_;
+}
+
+
+/****************************************************************************
+ *
+ * SyncManager::ParallelFolderSyncThread
+ *
+ */
+
+qm::SyncManager::ParallelFolderSyncThread::ParallelFolderSyncThread(SyncManager* pSyncManager,
+																	const SyncData* pData,
+																	const SyncItem* pFirstItem,
+																	SyncFolderQueue* pQueue) :
+	pSyncManager_(pSyncManager),
+	pSyncData_(pData),
+	pFirstItem_(pFirstItem),
+	pQueue_(pQueue)
+{
+}
+
+qm::SyncManager::ParallelFolderSyncThread::~ParallelFolderSyncThread()
+{
+}
+
+void qm::SyncManager::ParallelFolderSyncThread::run()
+{
+	InitThread init(0);
+	
+	pSyncManager_->syncQueuedFolders(pSyncData_, pFirstItem_, pQueue_);
+}
+
+
 /****************************************************************************
  *
  * SyncManager::ReceiveSessionCallbackImpl
@@ -400,6 +400,9 @@ public:
 						 UINT nMessageId,
 						 const WCHAR* pwszDescription);
 
+private:
+	class SyncFolderQueue;
+
 private:
 	bool syncData(SyncData* pData);
 	void syncSlotData(const SyncData* pData,
@@ -409,6 +412,15 @@ private:
 					SyncManagerCallback* pSyncManagerCallback,
 					const SyncItem* pItem,
 					ReceiveSession* pSession);
+	SyncData::ItemList::const_iterator syncFolders(unsigned int nId,
+												   const SyncData* pData,
+												   SyncData::ItemList::const_iterator itBegin,
+												   SyncData::ItemList::const_iterator itEnd,
+												   ReceiveSession* pSession,
+												   unsigned int nSession);
+	void syncQueuedFolders(const SyncData* pData,
+						   const SyncItem* pFirstItem,
+						   SyncFolderQueue* pQueue);
 	bool send(unsigned int nId,
 			  Document* pDocument,
 			  SyncManagerCallback* pSyncManagerCallback,
@@ -480,6 +492,58 @@ private:
 	};
 	friend class ParallelSyncThread;
 	
+	class SyncFolderQueue
+	{
+	public:
+		SyncFolderQueue(SyncData::ItemList::const_iterator itBegin,
+						SyncData::ItemList::const_iterator itEnd);
+		~SyncFolderQueue();
+	
+	public:
+		/**
+		 * Take the next item. Return null if no item is left.
+		 */
+		const SyncItem* get();
+		
+		/**
+		 * Get the position of the first item which hasn't been taken.
+		 */
+		SyncData::ItemList::const_iterator getPosition() const;
+	
+	private:
+		SyncFolderQueue(const SyncFolderQueue&);
+		SyncFolderQueue& operator=(const SyncFolderQueue&);
+	
+	private:
+		SyncData::ItemList::const_iterator it_;
+		SyncData::ItemList::const_iterator itEnd_;
+		mutable qs::CriticalSection cs_;
+	};
+	
+	class ParallelFolderSyncThread : public qs::Thread
+	{
+	public:
+		ParallelFolderSyncThread(SyncManager* pSyncManager,
+								 const SyncData* pData,
+								 const SyncItem* pFirstItem,
+								 SyncFolderQueue* pQueue);
+		virtual ~ParallelFolderSyncThread();
+	
+	public:
+		virtual void run();
+	
+	private:
+		ParallelFolderSyncThread(const ParallelFolderSyncThread&);
+		ParallelFolderSyncThread& operator=(const ParallelFolderSyncThread&);
+	
+	private:
+		SyncManager* pSyncManager_;
+		const SyncData* pSyncData_;
+		const SyncItem* pFirstItem_;
+		SyncFolderQueue* pQueue_;
+	};
+	friend class ParallelFolderSyncThread;
+	
 	class ReceiveSessionCallbackImpl : public ReceiveSessionCallback
 	{
 	public:
@@ -1643,9 +1643,12 @@ void qm::MainWindowImpl::folderSelected(const FolderModelEvent& event)
 		pFolder->isFlag(Folder::FLAG_ACTIVESYNC))
 		pSyncQueue_->pushFolder(static_cast<NormalFolder*>(pFolder), true);
 	else if (pFolder->getType() == Folder::TYPE_QUERY &&
-		pFolder->isFlag(Folder::FLAG_ACTIVESYNC))
+		pFolder->isFlag(Folder::FLAG_ACTIVESYNC)) {
+		ProgressDialogMessageOperationCallback callback(pThis_->getHandle(),
+			IDS_PROGRESS_SEARCH, IDS_PROGRESS_SEARCH);
 		static_cast<QueryFolder*>(pFolder)->search(pDocument_, pActionInvoker_.get(),
-			pThis_->getHandle(), pProfile_, pSecurityModel_->getSecurityMode());
+			pThis_->getHandle(), pProfile_, pSecurityModel_->getSecurityMode(), &callback);
+	}
 }
 
 std::pair<Account*, Folder*> qm::MainWindowImpl::getFocusedAccountOrFolder()
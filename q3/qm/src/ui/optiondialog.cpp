@@ -1782,6 +1782,11 @@ struct {
 	const WCHAR* pwszSearch_;
 	const WCHAR* pwszUpdate_;
 } engines[] = {
+	{
+		IDC_BUILTIN,
+		L"",
+		L""
+	},
 	{
 		IDC_NAMAZU,
 		L"namazu -l -a \"$condition\" \"$index\"",
@@ -1811,6 +1816,7 @@ LRESULT qm::OptionSearchDialog::onCommand(WORD nCode,
 {
 #ifndef _WIN32_WCE
 	BEGIN_COMMAND_HANDLER()
+		HANDLE_COMMAND_ID_CODE(IDC_BUILTIN, BN_CLICKED, onClicked)
 		HANDLE_COMMAND_ID_CODE(IDC_NAMAZU, BN_CLICKED, onClicked)
 		HANDLE_COMMAND_ID_CODE(IDC_HYPERESTRAIER, BN_CLICKED, onClicked)
 		HANDLE_COMMAND_ID_CODE(IDC_CUSTOM, BN_CLICKED, onClicked)
@@ -50,6 +50,7 @@
 #define IDS_PROGRESS_MOVEMESSAGE        1210
 #define IDS_PROGRESS_PROCESS            1211
 #define IDS_PROGRESS_SALVAGE            1212
+#define IDS_PROGRESS_SEARCH             1213
 #define IDS_ADDRESSBOOK_ALLCATEGORY     1300
 #define IDS_ADDRESSBOOK_THISCATEGORY    1301
 #define IDS_ADDRESSBOOK_CATEGORY        1302
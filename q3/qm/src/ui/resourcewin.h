@@ -441,6 +441,7 @@
 #define IDC_AUTOPOPUP                   1466
 #define IDC_SCANATTACHMENT              1467
 #define IDC_LAUNCHPASSWORD              1571
+#define IDC_BUILTIN                     1573
 
 // Next default values for new objects
 // 
@@ -449,7 +450,7 @@
 #define _APS_NO_MFC                     1
 #define _APS_NEXT_RESOURCE_VALUE        228
 #define _APS_NEXT_COMMAND_VALUE         49000
-#define _APS_NEXT_CONTROL_VALUE         1573
+#define _APS_NEXT_CONTROL_VALUE         1574
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
@@ -362,6 +362,250 @@ qm::ViewModelHandler::~ViewModelHandler()
 }
 
 
+/****************************************************************************
+ *
+ * ViewModelThreadIndex
+ *
+ */
+
+qm::ViewModelThreadIndex::ViewModelThreadIndex()
+{
+}
+
+qm::ViewModelThreadIndex::~ViewModelThreadIndex()
+{
+}
+
+void qm::ViewModelThreadIndex::build(const ItemList& listItem,
+									 const MessageThreader::ParentList& listParent)
+{
+	clear();
+	
+	MessageItemList listMessageItem;
+	listMessageItem.reserve(listItem.size());
+	for (ItemList::const_iterator it = listItem.begin(); it != listItem.end(); ++it) {
+		ViewModelItem* pItem = *it;
+		pItem->setParentItem(0);
+		unsigned int nMessageIdHash = pItem->getMessageIdHash();
+		if (nMessageIdHash != 0)
+			mapMessageId_.insert(ItemMap::value_type(nMessageIdHash, pItem));
+		listMessageItem.push_back(std::make_pair(pItem->getMessageHolder(), pItem));
+	}
+	std::sort(listMessageItem.begin(), listMessageItem.end());
+	
+	for (ItemList::const_iterator it = listItem.begin(); it != listItem.end(); ++it) {
+		ViewModelItem* pItem = *it;
+		
+		// Go up until an ancestor in the view is found, because the parent
+		// may be filtered out of the view
+		ViewModelItem* pParentItem = 0;
+		MessageHolder* pmh = pItem->getMessageHolder();
+		for (size_t n = 0; n < listParent.size() && !pParentItem; ++n) {
+			pmh = MessageThreader::getParent(listParent, pmh);
+			if (!pmh)
+				break;
+			
+			MessageItemList::const_iterator itI = std::lower_bound(
+				listMessageItem.begin(), listMessageItem.end(),
+				std::make_pair(pmh, static_cast<ViewModelItem*>(0)));
+			if (itI != listMessageItem.end() && (*itI).first == pmh)
+				pParentItem = (*itI).second;
+		}
+		
+		if (pParentItem &&
+			!MessageThreadUtil::isAncestorOf(pItem, pParentItem,
+				std::mem_fun(&ViewModelItem::getParentItem)))
+			pItem->setParentItem(pParentItem);
+		addWaiting(pItem);
+	}
+}
+
+void qm::ViewModelThreadIndex::add(ViewModelItem* pItem,
+								   ItemList* pListAdopted)
+{
+	assert(pItem);
+	assert(!pItem->getParentItem());
+	assert(pListAdopted);
+	
+	unsigned int nMessageIdHash = pItem->getMessageIdHash();
+	if (nMessageIdHash != 0)
+		mapMessageId_.insert(ItemMap::value_type(nMessageIdHash, pItem));
+	
+	link(pItem);
+	adopt(pItem, pListAdopted);
+}
+
+void qm::ViewModelThreadIndex::remove(ViewModelItem* pItem)
+{
+	assert(pItem);
+	
+	unsigned int nMessageIdHash = pItem->getMessageIdHash();
+	if (nMessageIdHash != 0) {
+		std::pair<ItemMap::iterator, ItemMap::iterator> range(
+			mapMessageId_.equal_range(nMessageIdHash));
+		ItemMap::iterator it = std::find_if(range.first, range.second,
+			boost::bind(&ItemMap::value_type::second, _1) == pItem);
+		if (it != range.second)
+			mapMessageId_.erase(it);
+	}
+	
+	removeWaiting(pItem);
+}
+
+void qm::ViewModelThreadIndex::addOrphan(ViewModelItem* pItem)
+{
+	assert(pItem);
+	assert(!pItem->getParentItem());
+	
+	removeWaiting(pItem);
+	addWaiting(pItem);
+}
+
+void qm::ViewModelThreadIndex::clear()
+{
+	mapMessageId_.clear();
+	mapWaiting_.clear();
+}
+
+void qm::ViewModelThreadIndex::link(ViewModelItem* pItem)
+{
+	ViewModelItem* pParentItem = findParent(pItem);
+	if (pParentItem)
+		pItem->setParentItem(pParentItem);
+	addWaiting(pItem);
+}
+
+ViewModelItem* qm::ViewModelThreadIndex::findParent(ViewModelItem* pItem) const
+{
+	MessageHolder* pmh = pItem->getMessageHolder();
+	if (pmh->getReferenceHash() == 0)
+		return 0;
+	
+	// Look for the nearest ancestor in the view
+	MessageThreader::ReferenceList listReference;
+	wstring_ptr wstrReferences(MessageThreader::getReferences(pmh, &listReference));
+	for (MessageThreader::ReferenceList::reverse_iterator itR = listReference.rbegin(); itR != listReference.rend(); ++itR) {
+		std::pair<ItemMap::const_iterator, ItemMap::const_iterator> range(
+			mapMessageId_.equal_range(MessageHolder::hashMessageId(*itR)));
+		for (ItemMap::const_iterator it = range.first; it != range.second; ++it) {
+			ViewModelItem* pParentItem = (*it).second;
+			wstring_ptr wstrMessageId(pParentItem->getMessageHolder()->getMessageId());
+			if (wcscmp(*itR, wstrMessageId.get()) == 0 &&
+				!MessageThreadUtil::isAncestorOf(pItem, pParentItem,
+					std::mem_fun(&ViewModelItem::getParentItem)))
+				return pParentItem;
+		}
+	}
+	
+	return 0;
+}
+
+void qm::ViewModelThreadIndex::adopt(ViewModelItem* pItem,
+									 ItemList* pListAdopted)
+{
+	unsigned int nMessageIdHash = pItem->getMessageIdHash();
+	if (nMessageIdHash == 0)
+		return;
+	
+	std::pair<ItemMap::iterator, ItemMap::iterator> range(
+		mapWaiting_.equal_range(nMessageIdHash));
+	if (range.first == range.second)
+		return;
+	
+	// An item waits for this item if this item is nearer than its current
+	// parent in its references. Collect them first, because re-indexing
+	// them modifies the map.
+	wstring_ptr wstrMessageId(pItem->getMessageHolder()->getMessageId());
+	ItemList listWaiting;
+	for (ItemMap::iterator it = range.first; it != range.second; ++it) {
+		ViewModelItem* pWaitingItem = (*it).second;
+		if (std::find(listWaiting.begin(), listWaiting.end(), pWaitingItem) == listWaiting.end())
+			listWaiting.push_back(pWaitingItem);
+	}
+	
+	for (ItemList::const_iterator it = listWaiting.begin(); it != listWaiting.end(); ++it) {
+		ViewModelItem* pWaitingItem = *it;
+		
+		MessageThreader::ReferenceList listReference;
+		wstring_ptr wstrReferences(MessageThreader::getReferences(
+			pWaitingItem->getMessageHolder(), &listReference));
+		wstring_ptr wstrParentId;
+		if (pWaitingItem->getParentItem())
+			wstrParentId = pWaitingItem->getParentItem()->getMessageHolder()->getMessageId();
+		
+		bool bNearer = false;
+		for (MessageThreader::ReferenceList::reverse_iterator itR = listReference.rbegin(); itR != listReference.rend(); ++itR) {
+			if (wcscmp(*itR, wstrMessageId.get()) == 0) {
+				bNearer = true;
+				break;
+			}
+			else if (wstrParentId.get() && wcscmp(*itR, wstrParentId.get()) == 0) {
+				break;
+			}
+		}
+		
+		if (bNearer &&
+			!MessageThreadUtil::isAncestorOf(pWaitingItem, pItem,
+				std::mem_fun(&ViewModelItem::getParentItem))) {
+			removeWaiting(pWaitingItem);
+			pWaitingItem->setParentItem(pItem);
+			addWaiting(pWaitingItem);
+			pListAdopted->push_back(pWaitingItem);
+		}
+	}
+}
+
+void qm::ViewModelThreadIndex::addWaiting(ViewModelItem* pItem)
+{
+	MessageHolder* pmh = pItem->getMessageHolder();
+	unsigned int nReferenceHash = pmh->getReferenceHash();
+	if (nReferenceHash == 0)
+		return;
+	
+	// Nothing is skipped when it's linked to its direct parent
+	ViewModelItem* pParentItem = pItem->getParentItem();
+	if (pParentItem && pParentItem->getMessageIdHash() == nReferenceHash)
+		return;
+	
+	MessageThreader::ReferenceList listReference;
+	wstring_ptr wstrReferences(MessageThreader::getReferences(pmh, &listReference));
+	wstring_ptr wstrParentId;
+	if (pParentItem)
+		wstrParentId = pParentItem->getMessageHolder()->getMessageId();
+	for (MessageThreader::ReferenceList::reverse_iterator itR = listReference.rbegin(); itR != listReference.rend(); ++itR) {
+		if (wstrParentId.get() && wcscmp(*itR, wstrParentId.get()) == 0)
+			break;
+		mapWaiting_.insert(ItemMap::value_type(MessageHolder::hashMessageId(*itR), pItem));
+	}
+}
+
+void qm::ViewModelThreadIndex::removeWaiting(ViewModelItem* pItem)
+{
+	MessageHolder* pmh = pItem->getMessageHolder();
+	unsigned int nReferenceHash = pmh->getReferenceHash();
+	if (nReferenceHash == 0)
+		return;
+	
+	ViewModelItem* pParentItem = pItem->getParentItem();
+	if (pParentItem && pParentItem->getMessageIdHash() == nReferenceHash)
+		return;
+	
+	MessageThreader::ReferenceList listReference;
+	wstring_ptr wstrReferences(MessageThreader::getReferences(pmh, &listReference));
+	for (MessageThreader::ReferenceList::const_iterator itR = listReference.begin(); itR != listReference.end(); ++itR) {
+		std::pair<ItemMap::iterator, ItemMap::iterator> range(
+			mapWaiting_.equal_range(MessageHolder::hashMessageId(*itR)));
+		ItemMap::iterator it = range.first;
+		while (it != range.second) {
+			if ((*it).second == pItem)
+				mapWaiting_.erase(it++);
+			else
+				++it;
+		}
+	}
+}
+
+
 /****************************************************************************
  *
  * ViewModel::SelectionRestorer
@@ -1006,73 +1250,103 @@ void qm::ViewModel::messageAdded(const FolderMessageEvent& event)
 		if (bAdd) {
 			ViewModelItemPtr pItem(pmh, nCacheCount_);
 			
-			if ((getSort() & SORT_THREAD_MASK) == SORT_THREAD) {
+			ItemList listAdopted;
+			if ((getSort() & SORT_THREAD_MASK) == SORT_THREAD)
+				threadIndex_.add(pItem.get(), &listAdopted);
+			
+			// Items which have been adopted move into the thread of this
+			// item with their descendants. Take them out here and put them
+			// back just after this item, instead of sorting all the items.
+			SelectionRestorer subtreeRestorer(this, false, listAdopted.empty());
+			ItemList listSubtree;
+			if (!listAdopted.empty()) {
+				std::stable_sort(listAdopted.begin(), listAdopted.end(), getComparator(nSort_));
+				for (ItemList::const_iterator itA = listAdopted.begin(); itA != listAdopted.end(); ++itA) {
+					ViewModelItem* pAdoptedItem = *itA;
+					ItemList::iterator itBegin = std::find(listItem_.begin(), listItem_.end(), pAdoptedItem);
+					if (itBegin == listItem_.end())
+						continue;
+					ItemList::iterator itEnd = itBegin + 1;
+					while (itEnd != listItem_.end()) {
+						const ViewModelItem* pParentItem = (*itEnd)->getParentItem();
+						while (pParentItem && pParentItem != pAdoptedItem)
+							pParentItem = pParentItem->getParentItem();
+						if (!pParentItem)
+							break;
+						++itEnd;
+					}
+					listSubtree.insert(listSubtree.end(), itBegin, itEnd);
+					listItem_.erase(itBegin, itEnd);
+				}
+			}
+			
+			if ((getSort() & SORT_THREAD_MASK) == SORT_THREAD && isFloatThread(nSort_)) {
+				ViewModelItemComp comp(getComparator(nSort_));
+				
+				ViewModelItem* pRootItem = pItem.get();
+				while (pRootItem->getParentItem())
+					pRootItem = pRootItem->getParentItem();
+				const ViewModelItem* pLatestItem = pRootItem->getLatestItem();
+				
+				for (ItemList::const_iterator it = listAdopted.begin(); it != listAdopted.end(); ++it)
+					pItem->updateLatestItem((*it)->getLatestItem(), comp);
+				ViewModelItem* pParentItem = pItem->getParentItem();
+				if (pParentItem)
+					pParentItem->updateLatestItem(pItem->getLatestItem(), comp);
+				
 				ItemList::iterator itParent = listItem_.end();
+				if (pParentItem && pRootItem->getLatestItem() != pLatestItem) {
+					unsigned int nParent = getIndex(pParentItem->getMessageHolder());
+					if (nParent != -1)
+						itParent = listItem_.begin() + nParent;
+				}
 				
-				unsigned int nReferenceHash = pmh->getReferenceHash();
-				if (nReferenceHash != 0) {
-					wstring_ptr wstrReference(pmh->getReference());
+				if (itParent != listItem_.end()) {
+					assert(*itParent == pParentItem);
+					ItemList::iterator itThreadBegin = itParent;
+					while ((*itThreadBegin)->getParentItem())
+						--itThreadBegin;
+					ItemList::iterator itThreadEnd = itParent + 1;
+					while (itThreadEnd != listItem_.end() && (*itThreadEnd)->getParentItem())
+						++itThreadEnd;
 					
-					for (itParent = listItem_.begin(); itParent != listItem_.end(); ++itParent) {
-						MessageHolder* pmhParent = (*itParent)->getMessageHolder();
-						if (pmhParent->getMessageIdHash() == nReferenceHash) {
-							wstring_ptr wstrMessageId(pmhParent->getMessageId());
-							if (wcscmp(wstrReference.get(), wstrMessageId.get()) == 0)
+					if ((nSort_ & SORT_DIRECTION_MASK) == SORT_ASCENDING) {
+						ItemList::iterator itInsert = itThreadEnd;
+						while (itInsert != listItem_.end()) {
+							if (!(*itInsert)->getParentItem() &&
+								comp(*itThreadBegin, *itInsert))
 								break;
+							++itInsert;
+						}
+						
+						if (itInsert != itThreadEnd) {
+							SelectionRestorer restorer(this, false, !listAdopted.empty());
+							ItemList l(itThreadBegin, itThreadEnd);
+							std::copy(l.begin(), l.end(),
+								std::copy(itThreadEnd, itInsert, itThreadBegin));
+							if (listAdopted.empty())
+								restorer.restore();
 						}
 					}
-				}
-				
-				if (itParent != listItem_.end()) {
-					ViewModelItem* pParentItem = *itParent;
-					pItem->setParentItem(pParentItem);
-					if (isFloatThread(nSort_)) {
-						ViewModelItemComp comp(getComparator(nSort_));
-						if (pParentItem->updateLatestItem(pItem.get(), comp)) {
-							ItemList::iterator itThreadBegin = itParent;
-							while ((*itThreadBegin)->getParentItem())
-								--itThreadBegin;
-							ItemList::iterator itThreadEnd = itParent + 1;
-							while (itThreadEnd != listItem_.end() && (*itThreadEnd)->getParentItem())
-								++itThreadEnd;
-							
-							if ((nSort_ & SORT_DIRECTION_MASK) == SORT_ASCENDING) {
-								ItemList::iterator itInsert = itThreadEnd;
-								while (itInsert != listItem_.end()) {
-									if (!(*itInsert)->getParentItem() &&
-										comp(*itThreadBegin, *itInsert))
-										break;
-									++itInsert;
-								}
-								
-								if (itInsert != itThreadEnd) {
-									SelectionRestorer restorer(this, false, false);
-									ItemList l(itThreadBegin, itThreadEnd);
-									std::copy(l.begin(), l.end(),
-										std::copy(itThreadEnd, itInsert, itThreadBegin));
-									restorer.restore();
-								}
-							}
-							else {
-								ItemList::iterator itInsert = itThreadBegin;
-								for (ItemList::iterator it = itThreadBegin; it != listItem_.begin(); ) {
-									--it;
-									if (!(*it)->getParentItem()) {
-										if (comp(*it, *itThreadBegin))
-											break;
-										itInsert = it;
-									}
-								}
-								
-								if (itInsert != itThreadBegin) {
-									SelectionRestorer restorer(this, false, false);
-									ItemList l(itThreadBegin, itThreadEnd);
-									std::copy_backward(l.begin(), l.end(),
-										std::copy_backward(itInsert, itThreadBegin, itThreadEnd));
-									restorer.restore();
-								}
+					else {
+						ItemList::iterator itInsert = itThreadBegin;
+						for (ItemList::iterator it = itThreadBegin; it != listItem_.begin(); ) {
+							--it;
+							if (!(*it)->getParentItem()) {
+								if (comp(*it, *itThreadBegin))
+									break;
+								itInsert = it;
 							}
 						}
+						
+						if (itInsert != itThreadBegin) {
+							SelectionRestorer restorer(this, false, !listAdopted.empty());
+							ItemList l(itThreadBegin, itThreadEnd);
+							std::copy_backward(l.begin(), l.end(),
+								std::copy_backward(itInsert, itThreadBegin, itThreadEnd));
+							if (listAdopted.empty())
+								restorer.restore();
+						}
 					}
 				}
 			}
@@ -1084,17 +1358,24 @@ void qm::ViewModel::messageAdded(const FolderMessageEvent& event)
 			ItemList::iterator itInsert = listItem_.insert(it, pItem.get());
 			pItem.release();
 			
-			unsigned int nPos = static_cast<unsigned int>(itInsert - listItem_.begin());
-			if (nLastSelection_ >= nPos && nLastSelection_ < listItem_.size() - 1)
-				++nLastSelection_;
-			if (nFocused_ >= nPos && nFocused_ < listItem_.size() - 1)
-				++nFocused_;
-			if (listItem_.size() == 1) {
-				assert(nFocused_ == 0);
-				assert(nLastSelection_ == 0);
-				listItem_[0]->setFlags(
-					ViewModelItem::FLAG_FOCUSED | ViewModelItem::FLAG_SELECTED,
-					ViewModelItem::FLAG_FOCUSED | ViewModelItem::FLAG_SELECTED);
+			if (!listAdopted.empty()) {
+				// Descendants of this item always follow it
+				listItem_.insert(itInsert + 1, listSubtree.begin(), listSubtree.end());
+				subtreeRestorer.restore();
+			}
+			else {
+				unsigned int nPos = static_cast<unsigned int>(itInsert - listItem_.begin());
+				if (nLastSelection_ >= nPos && nLastSelection_ < listItem_.size() - 1)
+					++nLastSelection_;
+				if (nFocused_ >= nPos && nFocused_ < listItem_.size() - 1)
+					++nFocused_;
+				if (listItem_.size() == 1) {
+					assert(nFocused_ == 0);
+					assert(nLastSelection_ == 0);
+					listItem_[0]->setFlags(
+						ViewModelItem::FLAG_FOCUSED | ViewModelItem::FLAG_SELECTED,
+						ViewModelItem::FLAG_FOCUSED | ViewModelItem::FLAG_SELECTED);
+				}
 			}
 			assert(listItem_.empty() ||
 				(listItem_[nFocused_]->getFlags() & ViewModelItem::FLAG_FOCUSED));
@@ -1180,11 +1461,13 @@ void qm::ViewModel::messageRemoved(const FolderMessageEvent& event)
 			for (ItemList::const_iterator itC = it + 1; itC != itEnd; ++itC) {
 				if ((*itC)->getParentItem() == pItem) {
 					(*itC)->setParentItem(0);
+					threadIndex_.addOrphan(*itC);
 					bSort = true;
 				}
 			}
 			assert(std::find_if(listItem_.begin(), listItem_.end(),
 				boost::bind(&ViewModelItem::getParentItem, _1) == pItem) == listItem_.end());
+			threadIndex_.remove(pItem);
 		}
 		
 		ViewModelItem::deleteItem(pItem, nCacheCount_);
@@ -1337,14 +1620,11 @@ void qm::ViewModel::update(bool bRestoreSelection,
 	
 	SelectionRestorer restorer(this, true, !bRestoreSelection);
 	
-	for (ItemList::iterator it = listItem_.begin(); it != listItem_.end(); ++it)
-		ViewModelItem::deleteItem(*it, nOldCacheCount);
-	listItem_.clear();
-	
 	unsigned int nCount = pFolder_->getCount();
-	listItem_.reserve(nCount);
+	ItemList listItem;
+	listItem.reserve(nCount);
 	
-	nUnseenCount_ = 0;
+	unsigned int nUnseenCount = 0;
 	
 	MacroVariableHolder globalVariable;
 	for (unsigned int n = 0; n < nCount; ++n) {
@@ -1361,13 +1641,19 @@ void qm::ViewModel::update(bool bRestoreSelection,
 		}
 		if (bAdd) {
 			ViewModelItemPtr pItem(pmh, nCacheCount_);
-			listItem_.push_back(pItem.release());
+			listItem.push_back(pItem.release());
 			
 			if (!pmh->isSeen())
-				++nUnseenCount_;
+				++nUnseenCount;
 		}
 	}
 	
+	listItem_.swap(listItem);
+	nUnseenCount_ = nUnseenCount;
+	threadIndex_.clear();
+	for (ItemList::iterator it = listItem.begin(); it != listItem.end(); ++it)
+		ViewModelItem::deleteItem(*it, nOldCacheCount);
+	
 	sort(nSort_, false, true);
 	
 	if (bRestoreSelection)
@@ -1401,10 +1687,27 @@ void qm::ViewModel::sort(unsigned int nSort,
 		pAccount->prepareIndex(l);
 	}
 	
-	if (bUpdateParentLink && (nSort & SORT_THREAD_MASK) == SORT_THREAD)
+	bool bAscending = (nSort & SORT_DIRECTION_MASK) == SORT_ASCENDING;
+	bool bThread = (nSort & SORT_THREAD_MASK) == SORT_THREAD;
+	if (bUpdateParentLink && bThread)
 		makeParentLink(isFloatThread(nSort));
-	
-	std::stable_sort(listItem_.begin(), listItem_.end(), getComparator(nSort));
+	else if (!bThread)
+		threadIndex_.clear();
+	
+	// Keys are extracted in this thread because MessageHolder locks the
+	// account which this thread has locked. Only comparisons of the keys
+	// are run in parallel, and this thread waits for them to finish, so
+	// sorting still blocks the caller, but for a shorter time. Items are
+	// referred by the list window while it paints, so they cannot be sorted
+	// behind it without copying the list and merging changes made while
+	// sorting.
+	ThreadPool* pThreadPool = pViewModelManager_->getThreadPool();
+	ViewModelSortKey key(this, column, listItem_, bThread, pThreadPool);
+	if (bThread)
+		parallelStableSort(pThreadPool, listItem_.begin(), listItem_.end(),
+			ViewModelItemComp(this, column, bAscending, bThread, isFloatThread(nSort), &key));
+	else
+		key.sort(&listItem_, bAscending);
 	
 	if (bRestoreSelection)
 		restorer.restore();
@@ -1414,7 +1717,7 @@ ViewModelItemComp qm::ViewModel::getComparator(unsigned int nSort) const
 {
 	return ViewModelItemComp(this, getColumn(nSort & SORT_INDEX_MASK),
 		(nSort & SORT_DIRECTION_MASK) == SORT_ASCENDING,
-		(nSort & SORT_THREAD_MASK) == SORT_THREAD, isFloatThread(nSort));
+		(nSort & SORT_THREAD_MASK) == SORT_THREAD, isFloatThread(nSort), 0);
 }
 
 bool qm::ViewModel::isFloatThread(unsigned int nSort) const
@@ -1426,12 +1729,19 @@ void qm::ViewModel::makeParentLink(bool bUpdateLatest)
 {
 	Lock<ViewModel> lock(*this);
 	
-	MessageThreadUtil::makeParentLink(pFolder_->getAccount(), listItem_,
-		std::mem_fun(&ViewModelItem::getMessageHolder),
-		std::ptr_fun(&ViewModelItem::createItemWithMessageIdHash),
-		std::mem_fun(&ViewModelItem::getMessageIdHash),
-		std::mem_fun(&ViewModelItem::getParentItem),
-		std::mem_fun(&ViewModelItem::setParentItem));
+	Account* pAccount = pFolder_->getAccount();
+	if (!listItem_.empty() &&
+		!pAccount->isIndexPrepared(listItem_[listItem_.size()/2]->getMessageHolder())) {
+		MessageHolderList l;
+		l.resize(listItem_.size());
+		std::transform(listItem_.begin(), listItem_.end(), l.begin(),
+			std::mem_fun(&ViewModelItem::getMessageHolder));
+		pAccount->prepareIndex(l);
+	}
+	
+	MessageThreader::ParentList listParent;
+	MessageThreader::getParentList(pFolder_, &listParent);
+	threadIndex_.build(listItem_, listParent);
 	
 	if (bUpdateLatest) {
 		std::for_each(listItem_.begin(), listItem_.end(), std::mem_fun(&ViewModelItem::clearLatestItem));
@@ -1720,6 +2030,11 @@ qm::ViewModelManager::ViewModelManager(Document* pDocument,
 	pFilterManager_.reset(new FilterManager(app.getProfilePath(FileNames::FILTERS_XML).get()));
 	pColorManager_.reset(new ColorManager(app.getProfilePath(FileNames::COLORS_XML).get()));
 	pColorManager_->addColorManagerHandler(this);
+	
+	int nThreadCount = pProfile_->getInt(L"ListWindow", L"ThreadCount");
+	if (nThreadCount < 0)
+		nThreadCount = 0;
+	pThreadPool_.reset(new ThreadPool(nThreadCount));
 }
 
 qm::ViewModelManager::~ViewModelManager()
@@ -1748,6 +2063,11 @@ FilterManager* qm::ViewModelManager::getFilterManager() const
 	return pFilterManager_.get();
 }
 
+ThreadPool* qm::ViewModelManager::getThreadPool() const
+{
+	return pThreadPool_.get();
+}
+
 Account* qm::ViewModelManager::getCurrentAccount() const
 {
 	return pCurrentAccount_;
@@ -2005,12 +2325,14 @@ qm::ViewModelItemComp::ViewModelItemComp(const ViewModel* pViewModel,
 										 const ViewColumn& column,
 										 bool bAscending,
 										 bool bThread,
-										 bool bFloat) :
+										 bool bFloat,
+										 const ViewModelSortKey* pSortKey) :
 	pViewModel_(pViewModel),
 	column_(column),
 	bAscending_(bAscending),
 	bThread_(bThread),
-	bFloat_(bFloat)
+	bFloat_(bFloat),
+	pSortKey_(pSortKey)
 {
 }
 
@@ -2082,6 +2404,15 @@ bool qm::ViewModelItemComp::operator()(const ViewModelItem* pLhs,
 int qm::ViewModelItemComp::compare(const ViewModelItem* pLhs,
 								   const ViewModelItem* pRhs) const
 {
+	if (pSortKey_) {
+		// This may be called from a thread other than the thread which
+		// locks the account, so don't fall back to getting values
+		unsigned int nLhs = pSortKey_->getIndex(pLhs);
+		unsigned int nRhs = pSortKey_->getIndex(pRhs);
+		assert(nLhs != -1 && nRhs != -1);
+		return nLhs != -1 && nRhs != -1 ? pSortKey_->compare(nLhs, nRhs) : 0;
+	}
+	
 	unsigned int nFlags = column_.getFlags();
 	if ((nFlags & ViewColumn::FLAG_SORT_MASK) == ViewColumn::FLAG_SORT_NUMBER) {
 		unsigned int nLhs = column_.getNumber(pViewModel_, pLhs);
@@ -2103,6 +2434,116 @@ int qm::ViewModelItemComp::compare(const ViewModelItem* pLhs,
 }
 
 
+/****************************************************************************
+ *
+ * ViewModelSortKey
+ *
+ */
+
+qm::ViewModelSortKey::ViewModelSortKey(const ViewModel* pViewModel,
+									   const ViewColumn& column,
+									   const ViewModel::ItemList& listItem,
+									   bool bIndex,
+									   ThreadPool* pThreadPool) :
+	pThreadPool_(pThreadPool),
+	nSort_(column.getFlags() & ViewColumn::FLAG_SORT_MASK)
+{
+	listKey_.reserve(listItem.size());
+	
+	for (ViewModel::ItemList::const_iterator it = listItem.begin(); it != listItem.end(); ++it) {
+		const ViewModelItem* pItem = *it;
+		unsigned __int64 nKey = 0;
+		if (nSort_ == ViewColumn::FLAG_SORT_NUMBER) {
+			nKey = column.getNumber(pViewModel, pItem);
+		}
+		else if (nSort_ == ViewColumn::FLAG_SORT_DATE) {
+			Time time;
+			column.getTime(pViewModel, pItem, &time);
+			// Pack fields in the same order as operator< compares them
+			nKey = (static_cast<unsigned __int64>(time.wYear) << 46) |
+				(static_cast<unsigned __int64>(time.wMonth & 0x0f) << 42) |
+				(static_cast<unsigned __int64>(time.wDay & 0x1f) << 37) |
+				(static_cast<unsigned __int64>(time.wHour & 0x1f) << 32) |
+				(static_cast<unsigned __int64>(time.wMinute & 0x3f) << 26) |
+				(static_cast<unsigned __int64>(time.wSecond & 0x3f) << 20) |
+				(time.wMilliseconds & 0x3ff);
+		}
+		else {
+			wstring_ptr wstrText(column.getText(pViewModel, pItem));
+			nKey = text_.size();
+			for (const WCHAR* p = wstrText.get(); *p; ++p)
+				text_.push_back(towlower(*p));
+			text_.push_back(L'\0');
+		}
+		listKey_.push_back(nKey);
+	}
+	
+	if (bIndex) {
+		listIndex_.reserve(listItem.size());
+		for (ViewModel::ItemList::size_type n = 0; n < listItem.size(); ++n)
+			listIndex_.push_back(IndexList::value_type(listItem[n], static_cast<unsigned int>(n)));
+		std::sort(listIndex_.begin(), listIndex_.end(),
+			boost::bind(&IndexList::value_type::first, _1) <
+			boost::bind(&IndexList::value_type::first, _2));
+	}
+}
+
+qm::ViewModelSortKey::~ViewModelSortKey()
+{
+}
+
+int qm::ViewModelSortKey::compare(unsigned int nLhs,
+								  unsigned int nRhs) const
+{
+	assert(nLhs < listKey_.size() && nRhs < listKey_.size());
+	
+	unsigned __int64 nKeyLhs = listKey_[nLhs];
+	unsigned __int64 nKeyRhs = listKey_[nRhs];
+	if (nSort_ == ViewColumn::FLAG_SORT_NUMBER || nSort_ == ViewColumn::FLAG_SORT_DATE)
+		return nKeyLhs < nKeyRhs ? -1 : nKeyLhs > nKeyRhs ? 1 : 0;
+	else
+		return wcscmp(&text_[static_cast<size_t>(nKeyLhs)], &text_[static_cast<size_t>(nKeyRhs)]);
+}
+
+unsigned int qm::ViewModelSortKey::getIndex(const ViewModelItem* pItem) const
+{
+	IndexList::const_iterator it = std::lower_bound(
+		listIndex_.begin(), listIndex_.end(),
+		IndexList::value_type(pItem, 0),
+		boost::bind(&IndexList::value_type::first, _1) <
+		boost::bind(&IndexList::value_type::first, _2));
+	if (it == listIndex_.end() || (*it).first != pItem)
+		return -1;
+	return (*it).second;
+}
+
+void qm::ViewModelSortKey::sort(ViewModel::ItemList* pListItem,
+								bool bAscending) const
+{
+	assert(pListItem);
+	assert(pListItem->size() == listKey_.size());
+	
+	typedef std::vector<unsigned int> PositionList;
+	PositionList listPosition;
+	listPosition.resize(listKey_.size());
+	for (PositionList::size_type n = 0; n < listPosition.size(); ++n)
+		listPosition[n] = static_cast<unsigned int>(n);
+	
+	if (bAscending)
+		parallelStableSort(pThreadPool_, listPosition.begin(), listPosition.end(),
+			boost::bind(&ViewModelSortKey::compare, this, _1, _2) < 0);
+	else
+		parallelStableSort(pThreadPool_, listPosition.begin(), listPosition.end(),
+			boost::bind(&ViewModelSortKey::compare, this, _1, _2) > 0);
+	
+	ViewModel::ItemList l;
+	l.reserve(listPosition.size());
+	for (PositionList::const_iterator it = listPosition.begin(); it != listPosition.end(); ++it)
+		l.push_back((*pListItem)[*it]);
+	pListItem->swap(l);
+}
+
+
 /****************************************************************************
  *
  * ViewData
@@ -19,11 +19,13 @@
 #include <qsthread.h>
 #include <qsutil.h>
 
+#include <hash_map>
 #include <vector>
 
 #include "foldermodel.h"
 #include "messageviewmode.h"
 #include "../model/color.h"
+#include "../model/messagethreader.h"
 
 
 namespace qm {
@@ -33,12 +35,14 @@ class ViewModel;
 class ViewModelHandler;
 class ViewModelEvent;
 class ViewModelItem;
+class ViewModelThreadIndex;
 class ViewModelFolderComp;
 class ViewModelHolder;
 class ViewModelManager;
 class ViewModelManagerHandler;
 class ViewModelManagerEvent;
 class ViewModelItemComp;
+class ViewModelSortKey;
 class ViewModelItemEqual;
 class ViewModelParentItemComp;
 class ViewData;
@@ -278,6 +282,85 @@ private:
 };
 
 
+/****************************************************************************
+ *
+ * ViewModelThreadIndex
+ *
+ * Index of items by hashes of their Message-IDs, and of items by hashes of
+ * their references which are nearer than their current parents. A view
+ * keeps it while it's threaded to link a new item to its parent and to
+ * items waiting for it without looking through all the items. Items are
+ * linked using all the references, so that an item whose direct parent is
+ * not in the view is linked to its nearest ancestor in the view, and is
+ * linked again when a nearer one is added.
+ *
+ */
+
+class ViewModelThreadIndex
+{
+public:
+	typedef std::vector<ViewModelItem*> ItemList;
+
+public:
+	ViewModelThreadIndex();
+	~ViewModelThreadIndex();
+
+public:
+	/**
+	 * Clear the index and link all the items again.
+	 *
+	 * @param listItem [in] Items.
+	 * @param listParent [in] Parents of messages in the folder.
+	 */
+	void build(const ItemList& listItem,
+			   const MessageThreader::ParentList& listParent);
+	
+	/**
+	 * Add an item and link it to its parent.
+	 *
+	 * @param pItem [in] Item.
+	 * @param pListAdopted [out] Items which have been linked to the item.
+	 */
+	void add(ViewModelItem* pItem,
+			 ItemList* pListAdopted);
+	
+	/**
+	 * Remove an item. Its children must be unlinked by the caller and
+	 * passed to addOrphan.
+	 */
+	void remove(ViewModelItem* pItem);
+	
+	/**
+	 * Add an item whose parent has been removed.
+	 */
+	void addOrphan(ViewModelItem* pItem);
+	
+	void clear();
+
+private:
+	typedef std::vector<std::pair<MessageHolder*, ViewModelItem*> > MessageItemList;
+
+private:
+	void link(ViewModelItem* pItem);
+	ViewModelItem* findParent(ViewModelItem* pItem) const;
+	void adopt(ViewModelItem* pItem,
+			   ItemList* pListAdopted);
+	void addWaiting(ViewModelItem* pItem);
+	void removeWaiting(ViewModelItem* pItem);
+
+private:
+	ViewModelThreadIndex(const ViewModelThreadIndex&);
+	ViewModelThreadIndex& operator=(const ViewModelThreadIndex&);
+
+private:
+	typedef std::hash_multimap<unsigned int, ViewModelItem*> ItemMap;
+
+private:
+	ItemMap mapMessageId_;
+	ItemMap mapWaiting_;
+};
+
+
 /****************************************************************************
  *
  * ViewModel
@@ -493,6 +576,7 @@ private:
 	unsigned int nUnseenCount_;
 	unsigned int nSort_;
 	std::auto_ptr<Filter> pFilter_;
+	ViewModelThreadIndex threadIndex_;
 	unsigned int nLastSelection_;
 	unsigned int nFocused_;
 	std::pair<unsigned int, unsigned int> scroll_;
@@ -631,6 +715,7 @@ public:
 	DefaultViewData* getDefaultViewData() const;
 	ColorManager* getColorManager() const;
 	FilterManager* getFilterManager() const;
+	qs::ThreadPool* getThreadPool() const;
 	
 	Account* getCurrentAccount() const;
 	void setCurrentAccount(Account* pAccount);
@@ -684,6 +769,7 @@ private:
 	std::auto_ptr<DefaultViewData> pDefaultViewData_;
 	std::auto_ptr<FilterManager> pFilterManager_;
 	std::auto_ptr<ColorManager> pColorManager_;
+	std::auto_ptr<qs::ThreadPool> pThreadPool_;
 	HandlerList listHandler_;
 };
 
@@ -748,7 +834,8 @@ public:
 					  const ViewColumn& column,
 					  bool bAscending,
 					  bool bThread,
-					  bool bFloat);
+					  bool bFloat,
+					  const ViewModelSortKey* pSortKey);
 	~ViewModelItemComp();
 
 public:
@@ -763,6 +850,79 @@ private:
 	bool bAscending_;
 	bool bThread_;
 	bool bFloat_;
+	const ViewModelSortKey* pSortKey_;
+};
+
+
+/****************************************************************************
+ *
+ * ViewModelSortKey
+ *
+ * Keys of items extracted at once before sorting them. Text keys are case
+ * folded so that they can be compared without getting and converting texts
+ * in each comparison.
+ *
+ */
+
+class ViewModelSortKey
+{
+public:
+	/**
+	 * Create instance.
+	 *
+	 * @param pViewModel [in] View model.
+	 * @param column [in] Column whose values are used as keys.
+	 * @param listItem [in] Items.
+	 * @param bIndex [in] true if getIndex is used, false otherwise.
+	 * @param pThreadPool [in] Thread pool used to sort items in parallel.
+	 *                         Can be null.
+	 */
+	ViewModelSortKey(const ViewModel* pViewModel,
+					 const ViewColumn& column,
+					 const ViewModel::ItemList& listItem,
+					 bool bIndex,
+					 qs::ThreadPool* pThreadPool);
+	~ViewModelSortKey();
+
+public:
+	/**
+	 * Compare keys of the items at the specified positions.
+	 */
+	int compare(unsigned int nLhs,
+				unsigned int nRhs) const;
+	
+	/**
+	 * Get the position of the specified item.
+	 *
+	 * @return Position. -1 if not found.
+	 */
+	unsigned int getIndex(const ViewModelItem* pItem) const;
+	
+	/**
+	 * Sort items using keys only. Items which have the same key keep
+	 * their order.
+	 *
+	 * @param pListItem [in, out] Items. Must be the same as the items
+	 *                            passed to the constructor.
+	 * @param bAscending [in] true if sorting in ascending order.
+	 */
+	void sort(ViewModel::ItemList* pListItem,
+			  bool bAscending) const;
+
+private:
+	ViewModelSortKey(const ViewModelSortKey&);
+	ViewModelSortKey& operator=(const ViewModelSortKey&);
+
+private:
+	typedef std::vector<unsigned __int64> KeyList;
+	typedef std::vector<std::pair<const ViewModelItem*, unsigned int> > IndexList;
+
+private:
+	qs::ThreadPool* pThreadPool_;
+	unsigned int nSort_;
+	KeyList listKey_;
+	std::vector<WCHAR> text_;
+	IndexList listIndex_;
 };
 
 
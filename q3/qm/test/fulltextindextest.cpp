@@ -0,0 +1,221 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+/*
+ * Throughput test of FullTextIndex.
+ *
+ * Messages of an existing account are indexed into new indexes in the
+ * specified directory in three ways. First all of them are indexed by one
+ * update. Then they are indexed by updates of up to 500 messages with a new
+ * instance for each, as FullTextIndexThread does, once without and once
+ * with a pending which keeps the messages left by the previous update.
+ * Without it, each update scans all the messages again. The elapsed time
+ * and the number of updates of each are printed. Finally the specified
+ * conditions are searched in each index, and the elapsed time and the
+ * number of messages found are printed, with whether the indexes give the
+ * same results.
+ *
+ * The account is opened as it is and a checkpoint is set to its change
+ * feed, so run it against a copy of an account.
+ *
+ * This is not built by the makefiles. FullTextIndex is not exported from
+ * qm, so build it with the objects of qm and link it with qs, e.g.
+ *
+ *   cl /EHsc /DUNICODE /D_UNICODE /I..\include /I..\..\qs\include
+ *      /I<boost> fulltextindextest.cpp <qm objdir>\*\*.obj qs.lib
+ *
+ * Usage: fulltextindextest <account directory> <index directory> [conditions]
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qmaccount.h>
+#include <qmfolder.h>
+#include <qmsearch.h>
+#include <qmsecurity.h>
+
+#include <qsconv.h>
+#include <qsfile.h>
+#include <qsinit.h>
+#include <qsprofile.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../src/search/fulltextindex.h"
+
+using namespace qm;
+using namespace qs;
+
+
+namespace {
+
+enum {
+	BATCH_SIZE	= 500
+};
+
+enum Mode {
+	MODE_FULL,
+	MODE_BATCH,
+	MODE_PENDING,
+	MODE_MAX
+};
+
+const WCHAR* pwszNames[] = {
+	L"full",
+	L"batch",
+	L"pending"
+};
+
+const CHAR* pszTitles[] = {
+	"Full",
+	"Batch",
+	"Pending"
+};
+
+
+/****************************************************************************
+ *
+ * Functions
+ *
+ */
+
+bool update(Account* pAccount,
+			const WCHAR* pwszPath,
+			Mode mode,
+			DWORD* pdwElapsed,
+			unsigned int* pnCount)
+{
+	File::removeDirectory(pwszPath);
+	
+	FullTextIndex::Pending pending;
+	
+	Lock<Account> lock(*pAccount);
+	
+	DWORD dwStart = ::GetTickCount();
+	bool bMore = true;
+	while (bMore) {
+		FullTextIndex index(pAccount, pwszPath);
+		bool bUpdate = false;
+		switch (mode) {
+		case MODE_FULL:
+			bUpdate = index.update();
+			bMore = false;
+			break;
+		case MODE_BATCH:
+			bUpdate = index.update(BATCH_SIZE, 0, &bMore);
+			break;
+		case MODE_PENDING:
+			bUpdate = index.update(BATCH_SIZE, &pending, &bMore);
+			break;
+		default:
+			break;
+		}
+		if (!bUpdate)
+			return false;
+		++*pnCount;
+	}
+	*pdwElapsed = ::GetTickCount() - dwStart;
+	
+	return true;
+}
+
+bool search(Account* pAccount,
+			const WCHAR* pwszPath,
+			const WCHAR* pwszCondition,
+			const SearchContext::FolderList& listFolder,
+			DWORD* pdwElapsed,
+			MessageHolderList* pList)
+{
+	Lock<Account> lock(*pAccount);
+	
+	DWORD dwStart = ::GetTickCount();
+	if (!FullTextIndex(pAccount, pwszPath).search(pwszCondition, listFolder, pList))
+		return false;
+	*pdwElapsed = ::GetTickCount() - dwStart;
+	
+	std::sort(pList->begin(), pList->end());
+	
+	return true;
+}
+
+}
+
+
+int main(int argc,
+		 char** argv)
+{
+	if (argc < 3) {
+		fprintf(stderr, "Usage: fulltextindextest <account directory> <index directory> [conditions]\n");
+		return 1;
+	}
+	
+	Init init(::GetModuleHandle(0), L"fulltextindextest", 0, 0);
+	
+	wstring_ptr wstrPath(mbs2wcs(argv[1]));
+	wstring_ptr wstrIndex(mbs2wcs(argv[2]));
+	
+	XMLProfile profile(L"", 0, 0);
+	Security security(wstrPath.get(), &profile);
+	Account account(wstrPath.get(), &security, 0, 0);
+	
+	SearchContext::FolderList listFolder;
+	{
+		Lock<Account> lock(account);
+		
+		const Account::FolderList& l = account.getFolders();
+		for (Account::FolderList::const_iterator it = l.begin(); it != l.end(); ++it) {
+			if ((*it)->getType() != Folder::TYPE_NORMAL)
+				continue;
+			NormalFolder* pFolder = static_cast<NormalFolder*>(*it);
+			if (!pFolder->loadMessageHolders()) {
+				fprintf(stderr, "Failed to load messages\n");
+				return 1;
+			}
+			listFolder.push_back(pFolder);
+		}
+	}
+	
+	wstring_ptr wstrIndexes[MODE_MAX];
+	for (int n = 0; n < MODE_MAX; ++n) {
+		wstrIndexes[n] = concat(wstrIndex.get(), L"\\", pwszNames[n]);
+		
+		DWORD dwElapsed = 0;
+		unsigned int nCount = 0;
+		if (!update(&account, wstrIndexes[n].get(),
+			static_cast<Mode>(n), &dwElapsed, &nCount)) {
+			fprintf(stderr, "Failed to update\n");
+			return 1;
+		}
+		printf("%-8s Elapsed: %6lums, Updates: %5u\n", pszTitles[n], dwElapsed, nCount);
+	}
+	
+	for (int nArg = 3; nArg < argc; ++nArg) {
+		wstring_ptr wstrCondition(mbs2wcs(argv[nArg]));
+		
+		MessageHolderList listResult[MODE_MAX];
+		for (int n = 0; n < MODE_MAX; ++n) {
+			DWORD dwElapsed = 0;
+			if (!search(&account, wstrIndexes[n].get(),
+				wstrCondition.get(), listFolder, &dwElapsed, &listResult[n])) {
+				fprintf(stderr, "Failed to search\n");
+				return 1;
+			}
+			printf("%-8s Search: %s, Elapsed: %6lums, Found: %6u\n", pszTitles[n],
+				argv[nArg], dwElapsed, static_cast<unsigned int>(listResult[n].size()));
+		}
+		if (listResult[MODE_BATCH] != listResult[MODE_FULL] ||
+			listResult[MODE_PENDING] != listResult[MODE_FULL]) {
+			fprintf(stderr, "Results differ\n");
+			return 1;
+		}
+	}
+	
+	return 0;
+}
@@ -0,0 +1,362 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+/*
+ * Evaluation test of compiled macros.
+ *
+ * Conditions of a rule set which files mailing lists, notifications and
+ * newsletters are evaluated over the specified number of generated
+ * messages, as rules are applied. For each message, the conditions are
+ * evaluated in order until one of them matches, in a new context for each
+ * condition. They are evaluated first by walking the expression trees and
+ * then by running the programs compiled from them, and the elapsed time of
+ * each and the number of matches of each rule are printed.
+ *
+ * The messages are generated in memory, so the contexts have neither an
+ * account nor a document. Build it with NDEBUG defined, and don't add a
+ * condition which refers them.
+ *
+ * This is not built by the makefiles. MacroExpr is not exported from qm, so
+ * build it with the objects of qm and link it with qs, e.g.
+ *
+ *   cl /EHsc /DUNICODE /D_UNICODE /DNDEBUG /I..\include /I..\..\qs\include
+ *      /I<boost> macrotest.cpp <qm objdir>\*\*.obj qs.lib
+ *
+ * Usage: macrotest [messages]
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qmmacro.h>
+#include <qmmessage.h>
+#include <qmmessageholder.h>
+#include <qmsecurity.h>
+
+#include <qsinit.h>
+#include <qsprofile.h>
+#include <qsstl.h>
+#include <qsstring.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "../src/macro/macro.h"
+
+using namespace qm;
+using namespace qs;
+
+
+namespace {
+
+/****************************************************************************
+ *
+ * TestMessageHolder
+ *
+ */
+
+class TestMessageHolder : public MessageHolderBase
+{
+public:
+	TestMessageHolder(unsigned int nId,
+					  unsigned int nFlags,
+					  const WCHAR* pwszFrom,
+					  const WCHAR* pwszTo,
+					  const WCHAR* pwszSubject,
+					  const Time& date,
+					  unsigned int nSize);
+	virtual ~TestMessageHolder();
+
+public:
+	virtual unsigned int getId() const;
+	virtual unsigned int getFlags() const;
+	virtual wstring_ptr getFrom() const;
+	virtual wstring_ptr getTo() const;
+	virtual wstring_ptr getFromTo() const;
+	virtual wstring_ptr getSubject() const;
+	virtual void getDate(Time* pTime) const;
+	virtual unsigned int getSize() const;
+	virtual unsigned int getTextSize() const;
+	virtual NormalFolder* getFolder() const;
+	virtual Account* getAccount() const;
+	virtual bool getMessage(unsigned int nFlags,
+							const WCHAR* pwszField,
+							unsigned int nSecurityMode,
+							Message* pMessage);
+	virtual MessageHolder* getMessageHolder();
+
+private:
+	TestMessageHolder(const TestMessageHolder&);
+	TestMessageHolder& operator=(const TestMessageHolder&);
+
+private:
+	unsigned int nId_;
+	unsigned int nFlags_;
+	wstring_ptr wstrFrom_;
+	wstring_ptr wstrTo_;
+	wstring_ptr wstrSubject_;
+	Time date_;
+	unsigned int nSize_;
+};
+
+TestMessageHolder::TestMessageHolder(unsigned int nId,
+									 unsigned int nFlags,
+									 const WCHAR* pwszFrom,
+									 const WCHAR* pwszTo,
+									 const WCHAR* pwszSubject,
+									 const Time& date,
+									 unsigned int nSize) :
+	nId_(nId),
+	nFlags_(nFlags),
+	date_(date),
+	nSize_(nSize)
+{
+	wstrFrom_ = allocWString(pwszFrom);
+	wstrTo_ = allocWString(pwszTo);
+	wstrSubject_ = allocWString(pwszSubject);
+}
+
+TestMessageHolder::~TestMessageHolder()
+{
+}
+
+unsigned int TestMessageHolder::getId() const
+{
+	return nId_;
+}
+
+unsigned int TestMessageHolder::getFlags() const
+{
+	return nFlags_;
+}
+
+wstring_ptr TestMessageHolder::getFrom() const
+{
+	return allocWString(wstrFrom_.get());
+}
+
+wstring_ptr TestMessageHolder::getTo() const
+{
+	return allocWString(wstrTo_.get());
+}
+
+wstring_ptr TestMessageHolder::getFromTo() const
+{
+	if (nFlags_ & MessageHolder::FLAG_SENT)
+		return getTo();
+	else
+		return getFrom();
+}
+
+wstring_ptr TestMessageHolder::getSubject() const
+{
+	return allocWString(wstrSubject_.get());
+}
+
+void TestMessageHolder::getDate(Time* pTime) const
+{
+	*pTime = date_;
+}
+
+unsigned int TestMessageHolder::getSize() const
+{
+	return nSize_;
+}
+
+unsigned int TestMessageHolder::getTextSize() const
+{
+	return nSize_;
+}
+
+NormalFolder* TestMessageHolder::getFolder() const
+{
+	return 0;
+}
+
+Account* TestMessageHolder::getAccount() const
+{
+	return 0;
+}
+
+bool TestMessageHolder::getMessage(unsigned int nFlags,
+								   const WCHAR* pwszField,
+								   unsigned int nSecurityMode,
+								   Message* pMessage)
+{
+	return false;
+}
+
+MessageHolder* TestMessageHolder::getMessageHolder()
+{
+	return 0;
+}
+
+
+/****************************************************************************
+ *
+ * Functions
+ *
+ */
+
+typedef std::vector<TestMessageHolder*> MessageList;
+typedef std::vector<Macro*> MacroList;
+typedef std::vector<unsigned int> CountList;
+
+const WCHAR* pwszConditions[] = {
+	L"@Contain(%Subject, '[qmail-ml:')",
+	L"@Contain(%From, '@notifications.example.com')",
+	L"@And(@Not(@Seen()), @Contain(%To, 'team@example.com'))",
+	L"@Or(@BeginWith(%Subject, '[dev]'), @BeginWith(%Subject, 'Re: [dev]'))",
+	L"@And(@Greater(%Size, 1048576), @Not(@Marked()))",
+	L"@If(@Sent(), @Contain(%To, 'boss@example.com'), @Contain(%From, 'boss@example.com'))",
+	L"@Contain(%Subject, 'Invoice', @True())",
+	L"@Or(@Contain(%From, 'newsletter'), @Contain(%From, 'no-reply'), @Contain(%Subject, 'unsubscribe'))",
+	L"@And(@Not(@Deleted()), @Contain(%FromTo, 'example.org'))",
+	L"@Not(@Or(@Seen(), @Contain(%Subject, 'spam')))"
+};
+
+void generate(size_t nCount,
+			  MessageList* pList)
+{
+	const WCHAR* pwszFroms[] = {
+		L"Alice <alice@example.org>",
+		L"GitHub <noreply@notifications.example.com>",
+		L"Boss <boss@example.com>",
+		L"News <newsletter@shop.example.net>",
+		L"Bob <bob@example.net>",
+		L"Service <no-reply@service.example.net>"
+	};
+	const WCHAR* pwszTos[] = {
+		L"me@example.com",
+		L"team@example.com",
+		L"qmail-ml@example.jp",
+		L"boss@example.com"
+	};
+	const WCHAR* pwszSubjects[] = {
+		L"[qmail-ml:%05u] Re: Sorting large folders",
+		L"[dev] Build %u failed",
+		L"Re: [dev] Review request %u",
+		L"Invoice %u for your order",
+		L"Weekly digest %u - unsubscribe at any time",
+		L"Lunch on Friday? (%u)",
+		L"Re: spam report %u"
+	};
+	const unsigned int nFlags[] = {
+		0,
+		MessageHolder::FLAG_SEEN,
+		MessageHolder::FLAG_SEEN | MessageHolder::FLAG_MARKED,
+		MessageHolder::FLAG_SEEN | MessageHolder::FLAG_SENT,
+		MessageHolder::FLAG_SEEN | MessageHolder::FLAG_DELETED
+	};
+	
+	Time date(Time::getCurrentTime());
+	pList->reserve(nCount);
+	for (size_t n = 0; n < nCount; ++n) {
+		WCHAR wszSubject[128];
+		_snwprintf(wszSubject, countof(wszSubject),
+			pwszSubjects[rand()%countof(pwszSubjects)], static_cast<unsigned int>(n));
+		unsigned int nSize = 1024 + rand()%(64*1024);
+		if (rand()%50 == 0)
+			nSize *= 64;
+		std::auto_ptr<TestMessageHolder> pmh(new TestMessageHolder(
+			static_cast<unsigned int>(n), nFlags[rand()%countof(nFlags)],
+			pwszFroms[rand()%countof(pwszFroms)], pwszTos[rand()%countof(pwszTos)],
+			wszSubject, date, nSize));
+		pList->push_back(pmh.get());
+		pmh.release();
+	}
+}
+
+bool evaluate(const MessageList& listMessage,
+			  const MacroList& listMacro,
+			  bool bCompiled,
+			  Profile* pProfile,
+			  DWORD* pdwElapsed,
+			  CountList* pListCount)
+{
+	pListCount->assign(listMacro.size() + 1, 0);
+	
+	DWORD dwStart = ::GetTickCount();
+	for (MessageList::const_iterator itM = listMessage.begin(); itM != listMessage.end(); ++itM) {
+		MacroList::size_type nMatch = listMacro.size();
+		for (MacroList::size_type n = 0; n < listMacro.size() && nMatch == listMacro.size(); ++n) {
+			Message msg;
+			MacroContext context(*itM, &msg, 0, 0, MessageHolderList(), 0, 0, 0, 0,
+				pProfile, 0, 0, SECURITYMODE_NONE, 0, 0);
+			const Macro* pMacro = listMacro[n];
+			MacroValuePtr pValue(bCompiled ? pMacro->value(&context) :
+				pMacro->getExpr()->value(&context));
+			if (!pValue.get())
+				return false;
+			if (pValue->boolean())
+				nMatch = n;
+		}
+		++(*pListCount)[nMatch];
+	}
+	*pdwElapsed = ::GetTickCount() - dwStart;
+	
+	return true;
+}
+
+}
+
+
+int main(int argc,
+		 char** argv)
+{
+	size_t nCount = argc > 1 ? atoi(argv[1]) : 100000;
+	if (nCount == 0) {
+		fprintf(stderr, "Usage: macrotest [messages]\n");
+		return 1;
+	}
+	
+	Init init(::GetModuleHandle(0), L"macrotest", 0, 0);
+	XMLProfile profile(L"", 0, 0);
+	
+	MacroList listMacro;
+	CONTAINER_DELETER(freeMacro, listMacro);
+	MacroParser parser;
+	for (int n = 0; n < countof(pwszConditions); ++n) {
+		std::auto_ptr<Macro> pMacro(parser.parse(pwszConditions[n]));
+		if (!pMacro.get()) {
+			fprintf(stderr, "Failed to parse condition %d\n", n);
+			return 1;
+		}
+		listMacro.push_back(pMacro.get());
+		pMacro.release();
+	}
+	
+	srand(0);
+	MessageList listMessage;
+	CONTAINER_DELETER(freeMessage, listMessage);
+	generate(nCount, &listMessage);
+	
+	printf("Messages: %u, Rules: %u\n", static_cast<unsigned int>(nCount),
+		static_cast<unsigned int>(listMacro.size()));
+	
+	CountList listCount[2];
+	for (int n = 0; n < countof(listCount); ++n) {
+		bool bCompiled = n != 0;
+		DWORD dwElapsed = 0;
+		if (!evaluate(listMessage, listMacro, bCompiled, &profile, &dwElapsed, &listCount[n])) {
+			fprintf(stderr, "Failed to evaluate\n");
+			return 1;
+		}
+		printf("%-8s Elapsed: %6lums, Matches:", bCompiled ? "Program" : "Tree", dwElapsed);
+		for (CountList::const_iterator it = listCount[n].begin(); it != listCount[n].end(); ++it)
+			printf(" %u", *it);
+		printf("\n");
+	}
+	if (listCount[0] != listCount[1]) {
+		fprintf(stderr, "Results differ\n");
+		return 1;
+	}
+	
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+/*
+ * Sort test of ViewModelSortKey.
+ *
+ * Messages in a folder of an existing account are sorted by subject (text),
+ * size (number) and date. Each column is sorted first by getting and
+ * comparing its values in each comparison, which is what ViewModelItemComp
+ * does without keys, and then by extracting keys with ViewModelSortKey.
+ * The elapsed time of each and whether they give the same order are
+ * printed. Values of the index are read once before timing, so that both
+ * read them from the index cache as far as it holds them. The account is
+ * opened as it is, so run it against a copy of an account.
+ *
+ * This is not built by the makefiles. ViewModelSortKey is not exported from
+ * qm, so build it with the objects of qm and link it with qs, e.g.
+ *
+ *   cl /EHsc /DUNICODE /D_UNICODE /I..\include /I..\..\qs\include
+ *      /I<boost> sorttest.cpp <qm objdir>\*\*.obj qs.lib
+ *
+ * Usage: sorttest <account directory> <folder> [threads]
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qmaccount.h>
+#include <qmfolder.h>
+#include <qmmessageholder.h>
+#include <qmsecurity.h>
+
+#include <qsconv.h>
+#include <qsinit.h>
+#include <qsprofile.h>
+#include <qsthread.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include "../src/uimodel/viewmodel.h"
+
+using namespace qm;
+using namespace qs;
+
+
+namespace {
+
+struct Column
+{
+	const WCHAR* pwszTitle_;
+	ViewColumn::Type type_;
+	unsigned int nFlags_;
+};
+
+
+/****************************************************************************
+ *
+ * Functions
+ *
+ */
+
+DWORD sortByValue(const ViewColumn& column,
+				  ViewModel::ItemList* pListItem)
+{
+	DWORD dwStart = ::GetTickCount();
+	std::stable_sort(pListItem->begin(), pListItem->end(),
+		ViewModelItemComp(0, column, true, false, false, 0));
+	return ::GetTickCount() - dwStart;
+}
+
+void sortByKey(const ViewColumn& column,
+			   ThreadPool* pThreadPool,
+			   ViewModel::ItemList* pListItem,
+			   DWORD* pdwExtract,
+			   DWORD* pdwSort)
+{
+	DWORD dwStart = ::GetTickCount();
+	ViewModelSortKey key(0, column, *pListItem, false, pThreadPool);
+	*pdwExtract = ::GetTickCount() - dwStart;
+	
+	dwStart = ::GetTickCount();
+	key.sort(pListItem, true);
+	*pdwSort = ::GetTickCount() - dwStart;
+}
+
+}
+
+
+int main(int argc,
+		 char** argv)
+{
+	if (argc < 3) {
+		fprintf(stderr, "Usage: sorttest <account directory> <folder> [threads]\n");
+		return 1;
+	}
+	unsigned int nThreadCount = argc > 3 ? atoi(argv[3]) : 0;
+	
+	Init init(::GetModuleHandle(0), L"sorttest", 0, 0);
+	
+	wstring_ptr wstrPath(mbs2wcs(argv[1]));
+	wstring_ptr wstrFolder(mbs2wcs(argv[2]));
+	
+	XMLProfile profile(L"", 0, 0);
+	Security security(wstrPath.get(), &profile);
+	Account account(wstrPath.get(), &security, 0, 0);
+	
+	Folder* pFolder = account.getFolder(wstrFolder.get());
+	if (!pFolder) {
+		fprintf(stderr, "Folder not found\n");
+		return 1;
+	}
+	
+	Lock<Account> lock(account);
+	
+	if (!pFolder->loadMessageHolders()) {
+		fprintf(stderr, "Failed to load messages\n");
+		return 1;
+	}
+	
+	const MessageHolderList& l = pFolder->getMessages();
+	ViewModel::ItemList listItem;
+	listItem.reserve(l.size());
+	for (MessageHolderList::const_iterator it = l.begin(); it != l.end(); ++it)
+		listItem.push_back(ViewModelItem::newItem(*it, 0));
+	
+	std::auto_ptr<ThreadPool> pThreadPool;
+	if (nThreadCount > 1)
+		pThreadPool.reset(new ThreadPool(nThreadCount));
+	
+	printf("Messages: %u, Threads: %u\n",
+		static_cast<unsigned int>(listItem.size()), nThreadCount);
+	
+	const Column columns[] = {
+		{ L"Subject",	ViewColumn::TYPE_SUBJECT,	ViewColumn::FLAG_SORT_TEXT		},
+		{ L"Size",		ViewColumn::TYPE_SIZE,		ViewColumn::FLAG_SORT_NUMBER	},
+		{ L"Date",		ViewColumn::TYPE_DATE,		ViewColumn::FLAG_SORT_DATE		}
+	};
+	for (int n = 0; n < countof(columns); ++n) {
+		ViewColumn column(columns[n].pwszTitle_, columns[n].type_,
+			std::auto_ptr<Macro>(), columns[n].nFlags_, 100);
+		
+		// Read values into the index cache
+		ViewModelSortKey keyLoad(0, column, listItem, false, 0);
+		
+		ViewModel::ItemList listValue(listItem);
+		DWORD dwValue = sortByValue(column, &listValue);
+		
+		ViewModel::ItemList listKey(listItem);
+		DWORD dwExtract = 0;
+		DWORD dwSort = 0;
+		sortByKey(column, pThreadPool.get(), &listKey, &dwExtract, &dwSort);
+		
+		string_ptr strTitle(wcs2mbs(columns[n].pwszTitle_));
+		printf("%-8s Value: %6lums, Key: %6lums (Extract: %6lums, Sort: %6lums), %s\n",
+			strTitle.get(), dwValue, dwExtract + dwSort, dwExtract, dwSort,
+			listValue == listKey ? "Same order" : "Different order");
+	}
+	
+	for (ViewModel::ItemList::const_iterator it = listItem.begin(); it != listItem.end(); ++it)
+		ViewModelItem::deleteItem(*it, 0);
+	
+	return 0;
+}
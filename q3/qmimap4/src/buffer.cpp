@@ -226,3 +226,21 @@ bool qmimap4::TokenUtil::string2number(const std::pair<const CHAR*, size_t>& s,
 	
 	return true;
 }
+
+bool qmimap4::TokenUtil::string2number(const std::pair<const CHAR*, size_t>& s,
+									   unsigned __int64* pn)
+{
+	assert(s.first);
+	assert(pn);
+	
+	*pn = 0;
+	
+	const CHAR* p = s.first;
+	for (size_t n = 0; n < s.second; ++n, ++p) {
+		if (*p < '0' || '9' < *p)
+			return false;
+		*pn = *pn*10 + *p - '0';
+	}
+	
+	return true;
+}
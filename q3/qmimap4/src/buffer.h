@@ -119,6 +119,8 @@ struct TokenUtil
 								  const CHAR* psz);
 	static bool string2number(const std::pair<const CHAR*, size_t>& s,
 							  unsigned int* pn);
+	static bool string2number(const std::pair<const CHAR*, size_t>& s,
+							  unsigned __int64* pn);
 };
 
 }
@@ -0,0 +1,404 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qmaccount.h>
+#include <qmfolder.h>
+
+#include <qsinit.h>
+#include <qslog.h>
+#include <qsstl.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include "idlewatcher.h"
+#include "imap4.h"
+#include "imap4driver.h"
+
+using namespace qmimap4;
+using namespace qm;
+using namespace qs;
+
+
+/****************************************************************************
+ *
+ * IdleWatcher
+ *
+ */
+
+qmimap4::IdleWatcher::IdleWatcher(SessionCacheManager* pSessionCacheManager) :
+	pSessionCacheManager_(pSessionCacheManager),
+	bActive_(false)
+{
+	pSessionCacheManager_->getAccount()->addAccountHandler(this);
+}
+
+qmimap4::IdleWatcher::~IdleWatcher()
+{
+	pSessionCacheManager_->getAccount()->removeAccountHandler(this);
+	stop();
+}
+
+void qmimap4::IdleWatcher::start()
+{
+	stop();
+	
+	{
+		Lock<CriticalSection> lock(cs_);
+		bActive_ = true;
+	}
+	update();
+}
+
+void qmimap4::IdleWatcher::stop()
+{
+	ThreadList l;
+	{
+		Lock<CriticalSection> lock(cs_);
+		bActive_ = false;
+		l.swap(listThread_);
+		l.insert(l.end(), listStoppingThread_.begin(), listStoppingThread_.end());
+		listStoppingThread_.clear();
+	}
+	if (l.empty())
+		return;
+	
+	// Request all the threads to stop first, so that it doesn't take
+	// longer as more folders are watched. Wait for them without locking,
+	// because they lock the account to notify changes.
+	std::for_each(l.begin(), l.end(),
+		boost::bind(&IdleThread::stop, _1));
+	std::for_each(l.begin(), l.end(),
+		boost::bind(static_cast<bool (Thread::*)()>(&Thread::join), _1));
+	std::for_each(l.begin(), l.end(),
+		boost::checked_deleter<IdleThread>());
+}
+
+void qmimap4::IdleWatcher::folderListChanged(const FolderListChangedEvent& event)
+{
+	if (event.getType() == FolderListChangedEvent::TYPE_FLAGS) {
+		const unsigned int nFlags = Folder::FLAG_LOCAL | Folder::FLAG_NOSELECT |
+			Folder::FLAG_SYNCABLE | Folder::FLAG_ACTIVESYNC;
+		if (((event.getOldFlags() ^ event.getNewFlags()) & nFlags) == 0)
+			return;
+	}
+	update();
+}
+
+void qmimap4::IdleWatcher::update()
+{
+	Account* pAccount = pSessionCacheManager_->getAccount();
+	Lock<Account> lockAccount(*pAccount);
+	
+	Lock<CriticalSection> lock(cs_);
+	
+	reap();
+	
+	if (!bActive_)
+		return;
+	
+	SubAccount* pSubAccount = pSessionCacheManager_->getSubAccount();
+	
+	typedef std::vector<std::pair<unsigned int, WSTRING> > MailboxList;
+	MailboxList listMailbox;
+	CONTAINER_DELETER(free, listMailbox,
+		boost::bind(&freeWString, boost::bind(&MailboxList::value_type::second, _1)));
+	if (pSubAccount->getPropertyInt(L"Imap4", L"Idle")) {
+		Account::FolderList l;
+		const Account::FolderList& listFolder = pAccount->getFolders();
+		for (Account::FolderList::const_iterator it = listFolder.begin(); it != listFolder.end(); ++it) {
+			Folder* pFolder = *it;
+			if (pFolder->getType() == Folder::TYPE_NORMAL &&
+				!pFolder->isFlag(Folder::FLAG_LOCAL) &&
+				!pFolder->isFlag(Folder::FLAG_NOSELECT) &&
+				pFolder->isFlag(Folder::FLAG_SYNCABLE) &&
+				pFolder->isFlag(Folder::FLAG_ACTIVESYNC))
+				l.push_back(pFolder);
+		}
+		
+		// Each folder is watched on its own connection because IDLE command
+		// only watches the selected mailbox, so the number of them is limited
+		// not to be rejected by the server. The inbox is watched first.
+		std::stable_partition(l.begin(), l.end(),
+			boost::bind(&Folder::isFlag, _1, Folder::FLAG_INBOX));
+		unsigned int nMax = pSubAccount->getPropertyInt(L"Imap4", L"IdleMaxSession");
+		if (l.size() > nMax)
+			l.resize(nMax);
+		
+		listMailbox.reserve(l.size());
+		for (Account::FolderList::const_iterator it = l.begin(); it != l.end(); ++it) {
+			wstring_ptr wstrMailbox(Util::getFolderName(static_cast<NormalFolder*>(*it)));
+			listMailbox.push_back(std::make_pair((*it)->getId(), wstrMailbox.get()));
+			wstrMailbox.release();
+		}
+	}
+	
+	// Stop watching folders which have been removed, renamed or are no
+	// longer synchronized actively, without waiting for them to stop
+	ThreadList::iterator itThread = listThread_.begin();
+	while (itThread != listThread_.end()) {
+		IdleThread* pThread = *itThread;
+		MailboxList::iterator it = std::find_if(listMailbox.begin(), listMailbox.end(),
+			boost::bind(&MailboxList::value_type::first, _1) == pThread->getFolderId());
+		if (it != listMailbox.end() && wcscmp((*it).second, pThread->getMailbox()) == 0) {
+			freeWString((*it).second);
+			listMailbox.erase(it);
+			++itThread;
+		}
+		else {
+			pThread->stop();
+			listStoppingThread_.push_back(pThread);
+			itThread = listThread_.erase(itThread);
+		}
+	}
+	if (listMailbox.empty())
+		return;
+	
+	// The server may drop a connection which is idle for 30 minutes,
+	// even when IDLE command is in progress
+	unsigned int nIdleTimeout = pSubAccount->getPropertyInt(L"Imap4", L"IdleTimeout");
+	if (nIdleTimeout == 0 || nIdleTimeout > MAX_IDLE_TIMEOUT)
+		nIdleTimeout = MAX_IDLE_TIMEOUT;
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qmimap4::IdleWatcher");
+	
+	for (MailboxList::const_iterator it = listMailbox.begin(); it != listMailbox.end(); ++it) {
+		std::auto_ptr<IdleThread> pThread(new IdleThread(pSessionCacheManager_,
+			(*it).first, (*it).second, nIdleTimeout));
+		if (!pThread->start()) {
+			log.errorf(L"Failed to start watching: %s", (*it).second);
+			continue;
+		}
+		listThread_.push_back(pThread.get());
+		pThread.release();
+	}
+}
+
+void qmimap4::IdleWatcher::reap()
+{
+	ThreadList::iterator it = listStoppingThread_.begin();
+	while (it != listStoppingThread_.end()) {
+		IdleThread* pThread = *it;
+		if (pThread->isStopped()) {
+			pThread->join();
+			delete pThread;
+			it = listStoppingThread_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+
+/****************************************************************************
+ *
+ * IdleThread
+ *
+ */
+
+qmimap4::IdleThread::IdleThread(SessionCacheManager* pSessionCacheManager,
+								unsigned int nFolderId,
+								const WCHAR* pwszMailbox,
+								unsigned int nIdleTimeout) :
+	pSessionCacheManager_(pSessionCacheManager),
+	nFolderId_(nFolderId),
+	nIdleTimeout_(nIdleTimeout),
+	bStop_(false),
+	event_(true, false)
+{
+	wstrMailbox_ = allocWString(pwszMailbox);
+}
+
+qmimap4::IdleThread::~IdleThread()
+{
+}
+
+unsigned int qmimap4::IdleThread::getFolderId() const
+{
+	return nFolderId_;
+}
+
+const WCHAR* qmimap4::IdleThread::getMailbox() const
+{
+	return wstrMailbox_.get();
+}
+
+void qmimap4::IdleThread::stop()
+{
+	bStop_ = true;
+	event_.set();
+}
+
+bool qmimap4::IdleThread::isStopped() const
+{
+	return ::WaitForSingleObject(getHandle(), 0) == WAIT_OBJECT_0;
+}
+
+void qmimap4::IdleThread::run()
+{
+	InitThread init(0);
+	
+	Log log(InitThread::getInitThread().getLogger(), L"qmimap4::IdleThread");
+	
+	while (!bStop_) {
+		bool bRetry = true;
+		if (watch(&bRetry) || bStop_)
+			break;
+		if (!bRetry) {
+			log.warnf(L"Stop watching: %s", wstrMailbox_.get());
+			break;
+		}
+		
+		log.warnf(L"Failed to watch, retry in %u seconds: %s",
+			static_cast<unsigned int>(RETRY_INTERVAL), wstrMailbox_.get());
+		event_.wait(RETRY_INTERVAL*1000);
+	}
+}
+
+bool qmimap4::IdleThread::watch(bool* pbRetry)
+{
+	assert(pbRetry);
+	
+	Account* pAccount = pSessionCacheManager_->getAccount();
+	SubAccount* pSubAccount = pSessionCacheManager_->getSubAccount();
+	
+	std::auto_ptr<Logger> pLogger;
+	if (pSubAccount->isLog(Account::HOST_RECEIVE))
+		pLogger = pAccount->openLogger(Account::HOST_RECEIVE);
+	
+	IdleCallback callback(pSubAccount, pSessionCacheManager_->getPasswordCallback(),
+		pSessionCacheManager_->getSecurity(), &bStop_);
+	Imap4 imap4(pSubAccount->getTimeout(), &callback, &callback, &callback, pLogger.get());
+	if (!imap4.connect(pSubAccount->getHost(Account::HOST_RECEIVE),
+		pSubAccount->getPort(Account::HOST_RECEIVE), Util::getSecure(pSubAccount))) {
+		// Don't ask a password again and again
+		unsigned int nError = imap4.getLastError() & Imap4::IMAP4_ERROR_MASK_HIGHLEVEL;
+		if (nError == Imap4::IMAP4_ERROR_LOGIN ||
+			nError == Imap4::IMAP4_ERROR_AUTHENTICATE)
+			*pbRetry = false;
+		return false;
+	}
+	if ((imap4.getCapability() & Imap4::CAPABILITY_IDLE) == 0) {
+		*pbRetry = false;
+		imap4.disconnect();
+		return false;
+	}
+	
+	if (!imap4.select(wstrMailbox_.get())) {
+		// The mailbox which cannot be selected won't be selected by retrying
+		if ((imap4.getLastError() & Imap4::IMAP4_ERROR_MASK_LOWLEVEL) == Imap4::IMAP4_ERROR_RESPONSE) {
+			*pbRetry = false;
+			imap4.disconnect();
+		}
+		return false;
+	}
+	
+	while (!bStop_) {
+		unsigned int nStart = ::GetTickCount();
+		unsigned int nCount = callback.getChangeCount();
+		if (!imap4.idle())
+			return false;
+		
+		// A burst of responses is notified at once after the server
+		// has been quiet for a while. It waits for them in short slices
+		// so that stop doesn't wait until IDLE times out.
+		bool bChanged = callback.getChangeCount() != nCount;
+		while (!bStop_) {
+			unsigned int nElapsed = (::GetTickCount() - nStart)/1000;
+			if (nElapsed >= nIdleTimeout_)
+				break;
+			
+			unsigned int nWait = bChanged ? QUIET_INTERVAL :
+				QSMIN(nIdleTimeout_ - nElapsed, static_cast<unsigned int>(STOP_INTERVAL));
+			nCount = callback.getChangeCount();
+			if (!imap4.waitIdle(nWait))
+				return false;
+			if (callback.getChangeCount() != nCount) {
+				bChanged = true;
+			}
+			else if (bChanged) {
+				notify();
+				bChanged = false;
+			}
+		}
+		if (bChanged)
+			notify();
+		
+		// Nothing can be sent after stop has been requested, because
+		// the socket reports that it has been canceled
+		if (bStop_)
+			return true;
+		
+		if (!imap4.done())
+			return false;
+	}
+	
+	imap4.disconnect();
+	
+	return true;
+}
+
+void qmimap4::IdleThread::notify()
+{
+	Account* pAccount = pSessionCacheManager_->getAccount();
+	
+	Lock<Account> lock(*pAccount);
+	
+	Folder* pFolder = pAccount->getFolderById(nFolderId_);
+	if (pFolder && pFolder->getType() == Folder::TYPE_NORMAL)
+		pAccount->fireRemoteFolderChanged(static_cast<NormalFolder*>(pFolder));
+}
+
+
+/****************************************************************************
+ *
+ * IdleCallback
+ *
+ */
+
+qmimap4::IdleCallback::IdleCallback(SubAccount* pSubAccount,
+									PasswordCallback* pPasswordCallback,
+									const Security* pSecurity,
+									const volatile bool* pbCanceled) :
+	AbstractCallback(pSubAccount, pPasswordCallback, pSecurity),
+	pbCanceled_(pbCanceled),
+	nChangeCount_(0)
+{
+}
+
+qmimap4::IdleCallback::~IdleCallback()
+{
+}
+
+unsigned int qmimap4::IdleCallback::getChangeCount() const
+{
+	return nChangeCount_;
+}
+
+bool qmimap4::IdleCallback::isCanceled(bool bForce) const
+{
+	return *pbCanceled_;
+}
+
+bool qmimap4::IdleCallback::response(Response* pResponse)
+{
+	switch (pResponse->getType()) {
+	case Response::TYPE_EXISTS:
+	case Response::TYPE_EXPUNGE:
+	case Response::TYPE_FETCH:
+	case Response::TYPE_VANISHED:
+		++nChangeCount_;
+		break;
+	default:
+		break;
+	}
+	return true;
+}
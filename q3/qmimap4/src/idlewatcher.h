@@ -0,0 +1,190 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#ifndef __IDLEWATCHER_H__
+#define __IDLEWATCHER_H__
+
+#include <qmaccount.h>
+
+#include <qs.h>
+#include <qsstring.h>
+#include <qsthread.h>
+
+#include <vector>
+
+#include "util.h"
+
+
+namespace qmimap4 {
+
+class IdleWatcher;
+class IdleThread;
+class IdleCallback;
+
+class SessionCacheManager;
+
+
+/****************************************************************************
+ *
+ * IdleWatcher
+ *
+ * Watch folders which are synchronized actively using IDLE command, and
+ * notify the account when the server pushes changes of them, so that they
+ * are synchronized without waiting for the next poll. Each folder is
+ * watched on its own connection, so only Imap4/IdleMaxSession folders are
+ * watched, the inbox first, not to exceed the limit of connections of
+ * the server. Watched folders follow changes of the folders, such as
+ * renaming, removing and changing their flags.
+ *
+ */
+
+class IdleWatcher : public qm::DefaultAccountHandler
+{
+public:
+	enum {
+		MAX_IDLE_TIMEOUT	= 29*60
+	};
+
+public:
+	explicit IdleWatcher(SessionCacheManager* pSessionCacheManager);
+	virtual ~IdleWatcher();
+
+public:
+	/**
+	 * Start watching folders. Folders which have been watched are stopped
+	 * first, so that this can be called again after the settings are
+	 * changed.
+	 */
+	void start();
+	
+	/**
+	 * Stop watching all the folders and wait until all the connections
+	 * are closed.
+	 */
+	void stop();
+
+public:
+	virtual void folderListChanged(const qm::FolderListChangedEvent& event);
+
+private:
+	void update();
+	void reap();
+
+private:
+	IdleWatcher(const IdleWatcher&);
+	IdleWatcher& operator=(const IdleWatcher&);
+
+private:
+	typedef std::vector<IdleThread*> ThreadList;
+
+private:
+	SessionCacheManager* pSessionCacheManager_;
+	bool bActive_;
+	ThreadList listThread_;
+	ThreadList listStoppingThread_;
+	qs::CriticalSection cs_;
+};
+
+
+/****************************************************************************
+ *
+ * IdleThread
+ *
+ */
+
+class IdleThread : public qs::Thread
+{
+public:
+	enum {
+		RETRY_INTERVAL	= 60,
+		QUIET_INTERVAL	= 1,
+		STOP_INTERVAL	= 1
+	};
+
+public:
+	IdleThread(SessionCacheManager* pSessionCacheManager,
+			   unsigned int nFolderId,
+			   const WCHAR* pwszMailbox,
+			   unsigned int nIdleTimeout);
+	virtual ~IdleThread();
+
+public:
+	unsigned int getFolderId() const;
+	const WCHAR* getMailbox() const;
+	
+	/**
+	 * Request to stop. Call join to wait until it stops. It stops within
+	 * STOP_INTERVAL seconds while it's waiting for responses of IDLE.
+	 */
+	void stop();
+	
+	/**
+	 * Check if the thread has stopped.
+	 */
+	bool isStopped() const;
+
+public:
+	virtual void run();
+
+private:
+	bool watch(bool* pbRetry);
+	void notify();
+
+private:
+	IdleThread(const IdleThread&);
+	IdleThread& operator=(const IdleThread&);
+
+private:
+	SessionCacheManager* pSessionCacheManager_;
+	unsigned int nFolderId_;
+	qs::wstring_ptr wstrMailbox_;
+	unsigned int nIdleTimeout_;
+	volatile bool bStop_;
+	qs::Event event_;
+};
+
+
+/****************************************************************************
+ *
+ * IdleCallback
+ *
+ */
+
+class IdleCallback : public AbstractCallback
+{
+public:
+	IdleCallback(qm::SubAccount* pSubAccount,
+				 qm::PasswordCallback* pPasswordCallback,
+				 const qm::Security* pSecurity,
+				 const volatile bool* pbCanceled);
+	virtual ~IdleCallback();
+
+public:
+	/**
+	 * Get the number of responses which notify changes of the selected
+	 * folder, such as EXISTS, EXPUNGE and FETCH.
+	 */
+	unsigned int getChangeCount() const;
+
+public:
+	virtual bool isCanceled(bool bForce) const;
+
+public:
+	virtual bool response(Response* pResponse);
+
+private:
+	IdleCallback(const IdleCallback&);
+	IdleCallback& operator=(const IdleCallback&);
+
+private:
+	const volatile bool* pbCanceled_;
+	unsigned int nChangeCount_;
+};
+
+}
+
+#endif // __IDLEWATCHER_H__
@@ -51,6 +51,7 @@ public:
 public:
 	const ResponseList& getResponseList() const;
 	ResponseState::Flag getResponse() const;
+	const ResponseCapability* getCapability() const;
 	void clear();
 
 public:
@@ -87,6 +88,24 @@ ResponseState::Flag qmimap4::ListParserCallback::getResponse() const
 		return static_cast<ResponseState*>(listResponse_.back())->getFlag();
 }
 
+const ResponseCapability* qmimap4::ListParserCallback::getCapability() const
+{
+	ResponseList::const_iterator it = std::find_if(listResponse_.begin(), listResponse_.end(),
+		boost::bind(&Response::getType, _1) == Response::TYPE_CAPABILITY);
+	if (it != listResponse_.end())
+		return static_cast<ResponseCapability*>(*it);
+	
+	for (it = listResponse_.begin(); it != listResponse_.end(); ++it) {
+		if ((*it)->getType() == Response::TYPE_STATE) {
+			const State* pState = static_cast<ResponseState*>(*it)->getState();
+			if (pState && pState->getCode() == State::CODE_CAPABILITY)
+				return pState->getArgCapability();
+		}
+	}
+	
+	return 0;
+}
+
 bool qmimap4::ListParserCallback::response(std::auto_ptr<Response> pResponse)
 {
 	listResponse_.push_back(pResponse.get());
@@ -170,17 +189,24 @@ qmimap4::Imap4::Imap4(long nTimeout,
 	pSSLSocketCallback_(pSSLSocketCallback),
 	pImap4Callback_(pImap4Callback),
 	pLogger_(pLogger),
+	pCompressedSocket_(0),
 	nCapability_(0),
+	nEnabled_(0),
 	nAuth_(AUTH_LOGIN),
 	bDisconnected_(false),
 	nTag_(0),
 	nError_(IMAP4_ERROR_SUCCESS),
-	utf7Converter_(true)
+	utf7Converter_(true),
+	nMaxPipeline_(0),
+	nPipelinedCount_(0),
+	nCompletedCount_(0),
+	bPipelineFailed_(false)
 {
 }
 
 qmimap4::Imap4::~Imap4()
 {
+	clearPipeline();
 }
 
 bool qmimap4::Imap4::connect(const WCHAR* pwszHost,
@@ -189,6 +215,8 @@ bool qmimap4::Imap4::connect(const WCHAR* pwszHost,
 {
 	assert(pwszHost);
 	
+	pCompressedSocket_ = 0;
+	
 	std::auto_ptr<Socket> pSocket(new Socket(
 		nTimeout_, pSocketCallback_, pLogger_));
 	
@@ -247,14 +275,27 @@ bool qmimap4::Imap4::connect(const WCHAR* pwszHost,
 			return false;
 	}
 	
-	if (!processLogin())
+	bool bCapability = false;
+	if (!processLogin(&bCapability))
 		return false;
 	
+	// Some servers advertise extensions only after authentication. Ask them
+	// unless they have been sent with the response to the login, and use
+	// the ones advertised before the login if the server refuses.
+	if (!bCapability && !processCapability()) {
+		Log log(pLogger_, L"qmimap4::Imap4");
+		log.warn(L"Failed to get capabilities after login.");
+		nError_ = IMAP4_ERROR_SUCCESS;
+	}
+	
 	return true;
 }
 
 void qmimap4::Imap4::disconnect()
 {
+	nMaxPipeline_ = 0;
+	clearPipeline();
+	
 	if (pSocket_.get() && !bDisconnected_) {
 		const CommandToken tokens[] = {
 			{ "LOGOUT\r\n",	0,	0,	false,	true	}
@@ -265,6 +306,15 @@ void qmimap4::Imap4::disconnect()
 		if (!sendCommandTokens(tokens, countof(tokens)))
 			nError_ |= IMAP4_ERROR_LOGOUT;
 	}
+	
+	if (pCompressedSocket_) {
+		Log log(pLogger_, L"qmimap4::Imap4");
+		if (log.isDebugEnabled())
+			log.debugf(L"Compressed: sent %I64u -> %I64u bytes, received %I64u -> %I64u bytes",
+				pCompressedSocket_->getSentBytes(), pCompressedSocket_->getCompressedSentBytes(),
+				pCompressedSocket_->getCompressedReceivedBytes(), pCompressedSocket_->getReceivedBytes());
+		pCompressedSocket_ = 0;
+	}
 	pSocket_.reset(0);
 }
 
@@ -625,11 +675,156 @@ bool qmimap4::Imap4::namespaceList()
 	return true;
 }
 
+bool qmimap4::Imap4::enable(Capability capability)
+{
+	const CHAR* pszCapability = 0;
+	switch (capability) {
+	case CAPABILITY_CONDSTORE:
+		pszCapability = "CONDSTORE";
+		break;
+	case CAPABILITY_QRESYNC:
+		pszCapability = "QRESYNC";
+		break;
+	default:
+		assert(false);
+		IMAP4_ERROR(IMAP4_ERROR_ENABLE | IMAP4_ERROR_OTHER);
+	}
+	
+	if ((nCapability_ & CAPABILITY_ENABLE) == 0 ||
+		(nCapability_ & capability) == 0)
+		IMAP4_ERROR(IMAP4_ERROR_ENABLE | IMAP4_ERROR_OTHER);
+	
+	string_ptr strCommand(concat("ENABLE ", pszCapability, "\r\n"));
+	ListParserCallback callback;
+	if (!sendCommand(strCommand.get(), &callback))
+		IMAP4_ERROR_OR(IMAP4_ERROR_ENABLE);
+	if (callback.getResponse() != ResponseState::FLAG_OK)
+		IMAP4_ERROR(IMAP4_ERROR_ENABLE | IMAP4_ERROR_RESPONSE);
+	
+	const ListParserCallback::ResponseList& l = callback.getResponseList();
+	for (ListParserCallback::ResponseList::const_iterator it = l.begin(); it != l.end(); ++it) {
+		if ((*it)->getType() == Response::TYPE_ENABLED &&
+			static_cast<ResponseEnabled*>(*it)->isEnabled(pszCapability)) {
+			nEnabled_ |= capability;
+			// QRESYNC implies CONDSTORE
+			if (capability == CAPABILITY_QRESYNC)
+				nEnabled_ |= CAPABILITY_CONDSTORE;
+		}
+	}
+	
+	return true;
+}
+
+bool qmimap4::Imap4::compress()
+{
+	assert(!pCompressedSocket_);
+	
+	if ((nCapability_ & CAPABILITY_COMPRESS) == 0)
+		IMAP4_ERROR(IMAP4_ERROR_COMPRESS | IMAP4_ERROR_OTHER);
+	
+	ListParserCallback callback;
+	if (!sendCommand("COMPRESS DEFLATE\r\n", &callback))
+		IMAP4_ERROR_OR(IMAP4_ERROR_COMPRESS);
+	if (callback.getResponse() != ResponseState::FLAG_OK)
+		IMAP4_ERROR(IMAP4_ERROR_COMPRESS | IMAP4_ERROR_RESPONSE);
+	
+	// Data after the tagged response must have been compressed, so it
+	// cannot be in the buffer received before compression starts
+	if (strOverBuf_.get() && *strOverBuf_.get())
+		IMAP4_ERROR(IMAP4_ERROR_COMPRESS | IMAP4_ERROR_PARSE);
+	
+	std::auto_ptr<CompressedSocket> pCompressedSocket(
+		new CompressedSocket(pSocket_.get(), true));
+	pSocket_.release();
+	pCompressedSocket_ = pCompressedSocket.get();
+	pSocket_ = pCompressedSocket;
+	
+	return true;
+}
+
+bool qmimap4::Imap4::idle()
+{
+	assert(!strIdleTag_.get());
+	
+	if ((nCapability_ & CAPABILITY_IDLE) == 0)
+		IMAP4_ERROR(IMAP4_ERROR_IDLE | IMAP4_ERROR_OTHER);
+	
+	ListParserCallback listCallback;
+	string_ptr strTag;
+	if (!sendCommand("IDLE\r\n", &strTag, &listCallback))
+		IMAP4_ERROR_OR(IMAP4_ERROR_IDLE);
+	const ListParserCallback::ResponseList& l = listCallback.getResponseList();
+	if (l.empty() || l.back()->getType() != Response::TYPE_CONTINUE)
+		IMAP4_ERROR(IMAP4_ERROR_RESPONSE | IMAP4_ERROR_IDLE);
+	for (ListParserCallback::ResponseList::size_type n = 0; n < l.size() - 1; ++n) {
+		if (!pImap4Callback_->response(l[n]))
+			return false;
+	}
+	
+	strIdleTag_ = strTag;
+	
+	return true;
+}
+
+bool qmimap4::Imap4::waitIdle(long nTimeout)
+{
+	assert(strIdleTag_.get());
+	
+	if (!pSocket_.get())
+		IMAP4_ERROR(IMAP4_ERROR_INVALIDSOCKET);
+	
+	if (!strOverBuf_.get() || !*strOverBuf_.get()) {
+		int nSelect = pSocket_->select(Socket::SELECT_READ, nTimeout);
+		if (nSelect == -1)
+			IMAP4_ERROR_SOCKET(IMAP4_ERROR_SELECTSOCKET | IMAP4_ERROR_IDLE);
+		else if (nSelect == 0)
+			return true;
+	}
+	
+	Imap4ParserCallback callback(pImap4Callback_);
+	if (!receive("", false, &callback))
+		IMAP4_ERROR_OR(IMAP4_ERROR_IDLE);
+	else if (bDisconnected_)
+		IMAP4_ERROR(IMAP4_ERROR_DISCONNECT | IMAP4_ERROR_IDLE);
+	
+	return true;
+}
+
+bool qmimap4::Imap4::done()
+{
+	assert(strIdleTag_.get());
+	
+	string_ptr strTag(strIdleTag_);
+	
+	Imap4ParserCallback callback(pImap4Callback_);
+	if (!send("DONE\r\n", strTag.get(), false, &callback))
+		IMAP4_ERROR_OR(IMAP4_ERROR_IDLE);
+	if (callback.getResponse() != ResponseState::FLAG_OK)
+		IMAP4_ERROR(IMAP4_ERROR_RESPONSE | IMAP4_ERROR_IDLE);
+	
+	return true;
+}
+
 bool qmimap4::Imap4::getFlags(const Range& range)
 {
 	return fetch(range, "(FLAGS)");
 }
 
+bool qmimap4::Imap4::getFlags(const Range& range,
+							  unsigned __int64 nChangedSince)
+{
+	assert(nEnabled_ & CAPABILITY_CONDSTORE);
+	
+	// Expunged messages are reported by VANISHED (EARLIER) responses
+	// only when QRESYNC has been enabled
+	bool bVanished = range.isUid() && (nEnabled_ & CAPABILITY_QRESYNC) != 0;
+	
+	CHAR szFetch[64];
+	_snprintf(szFetch, countof(szFetch), "(FLAGS) (CHANGEDSINCE %I64u%s)",
+		nChangedSince, bVanished ? " VANISHED" : "");
+	return fetch(range, szFetch);
+}
+
 bool qmimap4::Imap4::setFlags(const Range& range,
 							  const Flags& flags,
 							  const Flags& mask)
@@ -740,11 +935,56 @@ bool qmimap4::Imap4::getPartBody(const Range& range,
 	return fetch(range, strFetch.get());
 }
 
+void qmimap4::Imap4::beginPipeline(unsigned int nMaxCommand)
+{
+	assert(nMaxPipeline_ == 0);
+	assert(nMaxCommand != 0);
+	
+	nMaxPipeline_ = nMaxCommand;
+	nPipelinedCount_ = 0;
+	nCompletedCount_ = 0;
+	bPipelineFailed_ = false;
+}
+
+bool qmimap4::Imap4::endPipeline()
+{
+	assert(nMaxPipeline_ != 0);
+	
+	while (!listPipeline_.empty()) {
+		if (!receivePipelinedCommand()) {
+			nMaxPipeline_ = 0;
+			clearPipeline();
+			return false;
+		}
+	}
+	nMaxPipeline_ = 0;
+	
+	if (bPipelineFailed_)
+		IMAP4_ERROR(IMAP4_ERROR_RESPONSE);
+	
+	return true;
+}
+
+unsigned int qmimap4::Imap4::getPipelinedCount() const
+{
+	return nPipelinedCount_;
+}
+
+unsigned int qmimap4::Imap4::getCompletedCount() const
+{
+	return nCompletedCount_;
+}
+
 unsigned int qmimap4::Imap4::getCapability() const
 {
 	return nCapability_;
 }
 
+unsigned int qmimap4::Imap4::getEnabled() const
+{
+	return nEnabled_;
+}
+
 unsigned int qmimap4::Imap4::getLastError() const
 {
 	return nError_;
@@ -775,35 +1015,53 @@ bool qmimap4::Imap4::processGreeting()
 
 bool qmimap4::Imap4::processCapability()
 {
-	nCapability_ = 0;
-	
 	ListParserCallback callback;
 	if (!sendCommand("CAPABILITY\r\n", &callback))
 		IMAP4_ERROR_OR(IMAP4_ERROR_CAPABILITY);
 	if (callback.getResponse() != ResponseState::FLAG_OK)
 		IMAP4_ERROR(IMAP4_ERROR_CAPABILITY | IMAP4_ERROR_PARSE);
 	
-	const ListParserCallback::ResponseList& l = callback.getResponseList();
-	ListParserCallback::ResponseList::const_iterator it = std::find_if(l.begin(), l.end(),
-		boost::bind(&Response::getType, _1) == Response::TYPE_CAPABILITY);
-	if (it == l.end())
+	const ResponseCapability* pCapability = callback.getCapability();
+	if (!pCapability || !setCapability(*pCapability))
 		IMAP4_ERROR(IMAP4_ERROR_CAPABILITY | IMAP4_ERROR_PARSE);
 	
-	ResponseCapability* pCapability = static_cast<ResponseCapability*>(*it);
-	if (!pCapability->isSupport("IMAP4REV1"))
-		IMAP4_ERROR(IMAP4_ERROR_CAPABILITY | IMAP4_ERROR_PARSE);
-	if (pCapability->isSupport("NAMESPACE"))
-		nCapability_ |= CAPABILITY_NAMESPACE;
-	if (pCapability->isSupport("STARTTLS"))
-		nCapability_ |= CAPABILITY_STARTTLS;
-	if (pCapability->isSupportAuth("CRAM-MD5"))
+	return true;
+}
+
+bool qmimap4::Imap4::setCapability(const ResponseCapability& capability)
+{
+	if (!capability.isSupport("IMAP4REV1"))
+		return false;
+	
+	unsigned int nCapability = 0;
+	if (capability.isSupport("NAMESPACE"))
+		nCapability |= CAPABILITY_NAMESPACE;
+	if (capability.isSupport("STARTTLS"))
+		nCapability |= CAPABILITY_STARTTLS;
+	if (capability.isSupport("ENABLE"))
+		nCapability |= CAPABILITY_ENABLE;
+	if (capability.isSupport("CONDSTORE"))
+		nCapability |= CAPABILITY_CONDSTORE;
+	if (capability.isSupport("QRESYNC"))
+		nCapability |= CAPABILITY_QRESYNC;
+	if (capability.isSupport("IDLE"))
+		nCapability |= CAPABILITY_IDLE;
+	if (capability.isSupport("COMPRESS=DEFLATE"))
+		nCapability |= CAPABILITY_COMPRESS;
+	nCapability_ = nCapability;
+	
+	if (capability.isSupportAuth("CRAM-MD5"))
 		nAuth_ |= AUTH_CRAMMD5;
 	
 	return true;
 }
 
-bool qmimap4::Imap4::processLogin()
+bool qmimap4::Imap4::processLogin(bool* pbCapability)
 {
+	assert(pbCapability);
+	
+	*pbCapability = false;
+	
 	wstring_ptr wstrUserName;
 	wstring_ptr wstrPassword;
 	if (!pImap4Callback_->getUserInfo(&wstrUserName, &wstrPassword))
@@ -855,6 +1113,10 @@ bool qmimap4::Imap4::processLogin()
 					if (!send(bufSend.getCharArray(), strTag.get(), false, &callback))
 						IMAP4_ERROR_OR(IMAP4_ERROR_AUTHENTICATE);
 					bLogin = callback.getResponse() != ResponseState::FLAG_OK;
+					if (!bLogin) {
+						const ResponseCapability* pCapability = callback.getCapability();
+						*pbCapability = pCapability && setCapability(*pCapability);
+					}
 				}
 			}
 		}
@@ -877,6 +1139,9 @@ bool qmimap4::Imap4::processLogin()
 			IMAP4_ERROR_OR(IMAP4_ERROR_LOGIN);
 		if (callback.getResponse() != ResponseState::FLAG_OK)
 			IMAP4_ERROR(IMAP4_ERROR_RESPONSE | IMAP4_ERROR_LOGIN);
+		
+		const ResponseCapability* pCapability = callback.getCapability();
+		*pbCapability = pCapability && setCapability(*pCapability);
 	}
 	pImap4Callback_->setPassword(wstrPassword.get());
 	
@@ -889,6 +1154,16 @@ bool qmimap4::Imap4::receive(const CHAR* pszTag,
 							 bool bAcceptContinue,
 							 ParserCallback* pCallback)
 {
+	assert(pszTag);
+	return receive(pszTag, bAcceptContinue, pCallback, 0);
+}
+
+bool qmimap4::Imap4::receive(const CHAR* pszTag,
+							 bool bAcceptContinue,
+							 ParserCallback* pCallback,
+							 string_ptr* pstrTag)
+{
+	assert(pszTag || pstrTag);
 	assert(pCallback);
 	
 	if (!pSocket_.get())
@@ -918,7 +1193,9 @@ bool qmimap4::Imap4::receive(const CHAR* pszTag,
 	} callback(pCallback);
 	
 	Parser parser(&buf, pImap4Callback_);
-	if (!parser.parse(pszTag, bAcceptContinue, &callback)) {
+	bool bParsed = pszTag ? parser.parse(pszTag, bAcceptContinue, &callback) :
+		parser.parseTagged(&callback, pstrTag);
+	if (!bParsed) {
 		bDisconnected_ = true;
 		// TODO
 		// Log
@@ -950,6 +1227,7 @@ bool qmimap4::Imap4::sendCommand(const CHAR* pszCommand,
 {
 	assert(pszCommand);
 	assert(pCallback);
+	assert(nMaxPipeline_ == 0);
 	
 	if (!pSocket_.get())
 		IMAP4_ERROR(IMAP4_ERROR_INVALIDSOCKET);
@@ -991,6 +1269,18 @@ bool qmimap4::Imap4::send(const CHAR** pszContents,
 	assert(pszContents);
 	assert(pCallback);
 	
+	if (!write(pszContents, pnLen, nCount))
+		return false;
+	
+	return receive(pszTag, bAcceptContinue, pCallback);
+}
+
+bool qmimap4::Imap4::write(const CHAR** pszContents,
+						   const size_t* pnLen,
+						   size_t nCount)
+{
+	assert(pszContents);
+	
 	if (!pSocket_.get())
 		IMAP4_ERROR(IMAP4_ERROR_INVALIDSOCKET);
 	
@@ -1016,10 +1306,15 @@ bool qmimap4::Imap4::send(const CHAR** pszContents,
 		}
 	}
 	
+	// A command is written in pieces, so it's flushed at once after all
+	// of them have been written
+	if (pCompressedSocket_ && !pCompressedSocket_->flush())
+		IMAP4_ERROR_SOCKET(IMAP4_ERROR_SEND);
+	
 	// TODO
 	// Log
 	
-	return receive(pszTag, bAcceptContinue, pCallback);
+	return true;
 }
 
 bool qmimap4::Imap4::sendCommandTokens(const CommandToken* pTokens,
@@ -1064,6 +1359,9 @@ bool qmimap4::Imap4::sendCommandTokens(const CommandToken* pTokens,
 		}
 	}
 	
+	if (nMaxPipeline_ != 0)
+		return sendPipelinedCommand(buf.getCharArray());
+	
 	Imap4ParserCallback callback(pImap4Callback_);
 	if (!sendCommand(buf.getCharArray(), &callback))
 		return false;
@@ -1073,6 +1371,66 @@ bool qmimap4::Imap4::sendCommandTokens(const CommandToken* pTokens,
 	return true;
 }
 
+bool qmimap4::Imap4::sendPipelinedCommand(const CHAR* pszCommand)
+{
+	assert(pszCommand);
+	assert(nMaxPipeline_ != 0);
+	
+	while (listPipeline_.size() >= nMaxPipeline_) {
+		if (!receivePipelinedCommand())
+			return false;
+	}
+	
+	string_ptr strTag(getTag());
+	const CHAR* pszContents[] = {
+		strTag.get(),
+		" ",
+		pszCommand
+	};
+	if (!write(pszContents, 0, countof(pszContents)))
+		return false;
+	
+	listPipeline_.push_back(std::make_pair(strTag.get(), nPipelinedCount_++));
+	strTag.release();
+	
+	return true;
+}
+
+bool qmimap4::Imap4::receivePipelinedCommand()
+{
+	assert(!listPipeline_.empty());
+	
+	// The server may complete commands in a different order from the order
+	// in which they were sent, so find the command by its tag
+	Imap4ParserCallback callback(pImap4Callback_);
+	string_ptr strTag;
+	if (!receive(0, false, &callback, &strTag))
+		return false;
+	
+	PipelineList::iterator it = std::find_if(
+		listPipeline_.begin(), listPipeline_.end(),
+		boost::bind(string_equal<CHAR>(),
+			boost::bind(&PipelineList::value_type::first, _1), strTag.get()));
+	if (it == listPipeline_.end())
+		IMAP4_ERROR(IMAP4_ERROR_PARSE);
+	freeString((*it).first);
+	listPipeline_.erase(it);
+	
+	if (callback.getResponse() != ResponseState::FLAG_OK)
+		bPipelineFailed_ = true;
+	
+	nCompletedCount_ = listPipeline_.empty() ? nPipelinedCount_ : listPipeline_.front().second;
+	
+	return true;
+}
+
+void qmimap4::Imap4::clearPipeline()
+{
+	for (PipelineList::iterator it = listPipeline_.begin(); it != listPipeline_.end(); ++it)
+		freeString((*it).first);
+	listPipeline_.clear();
+}
+
 string_ptr qmimap4::Imap4::getTag()
 {
 	string_ptr strTag(allocString(32));
@@ -1637,6 +1995,39 @@ const State* qmimap4::ResponseContinue::getState() const
 }
 
 
+/****************************************************************************
+ *
+ * ResponseEnabled
+ *
+ */
+
+qmimap4::ResponseEnabled::ResponseEnabled() :
+	Response(TYPE_ENABLED)
+{
+}
+
+qmimap4::ResponseEnabled::~ResponseEnabled()
+{
+	std::for_each(listCapability_.begin(), listCapability_.end(), &freeString);
+}
+
+bool qmimap4::ResponseEnabled::isEnabled(const CHAR* pszCapability) const
+{
+	return std::find_if(listCapability_.begin(), listCapability_.end(),
+		std::bind2nd(string_equal_i<CHAR>(), pszCapability)) != listCapability_.end();
+}
+
+void qmimap4::ResponseEnabled::add(const CHAR* psz,
+								   size_t nLen)
+{
+	assert(psz);
+	
+	string_ptr str(allocString(psz, nLen));
+	listCapability_.push_back(str.get());
+	str.release();
+}
+
+
 /****************************************************************************
  *
  * ResponseExists
@@ -1838,6 +2229,23 @@ std::auto_ptr<ResponseFetch> qmimap4::ResponseFetch::create(unsigned int nNumber
 				return std::auto_ptr<ResponseFetch>(0);
 			}
 			break;
+		case L'M':
+		case L'm':
+			if (TokenUtil::isEqualIgnoreCase(name, "MODSEQ")) {
+				// MODSEQ
+				if (l[n + 1]->getType() != ListItem::TYPE_LIST)
+					return std::auto_ptr<ResponseFetch>(0);
+				
+				std::auto_ptr<FetchDataModSeq> pModSeq(
+					FetchDataModSeq::create(static_cast<List*>(l[n + 1])));
+				if (!pModSeq.get())
+					return std::auto_ptr<ResponseFetch>(0);
+				listData.push_back(pModSeq.release());
+			}
+			else {
+				return std::auto_ptr<ResponseFetch>(0);
+			}
+			break;
 		case L'R':
 		case L'r':
 			if (TokenUtil::isEqualIgnoreCase(name, "RFC822") ||
@@ -2323,6 +2731,78 @@ std::auto_ptr<ResponseStatus> qmimap4::ResponseStatus::create(const CHAR* pszMai
 }
 
 
+/****************************************************************************
+ *
+ * ResponseVanished
+ *
+ */
+
+qmimap4::ResponseVanished::ResponseVanished(bool bEarlier,
+											UidList& listUid) :
+	Response(TYPE_VANISHED),
+	bEarlier_(bEarlier)
+{
+	listUid_.swap(listUid);
+}
+
+qmimap4::ResponseVanished::~ResponseVanished()
+{
+}
+
+bool qmimap4::ResponseVanished::isEarlier() const
+{
+	return bEarlier_;
+}
+
+const ResponseVanished::UidList& qmimap4::ResponseVanished::getUids() const
+{
+	return listUid_;
+}
+
+bool qmimap4::ResponseVanished::contains(unsigned int nUid) const
+{
+	UidList::const_iterator it = std::lower_bound(listUid_.begin(),
+		listUid_.end(), std::make_pair(nUid, static_cast<unsigned int>(-1)));
+	if (it != listUid_.end() && (*it).first == nUid)
+		return true;
+	return it != listUid_.begin() && nUid <= (*(it - 1)).second;
+}
+
+std::auto_ptr<ResponseVanished> qmimap4::ResponseVanished::create(bool bEarlier,
+																  const CHAR* pszUids,
+																  size_t nUidsLen)
+{
+	assert(pszUids);
+	
+	UidList listUid;
+	
+	const CHAR* p = pszUids;
+	const CHAR* pEnd = pszUids + nUidsLen;
+	while (p < pEnd) {
+		const CHAR* pSep = std::find(p, pEnd, ',');
+		const CHAR* pColon = std::find(p, pSep, ':');
+		
+		unsigned int nBegin = 0;
+		if (!TokenUtil::string2number(std::make_pair(p, static_cast<size_t>(pColon - p)), &nBegin))
+			return std::auto_ptr<ResponseVanished>(0);
+		unsigned int nEnd = nBegin;
+		if (pColon != pSep) {
+			if (!TokenUtil::string2number(std::make_pair(pColon + 1,
+				static_cast<size_t>(pSep - pColon - 1)), &nEnd))
+				return std::auto_ptr<ResponseVanished>(0);
+			if (nEnd < nBegin)
+				std::swap(nBegin, nEnd);
+		}
+		listUid.push_back(std::make_pair(nBegin, nEnd));
+		
+		p = pSep == pEnd ? pEnd : pSep + 1;
+	}
+	std::sort(listUid.begin(), listUid.end());
+	
+	return std::auto_ptr<ResponseVanished>(new ResponseVanished(bEarlier, listUid));
+}
+
+
 /****************************************************************************
  *
  * FetchData
@@ -3308,6 +3788,43 @@ std::auto_ptr<FetchDataInternalDate> qmimap4::FetchDataInternalDate::create(cons
 }
 
 
+/****************************************************************************
+ *
+ * FetchDataModSeq
+ *
+ */
+
+qmimap4::FetchDataModSeq::FetchDataModSeq(unsigned __int64 nModSeq) :
+	FetchData(TYPE_MODSEQ),
+	nModSeq_(nModSeq)
+{
+}
+
+qmimap4::FetchDataModSeq::~FetchDataModSeq()
+{
+}
+
+unsigned __int64 qmimap4::FetchDataModSeq::getModSeq() const
+{
+	return nModSeq_;
+}
+
+std::auto_ptr<FetchDataModSeq> qmimap4::FetchDataModSeq::create(List* pList)
+{
+	const List::ItemList& l = pList->getList();
+	if (l.size() != 1 || l[0]->getType() != ListItem::TYPE_TEXT)
+		return std::auto_ptr<FetchDataModSeq>(0);
+	
+	std::pair<const CHAR*, size_t> modseq(
+		static_cast<ListItemText*>(l[0])->getText().get());
+	unsigned __int64 nModSeq = 0;
+	if (!TokenUtil::string2number(modseq, &nModSeq))
+		return std::auto_ptr<FetchDataModSeq>(0);
+	
+	return std::auto_ptr<FetchDataModSeq>(new FetchDataModSeq(nModSeq));
+}
+
+
 /****************************************************************************
  *
  * FetchDataSize
@@ -3513,6 +4030,11 @@ const CHAR* qmimap4::State::getMessage() const
 }
 
 unsigned int qmimap4::State::getArgNumber() const
+{
+	return static_cast<unsigned int>(n_);
+}
+
+unsigned __int64 qmimap4::State::getArgNumber64() const
 {
 	return n_;
 }
@@ -3522,6 +4044,11 @@ const List* qmimap4::State::getArgList() const
 	return pList_.get();
 }
 
+const ResponseCapability* qmimap4::State::getArgCapability() const
+{
+	return pCapability_.get();
+}
+
 void qmimap4::State::setMessage(string_ptr str)
 {
 	strMessage_ = str;
@@ -3532,7 +4059,17 @@ void qmimap4::State::setArg(unsigned int n)
 	n_ = n;
 }
 
+void qmimap4::State::setArg64(unsigned __int64 n)
+{
+	n_ = n;
+}
+
 void qmimap4::State::setArg(std::auto_ptr<List> pList)
 {
 	pList_ = pList;
 }
+
+void qmimap4::State::setArg(std::auto_ptr<ResponseCapability> pCapability)
+{
+	pCapability_ = pCapability;
+}
@@ -35,6 +35,7 @@ class PartPath;
 class Response;
 	class ResponseCapability;
 	class ResponseContinue;
+	class ResponseEnabled;
 	class ResponseExists;
 	class ResponseExpunge;
 	class ResponseFetch;
@@ -45,12 +46,14 @@ class Response;
 	class ResponseSearch;
 	class ResponseState;
 	class ResponseStatus;
+	class ResponseVanished;
 class FetchData;
 	class FetchDataBody;
 	class FetchDataBodyStructure;
 	class FetchDataEnvelope;
 	class FetchDataFlags;
 	class FetchDataInternalDate;
+	class FetchDataModSeq;
 	class FetchDataSize;
 class EnvelopeAddress;
 class ListItem;
@@ -114,6 +117,9 @@ public:
 		IMAP4_ERROR_NAMESPACE		= 0x00001500,
 		IMAP4_ERROR_LOGOUT			= 0x00001600,
 		IMAP4_ERROR_STARTTLS		= 0x00001700,
+		IMAP4_ERROR_ENABLE			= 0x00001800,
+		IMAP4_ERROR_IDLE			= 0x00001900,
+		IMAP4_ERROR_COMPRESS		= 0x00001a00,
 		IMAP4_ERROR_MASK_HIGHLEVEL	= 0x0000ff00
 	};
 	
@@ -129,7 +135,12 @@ public:
 	
 	enum Capability {
 		CAPABILITY_NAMESPACE	= 0x0001,
-		CAPABILITY_STARTTLS		= 0x0002
+		CAPABILITY_STARTTLS		= 0x0002,
+		CAPABILITY_ENABLE		= 0x0004,
+		CAPABILITY_CONDSTORE	= 0x0008,
+		CAPABILITY_QRESYNC		= 0x0010,
+		CAPABILITY_IDLE			= 0x0020,
+		CAPABILITY_COMPRESS		= 0x0040
 	};
 	
 	enum Auth {
@@ -193,8 +204,15 @@ public:
 	bool subscribe(const WCHAR* pwszFolderName);
 	bool unsubscribe(const WCHAR* pwszFolderName);
 	bool namespaceList();
+	bool enable(Capability capability);
+	bool compress();
+	bool idle();
+	bool waitIdle(long nTimeout);
+	bool done();
 	
 	bool getFlags(const Range& range);
+	bool getFlags(const Range& range,
+				  unsigned __int64 nChangedSince);
 	bool setFlags(const Range& range,
 				  const Flags& flags,
 				  const Flags& mask);
@@ -215,7 +233,40 @@ public:
 	bool getPartBody(const Range& range,
 					 const PartPath& path);
 	
+	/**
+	 * Start pipelining commands. While pipelining, commands which don't
+	 * need a continuation are sent without waiting for their completions,
+	 * and up to nMaxCommand commands are in flight. Their untagged
+	 * responses are passed to the callback as usual, but the methods
+	 * return as soon as the commands are sent.
+	 *
+	 * @param nMaxCommand [in] The maximum number of commands in flight.
+	 */
+	void beginPipeline(unsigned int nMaxCommand);
+	
+	/**
+	 * Wait for completions of all the commands in flight and stop
+	 * pipelining.
+	 *
+	 * @return true if all the commands completed with OK, false otherwise.
+	 *         The low level error is IMAP4_ERROR_RESPONSE when all the
+	 *         commands completed but some of them failed.
+	 */
+	bool endPipeline();
+	
+	/**
+	 * Get the number of commands sent since the pipelining started.
+	 */
+	unsigned int getPipelinedCount() const;
+	
+	/**
+	 * Get the number of leading commands which have completed since
+	 * the pipelining started.
+	 */
+	unsigned int getCompletedCount() const;
+	
 	unsigned int getCapability() const;
+	unsigned int getEnabled() const;
 	
 	unsigned int getLastError() const;
 	const WCHAR* getLastErrorResponse() const;
@@ -223,10 +274,15 @@ public:
 private:
 	bool processGreeting();
 	bool processCapability();
-	bool processLogin();
+	bool processLogin(bool* pbCapability);
+	bool setCapability(const ResponseCapability& capability);
 	bool receive(const CHAR* pszTag,
 				 bool bAcceptContinue,
 				 ParserCallback* pCallback);
+	bool receive(const CHAR* pszTag,
+				 bool bAcceptContinue,
+				 ParserCallback* pCallback,
+				 qs::string_ptr* pstrTag);
 	bool sendCommand(const CHAR* pszCommand,
 					 ParserCallback* pCallback);
 	bool sendCommand(const CHAR* pszCommand,
@@ -242,8 +298,14 @@ private:
 			  const CHAR* pszTag,
 			  bool bAcceptContinue,
 			  ParserCallback* pCallback);
+	bool write(const CHAR** pszContents,
+			   const size_t* pnLen,
+			   size_t nCount);
 	bool sendCommandTokens(const CommandToken* pTokens,
 						   size_t nCount);
+	bool sendPipelinedCommand(const CHAR* pszCommand);
+	bool receivePipelinedCommand();
+	void clearPipeline();
 	qs::string_ptr getTag();
 	unsigned int getAuthMethods();
 
@@ -265,6 +327,8 @@ private:
 		bool bQuote_;
 		bool b_;
 	};
+	
+	typedef std::vector<std::pair<qs::STRING, unsigned int> > PipelineList;
 
 private:
 	long nTimeout_;
@@ -273,13 +337,21 @@ private:
 	Imap4Callback* pImap4Callback_;
 	qs::Logger* pLogger_;
 	std::auto_ptr<qs::SocketBase> pSocket_;
+	qs::CompressedSocket* pCompressedSocket_;
 	qs::string_ptr strOverBuf_;
+	qs::string_ptr strIdleTag_;
 	unsigned int nCapability_;
+	unsigned int nEnabled_;
 	unsigned int nAuth_;
 	bool bDisconnected_;
 	unsigned int nTag_;
 	unsigned int nError_;
 	qs::UTF7Converter utf7Converter_;
+	unsigned int nMaxPipeline_;
+	PipelineList listPipeline_;
+	unsigned int nPipelinedCount_;
+	unsigned int nCompletedCount_;
+	bool bPipelineFailed_;
 };
 
 
@@ -519,6 +591,7 @@ public:
 	enum Type {
 		TYPE_CAPABILITY,
 		TYPE_CONTINUE,
+		TYPE_ENABLED,
 		TYPE_EXISTS,
 		TYPE_EXPUNGE,
 		TYPE_FETCH,
@@ -528,7 +601,8 @@ public:
 		TYPE_RECENT,
 		TYPE_SEARCH,
 		TYPE_STATE,
-		TYPE_STATUS
+		TYPE_STATUS,
+		TYPE_VANISHED
 	};
 
 protected:
@@ -606,6 +680,37 @@ private:
 };
 
 
+/****************************************************************************
+ *
+ * ResponseEnabled
+ *
+ */
+
+class ResponseEnabled : public Response
+{
+public:
+	ResponseEnabled();
+	virtual ~ResponseEnabled();
+
+public:
+	bool isEnabled(const CHAR* pszCapability) const;
+
+public:
+	void add(const CHAR* psz,
+			 size_t nLen);
+
+private:
+	ResponseEnabled(const ResponseEnabled&);
+	ResponseEnabled& operator=(const ResponseEnabled&);
+
+private:
+	typedef std::vector<qs::STRING> CapabilityList;
+
+private:
+	CapabilityList listCapability_;
+};
+
+
 /****************************************************************************
  *
  * ResponseExists
@@ -949,6 +1054,46 @@ private:
 };
 
 
+/****************************************************************************
+ *
+ * ResponseVanished
+ *
+ * Represents UIDs of expunged messages sent by a server which supports
+ * QRESYNC instead of EXPUNGE responses. EARLIER is set when the response
+ * is a reply for UID FETCH with VANISHED modifier.
+ *
+ */
+
+class ResponseVanished : public Response
+{
+public:
+	typedef std::vector<std::pair<unsigned int, unsigned int> > UidList;
+
+public:
+	ResponseVanished(bool bEarlier,
+					 UidList& listUid);
+	virtual ~ResponseVanished();
+
+public:
+	bool isEarlier() const;
+	const UidList& getUids() const;
+	bool contains(unsigned int nUid) const;
+
+public:
+	static std::auto_ptr<ResponseVanished> create(bool bEarlier,
+												  const CHAR* pszUids,
+												  size_t nUidsLen);
+
+private:
+	ResponseVanished(const ResponseVanished&);
+	ResponseVanished& operator=(const ResponseVanished&);
+
+private:
+	bool bEarlier_;
+	UidList listUid_;
+};
+
+
 /****************************************************************************
  *
  * FetchData
@@ -964,6 +1109,7 @@ public:
 		TYPE_ENVELOPE,
 		TYPE_FLAGS,
 		TYPE_INTERNALDATE,
+		TYPE_MODSEQ,
 		TYPE_SIZE
 	};
 
@@ -1235,6 +1381,33 @@ private:
 };
 
 
+/****************************************************************************
+ *
+ * FetchDataModSeq
+ *
+ */
+
+class FetchDataModSeq : public FetchData
+{
+public:
+	FetchDataModSeq(unsigned __int64 nModSeq);
+	virtual ~FetchDataModSeq();
+
+public:
+	unsigned __int64 getModSeq() const;
+
+public:
+	static std::auto_ptr<FetchDataModSeq> create(List* pList);
+
+private:
+	FetchDataModSeq(const FetchDataModSeq&);
+	FetchDataModSeq& operator=(const FetchDataModSeq&);
+
+private:
+	unsigned __int64 nModSeq_;
+};
+
+
 /****************************************************************************
  *
  * FetchDataSize
@@ -1420,6 +1593,9 @@ public:
 		CODE_UIDVALIDITY,
 		CODE_UNSEEN,
 		CODE_UIDNEXT,
+		CODE_HIGHESTMODSEQ,
+		CODE_NOMODSEQ,
+		CODE_CAPABILITY,
 		CODE_OTHER
 	};
 
@@ -1431,12 +1607,16 @@ public:
 	Code getCode() const;
 	const CHAR* getMessage() const;
 	unsigned int getArgNumber() const;
+	unsigned __int64 getArgNumber64() const;
 	const List* getArgList() const;
+	const ResponseCapability* getArgCapability() const;
 
 public:
 	void setMessage(qs::string_ptr str);
 	void setArg(unsigned int n);
+	void setArg64(unsigned __int64 n);
 	void setArg(std::auto_ptr<List> pList);
+	void setArg(std::auto_ptr<ResponseCapability> pCapability);
 	
 private:
 	State(const State&);
@@ -1445,8 +1625,9 @@ private:
 private:
 	Code code_;
 	qs::string_ptr strMessage_;
-	unsigned int n_;
+	unsigned __int64 n_;
 	std::auto_ptr<List> pList_;
+	std::auto_ptr<ResponseCapability> pCapability_;
 };
 
 }
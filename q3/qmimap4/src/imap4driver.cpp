@@ -19,6 +19,7 @@
 
 #include <boost/bind.hpp>
 
+#include "idlewatcher.h"
 #include "imap4driver.h"
 #include "offlinejob.h"
 #include "option.h"
@@ -62,7 +63,8 @@ using namespace qs;
 const unsigned int qmimap4::Imap4Driver::nSupport__ =
 	Account::SUPPORT_REMOTEFOLDER |
 	Account::SUPPORT_DELETEDMESSAGE |
-	Account::SUPPORT_JUNKFILTER;
+	Account::SUPPORT_JUNKFILTER |
+	Account::SUPPORT_PARALLELSYNC;
 
 const WCHAR* qmimap4::Imap4Driver::pwszParamNames__[] = {
 	L"To"
@@ -77,11 +79,13 @@ qmimap4::Imap4Driver::Imap4Driver(Account* pAccount,
 {
 	pSessionCacheManager_.reset(new SessionCacheManager(
 		pAccount, pSecurity, pPasswordCallback, pErrorCallback));
+	pIdleWatcher_.reset(new IdleWatcher(pSessionCacheManager_.get()));
 	pOfflineJobManager_.reset(new OfflineJobManager(pAccount_->getPath()));
 }
 
 qmimap4::Imap4Driver::~Imap4Driver()
 {
+	pIdleWatcher_->stop();
 }
 
 bool qmimap4::Imap4Driver::save(bool bForce)
@@ -98,13 +102,26 @@ bool qmimap4::Imap4Driver::isSupport(Account::Support support)
 
 void qmimap4::Imap4Driver::setOffline(bool bOffline)
 {
+	if (bOffline == pSessionCacheManager_->isOffline())
+		return;
+	
+	pIdleWatcher_->stop();
 	pSessionCacheManager_->setOffline(bOffline);
+	if (!bOffline)
+		pIdleWatcher_->start();
 }
 
 void qmimap4::Imap4Driver::setSubAccount(SubAccount* pSubAccount)
 {
+	bool bChanged = pSubAccount != pSessionCacheManager_->getSubAccount();
+	if (bChanged)
+		pIdleWatcher_->stop();
+	
 	pSessionCacheManager_->setSubAccount(pSubAccount);
 	nOption_ = pSubAccount->getPropertyInt(L"Imap4", L"Option");
+	
+	if (bChanged && !pSessionCacheManager_->isOffline())
+		pIdleWatcher_->start();
 }
 
 std::auto_ptr<NormalFolder> qmimap4::Imap4Driver::createFolder(const WCHAR* pwszName,
@@ -1990,6 +2007,15 @@ std::auto_ptr<Session> qmimap4::SessionCacheManager::getSessionWithoutSelect(Nor
 			return std::auto_ptr<Session>();
 		}
 		
+		if (pSubAccount_->getPropertyInt(L"Imap4", L"Compress") &&
+			pImap4->getCapability() & Imap4::CAPABILITY_COMPRESS &&
+			!pImap4->compress() &&
+			(pImap4->getLastError() & Imap4::IMAP4_ERROR_MASK_LOWLEVEL) != Imap4::IMAP4_ERROR_RESPONSE) {
+			Util::reportError(pImap4.get(), pErrorCallback_, pAccount_, pSubAccount_, pFolder,
+				0, pCallback->getErrorMessage(), pCallback->getSSLErrorMessage().get());
+			return std::auto_ptr<Session>();
+		}
+		
 		pSession.reset(new Session(pFolder, pLogger, pCallback, pImap4, 0, nValidity_));
 		*pbNew = true;
 	}
@@ -30,6 +30,7 @@ class Session;
 class ThreadSession;
 class SessionCacheManager;
 class SessionCache;
+class IdleWatcher;
 
 class OfflineJobManager;
 
@@ -113,6 +114,7 @@ private:
 private:
 	qm::Account* pAccount_;
 	std::auto_ptr<SessionCacheManager> pSessionCacheManager_;
+	std::auto_ptr<IdleWatcher> pIdleWatcher_;
 	std::auto_ptr<OfflineJobManager> pOfflineJobManager_;
 	unsigned int nOption_;
 
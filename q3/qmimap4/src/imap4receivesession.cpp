@@ -62,6 +62,7 @@ qmimap4::Imap4ReceiveSession::Imap4ReceiveSession() :
 	pProcessHook_(0),
 	nExists_(0),
 	nUidValidity_(0),
+	nHighestModSeq_(0),
 	bReadOnly_(false),
 	nUidStart_(0),
 	nIdStart_(0),
@@ -118,6 +119,24 @@ bool qmimap4::Imap4ReceiveSession::connect()
 		pSubAccount_->getPort(Account::HOST_RECEIVE), secure))
 		HANDLE_ERROR_SSL();
 	
+	if (pSubAccount_->getPropertyInt(L"Imap4", L"Compress") &&
+		pImap4_->getCapability() & Imap4::CAPABILITY_COMPRESS) {
+		if (!pImap4_->compress()) {
+			if ((pImap4_->getLastError() & Imap4::IMAP4_ERROR_MASK_LOWLEVEL) != Imap4::IMAP4_ERROR_RESPONSE)
+				HANDLE_ERROR();
+			log.warn(L"Failed to compress the connection.");
+		}
+	}
+	
+	const unsigned int nQResync = Imap4::CAPABILITY_ENABLE | Imap4::CAPABILITY_QRESYNC;
+	if ((pImap4_->getCapability() & nQResync) == nQResync) {
+		if (!pImap4_->enable(Imap4::CAPABILITY_QRESYNC)) {
+			if ((pImap4_->getLastError() & Imap4::IMAP4_ERROR_MASK_LOWLEVEL) != Imap4::IMAP4_ERROR_RESPONSE)
+				HANDLE_ERROR();
+			log.warn(L"Failed to enable QRESYNC.");
+		}
+	}
+	
 	log.debug(L"Connected to the server.");
 	
 	return true;
@@ -151,6 +170,7 @@ bool qmimap4::Imap4ReceiveSession::selectFolder(NormalFolder* pFolder,
 	
 	pFolder_ = 0;
 	bSync_ = false;
+	nHighestModSeq_ = 0;
 	
 	if (!pImap4_->select(wstrName.get()))
 		HANDLE_ERROR();
@@ -222,6 +242,10 @@ bool qmimap4::Imap4ReceiveSession::updateMessages()
 			return false;
 	}
 	
+	// HIGHESTMODSEQ may be updated while synchronizing, but the value
+	// returned by SELECT is saved so as not to miss any change
+	unsigned __int64 nHighestModSeq = nHighestModSeq_;
+	
 	if (nUidStart_ != 0) {
 		struct UpdateFlagsProcessHook : public DefaultProcessHook
 		{
@@ -289,29 +313,59 @@ bool qmimap4::Imap4ReceiveSession::updateMessages()
 			ReceiveSessionCallback* pSessionCallback_;
 			MessageInfoList listMessageInfo_;
 			unsigned int nLastId_;
-		} hook(nUidStart_, pSessionCallback_);
+		};
 		
-		if (nExists_ != 0) {
-			Hook h(this, &hook);
-			ContinuousRange range(1, nUidStart_, true);
-			if (!pImap4_->getFlags(range)) {
-				// Because some servers return NO response when I try
-				// getting flags of UID that doesn't exist, I ignore this.
-				if ((pImap4_->getLastError() & Imap4::IMAP4_ERROR_MASK_LOWLEVEL) != Imap4::IMAP4_ERROR_RESPONSE)
-					HANDLE_ERROR();
+		bool bSynchronized = false;
+		unsigned __int64 nModSeq = pFolder_->getHighestModSeq();
+		if ((pImap4_->getEnabled() & Imap4::CAPABILITY_QRESYNC) &&
+			nModSeq != 0 && nHighestModSeq != 0 && nExists_ != 0) {
+			// Get only flags changed since the last synchronization.
+			// Messages expunged since then are reported by VANISHED (EARLIER)
+			// responses and removed in processVanishedResponse.
+			bool bFetched = true;
+			if (nModSeq != nHighestModSeq) {
+				UpdateFlagsProcessHook hook(nUidStart_, pSessionCallback_);
+				Hook h(this, &hook);
+				ContinuousRange range(1, nUidStart_, true);
+				if (!pImap4_->getFlags(range, nModSeq)) {
+					if ((pImap4_->getLastError() & Imap4::IMAP4_ERROR_MASK_LOWLEVEL) != Imap4::IMAP4_ERROR_RESPONSE)
+						HANDLE_ERROR();
+					bFetched = false;
+				}
+				else if (!pFolder_->updateMessageFlags(hook.listMessageInfo_)) {
+					return false;
+				}
 			}
-			pSessionCallback_->setPos(hook.nLastId_);
+			if (bFetched && !checkSynchronized(&nIdStart_, &bSynchronized))
+				return false;
 		}
 		
-		bool bClear = false;
-		if (!pFolder_->updateMessageInfos(hook.listMessageInfo_, true, &bClear))
-			return false;
-		if (bClear)
-			nUidStart_ = 0;
-		else
-			nIdStart_ = hook.nLastId_;
+		if (!bSynchronized) {
+			UpdateFlagsProcessHook hook(nUidStart_, pSessionCallback_);
+			if (nExists_ != 0) {
+				Hook h(this, &hook);
+				ContinuousRange range(1, nUidStart_, true);
+				if (!pImap4_->getFlags(range)) {
+					// Because some servers return NO response when I try
+					// getting flags of UID that doesn't exist, I ignore this.
+					if ((pImap4_->getLastError() & Imap4::IMAP4_ERROR_MASK_LOWLEVEL) != Imap4::IMAP4_ERROR_RESPONSE)
+						HANDLE_ERROR();
+				}
+				pSessionCallback_->setPos(hook.nLastId_);
+			}
+			
+			bool bClear = false;
+			if (!pFolder_->updateMessageInfos(hook.listMessageInfo_, true, &bClear))
+				return false;
+			if (bClear)
+				nUidStart_ = 0;
+			else
+				nIdStart_ = hook.nLastId_;
+		}
 	}
 	
+	pFolder_->setHighestModSeq(nHighestModSeq);
+	
 	pSessionCallback_->setPos(nIdStart_);
 	
 	++nUidStart_;
@@ -537,8 +591,6 @@ bool qmimap4::Imap4ReceiveSession::downloadMessages(const SyncFilterSet* pSyncFi
 			}
 			nFlags |= MessageHolder::FLAG_INDEXONLY;
 			
-			Lock<Account> lock(*pAccount_);
-			
 			MessageHolder* pmh = pAccount_->storeMessage(pFolder_, buf.getCharArray(),
 				buf.getLength(), &msg, nUid, nFlags, wstrLabel.get(), nSize,
 				Account::STOREFLAG_INDEXONLY | Account::OPFLAG_BACKGROUND, 0);
@@ -995,7 +1047,8 @@ bool qmimap4::Imap4ReceiveSession::applyOfflineJobs()
 	
 	Imap4Driver* pDriver = static_cast<Imap4Driver*>(pAccount_->getProtocolDriver());
 	OfflineJobManager* pManager = pDriver->getOfflineJobManager();
-	if (!pManager->apply(pAccount_, pImap4_.get(), pSessionCallback_))
+	unsigned int nPipeline = pSubAccount_->getPropertyInt(L"Imap4", L"Pipeline");
+	if (!pManager->apply(pAccount_, pImap4_.get(), nPipeline, pSessionCallback_))
 		return false;
 	
 	return true;
@@ -1358,6 +1411,62 @@ bool qmimap4::Imap4ReceiveSession::applyRules(const MessageDataList& l,
 		pSubAccount_, pDocument_, pProfile_, nFlags, &callback);
 }
 
+bool qmimap4::Imap4ReceiveSession::checkSynchronized(unsigned int* pnCount,
+													 bool* pbSynchronized)
+{
+	assert(pnCount);
+	assert(pbSynchronized);
+	
+	*pbSynchronized = false;
+	
+	unsigned int nCount = 0;
+	unsigned int nLastUid = 0;
+	{
+		Lock<Account> lock(*pAccount_);
+		nCount = pFolder_->getCount();
+		if (nCount != 0)
+			nLastUid = pFolder_->getMessage(nCount - 1)->getId();
+	}
+	if (nCount > nExists_)
+		return true;
+	
+	// All the local messages exist on the server. So if the last local
+	// message is at the same position on the server, there is no message
+	// on the server which is not in the local folder before it.
+	if (nCount != 0) {
+		struct UidProcessHook : public DefaultProcessHook
+		{
+			UidProcessHook(unsigned int nId) :
+				nId_(nId),
+				nUid_(0)
+			{
+			}
+			
+			virtual Result processFetchResponse(ResponseFetch* pFetch)
+			{
+				if (pFetch->getNumber() == nId_)
+					nUid_ = pFetch->getUid();
+				return RESULT_PROCESSED;
+			}
+			
+			unsigned int nId_;
+			unsigned int nUid_;
+		} hook(nCount);
+		
+		Hook h(this, &hook);
+		SingleRange range(nCount, false);
+		if (!pImap4_->fetch(range, "(UID)"))
+			HANDLE_ERROR();
+		if (hook.nUid_ != nLastUid)
+			return true;
+	}
+	
+	*pnCount = nCount;
+	*pbSynchronized = true;
+	
+	return true;
+}
+
 bool qmimap4::Imap4ReceiveSession::processCapabilityResponse(ResponseCapability* pCapability)
 {
 	return true;
@@ -1368,6 +1477,11 @@ bool qmimap4::Imap4ReceiveSession::processContinueResponse(ResponseContinue* pCo
 	return true;
 }
 
+bool qmimap4::Imap4ReceiveSession::processEnabledResponse(ResponseEnabled* pEnabled)
+{
+	return true;
+}
+
 bool qmimap4::Imap4ReceiveSession::processExistsResponse(ResponseExists* pExists)
 {
 	nExists_ = pExists->getExists();
@@ -1462,6 +1576,14 @@ bool qmimap4::Imap4ReceiveSession::processStateResponse(ResponseState* pState)
 				break;
 			case State::CODE_UIDNEXT:
 				break;
+			case State::CODE_HIGHESTMODSEQ:
+				nHighestModSeq_ = p->getArgNumber64();
+				break;
+			case State::CODE_NOMODSEQ:
+				nHighestModSeq_ = 0;
+				break;
+			case State::CODE_CAPABILITY:
+				break;
 			case State::CODE_OTHER:
 				break;
 			default:
@@ -1482,6 +1604,29 @@ bool qmimap4::Imap4ReceiveSession::processStatusResponse(ResponseStatus* pStatus
 	return true;
 }
 
+bool qmimap4::Imap4ReceiveSession::processVanishedResponse(ResponseVanished* pVanished)
+{
+	// Unlike EXPUNGE responses, messages are specified by UIDs here,
+	// so they can be removed whenever the folder is selected
+	if (pFolder_) {
+		Lock<Account> lock(*pAccount_);
+		
+		if (!pFolder_->loadMessageHolders())
+			return false;
+		
+		MessageHolderList l;
+		unsigned int nCount = pFolder_->getCount();
+		for (unsigned int n = 0; n < nCount; ++n) {
+			MessageHolder* pmh = pFolder_->getMessage(n);
+			if (pVanished->contains(pmh->getId()))
+				l.push_back(pmh);
+		}
+		if (!l.empty() && !pAccount_->unstoreMessages(l, 0))
+			return false;
+	}
+	return true;
+}
+
 
 /****************************************************************************
  *
@@ -1571,6 +1716,7 @@ bool qmimap4::Imap4ReceiveSession::CallbackImpl::response(Response* pResponse)
 	BEGIN_PROCESS_RESPONSE()
 		PROCESS_RESPONSE(TYPE_CAPABILITY, Capability)
 		PROCESS_RESPONSE(TYPE_CONTINUE, Continue)
+		PROCESS_RESPONSE(TYPE_ENABLED, Enabled)
 		PROCESS_RESPONSE(TYPE_EXISTS, Exists)
 		PROCESS_RESPONSE(TYPE_EXPUNGE, Expunge)
 		PROCESS_RESPONSE(TYPE_FETCH, Fetch)
@@ -1581,6 +1727,7 @@ bool qmimap4::Imap4ReceiveSession::CallbackImpl::response(Response* pResponse)
 		PROCESS_RESPONSE(TYPE_SEARCH, Search)
 		PROCESS_RESPONSE(TYPE_STATE, State)
 		PROCESS_RESPONSE(TYPE_STATUS, Status)
+		PROCESS_RESPONSE(TYPE_VANISHED, Vanished)
 	END_PROCESS_RESPONSE()
 	
 	return true;
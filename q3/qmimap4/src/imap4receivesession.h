@@ -73,6 +73,8 @@ public:
 
 private:
 	bool downloadReservedMessages(qm::NormalFolder* pFolder);
+	bool checkSynchronized(unsigned int* pnCount,
+						   bool* pbSynchronized);
 	bool applyJunkFilter(const MessageDataList& l);
 	bool applyRules(const MessageDataList& l,
 					bool bJunkFilter,
@@ -81,6 +83,7 @@ private:
 private:
 	bool processCapabilityResponse(ResponseCapability* pCapability);
 	bool processContinueResponse(ResponseContinue* pContinue);
+	bool processEnabledResponse(ResponseEnabled* pEnabled);
 	bool processExistsResponse(ResponseExists* pExists);
 	bool processExpungeResponse(ResponseExpunge* pExpunge);
 	bool processFetchResponse(ResponseFetch* pFetch);
@@ -91,6 +94,7 @@ private:
 	bool processSearchResponse(ResponseSearch* pSearch);
 	bool processStateResponse(ResponseState* pState);
 	bool processStatusResponse(ResponseStatus* pStatus);
+	bool processVanishedResponse(ResponseVanished* pVanished);
 
 private:
 	Imap4ReceiveSession(const Imap4ReceiveSession&);
@@ -145,6 +149,7 @@ private:
 	ProcessHook* pProcessHook_;
 	unsigned int nExists_;
 	unsigned int nUidValidity_;
+	unsigned __int64 nHighestModSeq_;
 	bool bReadOnly_;
 	unsigned int nUidStart_;
 	unsigned int nIdStart_;
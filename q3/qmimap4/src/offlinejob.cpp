@@ -104,6 +104,7 @@ void qmimap4::OfflineJobManager::add(std::auto_ptr<OfflineJob> pJob)
 
 bool qmimap4::OfflineJobManager::apply(Account* pAccount,
 									   Imap4* pImap4,
+									   unsigned int nPipeline,
 									   ReceiveSessionCallback* pCallback)
 {
 	assert(pImap4);
@@ -135,14 +136,32 @@ bool qmimap4::OfflineJobManager::apply(Account* pAccount,
 		pCallback->setRange(0, listJob_.size());
 		
 		Folder* pPrevFolder = 0;
+		bool bPipeline = false;
+		JobList::size_type nPipelineFirst = 0;
+		CommandList listCommand;
 		for (JobList::size_type n = 0; n < listJob_.size(); ++n) {
 			pCallback->setPos(n + 1);
 			
 			OfflineJob*& pJob = listJob_[n];
+			bool bPipelinable = nPipeline > 1 && pJob->isPipelinable();
+			if (bPipeline && !bPipelinable) {
+				bPipeline = false;
+				if (!endPipeline(pImap4, nPipelineFirst, listCommand))
+					return false;
+			}
+			
 			if (pJob->getFolder()) {
 				Folder* pFolder = pAccount->getFolder(pJob->getFolder());
 				if (pFolder && pFolder != pPrevFolder &&
 					pFolder->getType() == Folder::TYPE_NORMAL) {
+					// Commands in flight must be completed in the folder
+					// where they were sent
+					if (bPipeline) {
+						bPipeline = false;
+						if (!endPipeline(pImap4, nPipelineFirst, listCommand))
+							return false;
+					}
+					
 					wstring_ptr wstrName(Util::getFolderName(
 						static_cast<NormalFolder*>(pFolder)));
 					if (!pImap4->select(wstrName.get()))
@@ -151,14 +170,35 @@ bool qmimap4::OfflineJobManager::apply(Account* pAccount,
 				}
 			}
 			
+			if (bPipelinable && !bPipeline) {
+				pImap4->beginPipeline(nPipeline);
+				bPipeline = true;
+				nPipelineFirst = n;
+				listCommand.clear();
+			}
+			
 			bool bClosed = false;
-			if (!pJob->apply(pAccount, pImap4, &bClosed))
+			if (!pJob->apply(pAccount, pImap4, &bClosed)) {
+				if (bPipeline)
+					endPipeline(pImap4, nPipelineFirst, listCommand);
 				return false;
+			}
 			if (bClosed)
 				pPrevFolder = 0;
 			
-			delete pJob;
-			pJob = 0;
+			if (bPipeline) {
+				// This job is removed after all the commands sent so far
+				// have been completed
+				listCommand.push_back(pImap4->getPipelinedCount());
+			}
+			else {
+				delete pJob;
+				pJob = 0;
+			}
+		}
+		if (bPipeline) {
+			if (!endPipeline(pImap4, nPipelineFirst, listCommand))
+				return false;
 		}
 	}
 	
@@ -169,6 +209,30 @@ bool qmimap4::OfflineJobManager::apply(Account* pAccount,
 	return true;
 }
 
+bool qmimap4::OfflineJobManager::endPipeline(Imap4* pImap4,
+											 JobList::size_type nFirst,
+											 const CommandList& listCommand)
+{
+	assert(pImap4);
+	assert(nFirst + listCommand.size() <= listJob_.size());
+	
+	// Because some servers return NO response when I try
+	// storing flags to UID that doesn't exist, I ignore this
+	// as well as when jobs are applied one by one.
+	bool bEnd = pImap4->endPipeline() ||
+		(pImap4->getLastError() & Imap4::IMAP4_ERROR_MASK_LOWLEVEL) ==
+			Imap4::IMAP4_ERROR_RESPONSE;
+	
+	unsigned int nCompleted = bEnd ? pImap4->getPipelinedCount() : pImap4->getCompletedCount();
+	for (CommandList::size_type n = 0; n < listCommand.size() && listCommand[n] <= nCompleted; ++n) {
+		OfflineJob*& pJob = listJob_[nFirst + n];
+		delete pJob;
+		pJob = 0;
+	}
+	
+	return bEnd;
+}
+
 bool qmimap4::OfflineJobManager::save() const
 {
 	Lock<CriticalSection> lock(cs_);
@@ -306,6 +370,11 @@ bool qmimap4::OfflineJob::write(OutputStream* pStream) const
 	return true;
 }
 
+bool qmimap4::OfflineJob::isPipelinable() const
+{
+	return false;
+}
+
 const WCHAR* qmimap4::OfflineJob::getFolder() const
 {
 	return wstrFolder_.get();
@@ -695,6 +764,11 @@ bool qmimap4::SetFlagsOfflineJob::merge(OfflineJob* pOfflineJob)
 	return false;
 }
 
+bool qmimap4::SetFlagsOfflineJob::isPipelinable() const
+{
+	return true;
+}
+
 std::auto_ptr<OfflineJob> qmimap4::SetFlagsOfflineJob::create(qs::InputStream* pStream)
 {
 	wstring_ptr wstrFolder;
@@ -809,6 +883,11 @@ bool qmimap4::SetLabelOfflineJob::merge(OfflineJob* pOfflineJob)
 	return false;
 }
 
+bool qmimap4::SetLabelOfflineJob::isPipelinable() const
+{
+	return true;
+}
+
 std::auto_ptr<OfflineJob> qmimap4::SetLabelOfflineJob::create(InputStream* pStream)
 {
 	wstring_ptr wstrFolder;
@@ -48,8 +48,18 @@ public:
 
 public:
 	void add(std::auto_ptr<OfflineJob> pJob);
+	
+	/**
+	 * Apply all the jobs. Consecutive jobs which can be pipelined are sent
+	 * without waiting for their responses, up to nPipeline commands at once.
+	 * Jobs which have been applied are removed even when it fails.
+	 *
+	 * @param nPipeline [in] The max number of commands in flight.
+	 *                       Jobs are applied one by one if less than 2.
+	 */
 	bool apply(qm::Account* pAccount,
 			   Imap4* pImap4,
+			   unsigned int nPipeline,
 			   qm::ReceiveSessionCallback* pCallback);
 	bool save() const;
 	bool copyJobs(qm::NormalFolder* pFolderFrom,
@@ -57,18 +67,22 @@ public:
 				  const UidList& listUid,
 				  bool bMove);
 
+private:
+	typedef std::vector<OfflineJob*> JobList;
+	typedef std::vector<unsigned int> CommandList;
+
 private:
 	bool load();
 	OfflineJob* getCreateMessage(const WCHAR* pwszFolder,
 								 unsigned int nId) const;
+	bool endPipeline(Imap4* pImap4,
+					 JobList::size_type nFirst,
+					 const CommandList& listCommand);
 
 private:
 	OfflineJobManager(const OfflineJobManager&);
 	OfflineJobManager& operator=(const OfflineJobManager&);
 
-private:
-	typedef std::vector<OfflineJob*> JobList;
-
 private:
 	qs::wstring_ptr wstrPath_;
 	JobList listJob_;
@@ -111,6 +125,13 @@ public:
 	virtual bool isCreateMessage(const WCHAR* pwszFolder,
 								 unsigned int nId) = 0;
 	virtual bool merge(OfflineJob* pOfflineJob) = 0;
+	
+	/**
+	 * Check if this job can be applied without waiting for the responses
+	 * of the previous jobs. A job which depends on the result of the
+	 * previous job, or which the next job depends on, cannot be pipelined.
+	 */
+	virtual bool isPipelinable() const;
 
 public:
 	const WCHAR* getFolder() const;
@@ -235,6 +256,7 @@ public:
 	virtual bool isCreateMessage(const WCHAR* pwszFolder,
 								 unsigned int nId);
 	virtual bool merge(OfflineJob* pOfflineJob);
+	virtual bool isPipelinable() const;
 
 public:
 	static std::auto_ptr<OfflineJob> create(qs::InputStream* pStream);
@@ -279,6 +301,7 @@ public:
 	virtual bool isCreateMessage(const WCHAR* pwszFolder,
 								 unsigned int nId);
 	virtual bool merge(OfflineJob* pOfflineJob);
+	virtual bool isPipelinable() const;
 
 public:
 	static std::auto_ptr<OfflineJob> create(qs::InputStream* pStream);
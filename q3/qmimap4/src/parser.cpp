@@ -38,6 +38,32 @@ bool qmimap4::Parser::parse(const CHAR* pszTag,
 							ParserCallback* pCallback)
 {
 	assert(pszTag);
+	return parse(pszTag, bAcceptContinue, pCallback, 0);
+}
+
+bool qmimap4::Parser::parseTagged(ParserCallback* pCallback,
+								  string_ptr* pstrTag)
+{
+	assert(pstrTag);
+	return parse(0, false, pCallback, pstrTag);
+}
+
+string_ptr qmimap4::Parser::getProcessedString() const
+{
+	return pBuffer_->substr(0, nIndex_);
+}
+
+string_ptr qmimap4::Parser::getUnprocessedString() const
+{
+	return pBuffer_->substr(nIndex_, -1);
+}
+
+bool qmimap4::Parser::parse(const CHAR* pszTag,
+							bool bAcceptContinue,
+							ParserCallback* pCallback,
+							string_ptr* pstrTag)
+{
+	assert(pszTag || pstrTag);
 	
 	while (true) {
 		struct X
@@ -70,7 +96,7 @@ bool qmimap4::Parser::parse(const CHAR* pszTag,
 				return false;
 			if (!pCallback->response(pResponse))
 				return false;
-			if (!*pszTag)
+			if (pszTag && !*pszTag)
 				break;
 		}
 		else if (TokenUtil::isEqual(tag, "+")) {
@@ -83,7 +109,9 @@ bool qmimap4::Parser::parse(const CHAR* pszTag,
 				break;
 		}
 		else {
-			bool bEnd = TokenUtil::isEqual(tag, pszTag);
+			bool bEnd = !pszTag || TokenUtil::isEqual(tag, pszTag);
+			if (pstrTag)
+				*pstrTag = allocString(tag.first, tag.second);
 			std::auto_ptr<Response> pResponse(parseResponse());
 			if (!pResponse.get())
 				return false;
@@ -97,16 +125,6 @@ bool qmimap4::Parser::parse(const CHAR* pszTag,
 	return true;
 }
 
-string_ptr qmimap4::Parser::getProcessedString() const
-{
-	return pBuffer_->substr(0, nIndex_);
-}
-
-string_ptr qmimap4::Parser::getUnprocessedString() const
-{
-	return pBuffer_->substr(nIndex_, -1);
-}
-
 Parser::Token qmimap4::Parser::getNextToken(Buffer* pBuffer,
 											size_t* pnIndex,
 											const CHAR* pszSep,
@@ -314,6 +332,10 @@ std::auto_ptr<Response> qmimap4::Parser::parseResponse()
 		if (TokenUtil::isEqual(value, "CAPABILITY"))
 			pResponse = parseCapabilityResponse();
 		break;
+	case 'E':
+		if (TokenUtil::isEqual(value, "ENABLED"))
+			pResponse = parseEnabledResponse();
+		break;
 	case 'F':
 		if (TokenUtil::isEqual(value, "FLAGS"))
 			pResponse = parseFlagsResponse();
@@ -344,6 +366,10 @@ std::auto_ptr<Response> qmimap4::Parser::parseResponse()
 		else if (TokenUtil::isEqual(value, "SEARCH"))
 			pResponse = parseSearchResponse();
 		break;
+	case 'V':
+		if (TokenUtil::isEqual(value, "VANISHED"))
+			pResponse = parseVanishedResponse();
+		break;
 	}
 	if (flag == ResponseState::FLAG_UNKNOWN && !pResponse.get()) {
 		unsigned int nNumber = 0;
@@ -449,6 +475,28 @@ std::auto_ptr<ResponseContinue> qmimap4::Parser::parseContinueResponse()
 	return std::auto_ptr<ResponseContinue>(new ResponseContinue(pState));
 }
 
+std::auto_ptr<ResponseEnabled> qmimap4::Parser::parseEnabledResponse()
+{
+	std::auto_ptr<ResponseEnabled> pEnabled(new ResponseEnabled());
+	
+	while (true) {
+		std::pair<const CHAR*, size_t> value;
+		Token token = getNextToken(" \r", &value);
+		if (token != TOKEN_ATOM)
+			return std::auto_ptr<ResponseEnabled>(0);
+		if (value.second == 0)
+			break;
+		
+		pEnabled->add(value.first, value.second);
+	}
+	
+	if (pBuffer_->get(nIndex_) != '\r' || pBuffer_->get(nIndex_ + 1) != '\n')
+		return std::auto_ptr<ResponseEnabled>(0);
+	nIndex_ += 2;
+	
+	return pEnabled;
+}
+
 std::auto_ptr<ResponseFetch> qmimap4::Parser::parseFetchResponse(unsigned int nNumber)
 {
 	std::auto_ptr<List> pList(parseList());
@@ -576,6 +624,35 @@ std::auto_ptr<ResponseStatus> qmimap4::Parser::parseStatusResponse()
 	return ResponseStatus::create(mailbox.first, mailbox.second, pList.get());
 }
 
+std::auto_ptr<ResponseVanished> qmimap4::Parser::parseVanishedResponse()
+{
+	bool bEarlier = false;
+	if (pBuffer_->get(nIndex_) == '(') {
+		std::auto_ptr<List> pList(parseList());
+		if (!pList.get())
+			return std::auto_ptr<ResponseVanished>(0);
+		
+		const List::ItemList& l = pList->getList();
+		if (l.size() != 1 || l[0]->getType() != ListItem::TYPE_TEXT ||
+			!TokenUtil::isEqualIgnoreCase(static_cast<ListItemText*>(l[0])->getText().get(), "EARLIER"))
+			return std::auto_ptr<ResponseVanished>(0);
+		bEarlier = true;
+	}
+	
+	TokenValue tokenValue;
+	Token token = getNextToken(" \r", &tokenValue);
+	if (token != TOKEN_ATOM)
+		return std::auto_ptr<ResponseVanished>(0);
+	
+	nIndex_ = pBuffer_->find("\r\n", nIndex_);
+	if (nIndex_ == -1)
+		return std::auto_ptr<ResponseVanished>(0);
+	nIndex_ += 2;
+	
+	std::pair<const CHAR*, size_t> uids(tokenValue.get());
+	return ResponseVanished::create(bEarlier, uids.first, uids.second);
+}
+
 std::auto_ptr<State> qmimap4::Parser::parseStatus()
 {
 	CHAR c = pBuffer_->get(nIndex_);
@@ -595,7 +672,9 @@ std::auto_ptr<State> qmimap4::Parser::parseStatus()
 			enum Arg {
 				ARG_NONE,
 				ARG_LIST,
-				ARG_NUMBER
+				ARG_NUMBER,
+				ARG_NUMBER64,
+				ARG_CAPABILITY
 			};
 			const CHAR* pszCode_;
 			State::Code code_;
@@ -610,7 +689,10 @@ std::auto_ptr<State> qmimap4::Parser::parseStatus()
 			{ "TRYCREATE",		State::CODE_TRYCREATE,		S::ARG_NONE		},
 			{ "UIDVALIDITY",	State::CODE_UIDVALIDITY,	S::ARG_NUMBER	},
 			{ "UNSEEN",			State::CODE_UNSEEN,			S::ARG_NUMBER	},
-			{ "UIDNEXT",		State::CODE_UIDNEXT,		S::ARG_NUMBER	}
+			{ "UIDNEXT",		State::CODE_UIDNEXT,		S::ARG_NUMBER	},
+			{ "HIGHESTMODSEQ",	State::CODE_HIGHESTMODSEQ,	S::ARG_NUMBER64	},
+			{ "NOMODSEQ",		State::CODE_NOMODSEQ,		S::ARG_NONE		},
+			{ "CAPABILITY",		State::CODE_CAPABILITY,		S::ARG_CAPABILITY	}
 		};
 		
 		State::Code code = State::CODE_OTHER;
@@ -645,6 +727,28 @@ std::auto_ptr<State> qmimap4::Parser::parseStatus()
 				return std::auto_ptr<State>(0);
 			pState->setArg(nArg);
 		}
+		else if (arg == S::ARG_NUMBER64) {
+			std::pair<const CHAR*, size_t> arg;
+			token = getNextToken("]", &arg);
+			if (token != TOKEN_ATOM)
+				return std::auto_ptr<State>(0);
+			
+			unsigned __int64 nArg = 0;
+			if (!TokenUtil::string2number(arg, &nArg))
+				return std::auto_ptr<State>(0);
+			pState->setArg64(nArg);
+		}
+		else if (arg == S::ARG_CAPABILITY) {
+			std::auto_ptr<ResponseCapability> pCapability(new ResponseCapability());
+			while (pBuffer_->get(nIndex_) != ']') {
+				std::pair<const CHAR*, size_t> value;
+				token = getNextToken(" ]", &value);
+				if (token != TOKEN_ATOM)
+					return std::auto_ptr<State>(0);
+				pCapability->add(value.first, value.second);
+			}
+			pState->setArg(pCapability);
+		}
 		else {
 			nIndex_ = pBuffer_->find(']', nIndex_);
 			if (nIndex_ == -1)
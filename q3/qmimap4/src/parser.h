@@ -48,6 +48,17 @@ public:
 	bool parse(const CHAR* pszTag,
 			   bool bAcceptContinue,
 			   ParserCallback* pCallback);
+	
+	/**
+	 * Parse responses until a tagged response whose tag is any is parsed.
+	 *
+	 * @param pCallback [in] Callback.
+	 * @param pstrTag [out] Tag of the tagged response.
+	 * @return true if success, false otherwise.
+	 */
+	bool parseTagged(ParserCallback* pCallback,
+					 qs::string_ptr* pstrTag);
+	
 	qs::string_ptr getProcessedString() const;
 	qs::string_ptr getUnprocessedString() const;
 
@@ -63,15 +74,21 @@ public:
 										 Imap4Callback* pCallback);
 
 private:
+	bool parse(const CHAR* pszTag,
+			   bool bAcceptContinue,
+			   ParserCallback* pCallback,
+			   qs::string_ptr* pstrTag);
 	std::auto_ptr<Response> parseResponse();
 	std::auto_ptr<ResponseCapability> parseCapabilityResponse();
 	std::auto_ptr<ResponseContinue> parseContinueResponse();
+	std::auto_ptr<ResponseEnabled> parseEnabledResponse();
 	std::auto_ptr<ResponseFetch> parseFetchResponse(unsigned int nNumber);
 	std::auto_ptr<ResponseFlags> parseFlagsResponse();
 	std::auto_ptr<ResponseList> parseListResponse(bool bList);
 	std::auto_ptr<ResponseNamespace> parseNamespaceResponse();
 	std::auto_ptr<ResponseSearch> parseSearchResponse();
 	std::auto_ptr<ResponseStatus> parseStatusResponse();
+	std::auto_ptr<ResponseVanished> parseVanishedResponse();
 	std::auto_ptr<State> parseStatus();
 	std::auto_ptr<List> parseList();
 	
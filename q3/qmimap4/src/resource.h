@@ -43,6 +43,9 @@
 #define IDS_ERROR_NAMESPACE             11020
 #define IDS_ERROR_LOGOUT                11021
 #define IDS_ERROR_STARTTLS              11022
+#define IDS_ERROR_ENABLE                11023
+#define IDS_ERROR_IDLE                  11024
+#define IDS_ERROR_COMPRESS              11025
 #define IDS_ERROR_INITIALIZE            12000
 #define IDS_ERROR_CONNECT               12001
 #define IDS_ERROR_SELECTSOCKET          12002
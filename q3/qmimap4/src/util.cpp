@@ -635,7 +635,7 @@ void qmimap4::Util::reportError(Imap4* pImap4,
 	{
 		unsigned int nError_;
 		UINT nId_;
-	} maps[][23] = {
+	} maps[][26] = {
 		{
 			{ IMAP4ERROR_SAVE,			IDS_ERROR_SAVE			},
 			{ IMAP4ERROR_APPLYRULES,	IDS_ERROR_APPLYRULES	},
@@ -665,7 +665,10 @@ void qmimap4::Util::reportError(Imap4* pImap4,
 			{ Imap4::IMAP4_ERROR_SEARCH,		IDS_ERROR_SEARCH		},
 			{ Imap4::IMAP4_ERROR_NAMESPACE,		IDS_ERROR_NAMESPACE		},
 			{ Imap4::IMAP4_ERROR_LOGOUT,		IDS_ERROR_LOGOUT		},
-			{ Imap4::IMAP4_ERROR_STARTTLS,		IDS_ERROR_STARTTLS		}
+			{ Imap4::IMAP4_ERROR_STARTTLS,		IDS_ERROR_STARTTLS		},
+			{ Imap4::IMAP4_ERROR_ENABLE,		IDS_ERROR_ENABLE		},
+			{ Imap4::IMAP4_ERROR_IDLE,			IDS_ERROR_IDLE			},
+			{ Imap4::IMAP4_ERROR_COMPRESS,		IDS_ERROR_COMPRESS		}
 		},
 		{
 			{ Imap4::IMAP4_ERROR_INITIALIZE,	IDS_ERROR_INITIALIZE	},
@@ -0,0 +1,388 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+/*
+ * Latency test of pipelined IMAP4 commands.
+ *
+ * A fake IMAP4 server runs on localhost and sends each tagged response
+ * after the specified delay from when its command arrived, as if they were
+ * on a network with that round-trip time. The same number of UID STORE
+ * commands are sent one by one and pipelined, and the elapsed time of
+ * each is printed.
+ *
+ * This is not built by the makefiles. Build it with the sources of
+ * qmimap4 and link it with qs, e.g.
+ *
+ *   cl /EHsc /DUNICODE /D_UNICODE /I..\..\qs\include /I<boost>
+ *      pipelinetest.cpp ..\src\imap4.cpp ..\src\parser.cpp
+ *      ..\src\buffer.cpp qs.lib ws2_32.lib
+ *
+ * Usage: pipelinetest [delay(ms)] [commands] [depth]
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qssocket.h>
+#include <qsstring.h>
+#include <qsthread.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+
+#include "../src/imap4.h"
+
+using namespace qmimap4;
+using namespace qs;
+
+
+namespace {
+
+enum {
+	PORT		= 14143,
+	TIMEOUT		= 60
+};
+
+
+/****************************************************************************
+ *
+ * FakeServer
+ *
+ * Serve one connection. Commands are answered in order, but responses are
+ * queued with the time they are due, so that commands sent without waiting
+ * for responses are delayed only once.
+ *
+ */
+
+class FakeServer : public Thread
+{
+public:
+	FakeServer(ServerSocket* pServerSocket,
+			   DWORD dwDelay);
+	virtual ~FakeServer();
+
+public:
+	unsigned int getCommandCount() const;
+
+public:
+	virtual void run();
+
+private:
+	void process(const CHAR* pszLine,
+				 size_t nLen);
+	void queue(const CHAR* pszResponse);
+	bool flush(SOCKET s);
+
+private:
+	FakeServer(const FakeServer&);
+	FakeServer& operator=(const FakeServer&);
+
+private:
+	struct Item
+	{
+		DWORD dwDue_;
+		STRING str_;
+	};
+	typedef std::deque<Item> ItemList;
+
+private:
+	ServerSocket* pServerSocket_;
+	DWORD dwDelay_;
+	ItemList listItem_;
+	unsigned int nCommand_;
+	bool bLogout_;
+};
+
+FakeServer::FakeServer(ServerSocket* pServerSocket,
+					   DWORD dwDelay) :
+	pServerSocket_(pServerSocket),
+	dwDelay_(dwDelay),
+	nCommand_(0),
+	bLogout_(false)
+{
+}
+
+FakeServer::~FakeServer()
+{
+	for (ItemList::iterator it = listItem_.begin(); it != listItem_.end(); ++it)
+		freeString((*it).str_);
+}
+
+unsigned int FakeServer::getCommandCount() const
+{
+	return nCommand_;
+}
+
+void FakeServer::run()
+{
+	SOCKET s = pServerSocket_->accept();
+	if (s == INVALID_SOCKET)
+		return;
+	
+	const CHAR* pszGreeting = "* OK Fake IMAP4 server ready\r\n";
+	::send(s, pszGreeting, static_cast<int>(strlen(pszGreeting)), 0);
+	
+	StringBuffer<STRING> buf;
+	while (!bLogout_ || !listItem_.empty()) {
+		if (!flush(s))
+			break;
+		
+		long nWait = TIMEOUT*1000;
+		if (!listItem_.empty()) {
+			DWORD dwNow = ::GetTickCount();
+			DWORD dwDue = listItem_.front().dwDue_;
+			nWait = dwDue > dwNow ? static_cast<long>(dwDue - dwNow) : 0;
+		}
+		else if (bLogout_) {
+			break;
+		}
+		
+		fd_set fdset;
+		FD_ZERO(&fdset);
+		FD_SET(s, &fdset);
+		timeval tv = { nWait/1000, (nWait%1000)*1000 };
+		int nSelect = ::select(0, &fdset, 0, 0, &tv);
+		if (nSelect == SOCKET_ERROR)
+			break;
+		else if (nSelect == 0)
+			continue;
+		
+		CHAR szBuf[4096];
+		int nRecv = ::recv(s, szBuf, sizeof(szBuf), 0);
+		if (nRecv <= 0)
+			break;
+		buf.append(szBuf, nRecv);
+		
+		while (true) {
+			const CHAR* p = strstr(buf.getCharArray(), "\r\n");
+			if (!p)
+				break;
+			size_t nLen = p - buf.getCharArray();
+			process(buf.getCharArray(), nLen);
+			buf.remove(0, nLen + 2);
+		}
+	}
+	
+	::closesocket(s);
+}
+
+void FakeServer::process(const CHAR* pszLine,
+						 size_t nLen)
+{
+	string_ptr strLine(allocString(pszLine, nLen));
+	CHAR* pCommand = strchr(strLine.get(), ' ');
+	if (!pCommand)
+		return;
+	*pCommand++ = '\0';
+	const CHAR* pszTag = strLine.get();
+	
+	++nCommand_;
+	
+	if (_strnicmp(pCommand, "CAPABILITY", 10) == 0) {
+		queue("* CAPABILITY IMAP4rev1\r\n");
+	}
+	else if (_strnicmp(pCommand, "LOGIN", 5) == 0) {
+		string_ptr str(concat(pszTag, " OK [CAPABILITY IMAP4rev1] Logged in\r\n"));
+		queue(str.get());
+		return;
+	}
+	else if (_strnicmp(pCommand, "SELECT", 6) == 0) {
+		queue("* 1000 EXISTS\r\n* 0 RECENT\r\n* OK [UIDVALIDITY 1] UIDs valid\r\n");
+		string_ptr str(concat(pszTag, " OK [READ-WRITE] Selected\r\n"));
+		queue(str.get());
+		return;
+	}
+	else if (_strnicmp(pCommand, "LOGOUT", 6) == 0) {
+		queue("* BYE Logging out\r\n");
+		bLogout_ = true;
+	}
+	
+	string_ptr str(concat(pszTag, " OK Completed\r\n"));
+	queue(str.get());
+}
+
+void FakeServer::queue(const CHAR* pszResponse)
+{
+	string_ptr str(allocString(pszResponse));
+	Item item = {
+		::GetTickCount() + dwDelay_,
+		str.get()
+	};
+	listItem_.push_back(item);
+	str.release();
+}
+
+bool FakeServer::flush(SOCKET s)
+{
+	DWORD dwNow = ::GetTickCount();
+	while (!listItem_.empty() &&
+		static_cast<long>(listItem_.front().dwDue_ - dwNow) <= 0) {
+		string_ptr str(listItem_.front().str_);
+		listItem_.pop_front();
+		if (::send(s, str.get(), static_cast<int>(strlen(str.get())), 0) == SOCKET_ERROR)
+			return false;
+	}
+	return true;
+}
+
+
+/****************************************************************************
+ *
+ * TestImap4Callback
+ *
+ */
+
+class TestImap4Callback : public Imap4Callback
+{
+public:
+	TestImap4Callback();
+	virtual ~TestImap4Callback();
+
+public:
+	virtual bool getUserInfo(wstring_ptr* pwstrUserName,
+							 wstring_ptr* pwstrPassword);
+	virtual void setPassword(const WCHAR* pwszPassword);
+	virtual wstring_ptr getAuthMethods();
+	virtual void authenticating();
+	virtual void setRange(size_t nMin,
+						  size_t nMax);
+	virtual void setPos(size_t nPos);
+	virtual bool response(Response* pResponse);
+
+private:
+	TestImap4Callback(const TestImap4Callback&);
+	TestImap4Callback& operator=(const TestImap4Callback&);
+};
+
+TestImap4Callback::TestImap4Callback()
+{
+}
+
+TestImap4Callback::~TestImap4Callback()
+{
+}
+
+bool TestImap4Callback::getUserInfo(wstring_ptr* pwstrUserName,
+									wstring_ptr* pwstrPassword)
+{
+	*pwstrUserName = allocWString(L"test");
+	*pwstrPassword = allocWString(L"test");
+	return true;
+}
+
+void TestImap4Callback::setPassword(const WCHAR* pwszPassword)
+{
+}
+
+wstring_ptr TestImap4Callback::getAuthMethods()
+{
+	return allocWString(L"LOGIN");
+}
+
+void TestImap4Callback::authenticating()
+{
+}
+
+void TestImap4Callback::setRange(size_t nMin,
+								 size_t nMax)
+{
+}
+
+void TestImap4Callback::setPos(size_t nPos)
+{
+}
+
+bool TestImap4Callback::response(Response* pResponse)
+{
+	return true;
+}
+
+
+/****************************************************************************
+ *
+ * Functions
+ *
+ */
+
+bool store(unsigned int nCommand,
+		   unsigned int nDepth,
+		   DWORD dwDelay,
+		   DWORD* pdwElapsed,
+		   unsigned int* pnReceived)
+{
+	ServerSocket serverSocket(PORT, 1);
+	if (!serverSocket)
+		return false;
+	
+	FakeServer server(&serverSocket, dwDelay);
+	if (!server.start())
+		return false;
+	
+	DefaultSocketCallback socketCallback;
+	TestImap4Callback callback;
+	bool bSucceeded = false;
+	{
+		Imap4 imap4(TIMEOUT, &socketCallback, 0, &callback, 0);
+		if (imap4.connect(L"localhost", PORT, Imap4::SECURE_NONE) &&
+			imap4.select(L"INBOX")) {
+			DWORD dwStart = ::GetTickCount();
+			
+			if (nDepth > 1)
+				imap4.beginPipeline(nDepth);
+			bool bStored = true;
+			for (unsigned int n = 0; n < nCommand && bStored; ++n) {
+				SingleRange range(n + 1, true);
+				bStored = imap4.store(range, "+FLAGS.SILENT (\\Seen)");
+			}
+			if (nDepth > 1 && !imap4.endPipeline())
+				bStored = false;
+			
+			*pdwElapsed = ::GetTickCount() - dwStart;
+			bSucceeded = bStored;
+		}
+		imap4.disconnect();
+	}
+	
+	server.join();
+	*pnReceived = server.getCommandCount();
+	
+	return bSucceeded;
+}
+
+}
+
+
+int main(int argc,
+		 char** argv)
+{
+	DWORD dwDelay = argc > 1 ? atoi(argv[1]) : 50;
+	unsigned int nCommand = argc > 2 ? atoi(argv[2]) : 100;
+	unsigned int nDepth = argc > 3 ? atoi(argv[3]) : 16;
+	if (nCommand == 0 || nDepth == 0) {
+		fprintf(stderr, "Usage: pipelinetest [delay(ms)] [commands] [depth]\n");
+		return 1;
+	}
+	
+	Winsock winsock;
+	
+	printf("Delay: %lums, Commands: %u\n", dwDelay, nCommand);
+	
+	unsigned int depths[] = { 1, nDepth };
+	for (int n = 0; n < countof(depths); ++n) {
+		DWORD dwElapsed = 0;
+		unsigned int nReceived = 0;
+		if (!store(nCommand, depths[n], dwDelay, &dwElapsed, &nReceived)) {
+			fprintf(stderr, "Failed (depth: %u)\n", depths[n]);
+			return 1;
+		}
+		printf("Depth: %3u, Elapsed: %6lums, Commands received: %u\n",
+			depths[n], dwElapsed, nReceived);
+	}
+	
+	return 0;
+}
@@ -24,6 +24,15 @@ namespace qs {
 class QSEXPORTCLASS ClusterStorage
 {
 public:
+	enum {
+		CLUSTER_SIZE	= 128
+	};
+
+public:
+	/**
+	 * Offset is an index of a cluster (128 bytes), not an offset in bytes.
+	 * A storage can hold up to 0x7fffffff clusters (256GB).
+	 */
 	typedef unsigned int Offset;
 
 public:
@@ -139,6 +148,14 @@ public:
 	 * @return true if success, false otherwise.
 	 */
 	bool freeUnused();
+	
+	/**
+	 * Get fragmentation of storage. This is the ratio of free clusters
+	 * to all clusters before the last used cluster.
+	 *
+	 * @return Fragmentation in percent.
+	 */
+	unsigned int getFragmentation() const;
 
 private:
 	ClusterStorage(const ClusterStorage&);
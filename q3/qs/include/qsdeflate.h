@@ -0,0 +1,157 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#ifndef __QSDEFLATE_H__
+#define __QSDEFLATE_H__
+
+#include <qs.h>
+#include <qsstl.h>
+
+
+namespace qs {
+
+class Deflater;
+class Inflater;
+
+class OutputStream;
+
+
+/****************************************************************************
+ *
+ * Deflater
+ *
+ * Compressor which writes raw deflate stream (RFC 1951) without zlib or
+ * gzip wrapper.
+ *
+ */
+
+class QSEXPORTCLASS Deflater
+{
+public:
+	enum Flush {
+		FLUSH_NONE,
+		FLUSH_SYNC,
+		FLUSH_FINISH
+	};
+
+public:
+	/**
+	 * Create instance.
+	 *
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	Deflater();
+	
+	~Deflater();
+
+public:
+	/**
+	 * Compress data.
+	 *
+	 * @param p [in] Data.
+	 * @param nLen [in] Length of data.
+	 * @param flush [in] FLUSH_NONE to buffer data if possible,
+	 *                   FLUSH_SYNC to write all the data compressed so far
+	 *                   ending at byte boundary, FLUSH_FINISH to end
+	 *                   the stream.
+	 * @param pOutputStream [in] Stream compressed data is written to.
+	 * @return true if success, false otherwise.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	bool deflate(const unsigned char* p,
+				 size_t nLen,
+				 Flush flush,
+				 OutputStream* pOutputStream);
+
+public:
+	/**
+	 * Compress data at once.
+	 *
+	 * @param p [in] Data.
+	 * @param nLen [in] Length of data.
+	 * @return Compressed data. null if failed.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	static malloc_size_ptr<unsigned char> deflate(const unsigned char* p,
+												  size_t nLen);
+
+private:
+	Deflater(const Deflater&);
+	Deflater& operator=(const Deflater&);
+
+private:
+	struct DeflaterImpl* pImpl_;
+};
+
+
+/****************************************************************************
+ *
+ * Inflater
+ *
+ * Decompressor of raw deflate stream (RFC 1951). Compressed data can be
+ * passed in pieces of any size.
+ *
+ */
+
+class QSEXPORTCLASS Inflater
+{
+public:
+	/**
+	 * Create instance.
+	 *
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	Inflater();
+	
+	~Inflater();
+
+public:
+	/**
+	 * Decompress data. Data which cannot be decompressed until more data
+	 * comes is kept internally.
+	 *
+	 * @param p [in] Compressed data.
+	 * @param nLen [in] Length of compressed data.
+	 * @param pOutputStream [in] Stream decompressed data is written to.
+	 * @return true if success, false if data is corrupted or error occured.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	bool inflate(const unsigned char* p,
+				 size_t nLen,
+				 OutputStream* pOutputStream);
+	
+	/**
+	 * Check if the final block has been decompressed.
+	 */
+	bool isFinished() const;
+
+public:
+	/**
+	 * Decompress data at once.
+	 *
+	 * @param p [in] Compressed data.
+	 * @param nLen [in] Length of compressed data.
+	 * @param nOriginalLen [in] Length of decompressed data.
+	 * @return Decompressed data. null if failed or the length of
+	 *         decompressed data doesn't match nOriginalLen.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	static malloc_size_ptr<unsigned char> inflate(const unsigned char* p,
+												  size_t nLen,
+												  size_t nOriginalLen);
+
+private:
+	Inflater(const Inflater&);
+	Inflater& operator=(const Inflater&);
+
+private:
+	struct InflaterImpl* pImpl_;
+};
+
+}
+
+#endif // __QSDEFLATE_H__
@@ -19,6 +19,7 @@ namespace qs {
 class Winsock;
 class SocketBase;
 	class Socket;
+	class CompressedSocket;
 class ServerSocket;
 class SocketCallback;
 	class DefaultSocketCallback;
@@ -170,6 +171,85 @@ private:
 };
 
 
+/****************************************************************************
+ *
+ * CompressedSocket
+ *
+ * Socket which compresses data sent and decompresses data received over
+ * the base socket with raw deflate (RFC 1951), such as IMAP COMPRESS=DEFLATE
+ * (RFC 4978). Each send is flushed to a byte boundary so that the peer can
+ * decompress it without waiting for more data.
+ *
+ */
+
+class QSEXPORTCLASS CompressedSocket : public SocketBase
+{
+public:
+	/**
+	 * Create instance.
+	 *
+	 * @param pSocket [in] Base socket.
+	 * @param bDeleteSocket [in] true if delete the base socket when this socket is deleted.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	CompressedSocket(SocketBase* pSocket,
+					 bool bDeleteSocket);
+	virtual ~CompressedSocket();
+
+public:
+	/**
+	 * Get the number of bytes passed to send before they are compressed.
+	 */
+	unsigned __int64 getSentBytes() const;
+	
+	/**
+	 * Get the number of compressed bytes sent over the base socket.
+	 */
+	unsigned __int64 getCompressedSentBytes() const;
+	
+	/**
+	 * Get the number of bytes decompressed from the data received.
+	 */
+	unsigned __int64 getReceivedBytes() const;
+	
+	/**
+	 * Get the number of compressed bytes received over the base socket.
+	 */
+	unsigned __int64 getCompressedReceivedBytes() const;
+	
+	/**
+	 * Compress and send all the data passed to send so far. Data passed
+	 * to send may be kept until this method is called.
+	 *
+	 * @return true if success, false otherwise.
+	 */
+	bool flush();
+
+public:
+	virtual long getTimeout() const;
+	virtual void setTimeout(long nTimeout);
+	virtual bool close();
+	virtual int recv(char* p,
+					 int nLen,
+					 int nFlags);
+	virtual int send(const char* p,
+					 int nLen,
+					 int nFlags);
+	virtual int select(int nSelect);
+	virtual int select(int nSelect,
+					   long nTimeout);
+	virtual InputStream* getInputStream();
+	virtual OutputStream* getOutputStream();
+
+private:
+	CompressedSocket(const CompressedSocket&);
+	CompressedSocket& operator=(const CompressedSocket&);
+
+private:
+	struct CompressedSocketImpl* pImpl_;
+};
+
+
 /****************************************************************************
  *
  * ServerSocket
@@ -11,6 +11,8 @@
 #include <qs.h>
 #include <windows.h>
 
+#include <vector>
+
 #ifdef _WIN32_WCE
 #	define UNVOLATILE(type) const_cast<type>
 #else
@@ -55,6 +57,9 @@ class ReadWriteWriteLock;
 template<class Object> class Lock;
 class Event;
 class Synchronizer;
+class ThreadPool;
+template<class RandomIterator, class Compare> class StableSortRunnable;
+template<class RandomIterator, class Compare> class MergeRunnable;
 
 class SynchronizerWindow;
 
@@ -412,6 +417,127 @@ private:
 	SynchronizerWindow* pWindow_;
 };
 
+
+/****************************************************************************
+ *
+ * ThreadPool
+ *
+ * Pool of worker threads which run a batch of runnables in parallel. The
+ * calling thread also runs runnables of the batch while waiting for them.
+ * A runnable must not call execute of the same pool.
+ *
+ */
+
+class QSEXPORTCLASS ThreadPool
+{
+public:
+	/**
+	 * Create instance.
+	 *
+	 * @param nThreadCount [in] Number of threads including the calling
+	 *                          thread. 0 to use the number of processors.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	explicit ThreadPool(unsigned int nThreadCount);
+	
+	~ThreadPool();
+
+public:
+	/**
+	 * Get the number of threads including the calling thread.
+	 */
+	unsigned int getThreadCount() const;
+	
+	/**
+	 * Run runnables and wait until all of them finish. When a runnable
+	 * throws an exception, the rest of them are still run.
+	 *
+	 * @param ppRunnable [in] Runnables.
+	 * @param nCount [in] Number of runnables.
+	 * @return true if all of them succeed, false if any of them throws
+	 *         an exception.
+	 */
+	bool execute(Runnable* const* ppRunnable,
+				 size_t nCount);
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+private:
+	struct ThreadPoolImpl* pImpl_;
+};
+
+
+/****************************************************************************
+ *
+ * parallelStableSort
+ *
+ * Sort elements like std::stable_sort. Ranges are sorted in parallel and
+ * then merged in parallel. When sorting or merging a range fails, all the
+ * elements are sorted again by the calling thread, which throws the
+ * exception if it fails again.
+ *
+ */
+
+template<class RandomIterator, class Compare>
+void parallelStableSort(ThreadPool* pThreadPool,
+						RandomIterator first,
+						RandomIterator last,
+						Compare comp);
+
+
+/****************************************************************************
+ *
+ * StableSortRunnable
+ *
+ */
+
+template<class RandomIterator, class Compare>
+class StableSortRunnable : public Runnable
+{
+public:
+	StableSortRunnable(RandomIterator first,
+					   RandomIterator last,
+					   const Compare* pComp);
+	virtual ~StableSortRunnable();
+
+public:
+	virtual void run();
+
+private:
+	RandomIterator first_;
+	RandomIterator last_;
+	const Compare* pComp_;
+};
+
+
+/****************************************************************************
+ *
+ * MergeRunnable
+ *
+ */
+
+template<class RandomIterator, class Compare>
+class MergeRunnable : public Runnable
+{
+public:
+	MergeRunnable(RandomIterator first,
+				  RandomIterator middle,
+				  RandomIterator last,
+				  const Compare* pComp);
+	virtual ~MergeRunnable();
+
+public:
+	virtual void run();
+
+private:
+	RandomIterator first_;
+	RandomIterator middle_;
+	RandomIterator last_;
+	const Compare* pComp_;
+};
+
 }
 
 #include <qsthread.inl>
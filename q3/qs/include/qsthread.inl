@@ -8,6 +8,8 @@
 #ifndef __QSTHREAD_INL__
 #define __QSTHREAD_INL__
 
+#include <algorithm>
+
 
 /****************************************************************************
  *
@@ -184,4 +186,134 @@ qs::Lock<Object>::~Lock()
 	o_.unlock();
 }
 
+
+/****************************************************************************
+ *
+ * parallelStableSort
+ *
+ */
+
+template<class RandomIterator, class Compare>
+void qs::parallelStableSort(ThreadPool* pThreadPool,
+							RandomIterator first,
+							RandomIterator last,
+							Compare comp)
+{
+	// Sorting small ranges in parallel costs more than it saves
+	const size_t nMinPartSize = 4096;
+	
+	size_t nSize = last - first;
+	size_t nPart = pThreadPool ? pThreadPool->getThreadCount() : 1;
+	if (nPart > nSize/nMinPartSize)
+		nPart = nSize/nMinPartSize;
+	if (nPart <= 1) {
+		std::stable_sort(first, last, comp);
+		return;
+	}
+	
+	typedef std::vector<RandomIterator> BoundaryList;
+	BoundaryList listBoundary;
+	listBoundary.reserve(nPart + 1);
+	for (size_t n = 0; n < nPart; ++n)
+		listBoundary.push_back(first + nSize*n/nPart);
+	listBoundary.push_back(last);
+	
+	std::vector<Runnable*> listRunnable;
+	listRunnable.reserve(nPart);
+	
+	typedef StableSortRunnable<RandomIterator, Compare> Sorter;
+	std::vector<Sorter> listSort;
+	listSort.reserve(nPart);
+	for (size_t n = 0; n < nPart; ++n) {
+		listSort.push_back(Sorter(listBoundary[n], listBoundary[n + 1], &comp));
+		listRunnable.push_back(&listSort.back());
+	}
+	if (!pThreadPool->execute(&listRunnable[0], listRunnable.size())) {
+		std::stable_sort(first, last, comp);
+		return;
+	}
+	
+	typedef MergeRunnable<RandomIterator, Compare> Merger;
+	std::vector<Merger> listMerge;
+	listMerge.reserve(nPart/2);
+	while (listBoundary.size() > 2) {
+		listRunnable.clear();
+		listMerge.clear();
+		BoundaryList l;
+		l.reserve(listBoundary.size()/2 + 2);
+		size_t n = 0;
+		for (; n + 2 < listBoundary.size(); n += 2) {
+			listMerge.push_back(Merger(listBoundary[n],
+				listBoundary[n + 1], listBoundary[n + 2], &comp));
+			listRunnable.push_back(&listMerge.back());
+			l.push_back(listBoundary[n]);
+		}
+		for (; n < listBoundary.size(); ++n)
+			l.push_back(listBoundary[n]);
+		if (!pThreadPool->execute(&listRunnable[0], listRunnable.size())) {
+			std::stable_sort(first, last, comp);
+			return;
+		}
+		listBoundary.swap(l);
+	}
+}
+
+
+/****************************************************************************
+ *
+ * StableSortRunnable
+ *
+ */
+
+template<class RandomIterator, class Compare>
+qs::StableSortRunnable<RandomIterator, Compare>::StableSortRunnable(RandomIterator first,
+																	RandomIterator last,
+																	const Compare* pComp) :
+	first_(first),
+	last_(last),
+	pComp_(pComp)
+{
+}
+
+template<class RandomIterator, class Compare>
+qs::StableSortRunnable<RandomIterator, Compare>::~StableSortRunnable()
+{
+}
+
+template<class RandomIterator, class Compare>
+void qs::StableSortRunnable<RandomIterator, Compare>::run()
+{
+	std::stable_sort(first_, last_, *pComp_);
+}
+
+
+/****************************************************************************
+ *
+ * MergeRunnable
+ *
+ */
+
+template<class RandomIterator, class Compare>
+qs::MergeRunnable<RandomIterator, Compare>::MergeRunnable(RandomIterator first,
+														  RandomIterator middle,
+														  RandomIterator last,
+														  const Compare* pComp) :
+	first_(first),
+	middle_(middle),
+	last_(last),
+	pComp_(pComp)
+{
+}
+
+template<class RandomIterator, class Compare>
+qs::MergeRunnable<RandomIterator, Compare>::~MergeRunnable()
+{
+}
+
+template<class RandomIterator, class Compare>
+void qs::MergeRunnable<RandomIterator, Compare>::run()
+{
+	std::inplace_merge(first_, middle_, last_, *pComp_);
+}
+
 #endif // __QSTHREAD_INL__
@@ -0,0 +1,1213 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qsassert.h>
+#include <qsdeflate.h>
+#include <qsstream.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+using namespace qs;
+
+namespace qs {
+struct DeflateUtil;
+struct DeflaterImpl;
+struct InflaterImpl;
+}
+
+
+/****************************************************************************
+ *
+ * DeflateUtil
+ *
+ */
+
+struct qs::DeflateUtil
+{
+	enum {
+		WINDOW_SIZE			= 32768,
+		MIN_MATCH			= 3,
+		MAX_MATCH			= 258,
+		MAX_BITS			= 15,
+		MAX_CODELENGTH_BITS	= 7,
+		LITERAL_COUNT		= 288,
+		DISTANCE_COUNT		= 30,
+		CODELENGTH_COUNT	= 19,
+		END_OF_BLOCK		= 256
+	};
+	
+	static void getCodes(const unsigned char* pLength,
+						 unsigned int nCount,
+						 unsigned short* pCode);
+	static unsigned int reverse(unsigned int nCode,
+								unsigned int nLength);
+	static void getFixedLengths(unsigned char* pLiteralLength,
+								unsigned char* pDistanceLength);
+	
+	static const unsigned short nLengthBase__[];
+	static const unsigned char nLengthExtra__[];
+	static const unsigned short nDistanceBase__[];
+	static const unsigned char nDistanceExtra__[];
+	static const unsigned char nCodeLengthOrder__[];
+};
+
+const unsigned short qs::DeflateUtil::nLengthBase__[] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+const unsigned char qs::DeflateUtil::nLengthExtra__[] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+const unsigned short qs::DeflateUtil::nDistanceBase__[] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+
+const unsigned char qs::DeflateUtil::nDistanceExtra__[] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+const unsigned char qs::DeflateUtil::nCodeLengthOrder__[] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+void qs::DeflateUtil::getCodes(const unsigned char* pLength,
+							   unsigned int nCount,
+							   unsigned short* pCode)
+{
+	unsigned int nLengthCount[MAX_BITS + 1] = { 0 };
+	for (unsigned int n = 0; n < nCount; ++n)
+		++nLengthCount[pLength[n]];
+	nLengthCount[0] = 0;
+	
+	unsigned int nNextCode[MAX_BITS + 1] = { 0 };
+	unsigned int nCode = 0;
+	for (unsigned int nBits = 1; nBits <= MAX_BITS; ++nBits) {
+		nCode = (nCode + nLengthCount[nBits - 1]) << 1;
+		nNextCode[nBits] = nCode;
+	}
+	
+	for (unsigned int n = 0; n < nCount; ++n) {
+		unsigned int nLength = pLength[n];
+		pCode[n] = nLength != 0 ?
+			static_cast<unsigned short>(reverse(nNextCode[nLength]++, nLength)) : 0;
+	}
+}
+
+unsigned int qs::DeflateUtil::reverse(unsigned int nCode,
+									  unsigned int nLength)
+{
+	unsigned int nReversed = 0;
+	for (unsigned int n = 0; n < nLength; ++n) {
+		nReversed = (nReversed << 1) | (nCode & 1);
+		nCode >>= 1;
+	}
+	return nReversed;
+}
+
+void qs::DeflateUtil::getFixedLengths(unsigned char* pLiteralLength,
+									  unsigned char* pDistanceLength)
+{
+	unsigned int n = 0;
+	for (; n < 144; ++n)
+		pLiteralLength[n] = 8;
+	for (; n < 256; ++n)
+		pLiteralLength[n] = 9;
+	for (; n < 280; ++n)
+		pLiteralLength[n] = 7;
+	for (; n < LITERAL_COUNT; ++n)
+		pLiteralLength[n] = 8;
+	
+	for (n = 0; n < DISTANCE_COUNT; ++n)
+		pDistanceLength[n] = 5;
+}
+
+
+/****************************************************************************
+ *
+ * DeflaterImpl
+ *
+ */
+
+struct qs::DeflaterImpl
+{
+	enum {
+		HASH_BITS		= 15,
+		HASH_SIZE		= 1 << HASH_BITS,
+		WINDOW_MASK		= DeflateUtil::WINDOW_SIZE - 1,
+		MAX_CHAIN		= 32,
+		GOOD_MATCH		= 64,
+		MAX_INSERT		= 32,
+		TOO_FAR			= 4096,
+		MAX_SYMBOL		= 16384,
+		MAX_STORED		= 65535
+	};
+	
+	struct Symbol
+	{
+		unsigned short nLength_;
+		unsigned short nDistance_;
+	};
+	
+	typedef std::vector<unsigned char> Buffer;
+	typedef std::vector<unsigned int> PositionList;
+	typedef std::vector<Symbol> SymbolList;
+	
+	void init();
+	void compress();
+	unsigned int insert(size_t nPos);
+	void writeBlock(bool bFinal);
+	void writeStored(bool bFinal);
+	void writeCodes(const unsigned char* pLiteralLength,
+					const unsigned char* pDistanceLength);
+	unsigned int getCodesCost(const unsigned char* pLiteralLength,
+							  const unsigned char* pDistanceLength) const;
+	void putBits(unsigned int nValue,
+				 unsigned int nBits);
+	void alignBits();
+	
+	static unsigned int getLengthCode(unsigned int nLength);
+	static unsigned int getDistanceCode(unsigned int nDistance);
+	static void buildLengths(const unsigned int* pFreq,
+							 unsigned int nCount,
+							 unsigned int nMaxBits,
+							 unsigned char* pLength);
+	
+	Buffer window_;
+	size_t nPos_;
+	size_t nBlockStart_;
+	unsigned int nBase_;
+	PositionList listHead_;
+	PositionList listPrev_;
+	SymbolList listSymbol_;
+	Buffer out_;
+	unsigned int nBitBuf_;
+	unsigned int nBitCount_;
+	bool bFinished_;
+};
+
+void qs::DeflaterImpl::init()
+{
+	nPos_ = 0;
+	nBlockStart_ = 0;
+	nBase_ = 0;
+	listHead_.resize(HASH_SIZE);
+	listPrev_.resize(DeflateUtil::WINDOW_SIZE);
+	listSymbol_.reserve(MAX_SYMBOL);
+	nBitBuf_ = 0;
+	nBitCount_ = 0;
+	bFinished_ = false;
+}
+
+void qs::DeflaterImpl::compress()
+{
+	const size_t nEnd = window_.size();
+	while (nPos_ < nEnd) {
+		size_t nAvail = nEnd - nPos_;
+		unsigned int nMatchLength = 0;
+		unsigned int nMatchDistance = 0;
+		if (nAvail >= DeflateUtil::MIN_MATCH) {
+			unsigned int nPos = nBase_ + static_cast<unsigned int>(nPos_);
+			unsigned int nCandidate = insert(nPos_);
+			
+			unsigned int nMaxLength = static_cast<unsigned int>(
+				QSMIN(nAvail, static_cast<size_t>(DeflateUtil::MAX_MATCH)));
+			unsigned int nLimit = static_cast<unsigned int>(
+				QSMIN(nPos_, static_cast<size_t>(DeflateUtil::WINDOW_SIZE)));
+			const unsigned char* pCurrent = &window_[nPos_];
+			for (int nChain = MAX_CHAIN; nChain > 0; --nChain) {
+				// Positions in the hash chain are only hints. They are
+				// checked by comparing bytes, so that it doesn't matter
+				// if a position wraps around or is overwritten.
+				unsigned int nDistance = nPos - nCandidate;
+				if (nDistance == 0 || nDistance > nLimit)
+					break;
+				
+				const unsigned char* pMatch = pCurrent - nDistance;
+				if (pMatch[nMatchLength] == pCurrent[nMatchLength] &&
+					pMatch[0] == pCurrent[0]) {
+					unsigned int nLength = 0;
+					while (nLength < nMaxLength && pMatch[nLength] == pCurrent[nLength])
+						++nLength;
+					if (nLength > nMatchLength) {
+						nMatchLength = nLength;
+						nMatchDistance = nDistance;
+						if (nLength >= nMaxLength || nLength >= GOOD_MATCH)
+							break;
+					}
+				}
+				
+				unsigned int nNext = listPrev_[nCandidate & WINDOW_MASK];
+				if (nPos - nNext <= nDistance)
+					break;
+				nCandidate = nNext;
+			}
+			if (nMatchLength == DeflateUtil::MIN_MATCH && nMatchDistance > TOO_FAR)
+				nMatchLength = 0;
+		}
+		
+		if (nMatchLength >= DeflateUtil::MIN_MATCH) {
+			Symbol symbol = {
+				static_cast<unsigned short>(nMatchLength),
+				static_cast<unsigned short>(nMatchDistance)
+			};
+			listSymbol_.push_back(symbol);
+			
+			if (nMatchLength <= MAX_INSERT) {
+				for (unsigned int n = 1; n < nMatchLength; ++n) {
+					if (nEnd - (nPos_ + n) >= DeflateUtil::MIN_MATCH)
+						insert(nPos_ + n);
+				}
+			}
+			nPos_ += nMatchLength;
+		}
+		else {
+			Symbol symbol = { window_[nPos_], 0 };
+			listSymbol_.push_back(symbol);
+			++nPos_;
+		}
+		
+		if (listSymbol_.size() >= MAX_SYMBOL)
+			writeBlock(false);
+	}
+}
+
+unsigned int qs::DeflaterImpl::insert(size_t nPos)
+{
+	const unsigned char* p = &window_[nPos];
+	unsigned int nHash = ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (HASH_SIZE - 1);
+	unsigned int nGlobalPos = nBase_ + static_cast<unsigned int>(nPos);
+	unsigned int nPrev = listHead_[nHash];
+	listHead_[nHash] = nGlobalPos;
+	listPrev_[nGlobalPos & WINDOW_MASK] = nPrev;
+	return nPrev;
+}
+
+void qs::DeflaterImpl::writeBlock(bool bFinal)
+{
+	unsigned int nLiteralFreq[DeflateUtil::LITERAL_COUNT] = { 0 };
+	unsigned int nDistanceFreq[DeflateUtil::DISTANCE_COUNT] = { 0 };
+	for (SymbolList::const_iterator it = listSymbol_.begin(); it != listSymbol_.end(); ++it) {
+		const Symbol& symbol = *it;
+		if (symbol.nDistance_ == 0) {
+			++nLiteralFreq[symbol.nLength_];
+		}
+		else {
+			++nLiteralFreq[257 + getLengthCode(symbol.nLength_)];
+			++nDistanceFreq[getDistanceCode(symbol.nDistance_)];
+		}
+	}
+	++nLiteralFreq[DeflateUtil::END_OF_BLOCK];
+	
+	// A code with only one symbol is incomplete and some decoders reject it
+	if (std::count_if(nDistanceFreq, nDistanceFreq + DeflateUtil::DISTANCE_COUNT,
+		std::bind2nd(std::not_equal_to<unsigned int>(), 0)) < 2) {
+		nDistanceFreq[0] = QSMAX(nDistanceFreq[0], 1U);
+		nDistanceFreq[1] = QSMAX(nDistanceFreq[1], 1U);
+	}
+	if (listSymbol_.empty())
+		nLiteralFreq[0] = 1;
+	
+	unsigned char nLiteralLength[DeflateUtil::LITERAL_COUNT];
+	unsigned char nDistanceLength[DeflateUtil::DISTANCE_COUNT];
+	buildLengths(nLiteralFreq, 286, DeflateUtil::MAX_BITS, nLiteralLength);
+	nLiteralLength[286] = 0;
+	nLiteralLength[287] = 0;
+	buildLengths(nDistanceFreq, DeflateUtil::DISTANCE_COUNT,
+		DeflateUtil::MAX_BITS, nDistanceLength);
+	
+	unsigned int nLiteralCount = 286;
+	while (nLiteralCount > 257 && nLiteralLength[nLiteralCount - 1] == 0)
+		--nLiteralCount;
+	unsigned int nDistanceCount = DeflateUtil::DISTANCE_COUNT;
+	while (nDistanceCount > 1 && nDistanceLength[nDistanceCount - 1] == 0)
+		--nDistanceCount;
+	
+	// Run length encode code lengths. Each element holds a code in
+	// the lower byte and the value of extra bits in the upper byte.
+	unsigned char nLengths[286 + DeflateUtil::DISTANCE_COUNT];
+	std::copy(nLiteralLength, nLiteralLength + nLiteralCount, nLengths);
+	std::copy(nDistanceLength, nDistanceLength + nDistanceCount, nLengths + nLiteralCount);
+	unsigned int nLengthCount = nLiteralCount + nDistanceCount;
+	
+	std::vector<unsigned short> listCodeLength;
+	listCodeLength.reserve(nLengthCount);
+	unsigned int nCodeLengthFreq[DeflateUtil::CODELENGTH_COUNT] = { 0 };
+	for (unsigned int n = 0; n < nLengthCount; ) {
+		unsigned int nLength = nLengths[n];
+		unsigned int nRun = 1;
+		while (n + nRun < nLengthCount && nLengths[n + nRun] == nLength)
+			++nRun;
+		n += nRun;
+		
+		if (nLength == 0) {
+			while (nRun >= 11) {
+				unsigned int nRep = QSMIN(nRun, 138U);
+				listCodeLength.push_back(static_cast<unsigned short>(18 | ((nRep - 11) << 8)));
+				++nCodeLengthFreq[18];
+				nRun -= nRep;
+			}
+			if (nRun >= 3) {
+				listCodeLength.push_back(static_cast<unsigned short>(17 | ((nRun - 3) << 8)));
+				++nCodeLengthFreq[17];
+				nRun = 0;
+			}
+		}
+		else {
+			listCodeLength.push_back(static_cast<unsigned short>(nLength));
+			++nCodeLengthFreq[nLength];
+			--nRun;
+			while (nRun >= 3) {
+				unsigned int nRep = QSMIN(nRun, 6U);
+				listCodeLength.push_back(static_cast<unsigned short>(16 | ((nRep - 3) << 8)));
+				++nCodeLengthFreq[16];
+				nRun -= nRep;
+			}
+		}
+		for (; nRun > 0; --nRun) {
+			listCodeLength.push_back(static_cast<unsigned short>(nLength));
+			++nCodeLengthFreq[nLength];
+		}
+	}
+	if (std::count_if(nCodeLengthFreq, nCodeLengthFreq + DeflateUtil::CODELENGTH_COUNT,
+		std::bind2nd(std::not_equal_to<unsigned int>(), 0)) < 2) {
+		nCodeLengthFreq[0] = QSMAX(nCodeLengthFreq[0], 1U);
+		nCodeLengthFreq[1] = QSMAX(nCodeLengthFreq[1], 1U);
+	}
+	
+	unsigned char nCodeLengthLength[DeflateUtil::CODELENGTH_COUNT];
+	buildLengths(nCodeLengthFreq, DeflateUtil::CODELENGTH_COUNT,
+		DeflateUtil::MAX_CODELENGTH_BITS, nCodeLengthLength);
+	unsigned int nCodeLengthCount = DeflateUtil::CODELENGTH_COUNT;
+	while (nCodeLengthCount > 4 &&
+		nCodeLengthLength[DeflateUtil::nCodeLengthOrder__[nCodeLengthCount - 1]] == 0)
+		--nCodeLengthCount;
+	
+	unsigned int nDynamicCost = 5 + 5 + 4 + nCodeLengthCount*3;
+	for (unsigned int n = 0; n < DeflateUtil::CODELENGTH_COUNT; ++n)
+		nDynamicCost += nCodeLengthFreq[n]*nCodeLengthLength[n];
+	nDynamicCost += nCodeLengthFreq[16]*2 + nCodeLengthFreq[17]*3 + nCodeLengthFreq[18]*7;
+	nDynamicCost += getCodesCost(nLiteralLength, nDistanceLength);
+	
+	unsigned char nFixedLiteralLength[DeflateUtil::LITERAL_COUNT];
+	unsigned char nFixedDistanceLength[DeflateUtil::DISTANCE_COUNT];
+	DeflateUtil::getFixedLengths(nFixedLiteralLength, nFixedDistanceLength);
+	unsigned int nFixedCost = getCodesCost(nFixedLiteralLength, nFixedDistanceLength);
+	
+	size_t nStoredLength = nPos_ - nBlockStart_;
+	size_t nStoredCost = (nStoredLength + (nStoredLength/MAX_STORED + 1)*5)*8;
+	
+	if (nStoredCost < QSMIN(nDynamicCost, nFixedCost)) {
+		writeStored(bFinal);
+	}
+	else if (nFixedCost <= nDynamicCost) {
+		putBits(bFinal ? 1 : 0, 1);
+		putBits(1, 2);
+		writeCodes(nFixedLiteralLength, nFixedDistanceLength);
+	}
+	else {
+		putBits(bFinal ? 1 : 0, 1);
+		putBits(2, 2);
+		putBits(nLiteralCount - 257, 5);
+		putBits(nDistanceCount - 1, 5);
+		putBits(nCodeLengthCount - 4, 4);
+		for (unsigned int n = 0; n < nCodeLengthCount; ++n)
+			putBits(nCodeLengthLength[DeflateUtil::nCodeLengthOrder__[n]], 3);
+		
+		unsigned short nCodeLengthCode[DeflateUtil::CODELENGTH_COUNT];
+		DeflateUtil::getCodes(nCodeLengthLength, DeflateUtil::CODELENGTH_COUNT, nCodeLengthCode);
+		for (std::vector<unsigned short>::const_iterator it = listCodeLength.begin(); it != listCodeLength.end(); ++it) {
+			unsigned int nCode = *it & 0xff;
+			unsigned int nExtra = *it >> 8;
+			putBits(nCodeLengthCode[nCode], nCodeLengthLength[nCode]);
+			switch (nCode) {
+			case 16:
+				putBits(nExtra, 2);
+				break;
+			case 17:
+				putBits(nExtra, 3);
+				break;
+			case 18:
+				putBits(nExtra, 7);
+				break;
+			}
+		}
+		
+		writeCodes(nLiteralLength, nDistanceLength);
+	}
+	
+	listSymbol_.clear();
+	nBlockStart_ = nPos_;
+}
+
+void qs::DeflaterImpl::writeStored(bool bFinal)
+{
+	size_t nPos = nBlockStart_;
+	do {
+		size_t nLength = QSMIN(nPos_ - nPos, static_cast<size_t>(MAX_STORED));
+		bool bLast = nPos + nLength == nPos_;
+		putBits(bFinal && bLast ? 1 : 0, 1);
+		putBits(0, 2);
+		alignBits();
+		out_.push_back(static_cast<unsigned char>(nLength & 0xff));
+		out_.push_back(static_cast<unsigned char>(nLength >> 8));
+		out_.push_back(static_cast<unsigned char>(~nLength & 0xff));
+		out_.push_back(static_cast<unsigned char>((~nLength >> 8) & 0xff));
+		out_.insert(out_.end(), window_.begin() + nPos, window_.begin() + nPos + nLength);
+		nPos += nLength;
+	} while (nPos < nPos_);
+}
+
+void qs::DeflaterImpl::writeCodes(const unsigned char* pLiteralLength,
+								  const unsigned char* pDistanceLength)
+{
+	unsigned short nLiteralCode[DeflateUtil::LITERAL_COUNT];
+	DeflateUtil::getCodes(pLiteralLength, DeflateUtil::LITERAL_COUNT, nLiteralCode);
+	unsigned short nDistanceCode[DeflateUtil::DISTANCE_COUNT];
+	DeflateUtil::getCodes(pDistanceLength, DeflateUtil::DISTANCE_COUNT, nDistanceCode);
+	
+	for (SymbolList::const_iterator it = listSymbol_.begin(); it != listSymbol_.end(); ++it) {
+		const Symbol& symbol = *it;
+		if (symbol.nDistance_ == 0) {
+			putBits(nLiteralCode[symbol.nLength_], pLiteralLength[symbol.nLength_]);
+		}
+		else {
+			unsigned int nLengthCode = getLengthCode(symbol.nLength_);
+			putBits(nLiteralCode[257 + nLengthCode], pLiteralLength[257 + nLengthCode]);
+			putBits(symbol.nLength_ - DeflateUtil::nLengthBase__[nLengthCode],
+				DeflateUtil::nLengthExtra__[nLengthCode]);
+			
+			unsigned int nDistanceSymbol = getDistanceCode(symbol.nDistance_);
+			putBits(nDistanceCode[nDistanceSymbol], pDistanceLength[nDistanceSymbol]);
+			putBits(symbol.nDistance_ - DeflateUtil::nDistanceBase__[nDistanceSymbol],
+				DeflateUtil::nDistanceExtra__[nDistanceSymbol]);
+		}
+	}
+	putBits(nLiteralCode[DeflateUtil::END_OF_BLOCK],
+		pLiteralLength[DeflateUtil::END_OF_BLOCK]);
+}
+
+unsigned int qs::DeflaterImpl::getCodesCost(const unsigned char* pLiteralLength,
+											const unsigned char* pDistanceLength) const
+{
+	unsigned int nCost = 3 + pLiteralLength[DeflateUtil::END_OF_BLOCK];
+	for (SymbolList::const_iterator it = listSymbol_.begin(); it != listSymbol_.end(); ++it) {
+		const Symbol& symbol = *it;
+		if (symbol.nDistance_ == 0) {
+			nCost += pLiteralLength[symbol.nLength_];
+		}
+		else {
+			unsigned int nLengthCode = getLengthCode(symbol.nLength_);
+			unsigned int nDistanceCode = getDistanceCode(symbol.nDistance_);
+			nCost += pLiteralLength[257 + nLengthCode] +
+				DeflateUtil::nLengthExtra__[nLengthCode] +
+				pDistanceLength[nDistanceCode] +
+				DeflateUtil::nDistanceExtra__[nDistanceCode];
+		}
+	}
+	return nCost;
+}
+
+void qs::DeflaterImpl::putBits(unsigned int nValue,
+							   unsigned int nBits)
+{
+	assert(nBits <= 16);
+	
+	nBitBuf_ |= nValue << nBitCount_;
+	nBitCount_ += nBits;
+	while (nBitCount_ >= 8) {
+		out_.push_back(static_cast<unsigned char>(nBitBuf_ & 0xff));
+		nBitBuf_ >>= 8;
+		nBitCount_ -= 8;
+	}
+}
+
+void qs::DeflaterImpl::alignBits()
+{
+	if (nBitCount_ != 0) {
+		out_.push_back(static_cast<unsigned char>(nBitBuf_ & 0xff));
+		nBitBuf_ = 0;
+		nBitCount_ = 0;
+	}
+}
+
+unsigned int qs::DeflaterImpl::getLengthCode(unsigned int nLength)
+{
+	assert(DeflateUtil::MIN_MATCH <= nLength && nLength <= DeflateUtil::MAX_MATCH);
+	
+	if (nLength == DeflateUtil::MAX_MATCH)
+		return 28;
+	const unsigned short* p = std::upper_bound(DeflateUtil::nLengthBase__,
+		DeflateUtil::nLengthBase__ + 28, static_cast<unsigned short>(nLength));
+	return static_cast<unsigned int>(p - DeflateUtil::nLengthBase__) - 1;
+}
+
+unsigned int qs::DeflaterImpl::getDistanceCode(unsigned int nDistance)
+{
+	assert(1 <= nDistance && nDistance <= DeflateUtil::WINDOW_SIZE);
+	
+	const unsigned short* p = std::upper_bound(DeflateUtil::nDistanceBase__,
+		DeflateUtil::nDistanceBase__ + DeflateUtil::DISTANCE_COUNT,
+		static_cast<unsigned short>(nDistance));
+	return static_cast<unsigned int>(p - DeflateUtil::nDistanceBase__) - 1;
+}
+
+void qs::DeflaterImpl::buildLengths(const unsigned int* pFreq,
+									unsigned int nCount,
+									unsigned int nMaxBits,
+									unsigned char* pLength)
+{
+	std::fill(pLength, pLength + nCount, 0);
+	
+	typedef std::vector<std::pair<unsigned int, unsigned int> > LeafList;
+	LeafList listLeaf;
+	for (unsigned int n = 0; n < nCount; ++n) {
+		if (pFreq[n] != 0)
+			listLeaf.push_back(std::make_pair(pFreq[n], n));
+	}
+	if (listLeaf.empty())
+		return;
+	if (listLeaf.size() == 1) {
+		pLength[listLeaf[0].second] = 1;
+		return;
+	}
+	std::sort(listLeaf.begin(), listLeaf.end());
+	
+	// Build a Huffman tree by merging the two lightest nodes. Leaves are
+	// sorted and merged nodes are created in order of their weights,
+	// so that the lightest node is always at the head of one of them.
+	size_t nLeafCount = listLeaf.size();
+	std::vector<unsigned int> listWeight(nLeafCount - 1);
+	std::vector<size_t> listParent(nLeafCount*2 - 1);
+	size_t nLeaf = 0;
+	size_t nNode = 0;
+	for (size_t n = 0; n < nLeafCount - 1; ++n) {
+		unsigned int nWeight = 0;
+		for (int m = 0; m < 2; ++m) {
+			if (nLeaf < nLeafCount &&
+				(nNode == n || listLeaf[nLeaf].first <= listWeight[nNode])) {
+				nWeight += listLeaf[nLeaf].first;
+				listParent[nLeaf] = nLeafCount + n;
+				++nLeaf;
+			}
+			else {
+				nWeight += listWeight[nNode];
+				listParent[nLeafCount + nNode] = nLeafCount + n;
+				++nNode;
+			}
+		}
+		listWeight[n] = nWeight;
+	}
+	
+	std::vector<unsigned int> listDepth(nLeafCount*2 - 1);
+	listDepth[nLeafCount*2 - 2] = 0;
+	for (size_t n = nLeafCount*2 - 2; n > 0; --n)
+		listDepth[n - 1] = listDepth[listParent[n - 1]] + 1;
+	
+	unsigned int nLengthCount[DeflateUtil::MAX_BITS + 1] = { 0 };
+	for (size_t n = 0; n < nLeafCount; ++n)
+		++nLengthCount[QSMIN(listDepth[n], nMaxBits)];
+	
+	// Clamping the depth makes the code over-subscribed. Lengthen the codes
+	// until the code becomes complete again.
+	unsigned int nTotal = 0;
+	for (unsigned int nBits = nMaxBits; nBits > 0; --nBits)
+		nTotal += nLengthCount[nBits] << (nMaxBits - nBits);
+	while (nTotal != 1U << nMaxBits) {
+		--nLengthCount[nMaxBits];
+		for (unsigned int nBits = nMaxBits - 1; nBits > 0; --nBits) {
+			if (nLengthCount[nBits] != 0) {
+				--nLengthCount[nBits];
+				nLengthCount[nBits + 1] += 2;
+				break;
+			}
+		}
+		--nTotal;
+	}
+	
+	// The heaviest leaves get the shortest codes
+	LeafList::const_reverse_iterator it = listLeaf.rbegin();
+	for (unsigned int nBits = 1; nBits <= nMaxBits; ++nBits) {
+		for (unsigned int n = 0; n < nLengthCount[nBits]; ++n, ++it)
+			pLength[(*it).second] = static_cast<unsigned char>(nBits);
+	}
+}
+
+
+/****************************************************************************
+ *
+ * Deflater
+ *
+ */
+
+qs::Deflater::Deflater() :
+	pImpl_(0)
+{
+	pImpl_ = new DeflaterImpl();
+	pImpl_->init();
+}
+
+qs::Deflater::~Deflater()
+{
+	delete pImpl_;
+}
+
+bool qs::Deflater::deflate(const unsigned char* p,
+						   size_t nLen,
+						   Flush flush,
+						   OutputStream* pOutputStream)
+{
+	assert(p || nLen == 0);
+	assert(pOutputStream);
+	
+	if (pImpl_->bFinished_)
+		return false;
+	
+	DeflaterImpl::Buffer& window = pImpl_->window_;
+	
+	// Drop data which is not referred any more
+	size_t nKeep = pImpl_->nPos_ > DeflateUtil::WINDOW_SIZE ?
+		pImpl_->nPos_ - DeflateUtil::WINDOW_SIZE : 0;
+	nKeep = QSMIN(nKeep, pImpl_->nBlockStart_);
+	if (nKeep != 0) {
+		window.erase(window.begin(), window.begin() + nKeep);
+		pImpl_->nBase_ += static_cast<unsigned int>(nKeep);
+		pImpl_->nPos_ -= nKeep;
+		pImpl_->nBlockStart_ -= nKeep;
+	}
+	
+	window.insert(window.end(), p, p + nLen);
+	pImpl_->compress();
+	
+	switch (flush) {
+	case FLUSH_NONE:
+		break;
+	case FLUSH_SYNC:
+		if (!pImpl_->listSymbol_.empty())
+			pImpl_->writeBlock(false);
+		pImpl_->putBits(0, 3);
+		pImpl_->alignBits();
+		pImpl_->out_.push_back(0x00);
+		pImpl_->out_.push_back(0x00);
+		pImpl_->out_.push_back(0xff);
+		pImpl_->out_.push_back(0xff);
+		break;
+	case FLUSH_FINISH:
+		pImpl_->writeBlock(true);
+		pImpl_->alignBits();
+		pImpl_->bFinished_ = true;
+		break;
+	default:
+		assert(false);
+		break;
+	}
+	
+	DeflaterImpl::Buffer& out = pImpl_->out_;
+	if (!out.empty()) {
+		if (pOutputStream->write(&out[0], out.size()) == -1)
+			return false;
+		out.clear();
+	}
+	
+	return true;
+}
+
+malloc_size_ptr<unsigned char> qs::Deflater::deflate(const unsigned char* p,
+													 size_t nLen)
+{
+	Deflater deflater;
+	ByteOutputStream stream;
+	if (!stream.reserve(nLen/2 + 64) ||
+		!deflater.deflate(p, nLen, FLUSH_FINISH, &stream))
+		return malloc_size_ptr<unsigned char>();
+	return stream.releaseSizeBuffer();
+}
+
+
+/****************************************************************************
+ *
+ * InflaterImpl
+ *
+ */
+
+struct qs::InflaterImpl
+{
+	enum {
+		FAST_BITS	= 9
+	};
+	
+	enum State {
+		STATE_HEADER,
+		STATE_STORED,
+		STATE_CODES,
+		STATE_DONE
+	};
+	
+	enum Result {
+		RESULT_SUCCESS,
+		RESULT_MORE,
+		RESULT_ERROR
+	};
+	
+	struct Huffman
+	{
+		unsigned short nCount_[DeflateUtil::MAX_BITS + 1];
+		unsigned short nSymbol_[DeflateUtil::LITERAL_COUNT];
+		unsigned short nFast_[1 << FAST_BITS];
+	};
+	
+	typedef std::vector<unsigned char> Buffer;
+	
+	Result process();
+	Result readHeader();
+	Result readStored();
+	Result readTables();
+	Result readCodes();
+	unsigned int getAvailableBits() const;
+	unsigned int peekBits(unsigned int nBits) const;
+	bool getBits(unsigned int nBits,
+				 unsigned int* pnValue);
+	Result decode(const Huffman& huffman,
+				  unsigned int* pnSymbol);
+	
+	static bool build(const unsigned char* pLength,
+					  unsigned int nCount,
+					  Huffman* pHuffman);
+	
+	Buffer in_;
+	size_t nBitPos_;
+	Buffer window_;
+	State state_;
+	bool bFinal_;
+	unsigned int nStoredLength_;
+	Huffman literal_;
+	Huffman distance_;
+};
+
+qs::InflaterImpl::Result qs::InflaterImpl::process()
+{
+	while (true) {
+		Result result = RESULT_SUCCESS;
+		switch (state_) {
+		case STATE_HEADER:
+			result = readHeader();
+			break;
+		case STATE_STORED:
+			result = readStored();
+			break;
+		case STATE_CODES:
+			result = readCodes();
+			break;
+		case STATE_DONE:
+			return RESULT_SUCCESS;
+		default:
+			assert(false);
+			return RESULT_ERROR;
+		}
+		if (result != RESULT_SUCCESS)
+			return result;
+	}
+}
+
+qs::InflaterImpl::Result qs::InflaterImpl::readHeader()
+{
+	if (bFinal_) {
+		state_ = STATE_DONE;
+		return RESULT_SUCCESS;
+	}
+	
+	// A block header is read at once, or not read at all
+	size_t nBitPos = nBitPos_;
+	
+	unsigned int nHeader = 0;
+	if (!getBits(3, &nHeader))
+		return RESULT_MORE;
+	
+	Result result = RESULT_SUCCESS;
+	switch (nHeader >> 1) {
+	case 0:
+		{
+			nBitPos_ = (nBitPos_ + 7) & ~static_cast<size_t>(7);
+			unsigned int nLength = 0;
+			unsigned int nComplement = 0;
+			if (!getBits(16, &nLength) || !getBits(16, &nComplement)) {
+				result = RESULT_MORE;
+			}
+			else if (nLength != (~nComplement & 0xffff)) {
+				result = RESULT_ERROR;
+			}
+			else {
+				nStoredLength_ = nLength;
+				state_ = STATE_STORED;
+			}
+		}
+		break;
+	case 1:
+		{
+			unsigned char nLiteralLength[DeflateUtil::LITERAL_COUNT];
+			unsigned char nDistanceLength[DeflateUtil::DISTANCE_COUNT];
+			DeflateUtil::getFixedLengths(nLiteralLength, nDistanceLength);
+			build(nLiteralLength, DeflateUtil::LITERAL_COUNT, &literal_);
+			build(nDistanceLength, DeflateUtil::DISTANCE_COUNT, &distance_);
+			state_ = STATE_CODES;
+		}
+		break;
+	case 2:
+		result = readTables();
+		if (result == RESULT_SUCCESS)
+			state_ = STATE_CODES;
+		break;
+	default:
+		result = RESULT_ERROR;
+		break;
+	}
+	
+	if (result == RESULT_MORE)
+		nBitPos_ = nBitPos;
+	else if (result == RESULT_SUCCESS)
+		bFinal_ = (nHeader & 1) != 0;
+	return result;
+}
+
+qs::InflaterImpl::Result qs::InflaterImpl::readStored()
+{
+	assert((nBitPos_ & 7) == 0);
+	
+	size_t nPos = nBitPos_ >> 3;
+	size_t nLength = QSMIN(static_cast<size_t>(nStoredLength_), in_.size() - nPos);
+	window_.insert(window_.end(), in_.begin() + nPos, in_.begin() + nPos + nLength);
+	nBitPos_ += nLength << 3;
+	nStoredLength_ -= static_cast<unsigned int>(nLength);
+	
+	if (nStoredLength_ != 0)
+		return RESULT_MORE;
+	state_ = STATE_HEADER;
+	return RESULT_SUCCESS;
+}
+
+qs::InflaterImpl::Result qs::InflaterImpl::readTables()
+{
+	unsigned int nLiteralCount = 0;
+	unsigned int nDistanceCount = 0;
+	unsigned int nCodeLengthCount = 0;
+	if (!getBits(5, &nLiteralCount) ||
+		!getBits(5, &nDistanceCount) ||
+		!getBits(4, &nCodeLengthCount))
+		return RESULT_MORE;
+	nLiteralCount += 257;
+	nDistanceCount += 1;
+	nCodeLengthCount += 4;
+	if (nLiteralCount > 286 || nDistanceCount > DeflateUtil::DISTANCE_COUNT)
+		return RESULT_ERROR;
+	
+	unsigned char nCodeLengthLength[DeflateUtil::CODELENGTH_COUNT] = { 0 };
+	for (unsigned int n = 0; n < nCodeLengthCount; ++n) {
+		unsigned int nLength = 0;
+		if (!getBits(3, &nLength))
+			return RESULT_MORE;
+		nCodeLengthLength[DeflateUtil::nCodeLengthOrder__[n]] = static_cast<unsigned char>(nLength);
+	}
+	Huffman codeLength;
+	if (!build(nCodeLengthLength, DeflateUtil::CODELENGTH_COUNT, &codeLength))
+		return RESULT_ERROR;
+	
+	unsigned char nLengths[286 + DeflateUtil::DISTANCE_COUNT];
+	unsigned int nCount = nLiteralCount + nDistanceCount;
+	for (unsigned int n = 0; n < nCount; ) {
+		unsigned int nSymbol = 0;
+		Result result = decode(codeLength, &nSymbol);
+		if (result != RESULT_SUCCESS)
+			return result;
+		
+		if (nSymbol < 16) {
+			nLengths[n++] = static_cast<unsigned char>(nSymbol);
+		}
+		else {
+			unsigned char nLength = 0;
+			unsigned int nRepeat = 0;
+			switch (nSymbol) {
+			case 16:
+				if (n == 0)
+					return RESULT_ERROR;
+				nLength = nLengths[n - 1];
+				if (!getBits(2, &nRepeat))
+					return RESULT_MORE;
+				nRepeat += 3;
+				break;
+			case 17:
+				if (!getBits(3, &nRepeat))
+					return RESULT_MORE;
+				nRepeat += 3;
+				break;
+			case 18:
+				if (!getBits(7, &nRepeat))
+					return RESULT_MORE;
+				nRepeat += 11;
+				break;
+			default:
+				return RESULT_ERROR;
+			}
+			if (n + nRepeat > nCount)
+				return RESULT_ERROR;
+			std::fill(nLengths + n, nLengths + n + nRepeat, nLength);
+			n += nRepeat;
+		}
+	}
+	if (nLengths[DeflateUtil::END_OF_BLOCK] == 0)
+		return RESULT_ERROR;
+	
+	if (!build(nLengths, nLiteralCount, &literal_) ||
+		!build(nLengths + nLiteralCount, nDistanceCount, &distance_))
+		return RESULT_ERROR;
+	
+	return RESULT_SUCCESS;
+}
+
+qs::InflaterImpl::Result qs::InflaterImpl::readCodes()
+{
+	while (true) {
+		// A symbol is read with its extra bits and its distance at once,
+		// or not read at all
+		size_t nBitPos = nBitPos_;
+		
+		unsigned int nSymbol = 0;
+		Result result = decode(literal_, &nSymbol);
+		if (result != RESULT_SUCCESS)
+			return result;
+		
+		if (nSymbol < DeflateUtil::END_OF_BLOCK) {
+			window_.push_back(static_cast<unsigned char>(nSymbol));
+		}
+		else if (nSymbol == DeflateUtil::END_OF_BLOCK) {
+			state_ = STATE_HEADER;
+			return RESULT_SUCCESS;
+		}
+		else {
+			nSymbol -= 257;
+			if (nSymbol >= 29)
+				return RESULT_ERROR;
+			unsigned int nExtra = 0;
+			if (!getBits(DeflateUtil::nLengthExtra__[nSymbol], &nExtra)) {
+				nBitPos_ = nBitPos;
+				return RESULT_MORE;
+			}
+			unsigned int nLength = DeflateUtil::nLengthBase__[nSymbol] + nExtra;
+			
+			unsigned int nDistanceSymbol = 0;
+			result = decode(distance_, &nDistanceSymbol);
+			if (result == RESULT_MORE)
+				nBitPos_ = nBitPos;
+			if (result != RESULT_SUCCESS)
+				return result;
+			if (nDistanceSymbol >= DeflateUtil::DISTANCE_COUNT)
+				return RESULT_ERROR;
+			if (!getBits(DeflateUtil::nDistanceExtra__[nDistanceSymbol], &nExtra)) {
+				nBitPos_ = nBitPos;
+				return RESULT_MORE;
+			}
+			unsigned int nDistance = DeflateUtil::nDistanceBase__[nDistanceSymbol] + nExtra;
+			if (nDistance > window_.size())
+				return RESULT_ERROR;
+			
+			size_t nPos = window_.size() - nDistance;
+			window_.resize(window_.size() + nLength);
+			unsigned char* p = &window_[0];
+			for (unsigned int n = 0; n < nLength; ++n, ++nPos)
+				p[nPos + nDistance] = p[nPos];
+		}
+	}
+}
+
+unsigned int qs::InflaterImpl::getAvailableBits() const
+{
+	size_t nBits = in_.size()*8 - nBitPos_;
+	return nBits > 32 ? 32 : static_cast<unsigned int>(nBits);
+}
+
+unsigned int qs::InflaterImpl::peekBits(unsigned int nBits) const
+{
+	assert(nBits <= 24);
+	
+	size_t nPos = nBitPos_ >> 3;
+	unsigned int nValue = 0;
+	for (size_t n = 0; n < 4 && nPos + n < in_.size(); ++n)
+		nValue |= static_cast<unsigned int>(in_[nPos + n]) << (n*8);
+	return (nValue >> (nBitPos_ & 7)) & ((1 << nBits) - 1);
+}
+
+bool qs::InflaterImpl::getBits(unsigned int nBits,
+							   unsigned int* pnValue)
+{
+	assert(pnValue);
+	
+	if (getAvailableBits() < nBits)
+		return false;
+	*pnValue = nBits != 0 ? peekBits(nBits) : 0;
+	nBitPos_ += nBits;
+	return true;
+}
+
+qs::InflaterImpl::Result qs::InflaterImpl::decode(const Huffman& huffman,
+												  unsigned int* pnSymbol)
+{
+	assert(pnSymbol);
+	
+	unsigned int nAvailable = getAvailableBits();
+	unsigned int nBits = peekBits(DeflateUtil::MAX_BITS);
+	
+	unsigned int nFast = huffman.nFast_[nBits & ((1 << FAST_BITS) - 1)];
+	if (nFast != 0) {
+		unsigned int nLength = nFast & 0x0f;
+		if (nLength > nAvailable)
+			return RESULT_MORE;
+		*pnSymbol = nFast >> 4;
+		nBitPos_ += nLength;
+		return RESULT_SUCCESS;
+	}
+	
+	unsigned int nCode = 0;
+	unsigned int nFirst = 0;
+	unsigned int nIndex = 0;
+	for (unsigned int nLength = 1; nLength <= DeflateUtil::MAX_BITS; ++nLength) {
+		if (nLength > nAvailable)
+			return RESULT_MORE;
+		nCode |= (nBits >> (nLength - 1)) & 1;
+		unsigned int nCount = huffman.nCount_[nLength];
+		if (nCode - nFirst < nCount) {
+			*pnSymbol = huffman.nSymbol_[nIndex + nCode - nFirst];
+			nBitPos_ += nLength;
+			return RESULT_SUCCESS;
+		}
+		nIndex += nCount;
+		nFirst = (nFirst + nCount) << 1;
+		nCode <<= 1;
+	}
+	return RESULT_ERROR;
+}
+
+bool qs::InflaterImpl::build(const unsigned char* pLength,
+							 unsigned int nCount,
+							 Huffman* pHuffman)
+{
+	assert(pLength);
+	assert(nCount <= DeflateUtil::LITERAL_COUNT);
+	assert(pHuffman);
+	
+	std::fill(pHuffman->nCount_, pHuffman->nCount_ + DeflateUtil::MAX_BITS + 1, 0);
+	for (unsigned int n = 0; n < nCount; ++n)
+		++pHuffman->nCount_[pLength[n]];
+	
+	int nLeft = 1;
+	for (unsigned int nBits = 1; nBits <= DeflateUtil::MAX_BITS; ++nBits) {
+		nLeft <<= 1;
+		nLeft -= pHuffman->nCount_[nBits];
+		if (nLeft < 0)
+			return false;
+	}
+	
+	unsigned short nOffset[DeflateUtil::MAX_BITS + 1];
+	nOffset[1] = 0;
+	for (unsigned int nBits = 1; nBits < DeflateUtil::MAX_BITS; ++nBits)
+		nOffset[nBits + 1] = nOffset[nBits] + pHuffman->nCount_[nBits];
+	for (unsigned int n = 0; n < nCount; ++n) {
+		if (pLength[n] != 0)
+			pHuffman->nSymbol_[nOffset[pLength[n]]++] = static_cast<unsigned short>(n);
+	}
+	
+	std::fill(pHuffman->nFast_, pHuffman->nFast_ + (1 << FAST_BITS), 0);
+	unsigned short nCode[DeflateUtil::LITERAL_COUNT];
+	DeflateUtil::getCodes(pLength, nCount, nCode);
+	for (unsigned int n = 0; n < nCount; ++n) {
+		unsigned int nLength = pLength[n];
+		if (nLength != 0 && nLength <= FAST_BITS) {
+			unsigned short nFast = static_cast<unsigned short>((n << 4) | nLength);
+			for (unsigned int m = nCode[n]; m < (1 << FAST_BITS); m += 1 << nLength)
+				pHuffman->nFast_[m] = nFast;
+		}
+	}
+	
+	return true;
+}
+
+
+/****************************************************************************
+ *
+ * Inflater
+ *
+ */
+
+qs::Inflater::Inflater() :
+	pImpl_(0)
+{
+	pImpl_ = new InflaterImpl();
+	pImpl_->nBitPos_ = 0;
+	pImpl_->state_ = InflaterImpl::STATE_HEADER;
+	pImpl_->bFinal_ = false;
+	pImpl_->nStoredLength_ = 0;
+}
+
+qs::Inflater::~Inflater()
+{
+	delete pImpl_;
+}
+
+bool qs::Inflater::inflate(const unsigned char* p,
+						   size_t nLen,
+						   OutputStream* pOutputStream)
+{
+	assert(p || nLen == 0);
+	assert(pOutputStream);
+	
+	InflaterImpl::Buffer& in = pImpl_->in_;
+	InflaterImpl::Buffer& window = pImpl_->window_;
+	
+	in.insert(in.end(), p, p + nLen);
+	size_t nStart = window.size();
+	
+	InflaterImpl::Result result = pImpl_->process();
+	
+	if (window.size() != nStart) {
+		if (pOutputStream->write(&window[nStart], window.size() - nStart) == -1)
+			return false;
+	}
+	if (window.size() > DeflateUtil::WINDOW_SIZE)
+		window.erase(window.begin(), window.end() - DeflateUtil::WINDOW_SIZE);
+	
+	size_t nConsumed = pImpl_->nBitPos_ >> 3;
+	in.erase(in.begin(), in.begin() + nConsumed);
+	pImpl_->nBitPos_ -= nConsumed << 3;
+	
+	return result != InflaterImpl::RESULT_ERROR;
+}
+
+bool qs::Inflater::isFinished() const
+{
+	return pImpl_->state_ == InflaterImpl::STATE_DONE;
+}
+
+malloc_size_ptr<unsigned char> qs::Inflater::inflate(const unsigned char* p,
+													 size_t nLen,
+													 size_t nOriginalLen)
+{
+	Inflater inflater;
+	ByteOutputStream stream;
+	if (!stream.reserve(nOriginalLen) ||
+		!inflater.inflate(p, nLen, &stream) ||
+		!inflater.isFinished() ||
+		stream.getLength() != nOriginalLen)
+		return malloc_size_ptr<unsigned char>();
+	return stream.releaseSizeBuffer();
+}
@@ -0,0 +1,434 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#include <qsassert.h>
+#include <qsfile.h>
+
+#include <algorithm>
+
+#include "clustermap.h"
+
+using namespace qs;
+
+
+/****************************************************************************
+ *
+ * ClusterMap
+ *
+ */
+
+qs::ClusterMap::ClusterMap() :
+	nSize_(0),
+	nLeafCount_(0)
+{
+}
+
+qs::ClusterMap::~ClusterMap()
+{
+}
+
+size_t qs::ClusterMap::getSize() const
+{
+	return nSize_;
+}
+
+size_t qs::ClusterMap::getByteSize() const
+{
+	return nSize_/8;
+}
+
+size_t qs::ClusterMap::getUsedByteSize() const
+{
+	WordList::size_type n = listWord_.size();
+	while (n > 0 && listWord_[n - 1] == 0)
+		--n;
+	if (n == 0)
+		return 0;
+	
+	Word w = listWord_[n - 1];
+	size_t nByte = sizeof(Word);
+	while ((w >> ((nByte - 1)*8) & 0xff) == 0)
+		--nByte;
+	return (n - 1)*sizeof(Word) + nByte;
+}
+
+size_t qs::ClusterMap::getUsedCount() const
+{
+	size_t nCount = 0;
+	for (WordList::const_iterator it = listWord_.begin(); it != listWord_.end(); ++it) {
+		Word w = *it;
+		w = w - ((w >> 1) & 0x5555555555555555);
+		w = (w & 0x3333333333333333) + ((w >> 2) & 0x3333333333333333);
+		w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0f;
+		nCount += static_cast<size_t>((w*0x0101010101010101) >> 56);
+	}
+	return nCount;
+}
+
+void qs::ClusterMap::resize(size_t nByteSize,
+							bool bUsed)
+{
+	size_t nSize = nByteSize*8;
+	if (nSize == nSize_)
+		return;
+	
+	size_t nOldSize = nSize_;
+	listWord_.resize((nSize + WORD_BITS - 1)/WORD_BITS, 0);
+	if (nSize > nOldSize) {
+		if (bUsed)
+			setBits(&listWord_[0], nOldSize, nSize - nOldSize, true);
+	}
+	else if (nSize%WORD_BITS != 0) {
+		// Bits after the end have to be clear, they are treated as free
+		listWord_.back() &= (static_cast<Word>(1) << (nSize%WORD_BITS)) - 1;
+	}
+	nSize_ = nSize;
+	
+	if (nSize > nOldSize)
+		update(nOldSize, nSize - nOldSize);
+	else
+		update(nSize, nOldSize - nSize);
+}
+
+void qs::ClusterMap::set(size_t nBegin,
+						 size_t nCount)
+{
+	assert(nBegin + nCount <= nSize_);
+	
+	if (nCount == 0)
+		return;
+	
+	setBits(&listWord_[0], nBegin, nCount, true);
+	update(nBegin, nCount);
+}
+
+void qs::ClusterMap::clear(size_t nBegin,
+						   size_t nCount)
+{
+	assert(nBegin + nCount <= nSize_);
+	
+	if (nCount == 0)
+		return;
+	
+	setBits(&listWord_[0], nBegin, nCount, false);
+	update(nBegin, nCount);
+}
+
+bool qs::ClusterMap::isFree(size_t nBegin,
+							size_t nCount) const
+{
+	assert(nBegin + nCount <= nSize_);
+	
+	size_t n = nBegin;
+	size_t nEnd = nBegin + nCount;
+	while (n < nEnd) {
+		size_t nBit = n%WORD_BITS;
+		size_t nBits = QSMIN(static_cast<size_t>(WORD_BITS) - nBit, nEnd - n);
+		Word mask = nBits == WORD_BITS ? ~static_cast<Word>(0) :
+			((static_cast<Word>(1) << nBits) - 1) << nBit;
+		if (listWord_[n/WORD_BITS] & mask)
+			return false;
+		n += nBits;
+	}
+	return true;
+}
+
+bool qs::ClusterMap::contains(const ClusterMap& map) const
+{
+	if (map.nSize_ != nSize_)
+		return false;
+	
+	for (WordList::size_type n = 0; n < listWord_.size(); ++n) {
+		if (map.listWord_[n] & ~listWord_[n])
+			return false;
+	}
+	return true;
+}
+
+size_t qs::ClusterMap::find(size_t nCount) const
+{
+	assert(nCount != 0);
+	
+	if (listNode_.empty())
+		buildTree();
+	
+	size_t nLength = nLeafCount_*LEAF_BITS;
+	const Node& root = listNode_[1];
+	if (root.nMax_ < nCount)
+		return nLength - root.nSuffix_;
+	
+	// Descend to the leftmost run. A run is in the left child, across
+	// the middle, or in the right child, in this order.
+	size_t nNode = 1;
+	size_t nBegin = 0;
+	while (nNode < nLeafCount_) {
+		nLength /= 2;
+		const Node& left = listNode_[nNode*2];
+		const Node& right = listNode_[nNode*2 + 1];
+		if (left.nMax_ >= nCount) {
+			nNode = nNode*2;
+		}
+		else if (left.nSuffix_ + right.nPrefix_ >= nCount) {
+			return nBegin + nLength - left.nSuffix_;
+		}
+		else {
+			nNode = nNode*2 + 1;
+			nBegin += nLength;
+		}
+	}
+	return findInLeaf(nNode - nLeafCount_, nCount);
+}
+
+bool qs::ClusterMap::load(File* pFile)
+{
+	assert(pFile);
+	
+	File::Offset nFileSize = pFile->getSize();
+	if (nFileSize == -1)
+		return false;
+	size_t nByteSize = static_cast<size_t>(nFileSize);
+	
+	WordList listWord((nByteSize*8 + WORD_BITS - 1)/WORD_BITS, 0);
+	unsigned char* p = listWord.empty() ? 0 :
+		reinterpret_cast<unsigned char*>(&listWord[0]);
+	size_t nRead = 0;
+	while (nRead < nByteSize) {
+		size_t n = pFile->read(p + nRead, nByteSize - nRead);
+		if (n == -1 || n == 0)
+			return false;
+		nRead += n;
+	}
+	
+	listWord_.swap(listWord);
+	nSize_ = nByteSize*8;
+	listNode_.clear();
+	nLeafCount_ = 0;
+	
+	return true;
+}
+
+bool qs::ClusterMap::save(File* pFile) const
+{
+	assert(pFile);
+	
+	size_t nByteSize = getByteSize();
+	if (nByteSize == 0)
+		return true;
+	return pFile->write(reinterpret_cast<const unsigned char*>(&listWord_[0]),
+		nByteSize) == nByteSize;
+}
+
+void qs::ClusterMap::assign(const ClusterMap& map)
+{
+	if (&map == this)
+		return;
+	
+	resize(map.getByteSize(), false);
+	assert(listWord_.size() == map.listWord_.size());
+	
+	// A leaf is updated once after all of its words are copied
+	const size_t nNone = static_cast<size_t>(-1);
+	size_t nLeaf = nNone;
+	for (WordList::size_type n = 0; n < listWord_.size(); ++n) {
+		if (listWord_[n] == map.listWord_[n])
+			continue;
+		
+		listWord_[n] = map.listWord_[n];
+		if (n/LEAF_WORDS != nLeaf) {
+			if (nLeaf != nNone)
+				update(nLeaf*LEAF_BITS, LEAF_BITS);
+			nLeaf = n/LEAF_WORDS;
+		}
+	}
+	if (nLeaf != nNone)
+		update(nLeaf*LEAF_BITS, LEAF_BITS);
+}
+
+void qs::ClusterMap::swap(ClusterMap& map)
+{
+	listWord_.swap(map.listWord_);
+	std::swap(nSize_, map.nSize_);
+	listNode_.swap(map.listNode_);
+	std::swap(nLeafCount_, map.nLeafCount_);
+}
+
+void qs::ClusterMap::update(size_t nBegin,
+							size_t nCount)
+{
+	if (listNode_.empty() || nCount == 0)
+		return;
+	
+	size_t nLeafCount = (listWord_.size() + LEAF_WORDS - 1)/LEAF_WORDS;
+	if (nLeafCount > nLeafCount_) {
+		// Build again when it's used next time
+		NodeList().swap(listNode_);
+		nLeafCount_ = 0;
+		return;
+	}
+	
+	size_t nLastLeaf = (nBegin + nCount - 1)/LEAF_BITS;
+	for (size_t nLeaf = nBegin/LEAF_BITS; nLeaf <= nLastLeaf && nLeaf < nLeafCount_; ++nLeaf)
+		updateLeaf(nLeaf);
+}
+
+void qs::ClusterMap::buildTree() const
+{
+	size_t nLeafCount = (listWord_.size() + LEAF_WORDS - 1)/LEAF_WORDS;
+	size_t nCapacity = 1;
+	while (nCapacity < nLeafCount)
+		nCapacity <<= 1;
+	// Leave room to grow without building the tree again as long as
+	// the number of clusters the tree covers fits in size_t
+	if (nCapacity < nLeafCount + nLeafCount/4 + 1 &&
+		nCapacity <= static_cast<size_t>(-1)/LEAF_BITS/4)
+		nCapacity <<= 1;
+	
+	NodeList listNode(nCapacity*2);
+	for (size_t n = 0; n < nCapacity; ++n)
+		listNode[nCapacity + n] = getLeaf(n);
+	size_t nLength = LEAF_BITS;
+	for (size_t nLevel = nCapacity; nLevel > 1; nLevel >>= 1, nLength <<= 1) {
+		for (size_t n = nLevel/2; n < nLevel; ++n)
+			listNode[n] = merge(listNode[n*2], nLength, listNode[n*2 + 1], nLength);
+	}
+	
+	listNode_.swap(listNode);
+	nLeafCount_ = nCapacity;
+}
+
+void qs::ClusterMap::updateLeaf(size_t nLeaf) const
+{
+	assert(nLeaf < nLeafCount_);
+	
+	size_t nNode = nLeafCount_ + nLeaf;
+	listNode_[nNode] = getLeaf(nLeaf);
+	
+	size_t nLength = LEAF_BITS;
+	while (nNode > 1) {
+		nNode >>= 1;
+		listNode_[nNode] = merge(listNode_[nNode*2], nLength,
+			listNode_[nNode*2 + 1], nLength);
+		nLength <<= 1;
+	}
+}
+
+ClusterMap::Node qs::ClusterMap::getLeaf(size_t nLeaf) const
+{
+	size_t nWord = nLeaf*LEAF_WORDS;
+	Node node = getWordNode(getWord(nWord));
+	for (size_t n = 1; n < LEAF_WORDS; ++n)
+		node = merge(node, n*WORD_BITS, getWordNode(getWord(nWord + n)), WORD_BITS);
+	return node;
+}
+
+ClusterMap::Word qs::ClusterMap::getWord(size_t n) const
+{
+	return n < listWord_.size() ? listWord_[n] : 0;
+}
+
+size_t qs::ClusterMap::findInLeaf(size_t nLeaf,
+								  size_t nCount) const
+{
+	size_t nBegin = 0;
+	size_t nFound = 0;
+	for (size_t n = 0; n < LEAF_WORDS; ++n) {
+		size_t nPos = (nLeaf*LEAF_WORDS + n)*WORD_BITS;
+		Word w = getWord(nLeaf*LEAF_WORDS + n);
+		if (w == 0) {
+			if (nFound == 0)
+				nBegin = nPos;
+			nFound += WORD_BITS;
+			if (nFound >= nCount)
+				return nBegin;
+		}
+		else if (w == ~static_cast<Word>(0)) {
+			nFound = 0;
+		}
+		else {
+			for (size_t m = 0; m < WORD_BITS; ++m, w >>= 1) {
+				if (w & 1) {
+					nFound = 0;
+				}
+				else {
+					if (nFound == 0)
+						nBegin = nPos + m;
+					if (++nFound >= nCount)
+						return nBegin;
+				}
+			}
+		}
+	}
+	assert(false);
+	return -1;
+}
+
+void qs::ClusterMap::setBits(Word* p,
+							 size_t nBegin,
+							 size_t nCount,
+							 bool bSet)
+{
+	size_t n = nBegin;
+	size_t nEnd = nBegin + nCount;
+	while (n < nEnd) {
+		size_t nBit = n%WORD_BITS;
+		size_t nBits = QSMIN(static_cast<size_t>(WORD_BITS) - nBit, nEnd - n);
+		Word mask = nBits == WORD_BITS ? ~static_cast<Word>(0) :
+			((static_cast<Word>(1) << nBits) - 1) << nBit;
+		if (bSet)
+			p[n/WORD_BITS] |= mask;
+		else
+			p[n/WORD_BITS] &= ~mask;
+		n += nBits;
+	}
+}
+
+ClusterMap::Node qs::ClusterMap::getWordNode(Word w)
+{
+	Node node;
+	if (w == 0) {
+		node.nPrefix_ = WORD_BITS;
+		node.nSuffix_ = WORD_BITS;
+		node.nMax_ = WORD_BITS;
+	}
+	else if (w == ~static_cast<Word>(0)) {
+		node.nPrefix_ = 0;
+		node.nSuffix_ = 0;
+		node.nMax_ = 0;
+	}
+	else {
+		Word free = ~w;
+		
+		node.nPrefix_ = 0;
+		for (Word b = free; b & 1; b >>= 1)
+			++node.nPrefix_;
+		
+		node.nSuffix_ = 0;
+		for (Word b = free; b & (static_cast<Word>(1) << (WORD_BITS - 1)); b <<= 1)
+			++node.nSuffix_;
+		
+		// Each step shortens all the runs of free bits by one
+		node.nMax_ = 0;
+		for (Word b = free; b; b &= b >> 1)
+			++node.nMax_;
+	}
+	return node;
+}
+
+ClusterMap::Node qs::ClusterMap::merge(const Node& left,
+									   size_t nLeftLength,
+									   const Node& right,
+									   size_t nRightLength)
+{
+	Node node;
+	node.nPrefix_ = left.nPrefix_ == nLeftLength ?
+		nLeftLength + right.nPrefix_ : left.nPrefix_;
+	node.nSuffix_ = right.nSuffix_ == nRightLength ?
+		nRightLength + left.nSuffix_ : right.nSuffix_;
+	node.nMax_ = QSMAX(QSMAX(left.nMax_, right.nMax_),
+		left.nSuffix_ + right.nPrefix_);
+	return node;
+}
@@ -0,0 +1,185 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#ifndef __CLUSTERMAP_H__
+#define __CLUSTERMAP_H__
+
+#include <qs.h>
+
+#include <vector>
+
+
+namespace qs {
+
+class ClusterMap;
+
+class File;
+
+
+/****************************************************************************
+ *
+ * ClusterMap
+ *
+ * Allocation map of clusters. Bit n of the map is set if the n-th cluster
+ * is used. The map is held in 64bit words, and the byte image of the words
+ * is identical to the map file format on little endian machines.
+ *
+ * To find a free run, it keeps a summary tree whose node holds the length
+ * of the free run at the beginning, at the end and the longest one in
+ * the range the node covers. The tree is built when find is called first,
+ * and is updated incrementally after that.
+ *
+ */
+
+class ClusterMap
+{
+public:
+	ClusterMap();
+	~ClusterMap();
+
+public:
+	/**
+	 * Get the number of clusters in the map. This is always a multiple of 8.
+	 */
+	size_t getSize() const;
+	
+	/**
+	 * Get the size of the map in bytes.
+	 */
+	size_t getByteSize() const;
+	
+	/**
+	 * Get the size of the map in bytes without unused bytes at the end.
+	 */
+	size_t getUsedByteSize() const;
+	
+	/**
+	 * Get the number of used clusters.
+	 */
+	size_t getUsedCount() const;
+	
+	/**
+	 * Resize the map.
+	 *
+	 * @param nByteSize [in] New size in bytes.
+	 * @param bUsed [in] true if new clusters should be marked as used.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	void resize(size_t nByteSize,
+				bool bUsed);
+	
+	/**
+	 * Mark clusters as used.
+	 */
+	void set(size_t nBegin,
+			 size_t nCount);
+	
+	/**
+	 * Mark clusters as free.
+	 */
+	void clear(size_t nBegin,
+			   size_t nCount);
+	
+	/**
+	 * Check if all the specified clusters are free.
+	 */
+	bool isFree(size_t nBegin,
+				size_t nCount) const;
+	
+	/**
+	 * Check if all the clusters used in the specified map are used
+	 * in this map too.
+	 */
+	bool contains(const ClusterMap& map) const;
+	
+	/**
+	 * Find the first free run of clusters.
+	 *
+	 * @param nCount [in] The number of clusters.
+	 * @return Position where the run begins. The run can exceed the end of
+	 *         the map, in which case the map should be extended.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	size_t find(size_t nCount) const;
+	
+	/**
+	 * Load the whole map from the file at once.
+	 *
+	 * @param pFile [in] File.
+	 * @return true if success, false otherwise.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	bool load(File* pFile);
+	
+	/**
+	 * Save the whole map to the file at once.
+	 *
+	 * @param pFile [in] File.
+	 * @return true if success, false otherwise.
+	 */
+	bool save(File* pFile) const;
+	
+	/**
+	 * Make this map identical to the specified map. Unlike assignment,
+	 * this keeps the summary tree and updates only the parts which differ.
+	 *
+	 * @param map [in] Map.
+	 * @exception std::bad_alloc Out of memory.
+	 */
+	void assign(const ClusterMap& map);
+	
+	void swap(ClusterMap& map);
+
+private:
+	typedef unsigned __int64 Word;
+	
+	enum {
+		WORD_BITS	= 64,
+		LEAF_WORDS	= 8,
+		LEAF_BITS	= WORD_BITS*LEAF_WORDS
+	};
+	
+	struct Node
+	{
+		size_t nPrefix_;
+		size_t nSuffix_;
+		size_t nMax_;
+	};
+	
+	typedef std::vector<Word> WordList;
+	typedef std::vector<Node> NodeList;
+
+private:
+	void update(size_t nBegin,
+				size_t nCount);
+	void buildTree() const;
+	void updateLeaf(size_t nLeaf) const;
+	Node getLeaf(size_t nLeaf) const;
+	Word getWord(size_t n) const;
+	size_t findInLeaf(size_t nLeaf,
+					  size_t nCount) const;
+	
+	static void setBits(Word* p,
+						size_t nBegin,
+						size_t nCount,
+						bool bSet);
+	static Node getWordNode(Word w);
+	static Node merge(const Node& left,
+					  size_t nLeftLength,
+					  const Node& right,
+					  size_t nRightLength);
+
+private:
+	WordList listWord_;
+	size_t nSize_;
+	mutable NodeList listNode_;
+	mutable size_t nLeafCount_;
+};
+
+}
+
+#endif // __CLUSTERMAP_H__
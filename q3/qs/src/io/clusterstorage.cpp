@@ -8,6 +8,8 @@
 #include <qsclusterstorage.h>
 #include <qsconv.h>
 #include <qsfile.h>
+#include <qsinit.h>
+#include <qslog.h>
 #include <qsosutil.h>
 #include <qsstl.h>
 #include <qsstream.h>
@@ -17,6 +19,8 @@
 
 #include <tchar.h>
 
+#include "clustermap.h"
+
 using namespace qs;
 
 
@@ -29,15 +33,12 @@ using namespace qs;
 struct qs::ClusterStorageImpl
 {
 	enum {
-		CLUSTER_SIZE		= 128,
-		SEARCHBEGIN_SIZE	= 64,
+		CLUSTER_SIZE		= ClusterStorage::CLUSTER_SIZE,
 		BYTE_SIZE			= 8,
-		BUFFER_SIZE			= 8192
+		BUFFER_SIZE			= 8192,
+		MAX_CLUSTER_COUNT	= 0x7fffffff
 	};
 	
-	typedef std::vector<unsigned char> Map;
-	typedef std::vector<Map::size_type> SearchBegin;
-	
 	bool loadMap();
 	bool saveMap();
 	bool adjustMapSize();
@@ -45,23 +46,19 @@ struct qs::ClusterStorageImpl
 	ClusterStorage::Offset getFreeOffset(size_t nSize);
 	ClusterStorage::Offset getFreeOffset(size_t nSize,
 										 ClusterStorage::Offset nCurrentOffset);
-	Map::size_type getSearchBegin(size_t nSize) const;
-	void setSearchBegin(size_t nSize,
-						Map::size_type nBegin,
-						bool bFree);
-	void clearSearchBegin();
 #ifndef NDEBUG
 	bool checkWorkMap() const;
 #endif
 	
+	static size_t getClusterCount(size_t nLength);
+	
 	wstring_ptr wstrPath_;
 	wstring_ptr wstrBoxExt_;
 	wstring_ptr wstrMapExt_;
 	unsigned int nBlockSize_;
 	std::auto_ptr<File> pFile_;
-	Map map_;
-	Map mapWork_;
-	SearchBegin searchBegin_;
+	ClusterMap map_;
+	ClusterMap mapWork_;
 	mutable bool bModified_;
 };
 
@@ -70,21 +67,11 @@ bool qs::ClusterStorageImpl::loadMap()
 	wstring_ptr wstrPath(concat(wstrPath_.get(), wstrMapExt_.get()));
 	
 	if (File::isFileExisting(wstrPath.get())) {
-		FileInputStream fileStream(wstrPath.get());
-		if (!fileStream)
+		BinaryFile file(wstrPath.get(), BinaryFile::MODE_READ, 0);
+		if (!file)
+			return false;
+		if (!map_.load(&file))
 			return false;
-		
-		BufferedInputStream stream(&fileStream, false);
-		
-		while (true) {
-			unsigned char c = 0;
-			size_t nRead = stream.read(&c, sizeof(c));
-			if (nRead == -1)
-				return false;
-			else if (nRead == 0)
-				break;
-			map_.push_back(c);
-		}
 	}
 	else {
 		bModified_ = true;
@@ -106,25 +93,18 @@ bool qs::ClusterStorageImpl::saveMap()
 	
 	TemporaryFileRenamer renamer(wstrPath.get());
 	
-	FileOutputStream fileStream(renamer.getPath());
-	if (!fileStream)
+	BinaryFile file(renamer.getPath(), BinaryFile::MODE_CREATE, 0);
+	if (!file)
 		return false;
-	BufferedOutputStream stream(&fileStream, false);
-	
-	for (Map::const_iterator it = mapWork_.begin(); it != mapWork_.end(); ++it) {
-		unsigned char c = *it;
-		if (stream.write(&c, sizeof(c)) != sizeof(c))
-			return false;
-	}
-	
-	if (!stream.close())
+	if (!mapWork_.save(&file) || !file.close())
 		return false;
 	
 	if (!renamer.rename())
 		return false;
 	
-	map_ = mapWork_;
-	clearSearchBegin();
+	// The summary tree of the map used to allocate clusters is kept
+	// because building it again takes time as the storage grows
+	map_.assign(mapWork_);
 	bModified_ = false;
 	
 	return true;
@@ -140,8 +120,8 @@ bool qs::ClusterStorageImpl::adjustMapSize()
 	if (nSize == -1)
 		return false;
 	size_t nBlock = static_cast<size_t>(nSize/nBlockSize) + (nSize%nBlockSize == 0 ? 0 : 1);
-	if (map_.size() < nBlock) {
-		map_.resize(nBlock, 0xff);
+	if (map_.getByteSize() < nBlock) {
+		map_.resize(nBlock, true);
 		mapWork_ = map_;
 		bModified_ = true;
 	}
@@ -184,176 +164,51 @@ ClusterStorage::Offset qs::ClusterStorageImpl::getFreeOffset(size_t nSize,
 	
 	bModified_ = true;
 	
-	nSize = nSize + (CLUSTER_SIZE - nSize%CLUSTER_SIZE);
-	assert(nSize%CLUSTER_SIZE == 0);
-	nSize /= CLUSTER_SIZE;
-	
-	size_t nCurrentBlock = nCurrentOffset != -1 ? nCurrentOffset/BYTE_SIZE : -1;
-	size_t nBegin = 0;
-	unsigned char nBeginBit = 0;
-	size_t nEnd = 0;
-	unsigned char nEndBit = 0;
-	size_t nFindSize = 0;
-	Map::iterator it = map_.begin();
-	Map::size_type nSearchBegin = getSearchBegin(nSize);
-	if (nSearchBegin == -1)
-		it = map_.end() - 1;
-	else if (nSearchBegin < map_.size())
-		it += nSearchBegin;
-	for (; it != map_.end() && nFindSize < nSize; ++it) {
-		if (static_cast<unsigned int>(it - map_.begin()) >= nCurrentBlock)
-			return nCurrentOffset;
-		
-		if (*it == 0xff) {
-			if (nFindSize != 0)
-				setSearchBegin(nFindSize, nBegin, false);
-			nFindSize = 0;
-		}
-		else {
-			BYTE b = 1;
-			for (unsigned char n = 0; n < BYTE_SIZE && nFindSize < nSize; ++n, b <<= 1) {
-				if (!(*it & b)) {
-					if (nFindSize == 0) {
-						nBegin = it - map_.begin();
-						nBeginBit = n;
-					}
-					++nFindSize;
-					if (nFindSize >= nSize) {
-						nEnd = it - map_.begin();
-						nEndBit = n + 1;
-					}
-				}
-				else {
-					if (nFindSize != 0)
-						setSearchBegin(nFindSize, nBegin, false);
-					nFindSize = 0;
-				}
-			}
-		}
-	}
-	if (nFindSize != 0) {
-		if (nFindSize < nSize) {
-			nEnd = map_.size() - 1;
-			nEndBit = BYTE_SIZE;
-		}
-		for (size_t n = nBegin; n <= nEnd; ++n) {
-			BYTE bMask = 0;
-			unsigned char nFirstBit = n == nBegin ? nBeginBit : 0;
-			unsigned char nLastBit = n == nEnd ? nEndBit : BYTE_SIZE;
-			if (nFirstBit == 0 && nLastBit == BYTE_SIZE) {
-				bMask = 0xff;
-			}
-			else {
-				BYTE b = 1;
-				b <<= nFirstBit;
-				for (unsigned char m = nFirstBit; m < nLastBit; ++m, b <<= 1)
-					bMask |= b;
-			}
-			map_[n] |= bMask;
-			mapWork_[n] |= bMask;
-		}
-	}
-	else {
-		nBegin = map_.size();
-		nBeginBit = 0;
+	size_t nCount = getClusterCount(nSize);
+	size_t nBegin = map_.find(nCount);
+	if (nCurrentOffset != -1 && nBegin >= nCurrentOffset)
+		return nCurrentOffset;
+	
+	// An offset is an index of a cluster, and it must not reach -1 which
+	// is used as an error. Positions in the map must fit in size_t as well.
+	size_t nEnd = nBegin + nCount;
+	if (nEnd < nBegin || nEnd > MAX_CLUSTER_COUNT) {
+		Log log(InitThread::getInitThread().getLogger(), L"qs::ClusterStorage");
+		log.errorf(L"No more space in storage: %s", wstrPath_.get());
+		return -1;
 	}
-	if (nFindSize < nSize) {
-		for (size_t n = 0; n < (nSize - nFindSize)/BYTE_SIZE; ++n) {
-			map_.push_back(0xff);
-			mapWork_.push_back(0xff);
-		}
-		if ((nSize - nFindSize)%BYTE_SIZE != 0) {
-			BYTE bData = 0;
-			BYTE b = 1;
-			for (size_t m = 0; m < (nSize - nFindSize)%BYTE_SIZE; ++m, b <<= 1)
-				bData |= b;
-			map_.push_back(bData);
-			mapWork_.push_back(bData);
-		}
+	
+	if (nEnd > map_.getSize()) {
+		size_t nByteSize = (nEnd + BYTE_SIZE - 1)/BYTE_SIZE;
+		map_.resize(nByteSize, false);
+		mapWork_.resize(nByteSize, false);
+		
 		if (pFile_->setPosition(
-			static_cast<File::Offset>(map_.size())*BYTE_SIZE*CLUSTER_SIZE,
+			static_cast<File::Offset>(nByteSize)*BYTE_SIZE*CLUSTER_SIZE,
 			File::SEEKORIGIN_BEGIN) == -1)
 			return -1;
 		if (!pFile_->setEndOfFile())
 			return -1;
-		setSearchBegin(nSize, -1, false);
-	}
-	else {
-		setSearchBegin(nSize, nBegin, false);
-	}
-	
-	// TODO
-	// Take care of overflow.
-	return static_cast<unsigned int>(nBegin)*BYTE_SIZE + nBeginBit;
-}
-
-ClusterStorageImpl::Map::size_type qs::ClusterStorageImpl::getSearchBegin(size_t nSize) const
-{
-	assert(searchBegin_.size() == SEARCHBEGIN_SIZE);
-	
-	if (nSize >= searchBegin_.size())
-		nSize = searchBegin_.size() - 1;
-	SearchBegin::size_type n = nSize;
-	while (n > 0 && searchBegin_[n] == 0)
-		--n;
-	return searchBegin_[n];
-}
-
-void qs::ClusterStorageImpl::setSearchBegin(size_t nSize,
-											Map::size_type nBegin,
-											bool bFree)
-{
-	assert(searchBegin_.size() == SEARCHBEGIN_SIZE);
-	
-	if (nSize >= searchBegin_.size())
-		nSize = searchBegin_.size() - 1;
-	
-	if (nBegin == -1) {
-		for (size_t n = nSize + 1; n < searchBegin_.size(); ++n) {
-			if (searchBegin_[n] == 0)
-				break;
-			searchBegin_[n] = nBegin;
-		}
 	}
+	map_.set(nBegin, nCount);
+	mapWork_.set(nBegin, nCount);
 	
-	if (bFree) {
-		while (nSize > 0) {
-			Map::size_type& n = searchBegin_[nSize];
-			if (n == 0)
-				;
-			else if (n <= nBegin)
-				break;
-			else
-				n = nBegin;
-			--nSize;
-		}
-	}
-	else {
-		while (nSize > 0) {
-			Map::size_type& n = searchBegin_[nSize];
-			if (n != 0 && n <= nBegin)
-				break;
-			n = nBegin;
-			--nSize;
-		}
-	}
-}
-
-void qs::ClusterStorageImpl::clearSearchBegin()
-{
-	std::fill(searchBegin_.begin(), searchBegin_.end(), 0);
+	return static_cast<ClusterStorage::Offset>(nBegin);
 }
 
 #ifndef NDEBUG
 bool qs::ClusterStorageImpl::checkWorkMap() const
 {
-	assert(map_.size() == mapWork_.size());
-	for (Map::size_type n = 0; n < map_.size(); ++n)
-		assert(map_[n] >= mapWork_[n]);
+	assert(map_.contains(mapWork_));
 	return true;
 }
 #endif
 
+size_t qs::ClusterStorageImpl::getClusterCount(size_t nLength)
+{
+	return nLength/CLUSTER_SIZE + 1;
+}
+
 
 /****************************************************************************
  *
@@ -370,15 +225,12 @@ qs::ClusterStorage::ClusterStorage(const WCHAR* pwszPath,
 	wstring_ptr wstrPath(concat(pwszPath, L"\\", pwszName));
 	wstring_ptr wstrBoxExt(allocWString(pwszBoxExt));
 	wstring_ptr wstrMapExt(allocWString(pwszMapExt));
-	ClusterStorageImpl::SearchBegin searchBegin(
-		ClusterStorageImpl::SEARCHBEGIN_SIZE);
 	
 	std::auto_ptr<ClusterStorageImpl> pImpl(new ClusterStorageImpl());
 	pImpl->wstrPath_ = wstrPath;
 	pImpl->wstrBoxExt_ = wstrBoxExt;
 	pImpl->wstrMapExt_ = wstrMapExt;
 	pImpl->nBlockSize_ = nBlockSize;
-	pImpl->searchBegin_.swap(searchBegin);
 	pImpl->bModified_ = false;
 	
 	if (!pImpl->loadMap() || !pImpl->adjustMapSize())
@@ -571,38 +423,7 @@ bool qs::ClusterStorage::free(Offset nOffset,
 	
 	pImpl_->bModified_ = true;
 	
-	size_t nBlock = nLength + (ClusterStorageImpl::CLUSTER_SIZE -
-		nLength%ClusterStorageImpl::CLUSTER_SIZE);
-	assert(nBlock%ClusterStorageImpl::CLUSTER_SIZE == 0);
-	nBlock /= ClusterStorageImpl::CLUSTER_SIZE;
-	
-	size_t nBegin = nOffset/ClusterStorageImpl::BYTE_SIZE;
-	unsigned char nBeginBit = static_cast<unsigned char>(
-		nOffset%ClusterStorageImpl::BYTE_SIZE);
-	size_t nEnd = (nOffset + nBlock)/ClusterStorageImpl::BYTE_SIZE;
-	unsigned char nEndBit = static_cast<unsigned char>(
-		(nOffset + nBlock)%ClusterStorageImpl::BYTE_SIZE);
-	if (nEndBit == 0) {
-		--nEnd;
-		nEndBit = ClusterStorageImpl::BYTE_SIZE;
-	}
-	assert(pImpl_->mapWork_.size() > nEnd);
-	for (size_t n = nBegin; n <= nEnd; ++n) {
-		BYTE bMask = 0;
-		unsigned char nFirstBit = n == nBegin ? nBeginBit : 0;
-		unsigned char nLastBit = n == nEnd ? nEndBit : ClusterStorageImpl::BYTE_SIZE;
-		if (nFirstBit != 0) {
-			BYTE b = 1;
-			for (unsigned char m = 0; m < nFirstBit; ++m, b <<= 1)
-				bMask |= b;
-		}
-		if (nLastBit != ClusterStorageImpl::BYTE_SIZE) {
-			BYTE b = 1 << nLastBit;
-			for (unsigned char m = nLastBit; m < ClusterStorageImpl::BYTE_SIZE; ++m, b <<= 1)
-				bMask |= b;
-		}
-		pImpl_->mapWork_[n] &= bMask;
-	}
+	pImpl_->mapWork_.clear(nOffset, ClusterStorageImpl::getClusterCount(nLength));
 	
 #ifndef NDEBUG
 	if (pImpl_->reopen()) {
@@ -681,45 +502,15 @@ void qs::ClusterStorage::freeUnrefered(const ReferList& listRefer)
 	
 	pImpl_->bModified_ = true;
 	
-	ClusterStorageImpl::Map m;
-	m.resize(pImpl_->mapWork_.size());
+	ClusterMap m;
+	m.resize(pImpl_->mapWork_.getByteSize(), false);
 	
 	for (ReferList::const_iterator it = listRefer.begin(); it != listRefer.end(); ++it) {
-		Offset nOffset = (*it).nOffset_;
-		unsigned int nLength = (*it).nLength_ +
-			(ClusterStorageImpl::CLUSTER_SIZE -
-				(*it).nLength_%ClusterStorageImpl::CLUSTER_SIZE);
-		assert(nLength%ClusterStorageImpl::CLUSTER_SIZE == 0);
-		nLength /= ClusterStorageImpl::CLUSTER_SIZE;
-		
-		unsigned int nBegin = nOffset/ClusterStorageImpl::BYTE_SIZE;
-		unsigned int nBeginBit = nOffset%ClusterStorageImpl::BYTE_SIZE;
-		unsigned int nEnd = (nOffset + nLength)/ClusterStorageImpl::BYTE_SIZE;
-		unsigned int nEndBit = (nOffset + nLength)%ClusterStorageImpl::BYTE_SIZE;
-		if (nEndBit == 0) {
-			--nEnd;
-			nEndBit = ClusterStorageImpl::BYTE_SIZE;
-		}
-		assert(m.size() > nEnd);
-		for (unsigned int n = nBegin; n <= nEnd; ++n) {
-			BYTE bMask = ~0;
-			unsigned int nFirstBit = n == nBegin ? nBeginBit : 0;
-			unsigned int nLastBit = n == nEnd ? nEndBit : ClusterStorageImpl::BYTE_SIZE;
-			if (nFirstBit != 0) {
-				BYTE b = 1;
-				for (unsigned int m = 0; m < nFirstBit; ++m, b <<= 1)
-					bMask &= ~b;
-			}
-			if (nLastBit != ClusterStorageImpl::BYTE_SIZE) {
-				BYTE b = 1 << nLastBit;
-				for (unsigned int m = nLastBit; m < ClusterStorageImpl::BYTE_SIZE; ++m, b <<= 1)
-					bMask &= ~b;
-			}
-			assert((m[n] & bMask) == 0);
-			m[n] |= bMask;
-		}
+		size_t nCount = ClusterStorageImpl::getClusterCount((*it).nLength_);
+		assert(m.isFree((*it).nOffset_, nCount));
+		m.set((*it).nOffset_, nCount);
 	}
-	pImpl_->mapWork_ = m;
+	pImpl_->mapWork_.swap(m);
 }
 
 bool qs::ClusterStorage::freeUnused()
@@ -731,17 +522,12 @@ bool qs::ClusterStorage::freeUnused()
 	
 	pImpl_->bModified_ = true;
 	
-	ClusterStorageImpl::Map& m = pImpl_->map_;
-	ClusterStorageImpl::Map::reverse_iterator it = m.rbegin();
-	while (it != m.rend() && *it == 0)
-		++it;
-	m.erase(it.base(), m.end());
-#ifndef NDEBUG
-	for (ClusterStorageImpl::Map::size_type n = m.size(); n < pImpl_->mapWork_.size(); ++n)
-		assert(pImpl_->mapWork_[n] == 0);
-#endif
-	pImpl_->mapWork_.resize(m.size());
-	if (pImpl_->pFile_->setPosition(static_cast<File::Offset>(m.size())*
+	ClusterMap& m = pImpl_->map_;
+	size_t nByteSize = m.getUsedByteSize();
+	assert(pImpl_->mapWork_.getUsedByteSize() <= nByteSize);
+	m.resize(nByteSize, false);
+	pImpl_->mapWork_.resize(nByteSize, false);
+	if (pImpl_->pFile_->setPosition(static_cast<File::Offset>(nByteSize)*
 		ClusterStorageImpl::BYTE_SIZE*ClusterStorageImpl::CLUSTER_SIZE,
 		File::SEEKORIGIN_BEGIN) == -1)
 		return false;
@@ -750,3 +536,13 @@ bool qs::ClusterStorage::freeUnused()
 	
 	return true;
 }
+
+unsigned int qs::ClusterStorage::getFragmentation() const
+{
+	const ClusterMap& m = pImpl_->mapWork_;
+	size_t nSize = m.getUsedByteSize()*ClusterStorageImpl::BYTE_SIZE;
+	if (nSize == 0)
+		return 0;
+	size_t nFree = nSize - m.getUsedCount();
+	return static_cast<unsigned int>(static_cast<__int64>(nFree)*100/nSize);
+}
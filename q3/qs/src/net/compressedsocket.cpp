@@ -0,0 +1,293 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+#include <qsassert.h>
+#include <qsdeflate.h>
+#include <qssocket.h>
+#include <qsstream.h>
+
+using namespace qs;
+
+
+/****************************************************************************
+ *
+ * CompressedSocketImpl
+ *
+ */
+
+struct qs::CompressedSocketImpl
+{
+	enum {
+		RECEIVE_BLOCK_SIZE	= 8192
+	};
+	
+	int fill();
+	bool send(Deflater::Flush flush,
+			  const unsigned char* p,
+			  size_t nLen,
+			  int nFlags);
+	void error();
+	
+	CompressedSocket* pThis_;
+	SocketBase* pSocket_;
+	bool bDeleteSocket_;
+	Deflater deflater_;
+	Inflater inflater_;
+	malloc_size_ptr<unsigned char> pBuffer_;
+	size_t nBufferPos_;
+	unsigned __int64 nSent_;
+	unsigned __int64 nCompressedSent_;
+	unsigned __int64 nReceived_;
+	unsigned __int64 nCompressedReceived_;
+	SocketInputStream* pInputStream_;
+	SocketOutputStream* pOutputStream_;
+};
+
+int qs::CompressedSocketImpl::fill()
+{
+	assert(nBufferPos_ == pBuffer_.size());
+	
+	char buf[RECEIVE_BLOCK_SIZE];
+	while (true) {
+		int nRecv = pSocket_->recv(buf, sizeof(buf), 0);
+		if (nRecv == -1) {
+			error();
+			return -1;
+		}
+		else if (nRecv == 0) {
+			return 0;
+		}
+		nCompressedReceived_ += nRecv;
+		
+		ByteOutputStream stream;
+		if (!inflater_.inflate(reinterpret_cast<unsigned char*>(buf), nRecv, &stream)) {
+			pThis_->setLastError(SocketBase::SOCKET_ERROR_RECV);
+			return -1;
+		}
+		
+		size_t nLen = stream.getLength();
+		if (nLen != 0) {
+			pBuffer_ = stream.releaseSizeBuffer();
+			nBufferPos_ = 0;
+			nReceived_ += nLen;
+			return static_cast<int>(nLen);
+		}
+		
+		// Only a part of a block has been received, so wait for the rest
+		int nSelect = pSocket_->select(SocketBase::SELECT_READ);
+		if (nSelect == -1) {
+			error();
+			return -1;
+		}
+		else if (nSelect == 0) {
+			pThis_->setLastError(SocketBase::SOCKET_ERROR_RECVTIMEOUT);
+			return -1;
+		}
+	}
+}
+
+bool qs::CompressedSocketImpl::send(Deflater::Flush flush,
+									const unsigned char* p,
+									size_t nLen,
+									int nFlags)
+{
+	assert(p || nLen == 0);
+	
+	ByteOutputStream stream;
+	if (!deflater_.deflate(p, nLen, flush, &stream)) {
+		pThis_->setLastError(SocketBase::SOCKET_ERROR_SEND);
+		return false;
+	}
+	
+	const char* pData = reinterpret_cast<const char*>(stream.getBuffer());
+	size_t nDataLen = stream.getLength();
+	size_t nTotalSent = 0;
+	while (nTotalSent < nDataLen) {
+		if (nTotalSent != 0) {
+			int nSelect = pSocket_->select(SocketBase::SELECT_WRITE);
+			if (nSelect == -1) {
+				error();
+				return false;
+			}
+			else if (nSelect == 0) {
+				pThis_->setLastError(SocketBase::SOCKET_ERROR_SENDTIMEOUT);
+				return false;
+			}
+		}
+		
+		int nSent = pSocket_->send(pData + nTotalSent,
+			static_cast<int>(nDataLen - nTotalSent), nFlags);
+		if (nSent == -1) {
+			error();
+			return false;
+		}
+		nTotalSent += nSent;
+	}
+	
+	nSent_ += nLen;
+	nCompressedSent_ += nDataLen;
+	
+	return true;
+}
+
+void qs::CompressedSocketImpl::error()
+{
+	pThis_->setLastError(pSocket_->getLastError());
+}
+
+
+/****************************************************************************
+ *
+ * CompressedSocket
+ *
+ */
+
+qs::CompressedSocket::CompressedSocket(SocketBase* pSocket,
+									   bool bDeleteSocket) :
+	pImpl_(0)
+{
+	assert(pSocket);
+	
+	pImpl_ = new CompressedSocketImpl();
+	pImpl_->pThis_ = this;
+	pImpl_->pSocket_ = pSocket;
+	pImpl_->bDeleteSocket_ = bDeleteSocket;
+	pImpl_->nBufferPos_ = 0;
+	pImpl_->nSent_ = 0;
+	pImpl_->nCompressedSent_ = 0;
+	pImpl_->nReceived_ = 0;
+	pImpl_->nCompressedReceived_ = 0;
+	pImpl_->pInputStream_ = 0;
+	pImpl_->pOutputStream_ = 0;
+}
+
+qs::CompressedSocket::~CompressedSocket()
+{
+	if (pImpl_) {
+		delete pImpl_->pInputStream_;
+		delete pImpl_->pOutputStream_;
+		
+		if (pImpl_->bDeleteSocket_)
+			delete pImpl_->pSocket_;
+		
+		delete pImpl_;
+		pImpl_ = 0;
+	}
+}
+
+bool qs::CompressedSocket::flush()
+{
+	return pImpl_->send(Deflater::FLUSH_SYNC, 0, 0, 0);
+}
+
+unsigned __int64 qs::CompressedSocket::getSentBytes() const
+{
+	return pImpl_->nSent_;
+}
+
+unsigned __int64 qs::CompressedSocket::getCompressedSentBytes() const
+{
+	return pImpl_->nCompressedSent_;
+}
+
+unsigned __int64 qs::CompressedSocket::getReceivedBytes() const
+{
+	return pImpl_->nReceived_;
+}
+
+unsigned __int64 qs::CompressedSocket::getCompressedReceivedBytes() const
+{
+	return pImpl_->nCompressedReceived_;
+}
+
+long qs::CompressedSocket::getTimeout() const
+{
+	return pImpl_->pSocket_->getTimeout();
+}
+
+void qs::CompressedSocket::setTimeout(long nTimeout)
+{
+	pImpl_->pSocket_->setTimeout(nTimeout);
+}
+
+bool qs::CompressedSocket::close()
+{
+	if (!pImpl_->pSocket_->close()) {
+		pImpl_->error();
+		return false;
+	}
+	return true;
+}
+
+int qs::CompressedSocket::recv(char* p,
+							   int nLen,
+							   int nFlags)
+{
+	assert(p);
+	
+	if (pImpl_->nBufferPos_ == pImpl_->pBuffer_.size()) {
+		int nRecv = pImpl_->fill();
+		if (nRecv <= 0)
+			return nRecv;
+	}
+	
+	size_t nCopy = QSMIN(static_cast<size_t>(nLen),
+		pImpl_->pBuffer_.size() - pImpl_->nBufferPos_);
+	memcpy(p, pImpl_->pBuffer_.get() + pImpl_->nBufferPos_, nCopy);
+	if (!(nFlags & MSG_PEEK))
+		pImpl_->nBufferPos_ += nCopy;
+	
+	return static_cast<int>(nCopy);
+}
+
+int qs::CompressedSocket::send(const char* p,
+							   int nLen,
+							   int nFlags)
+{
+	assert(p);
+	
+	// Data is buffered by the deflater until flush is called, so that
+	// a command written in pieces is compressed and sent at once
+	if (!pImpl_->send(Deflater::FLUSH_NONE,
+		reinterpret_cast<const unsigned char*>(p), nLen, nFlags))
+		return -1;
+	return nLen;
+}
+
+int qs::CompressedSocket::select(int nSelect)
+{
+	return select(nSelect, getTimeout());
+}
+
+int qs::CompressedSocket::select(int nSelect,
+								 long nTimeout)
+{
+	// Data which has already been decompressed can be read without
+	// waiting for the base socket
+	if (nSelect & SELECT_READ &&
+		pImpl_->nBufferPos_ != pImpl_->pBuffer_.size())
+		return SELECT_READ;
+	
+	int n = pImpl_->pSocket_->select(nSelect, nTimeout);
+	if (n == -1)
+		pImpl_->error();
+	return n;
+}
+
+InputStream* qs::CompressedSocket::getInputStream()
+{
+	if (!pImpl_->pInputStream_)
+		pImpl_->pInputStream_ = new SocketInputStream(this);
+	return pImpl_->pInputStream_;
+}
+
+OutputStream* qs::CompressedSocket::getOutputStream()
+{
+	if (!pImpl_->pOutputStream_)
+		pImpl_->pOutputStream_ = new SocketOutputStream(this);
+	return pImpl_->pOutputStream_;
+}
@@ -330,6 +330,15 @@ qs::RegexCharsAtom::RegexCharsAtom(const WCHAR* pStart,
 	bCaseInsensitive_(bCaseInsensitive)
 {
 	wstr_ = allocWString(pStart, pEnd - pStart);
+	
+	// Create finders here so that a compiled pattern can be shared by
+	// multiple threads without any lock
+	unsigned int nFlags = 0;
+	if (bCaseInsensitive_)
+		nFlags |= BMFindString<WSTRING>::FLAG_IGNORECASE;
+	pBmfsForward_.reset(new BMFindString<WSTRING>(wstr_.get(), nLen_, nFlags));
+	pBmfsBackward_.reset(new BMFindString<WSTRING>(wstr_.get(), nLen_,
+		nFlags | BMFindString<WSTRING>::FLAG_REVERSE));
 }
 
 qs::RegexCharsAtom::~RegexCharsAtom()
@@ -357,20 +366,10 @@ const WCHAR* qs::RegexCharsAtom::getCandidate(const WCHAR* pStart,
 											  const WCHAR* p,
 											  bool bReverse) const
 {
-	std::auto_ptr<qs::BMFindString<qs::WSTRING> >& pBmfs =
-		bReverse ? pBmfsBackward_ : pBmfsForward_;
-	if (!pBmfs.get()) {
-		unsigned int nFlags = 0;
-		if (bReverse)
-			nFlags |= BMFindString<WSTRING>::FLAG_REVERSE;
-		if (bCaseInsensitive_)
-			nFlags |= BMFindString<WSTRING>::FLAG_IGNORECASE;
-		pBmfs.reset(new BMFindString<WSTRING>(wstr_.get(), nLen_, nFlags));
-	}
 	if (bReverse)
-		return pBmfs->find(pStart, p - pStart + 1);
+		return pBmfsBackward_->find(pStart, p - pStart + 1);
 	else
-		return pBmfs->find(p, pEnd - p);
+		return pBmfsForward_->find(p, pEnd - p);
 }
 
 
@@ -306,8 +306,8 @@ private:
 	wstring_ptr wstr_;
 	size_t nLen_;
 	bool bCaseInsensitive_;
-	mutable std::auto_ptr<qs::BMFindString<qs::WSTRING> > pBmfsForward_;
-	mutable std::auto_ptr<qs::BMFindString<qs::WSTRING> > pBmfsBackward_;
+	std::auto_ptr<qs::BMFindString<qs::WSTRING> > pBmfsForward_;
+	std::auto_ptr<qs::BMFindString<qs::WSTRING> > pBmfsBackward_;
 };
 
 
@@ -8,6 +8,8 @@
 #include <qs.h>
 #include <qsassert.h>
 #include <qsconv.h>
+#include <qsinit.h>
+#include <qslog.h>
 #include <qsstring.h>
 #include <qsthread.h>
 
@@ -398,6 +400,218 @@ void qs::Synchronizer::asyncExec(std::auto_ptr<Runnable> pRunnable)
 }
 
 
+/****************************************************************************
+ *
+ * ThreadPoolImpl
+ *
+ */
+
+struct qs::ThreadPoolImpl
+{
+	class Worker : public Thread
+	{
+	public:
+		explicit Worker(ThreadPoolImpl* pImpl);
+		virtual ~Worker();
+	
+	public:
+		virtual void run();
+	
+	private:
+		Worker(const Worker&);
+		Worker& operator=(const Worker&);
+	
+	private:
+		ThreadPoolImpl* pImpl_;
+	};
+	
+	struct Batch
+	{
+		Runnable* const* ppRunnable_;
+		size_t nCount_;
+		size_t nNext_;
+		volatile LONG nRest_;
+		volatile LONG nFailed_;
+		Event* pEvent_;
+	};
+	
+	typedef std::vector<Worker*> WorkerList;
+	
+	bool runNext();
+	
+	static bool run(Runnable* pRunnable);
+	
+	unsigned int nThreadCount_;
+	WorkerList listWorker_;
+	Batch* pBatch_;
+	volatile bool bStop_;
+	CriticalSection cs_;
+	CriticalSection csExecute_;
+	std::auto_ptr<Event> pEvent_;
+};
+
+bool qs::ThreadPoolImpl::runNext()
+{
+	Batch* pBatch = 0;
+	size_t n = 0;
+	{
+		Lock<CriticalSection> lock(cs_);
+		
+		pBatch = pBatch_;
+		if (!pBatch)
+			return false;
+		
+		n = pBatch->nNext_++;
+		if (pBatch->nNext_ == pBatch->nCount_) {
+			pBatch_ = 0;
+			pEvent_->reset();
+		}
+	}
+	
+	if (!run(pBatch->ppRunnable_[n]))
+		::InterlockedIncrement(const_cast<LONG*>(&pBatch->nFailed_));
+	
+	if (::InterlockedDecrement(const_cast<LONG*>(&pBatch->nRest_)) == 0)
+		pBatch->pEvent_->set();
+	
+	return true;
+}
+
+bool qs::ThreadPoolImpl::run(Runnable* pRunnable)
+{
+	// An exception cannot be thrown across threads, so it is reported to
+	// the caller of execute as a failure instead
+	QTRY {
+		pRunnable->run();
+	}
+	QCATCH_ALL() {
+		Log log(InitThread::getInitThread().getLogger(), L"qs::ThreadPool");
+		log.error(L"Exception occurred while running a runnable.");
+		return false;
+	}
+	return true;
+}
+
+
+/****************************************************************************
+ *
+ * ThreadPoolImpl::Worker
+ *
+ */
+
+qs::ThreadPoolImpl::Worker::Worker(ThreadPoolImpl* pImpl) :
+	pImpl_(pImpl)
+{
+}
+
+qs::ThreadPoolImpl::Worker::~Worker()
+{
+}
+
+void qs::ThreadPoolImpl::Worker::run()
+{
+	InitThread init(0);
+	
+	while (true) {
+		pImpl_->pEvent_->wait();
+		if (pImpl_->bStop_)
+			break;
+		while (pImpl_->runNext())
+			;
+	}
+}
+
+
+/****************************************************************************
+ *
+ * ThreadPool
+ *
+ */
+
+qs::ThreadPool::ThreadPool(unsigned int nThreadCount) :
+	pImpl_(0)
+{
+	if (nThreadCount == 0) {
+		SYSTEM_INFO si;
+		::GetSystemInfo(&si);
+		nThreadCount = si.dwNumberOfProcessors;
+		if (nThreadCount == 0)
+			nThreadCount = 1;
+	}
+	
+	pImpl_ = new ThreadPoolImpl();
+	pImpl_->nThreadCount_ = 1;
+	pImpl_->pBatch_ = 0;
+	pImpl_->bStop_ = false;
+	pImpl_->pEvent_.reset(new Event(true, false));
+	
+	for (unsigned int n = 1; n < nThreadCount; ++n) {
+		std::auto_ptr<ThreadPoolImpl::Worker> pWorker(new ThreadPoolImpl::Worker(pImpl_));
+		if (!pWorker->start())
+			break;
+		pImpl_->listWorker_.push_back(pWorker.release());
+		++pImpl_->nThreadCount_;
+	}
+}
+
+qs::ThreadPool::~ThreadPool()
+{
+	pImpl_->bStop_ = true;
+	pImpl_->pEvent_->set();
+	for (ThreadPoolImpl::WorkerList::iterator it = pImpl_->listWorker_.begin(); it != pImpl_->listWorker_.end(); ++it) {
+		(*it)->join();
+		delete *it;
+	}
+	delete pImpl_;
+}
+
+unsigned int qs::ThreadPool::getThreadCount() const
+{
+	return pImpl_->nThreadCount_;
+}
+
+bool qs::ThreadPool::execute(Runnable* const* ppRunnable,
+							 size_t nCount)
+{
+	assert(ppRunnable || nCount == 0);
+	
+	if (nCount == 0) {
+		return true;
+	}
+	else if (nCount == 1 || pImpl_->listWorker_.empty()) {
+		bool bSucceeded = true;
+		for (size_t n = 0; n < nCount; ++n) {
+			if (!ThreadPoolImpl::run(ppRunnable[n]))
+				bSucceeded = false;
+		}
+		return bSucceeded;
+	}
+	
+	Lock<CriticalSection> lockExecute(pImpl_->csExecute_);
+	
+	Event event(true, false);
+	ThreadPoolImpl::Batch batch = {
+		ppRunnable,
+		nCount,
+		0,
+		static_cast<LONG>(nCount),
+		0,
+		&event
+	};
+	{
+		Lock<CriticalSection> lock(pImpl_->cs_);
+		pImpl_->pBatch_ = &batch;
+		pImpl_->pEvent_->set();
+	}
+	
+	while (pImpl_->runNext())
+		;
+	event.wait();
+	
+	return batch.nFailed_ == 0;
+}
+
+
 /****************************************************************************
  *
  * SynchronizerWindow
@@ -0,0 +1,236 @@
+/*
+ * $Id$
+ *
+ * Copyright(C) 1998-2008 Satoshi Nakamura
+ *
+ */
+
+/*
+ * Throughput test of ClusterStorage.
+ *
+ * A storage is created in the specified directory, and the specified number
+ * of records whose sizes are distributed like messages are saved into it.
+ * Then every other record is freed, as many records are saved again into
+ * the holes, and the storage is closed and opened again, which saves and
+ * loads the map. Finally every other record is freed again and the rest
+ * are compacted. The elapsed time of each step and the fragmentation after
+ * it are printed.
+ *
+ * This is not built by the makefiles. Build it and link it with qs, e.g.
+ *
+ *   cl /EHsc /DUNICODE /D_UNICODE /I..\include /I<boost>
+ *      clusterstoragetest.cpp qs.lib
+ *
+ * Usage: clusterstoragetest [records] [directory]
+ *
+ */
+
+#pragma warning(disable:4786)
+
+#include <qsclusterstorage.h>
+#include <qsconv.h>
+#include <qsstring.h>
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include <windows.h>
+
+using namespace qs;
+
+
+namespace {
+
+const WCHAR* pwszName = L"clusterstoragetest";
+const WCHAR* pwszBoxExt = L".box";
+const WCHAR* pwszMapExt = L".map";
+
+enum {
+	MAX_SIZE	= 256*1024
+};
+
+typedef std::vector<ClusterStorage::Refer> ReferList;
+
+
+/****************************************************************************
+ *
+ * Functions
+ *
+ */
+
+size_t getSize()
+{
+	// Most of them are a few KB, and some are large
+	size_t nSize = 512 + rand()%(8*1024);
+	if (rand()%20 == 0)
+		nSize += rand()%(MAX_SIZE - nSize);
+	return nSize;
+}
+
+bool saveRecords(ClusterStorage* pcs,
+				 const unsigned char* pBuf,
+				 size_t nCount,
+				 ReferList* pListRefer)
+{
+	for (size_t n = 0; n < nCount; ++n) {
+		size_t nLength = getSize();
+		const unsigned char* p[] = { pBuf };
+		size_t nLengths[] = { nLength };
+		ClusterStorage::Offset nOffset = pcs->save(p, nLengths, 1);
+		if (nOffset == -1)
+			return false;
+		ClusterStorage::Refer refer = { nOffset, static_cast<unsigned int>(nLength) };
+		pListRefer->push_back(refer);
+	}
+	return true;
+}
+
+bool freeRecords(ClusterStorage* pcs,
+				 ReferList* pListRefer)
+{
+	ReferList listRefer;
+	listRefer.reserve(pListRefer->size()/2 + 1);
+	for (ReferList::size_type n = 0; n < pListRefer->size(); ++n) {
+		const ClusterStorage::Refer& refer = (*pListRefer)[n];
+		if (n % 2 == 0) {
+			if (!pcs->free(refer.nOffset_, refer.nLength_))
+				return false;
+		}
+		else {
+			listRefer.push_back(refer);
+		}
+	}
+	pListRefer->swap(listRefer);
+	return true;
+}
+
+bool compactRecords(ClusterStorage* pcs,
+					ReferList* pListRefer)
+{
+	std::sort(pListRefer->begin(), pListRefer->end(),
+		boost::bind(&ClusterStorage::Refer::nOffset_, _1) <
+		boost::bind(&ClusterStorage::Refer::nOffset_, _2));
+	for (ReferList::iterator it = pListRefer->begin(); it != pListRefer->end(); ++it) {
+		ClusterStorage::Offset nOffset = pcs->compact((*it).nOffset_, (*it).nLength_, 0);
+		if (nOffset == -1)
+			return false;
+		(*it).nOffset_ = nOffset;
+	}
+	return pcs->freeUnused() && pcs->flush();
+}
+
+void print(const CHAR* pszStep,
+		   DWORD dwElapsed,
+		   size_t nCount,
+		   const ClusterStorage* pcs)
+{
+	printf("%-8s Elapsed: %6lums, Records: %7u, Fragmentation: %3u%%\n",
+		pszStep, dwElapsed, static_cast<unsigned int>(nCount),
+		pcs ? pcs->getFragmentation() : 0);
+}
+
+void removeFiles(const WCHAR* pwszPath)
+{
+	const WCHAR* pwszExts[] = { pwszBoxExt, pwszMapExt };
+	for (int n = 0; n < countof(pwszExts); ++n) {
+		wstring_ptr wstrPath(concat(pwszPath, L"\\", pwszName, pwszExts[n]));
+		::DeleteFile(wstrPath.get());
+	}
+}
+
+}
+
+
+int main(int argc,
+		 char** argv)
+{
+	size_t nCount = argc > 1 ? atoi(argv[1]) : 100000;
+	wstring_ptr wstrPath;
+	if (argc > 2) {
+		wstrPath = mbs2wcs(argv[2]);
+	}
+	else {
+		WCHAR wszPath[MAX_PATH];
+		::GetTempPath(countof(wszPath), wszPath);
+		size_t nLen = wcslen(wszPath);
+		if (nLen != 0 && wszPath[nLen - 1] == L'\\')
+			wszPath[nLen - 1] = L'\0';
+		wstrPath = allocWString(wszPath);
+	}
+	if (nCount == 0) {
+		fprintf(stderr, "Usage: clusterstoragetest [records] [directory]\n");
+		return 1;
+	}
+	
+	removeFiles(wstrPath.get());
+	srand(0);
+	
+	std::vector<unsigned char> buf(MAX_SIZE, 'x');
+	ReferList listRefer;
+	listRefer.reserve(nCount);
+	
+	std::auto_ptr<ClusterStorage> pcs(new ClusterStorage(
+		wstrPath.get(), pwszName, pwszBoxExt, pwszMapExt, -1));
+	if (!*pcs) {
+		fprintf(stderr, "Failed to create a storage\n");
+		return 1;
+	}
+	
+	DWORD dwStart = ::GetTickCount();
+	if (!saveRecords(pcs.get(), &buf[0], nCount, &listRefer) || !pcs->flush()) {
+		fprintf(stderr, "Failed to save\n");
+		return 1;
+	}
+	print("Save", ::GetTickCount() - dwStart, listRefer.size(), pcs.get());
+	
+	dwStart = ::GetTickCount();
+	if (!freeRecords(pcs.get(), &listRefer) || !pcs->flush()) {
+		fprintf(stderr, "Failed to free\n");
+		return 1;
+	}
+	print("Free", ::GetTickCount() - dwStart, listRefer.size(), pcs.get());
+	
+	dwStart = ::GetTickCount();
+	if (!saveRecords(pcs.get(), &buf[0], nCount/2, &listRefer) || !pcs->flush()) {
+		fprintf(stderr, "Failed to save into holes\n");
+		return 1;
+	}
+	print("Refill", ::GetTickCount() - dwStart, listRefer.size(), pcs.get());
+	
+	dwStart = ::GetTickCount();
+	if (!pcs->close()) {
+		fprintf(stderr, "Failed to close\n");
+		return 1;
+	}
+	pcs.reset(new ClusterStorage(wstrPath.get(),
+		pwszName, pwszBoxExt, pwszMapExt, -1));
+	if (!*pcs) {
+		fprintf(stderr, "Failed to reopen\n");
+		return 1;
+	}
+	print("Reopen", ::GetTickCount() - dwStart, listRefer.size(), pcs.get());
+	
+	dwStart = ::GetTickCount();
+	if (!freeRecords(pcs.get(), &listRefer) || !pcs->flush()) {
+		fprintf(stderr, "Failed to free\n");
+		return 1;
+	}
+	print("Free", ::GetTickCount() - dwStart, listRefer.size(), pcs.get());
+	
+	dwStart = ::GetTickCount();
+	if (!compactRecords(pcs.get(), &listRefer)) {
+		fprintf(stderr, "Failed to compact\n");
+		return 1;
+	}
+	print("Compact", ::GetTickCount() - dwStart, listRefer.size(), pcs.get());
+	
+	pcs->close();
+	pcs.reset(0);
+	removeFiles(wstrPath.get());
+	
+	return 0;
+}